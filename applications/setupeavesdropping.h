@@ -53,10 +53,7 @@ static SetupEavesdroppingResult setupEavesdropping(Connection *connection)
         writer.endArray();
         writer.writeUint32(0);
         msg.setArguments(writer.finish());
-        PendingReply pendingReply = connection->send(std::move(msg));
-        while (!pendingReply.isFinished()) {
-            connection->eventDispatcher()->poll();
-        }
+        const PendingReply pendingReply = connection->call(std::move(msg));
         if (!pendingReply.isError()) {
             return NewStyleEavesdropping;
         }
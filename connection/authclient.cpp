@@ -30,6 +30,7 @@
 #include <cassert>
 #include <cstring>
 #include <sstream>
+#include <vector>
 
 #ifdef __unix__
 #include <sys/types.h>
@@ -43,19 +44,57 @@
 #include "winutil.h"
 #endif
 
-AuthClient::AuthClient(ITransport *transport)
-   : m_state(InitialState),
+enum {
+    ReadChunkSize = 512,
+    // Lines in the handshake are short; a server that sends something else is broken or malicious
+    MaxLineLength = 4096
+};
+
+AuthClient::AuthClient(ITransport *transport, Mode mode, const chunk *pipelinedData,
+                       uint32 pipelinedDataCount)
+   : m_mode(mode),
+     m_state(InitialState),
      m_nextAuthMethod(0),
      m_fdPassingEnabled(false),
+     m_pipelinedDataWritten(0),
+     m_readPos(0),
      m_completionListener(nullptr)
 {
     transport->setReadListener(this);
+    if (m_mode == Mode::Pipelined) {
+        writePipelined(pipelinedData, pipelinedDataCount);
+        return;
+    }
     byte nullBuf[1] = { 0 };
     transport->write(chunk(nullBuf, 1));
 
     sendNextAuthMethod();
 }
 
+void AuthClient::writePipelined(const chunk *pipelinedData, uint32 pipelinedDataCount)
+{
+    assert(readTransport()->supportedPassingUnixFdsCount() > 0);
+    std::string handshake(1, '\0');
+    handshake += externalAuthLine();
+    handshake += "NEGOTIATE_UNIX_FD\r\n";
+    handshake += "BEGIN\r\n";
+
+    std::vector<chunk> parts;
+    parts.reserve(1 + pipelinedDataCount);
+    parts.push_back(chunk(handshake.c_str(), handshake.length()));
+    parts.insert(parts.end(), pipelinedData, pipelinedData + pipelinedDataCount);
+    // See the note about synchronous writing in advanceState(). If it goes wrong anyway, the caller
+    // can still send the rest of pipelinedData - unless not even the handshake made it, but then the
+    // server will give up on us.
+    const IO::Result ioRes = readTransport()->write(parts.data(), parts.size());
+    if (ioRes.length > handshake.length()) {
+        m_pipelinedDataWritten = ioRes.length - handshake.length();
+    }
+
+    m_nextAuthMethod = AuthExternal + 1;
+    m_state = ExpectOkState;
+}
+
 bool AuthClient::isFinished() const
 {
     return m_state >= AuthenticationFailedState;
@@ -93,46 +132,70 @@ IO::Status AuthClient::handleTransportCanRead()
     return ret;
 }
 
-bool AuthClient::readLine()
+chunk AuthClient::unprocessedData() const
 {
-    // don't care about performance here, this doesn't run often or process much data
-    if (isEndOfLine()) {
-        m_line.clear(); // start a new line
-    }
+    return chunk(m_readBuffer.c_str() + m_readPos, m_readBuffer.length() - m_readPos);
+}
 
-    byte readBuf[1];
+bool AuthClient::readLine()
+{
+    // Read more than one line at once if available. A pipelining server may also send the beginning of
+    // the message stream right after the handshake responses, which is why we keep the rest around.
     while (true) {
-        const IO::Result iores = readTransport()->read(readBuf, 1);
-        if (iores.length != 1 || iores.status != IO::Status::OK) {
+        if (takeBufferedLine()) {
+            return true;
+        }
+        if (m_readBuffer.length() - m_readPos > MaxLineLength) {
+            m_state = AuthenticationFailedState;
             return false;
         }
-        m_line += char(readBuf[0]);
 
-        if (isEndOfLine()) {
-            return true;
+        m_readBuffer.erase(0, m_readPos);
+        m_readPos = 0;
+        const size_t oldLength = m_readBuffer.length();
+        m_readBuffer.resize(oldLength + ReadChunkSize);
+        const IO::Result iores = readTransport()->read(reinterpret_cast<byte *>(&m_readBuffer[oldLength]),
+                                                       ReadChunkSize);
+        m_readBuffer.resize(oldLength + iores.length);
+        if (iores.status != IO::Status::OK) {
+            // The server may have sent its last responses right before closing the connection, so
+            // process what has arrived before giving up
+            return takeBufferedLine();
+        }
+        if (iores.length == 0) {
+            return false;
         }
     }
-    return false;
 }
 
-bool AuthClient::isEndOfLine() const
+bool AuthClient::takeBufferedLine()
 {
-    return m_line.length() >= 2 &&
-           m_line[m_line.length() - 2] == '\r' && m_line[m_line.length() - 1] == '\n';
+    const size_t lineEnd = m_readBuffer.find("\r\n", m_readPos);
+    if (lineEnd == std::string::npos) {
+        return false;
+    }
+    m_line.assign(m_readBuffer, m_readPos, lineEnd + 2 - m_readPos);
+    m_readPos = lineEnd + 2;
+    return true;
 }
 
-void AuthClient::sendNextAuthMethod()
+std::string AuthClient::externalAuthLine() const
 {
-    switch (m_nextAuthMethod) {
-    case AuthExternal: {
-        std::stringstream uidEncoded;
+    std::stringstream uidEncoded;
 #ifdef _WIN32
-        uidEncoded << fetchWindowsSid();
+    uidEncoded << fetchWindowsSid();
 #else
-        // The numeric UID is first encoded to ASCII ("1000") and the ASCII to hex... because.
-        uidEncoded << geteuid();
+    // The numeric UID is first encoded to ASCII ("1000") and the ASCII to hex... because.
+    uidEncoded << geteuid();
 #endif
-        std::string extLine = "AUTH EXTERNAL " + hexEncode(uidEncoded.str()) + "\r\n";
+    return "AUTH EXTERNAL " + hexEncode(uidEncoded.str()) + "\r\n";
+}
+
+void AuthClient::sendNextAuthMethod()
+{
+    switch (m_nextAuthMethod) {
+    case AuthExternal: {
+        const std::string extLine = externalAuthLine();
         readTransport()->write(chunk(extLine.c_str(), extLine.length()));
 
         m_nextAuthMethod++;
@@ -172,7 +235,9 @@ void AuthClient::advanceState()
             // continue below, either negotiate FD passing or just send BEGIN
         } else {
             const bool rejected = m_line.substr(0, strlen("REJECTED")) == "REJECTED";
-            if (rejected) {
+            // When pipelining, the server has already seen our later commands and the Hello message in
+            // the wrong state, so there is no way to continue
+            if (rejected && m_mode == Mode::Ordered) {
                 m_state = ExpectOkState;
                 // TODO read possible authentication methods from REJECTED [space separated list of methods]
                 sendNextAuthMethod();
@@ -182,6 +247,11 @@ void AuthClient::advanceState()
             break;
         }
 #ifdef __unix__
+        if (m_mode == Mode::Pipelined) {
+            // NEGOTIATE_UNIX_FD and BEGIN have already been sent
+            m_state = ExpectUnixFdResponseState;
+            break;
+        }
         if (readTransport()->supportedPassingUnixFdsCount() > 0) {
             cstring negotiateLine("NEGOTIATE_UNIX_FD\r\n");
             readTransport()->write(chunk(negotiateLine.ptr, negotiateLine.length));
@@ -193,8 +263,10 @@ void AuthClient::advanceState()
     case ExpectUnixFdResponseState: {
         m_fdPassingEnabled = m_line == "AGREE_UNIX_FD\r\n";
 #endif
-        cstring beginLine("BEGIN\r\n");
-        readTransport()->write(chunk(beginLine.ptr, beginLine.length));
+        if (m_mode == Mode::Ordered) {
+            cstring beginLine("BEGIN\r\n");
+            readTransport()->write(chunk(beginLine.ptr, beginLine.length));
+        }
         m_state = AuthenticatedState;
         break; }
     default:
@@ -39,7 +39,18 @@ class ICompletionListener;
 class AuthClient : public ITransportListener
 {
 public:
-    explicit AuthClient(ITransport *transport);
+    enum class Mode {
+        // Send each command after the server has responded to the previous one, trying all supported
+        // authentication methods
+        Ordered,
+        // Send AUTH EXTERNAL, NEGOTIATE_UNIX_FD, BEGIN and pipelinedData (the Hello message) in one write
+        // without waiting for responses. This saves three round trips, but fails if the server rejects
+        // AUTH EXTERNAL; use Ordered then. Only for transports that can pass Unix file descriptors.
+        Pipelined
+    };
+
+    AuthClient(ITransport *transport, Mode mode = Mode::Ordered, const chunk *pipelinedData = nullptr,
+               uint32 pipelinedDataCount = 0);
 
     // reimplemented from ITransportListener
     IO::Status handleTransportCanRead() override;
@@ -47,12 +58,20 @@ public:
     bool isFinished() const;
     bool isAuthenticated() const;
     bool isUnixFdPassingEnabled() const;
+    Mode mode() const { return m_mode; }
+    // how much of pipelinedData has been written by the constructor
+    uint32 pipelinedDataWritten() const { return m_pipelinedDataWritten; }
+    // Data that was received after the server's last handshake response. It belongs to the D-Bus
+    // message stream (the Hello reply, when pipelining). Valid until the AuthClient is destroyed.
+    chunk unprocessedData() const;
 
     void setCompletionListener(ICompletionListener *);
 
 private:
     bool readLine();
-    bool isEndOfLine() const;
+    bool takeBufferedLine();
+    void writePipelined(const chunk *pipelinedData, uint32 pipelinedDataCount);
+    std::string externalAuthLine() const;
     void sendNextAuthMethod();
     void advanceState();
 
@@ -70,10 +89,14 @@ private:
         LastAuthMethod // keep this last!
     };
 
+    Mode m_mode;
     State m_state;
     int m_nextAuthMethod;
     bool m_fdPassingEnabled;
+    uint32 m_pipelinedDataWritten;
     std::string m_line;
+    std::string m_readBuffer;
+    size_t m_readPos;
     ICompletionListener *m_completionListener;
 };
 
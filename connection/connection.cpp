@@ -31,16 +31,22 @@
 #include "icompletionlistener.h"
 #include "iconnectionstatelistener.h"
 #include "imessagereceiver.h"
+#include "ireplyreceiver.h"
+#include "isendqueuelistener.h"
 #include "iserver.h"
 #include "localsocket.h"
 #include "message.h"
 #include "message_p.h"
 #include "pendingreply.h"
 #include "pendingreply_p.h"
+#include "platformtime.h"
+#include "receivebuffer.h"
 #include "stringtools.h"
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <thread>
 
 class HelloReceiver : public IMessageReceiver
 {
@@ -78,6 +84,7 @@ static Connection::State userState(ConnectionPrivate::State ps)
     case ConnectionPrivate::Unconnected:
         return Connection::Unconnected;
     case ConnectionPrivate::ServerWaitingForClient:
+    case ConnectionPrivate::Connecting:
     case ConnectionPrivate::Authenticating:
     case ConnectionPrivate::AwaitingUniqueName:
         return Connection::Connecting;
@@ -129,8 +136,21 @@ void ConnectionStateChanger::disable()
 ConnectionPrivate::ConnectionPrivate(Connection *connection, EventDispatcher *dispatcher)
    : IIoEventForwarder(EventDispatcherPrivate::get(dispatcher)),
      m_connection(connection),
-     m_eventDispatcher(dispatcher)
+     m_deferredCloseTimer(dispatcher),
+     m_deferredMessagesTimer(dispatcher),
+     m_sendQueueWatermarkTimer(dispatcher),
+     m_connectRetryTimer(dispatcher),
+     m_eventDispatcher(dispatcher),
+     m_replyTimeouts(dispatcher)
 {
+    m_deferredCloseTimer.setRepeating(false);
+    m_deferredCloseTimer.setCompletionListener(this);
+    m_deferredMessagesTimer.setRepeating(false);
+    m_deferredMessagesTimer.setCompletionListener(this);
+    m_sendQueueWatermarkTimer.setRepeating(false);
+    m_sendQueueWatermarkTimer.setCompletionListener(this);
+    m_connectRetryTimer.setRepeating(false);
+    m_connectRetryTimer.setCompletionListener(this);
 }
 
 IO::Status ConnectionPrivate::handleIoReady(IO::RW rw)
@@ -147,24 +167,65 @@ IO::Status ConnectionPrivate::handleIoReady(IO::RW rw)
     } else {
         status = IO::Status::InternalError;
     }
+    if (rw == IO::RW::Write) {
+        checkSendQueueWatermarks();
+    }
 
     if (status != IO::Status::OK) {
         if (status != IO::Status::PayloadError) {
             close(Error::RemoteDisconnect);
         } else {
-            assert(!m_sendQueue.empty());
+            assert(!m_sendQueue.isEmpty());
             const Message &msg = m_sendQueue.front();
             uint32 failedSerial = msg.serial();
             Error error = msg.error();
-            m_sendQueue.pop_front();
+            m_sendQueue.popFront();
             // If the following fails, there is no "spontaneously failed to send" notification mechanism.
             // It is not a mistake in this case that it fails silently.
             maybeDispatchToPendingReply(failedSerial, error);
+            // Continue with the rest of the queue now; with edge-triggered readiness notification, we
+            // might not be notified again.
+            if (m_state != Unconnected && !m_sendQueue.isEmpty()) {
+                return handleIoReady(rw);
+            }
+            return IO::Status::OK;
         }
     }
     return status;
 }
 
+bool ConnectionPrivate::handleIoBlocking(int timeoutMsecs)
+{
+    if (!m_transport || !m_transport->isOpen()) {
+        return false;
+    }
+    if (m_transport->isConnectRetryPending()) {
+        // there is no I/O to wait for, only the next attempt to connect
+        const int retryMsecs = m_connectRetryTimer.remainingTime();
+        if (timeoutMsecs >= 0 && timeoutMsecs < retryMsecs) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMsecs));
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(retryMsecs));
+        m_connectRetryTimer.stop();
+        retryConnectTransport();
+        return true;
+    }
+    const uint32 interest = m_transport->ioInterest();
+    const uint32 ready = m_transport->waitForIo(interest, timeoutMsecs);
+    if (!ready) {
+        return false;
+    }
+    // Handling one kind of I/O can change the interest in the other one, or close the transport
+    for (IO::RW rw : { IO::RW::Read, IO::RW::Write }) {
+        if ((ready & uint32(rw)) && m_transport && m_transport->isOpen() &&
+            (m_transport->ioInterest() & uint32(rw))) {
+            handleIoReady(rw);
+        }
+    }
+    return true;
+}
+
 Connection::Connection(EventDispatcher *dispatcher, const ConnectAddress &ca)
    : d(new ConnectionPrivate(this, dispatcher))
 {
@@ -196,15 +257,18 @@ Connection::Connection(EventDispatcher *dispatcher, const ConnectAddress &ca)
     } else {
         d->m_transport = ITransport::create(ca);
         if (d->m_transport && d->m_transport->isOpen()) {
-            d->addIoListener(d->m_transport);
+            d->watchNewTransport();
             if (ca.role() == ConnectAddress::Role::BusClient) {
-                d->startAuthentication();
-                stateChanger.setNewState(ConnectionPrivate::Authenticating);
+                // Reserve serial 1 for the "hello" message - technically not necessary, there is no
+                // required ordering of serials.
+                d->takeNextSerial();
+            }
+            stateChanger.setNewState(ConnectionPrivate::Connecting);
+            if (d->m_transport->isConnecting()) {
+                // continued in handleCompletion() from the event loop
+                d->m_transport->setConnectListener(d);
             } else {
-                assert(ca.role() == ConnectAddress::Role::PeerClient);
-                // get ready to receive messages right away
-                d->receiveNextMessage();
-                stateChanger.setNewState(ConnectionPrivate::Connected);
+                d->handleTransportConnected();
             }
         } else {
             delete d->m_transport;
@@ -230,6 +294,7 @@ Connection::Connection(EventDispatcher *dispatcher, CommRef mainConnectionRef)
         return; // stay in Unconnected state
     }
 
+    d->m_isSecondaryThreadConnection = true;
     d->m_mainThreadConnection = mainConnectionRef.connection;
     ConnectionPrivate *mainD = d->m_mainThreadConnection;
 
@@ -269,7 +334,8 @@ Connection::Connection(ITransport *transport, EventDispatcher *ed, const Connect
     d->m_clientConnectedHandler->m_server->setNewConnectionListener(d->m_clientConnectedHandler);
     d->m_clientConnectedHandler->m_parent = d;
 #endif
-    d->receiveNextMessage();
+    d->startReceiving();
+    d->startSending();
     ConnectionStateChanger stateChanger(d, ConnectionPrivate::Connected);
 }
 
@@ -299,11 +365,14 @@ Connection::~Connection()
         return;
     }
     d->close(Error::LocalDisconnect);
+    if (d->m_deletedFlag) {
+        *d->m_deletedFlag = true;
+    }
 
     delete d->m_transport;
     delete d->m_authClient;
     delete d->m_helloReceiver;
-    delete d->m_receivingMessage;
+    delete d->m_receiveBuffer;
 
     delete d;
     d = nullptr;
@@ -332,6 +401,7 @@ void ConnectionPrivate::close(Error withError)
     m_closing = true;
 
     if (m_mainThreadConnection) {
+        SpinLocker linkLocker(&m_lock);
         CommutexUnlinker unlinker(&m_mainThreadLink);
         if (unlinker.hasLock()) {
             SecondaryConnectionDisconnectEvent *evt = new SecondaryConnectionDisconnectEvent();
@@ -365,21 +435,119 @@ void ConnectionPrivate::close(Error withError)
     cancelAllPendingReplies(withError);
 
     EventDispatcherPrivate::get(m_eventDispatcher)->m_connectionToNotify = nullptr;
+    m_connectRetryTimer.stop();
     if (m_transport) {
         m_transport->close();
     }
     ConnectionStateChanger stateChanger(this, Unconnected);
 }
 
+void ConnectionPrivate::watchNewTransport()
+{
+    if (m_transport->isConnectRetryPending()) {
+        // added to the event loop when connecting has really started
+        m_connectRetryTimer.start(ITransport::ConnectRetryIntervalMsecs);
+    } else {
+        addIoListener(m_transport);
+    }
+}
+
+void ConnectionPrivate::retryConnectTransport()
+{
+    // a failure is reported to handleCompletion() right away, which closes the connection
+    m_transport->retryConnect();
+    if (m_transport->isConnectRetryPending()) {
+        m_connectRetryTimer.start(ITransport::ConnectRetryIntervalMsecs);
+    } else if (m_transport->isOpen()) {
+        addIoListener(m_transport);
+    }
+}
+
+void ConnectionPrivate::handleTransportConnected()
+{
+    assert(m_state == Connecting);
+    m_transport->setConnectListener(nullptr);
+    ConnectionStateChanger stateChanger(this);
+    if (m_connectAddress.role() == ConnectAddress::Role::BusClient) {
+        // set the state first, the hello message may be sent during startAuthentication()
+        stateChanger.setNewState(Authenticating);
+        startAuthentication();
+    } else {
+        assert(m_connectAddress.role() == ConnectAddress::Role::PeerClient);
+        // get ready to receive messages right away
+        startReceiving();
+        startSending();
+        stateChanger.setNewState(Connected);
+    }
+}
+
 void ConnectionPrivate::startAuthentication()
 {
-    // Reserve serial 1 for the "hello" message - technically not necessary, there is no required ordering
-    // of serials.
-    takeNextSerial();
-    m_authClient = new AuthClient(m_transport);
+    // Local servers practically always accept AUTH EXTERNAL, so try to save the round trips of the
+    // handshake. Should it fail after all, restartAuthentication() falls back to the ordered handshake.
+    if (m_pipelineAuthentication && m_transport->supportedPassingUnixFdsCount() > 0) {
+        sendHello(); // only enqueued, sending hasn't started yet
+        if (!m_sendQueue.isEmpty() && m_sendQueue.front().serial() == s_helloSerial) {
+            chunk helloData[2];
+            const uint32 helloChunkCount = MessagePrivate::get(&m_sendQueue.front())->unsentData(helloData);
+            m_authClient = new AuthClient(m_transport, AuthClient::Mode::Pipelined,
+                                          helloData, helloChunkCount);
+            if (m_authClient->pipelinedDataWritten()) {
+                m_sendQueue.markFrontWritten(m_authClient->pipelinedDataWritten());
+            }
+        }
+    }
+    if (!m_authClient) {
+        m_authClient = new AuthClient(m_transport);
+    }
     m_authClient->setCompletionListener(this);
 }
 
+bool ConnectionPrivate::restartAuthentication()
+{
+    assert(!m_authClient);
+    m_pipelineAuthentication = false;
+    // The hello message will be sent again after authentication
+    delete m_helloReceiver;
+    m_helloReceiver = nullptr;
+    if (!m_sendQueue.isEmpty() && m_sendQueue.front().serial() == s_helloSerial) {
+        m_sendQueue.popFront();
+    }
+    // What the server has seen of the pipelined data is unknown, so start over with a new connection
+    removeIoListener(m_transport);
+    delete m_transport;
+    m_transport = ITransport::create(m_connectAddress);
+    if (!m_transport || !m_transport->isOpen()) {
+        delete m_transport;
+        m_transport = nullptr;
+        return false;
+    }
+    watchNewTransport();
+    if (m_transport->isConnecting()) {
+        m_state = Connecting; // the user-visible state is still Connecting
+        m_transport->setConnectListener(this);
+    } else {
+        startAuthentication();
+    }
+    return true;
+}
+
+void ConnectionPrivate::sendHello()
+{
+    // Announce our presence to the bus and have it send some introductory information of its own
+    Message hello = Message::createCall("/org/freedesktop/DBus", "org.freedesktop.DBus", "Hello");
+    hello.setSerial(s_helloSerial);
+    hello.setExpectsReply(false);
+    hello.setDestination(std::string("org.freedesktop.DBus"));
+
+    m_helloReceiver = new HelloReceiver;
+    m_helloReceiver->m_helloReply = m_connection->send(std::move(hello));
+    // Ensure that the hello message is sent before any other messages that may have been
+    // already enqueued by an API client
+    m_sendQueue.moveLastToFront();
+    m_helloReceiver->m_helloReply.setReceiver(m_helloReceiver);
+}
+
 void ConnectionPrivate::handleHelloReply()
 {
     if (!m_helloReceiver->m_helloReply.hasNonErrorReply()) {
@@ -437,7 +605,8 @@ void ConnectionPrivate::handleClientConnected()
 
     assert(m_transport);
     addIoListener(m_transport);
-    receiveNextMessage();
+    startReceiving();
+    startSending();
 
     ConnectionStateChanger stateChanger(this, Connected);
 }
@@ -454,29 +623,53 @@ int Connection::defaultReplyTimeout() const
 
 uint32 ConnectionPrivate::takeNextSerial()
 {
+    return takeSerialRange(1);
+}
+
+uint32 ConnectionPrivate::takeSerialRange(uint32 count)
+{
+    assert(count > 0);
     uint32 ret;
     do {
-        ret = m_sendSerial.fetch_add(1, std::memory_order_relaxed);
-    } while (unlikely(ret == 0));
+        ret = m_sendSerial.fetch_add(count, std::memory_order_relaxed);
+        // zero is not a valid serial; if the range wraps around through it, just take the next range
+    } while (unlikely(ret == 0 || uint32(ret + count - 1) < ret));
     return ret;
 }
 
-Error ConnectionPrivate::prepareSend(Message *msg)
+Error ConnectionPrivate::reserveSerials(uint32 count, uint32 *firstSerial)
 {
-    if (msg->serial() == 0) {
+    if (!m_isSecondaryThreadConnection) {
+        *firstSerial = takeSerialRange(count);
+    } else {
+        // we take serials from the other Connection and then serialize locally in order to keep the CPU
+        // expense of serialization local, even though it's more complicated than doing everything in the
+        // other thread / Connection.
+        // This may run in any thread (see Connection::sendFromAnyThread()), while the owning thread
+        // disconnects from the main Connection.
+        SpinLocker linkLocker(&m_lock);
         if (!m_mainThreadConnection) {
-            msg->setSerial(takeNextSerial());
+            return Error::LocalDisconnect;
+        }
+        CommutexLocker locker(&m_mainThreadLink);
+        if (locker.hasLock()) {
+            *firstSerial = m_mainThreadConnection->takeSerialRange(count);
         } else {
-            // we take a serial from the other Connection and then serialize locally in order to keep the CPU
-            // expense of serialization local, even though it's more complicated than doing everything in the
-            // other thread / Connection.
-            CommutexLocker locker(&m_mainThreadLink);
-            if (locker.hasLock()) {
-                msg->setSerial(m_mainThreadConnection->takeNextSerial());
-            } else {
-                return Error::LocalDisconnect;
-            }
+            return Error::LocalDisconnect;
+        }
+    }
+    return Error::NoError;
+}
+
+Error ConnectionPrivate::prepareSend(Message *msg)
+{
+    if (msg->serial() == 0) {
+        uint32 serial;
+        const Error error = reserveSerials(1, &serial);
+        if (error.isError()) {
+            return error;
         }
+        msg->setSerial(serial);
     }
 
     MessagePrivate *const mpriv = MessagePrivate::get(msg); // this is unchanged by move()ing the owning Message.
@@ -486,48 +679,155 @@ Error ConnectionPrivate::prepareSend(Message *msg)
     return Error::NoError;
 }
 
-void ConnectionPrivate::sendPreparedMessage(Message msg)
+static size_t serializedLength(Message *msg)
 {
-    MessagePrivate *const mpriv = MessagePrivate::get(&msg);
-    mpriv->setCompletionListener(this);
-    m_sendQueue.push_back(std::move(msg));
-    if (m_state == ConnectionPrivate::Connected && m_sendQueue.size() == 1) {
-        // first in queue, don't wait for some other event to trigger sending
-        mpriv->send(m_transport);
+    const MessagePrivate *const mpriv = MessagePrivate::get(msg);
+    return mpriv->m_headerLength + mpriv->m_bodyLength;
+}
+
+Error ConnectionPrivate::sendPreparedMessage(Message msg)
+{
+    // The hello message must not be rejected or delayed, and it always fits into the empty queue anyway
+    if (msg.serial() != s_helloSerial) {
+        const Error error = makeRoomInSendQueue(serializedLength(&msg));
+        if (error.isError()) {
+            return error;
+        }
+    }
+    // this only starts sending right away once startSending() has been called
+    if (m_sendQueue.enqueue(std::move(msg)) != IO::Status::OK) {
+        // handle it like an I/O error from the event loop, which would be delivered later, too
+        m_deferredCloseTimer.start(0);
     }
+    checkSendQueueWatermarks();
+    return Error::NoError;
 }
 
-PendingReply Connection::send(Message m, int timeoutMsecs)
+Error ConnectionPrivate::sendPreparedMessages(std::vector<Message> msgs)
 {
-    if (timeoutMsecs == DefaultTimeout) {
-        timeoutMsecs = d->m_defaultTimeout;
+    size_t byteCount = 0;
+    for (Message &msg : msgs) {
+        byteCount += serializedLength(&msg);
     }
+    const Error error = makeRoomInSendQueue(byteCount);
+    if (error.isError()) {
+        return error;
+    }
+    if (m_sendQueue.enqueue(std::move(msgs)) != IO::Status::OK) {
+        m_deferredCloseTimer.start(0);
+    }
+    checkSendQueueWatermarks();
+    return Error::NoError;
+}
 
-    Error error = d->prepareSend(&m);
+Error ConnectionPrivate::makeRoomInSendQueue(size_t byteCount)
+{
+    const size_t highWatermark = m_sendQueue.highWatermark();
+    // A message that is larger than the limit is still sent if it is the only one
+    if (!highWatermark || m_sendQueue.isEmpty() || m_sendQueue.byteCount() + byteCount <= highWatermark) {
+        return Error::NoError;
+    }
+
+    Connection::SendQueuePolicy policy = m_sendQueuePolicy;
+    if (policy == Connection::SendQueuePolicy::Block && m_isSendingForOtherThread) {
+        // The other thread isn't waiting for us, and blocking here would stall this thread's event loop,
+        // including the I/O of all other Connections that it runs
+        policy = Connection::SendQueuePolicy::Reject;
+    }
+
+    switch (policy) {
+    case Connection::SendQueuePolicy::Unlimited:
+        break;
+    case Connection::SendQueuePolicy::Reject:
+        return Error::SendQueueFull;
+    case Connection::SendQueuePolicy::DropOldestSignals:
+        m_sendQueue.dropOldestSignals(m_sendQueue.byteCount() + byteCount - highWatermark);
+        break;
+    case Connection::SendQueuePolicy::Block:
+        // Only write, so that no messages are received and dispatched to client code from inside a
+        // send method. Errors are handled from the event loop as usual.
+        while (m_sendQueue.isStarted() && m_sendQueue.byteCount() > m_sendQueue.lowWatermark()) {
+            if (!m_transport || !m_transport->isOpen() || m_deferredCloseTimer.isRunning()) {
+                return Error::RemoteDisconnect;
+            }
+            if (!m_transport->waitForIo(uint32(IO::RW::Write), -1)) {
+                continue;
+            }
+            const IO::Status status = m_sendQueue.handleTransportCanWrite();
+            if (status == IO::Status::PayloadError) {
+                break; // the message at the front fails, which is reported from the event loop
+            } else if (status != IO::Status::OK) {
+                m_deferredCloseTimer.start(0);
+                return Error::RemoteDisconnect;
+            }
+        }
+        break;
+    }
+    return Error::NoError;
+}
 
-    PendingReplyPrivate *pendingPriv = new PendingReplyPrivate(d->m_eventDispatcher, timeoutMsecs);
-    pendingPriv->m_connectionOrReply.connection = d;
+void ConnectionPrivate::checkSendQueueWatermarks()
+{
+    // Notify from the event loop because this is called from send methods and I/O handling
+    if (m_sendQueue.isAboveHighWatermark() != m_reportedAboveHighWatermark &&
+        !m_sendQueueWatermarkTimer.isRunning()) {
+        m_sendQueueWatermarkTimer.start(0);
+    }
+}
+
+PendingReplyPrivate *ConnectionPrivate::createPendingReply(uint32 serial)
+{
+    PendingReplyPrivate *pendingPriv = new PendingReplyPrivate;
+    pendingPriv->m_connectionOrReply.connection = this;
     pendingPriv->m_receiver = nullptr;
-    pendingPriv->m_serial = m.serial();
+    pendingPriv->m_serial = serial;
 
     // even if we're handing off I/O to a main Connection, keep a record because that simplifies
     // aborting all pending replies when we disconnect from the main Connection, no matter which
     // side initiated the disconnection.
-    d->m_pendingReplies.emplace(m.serial(), pendingPriv);
+    // A message that could not get a serial is never sent. Its PendingReply only finishes with an
+    // error, which is handled by m_replyTimeouts alone.
+    if (serial) {
+        m_pendingReplies.insert(serial, pendingPriv);
+    }
+    return pendingPriv;
+}
 
-    if (error.isError() || d->m_state == ConnectionPrivate::Unconnected) {
-        // Signal the error asynchronously, in order to get the same delayed completion callback as in
-        // the non-error case. This should make the behavior more predictable and client code harder to
-        // accidentally get wrong. To detect errors immediately, PendingReply::error() can be used.
+void ConnectionPrivate::finishPendingReplyLater(PendingReplyPrivate *pendingPriv, Error error)
+{
+    // Signal the error asynchronously, in order to get the same delayed completion callback as in
+    // the non-error case. This should make the behavior more predictable and client code harder to
+    // accidentally get wrong. To detect errors immediately, PendingReply::error() can be used.
+    pendingPriv->m_error = error;
+    m_replyTimeouts.remove(pendingPriv);
+    m_replyTimeouts.add(pendingPriv, 0);
+}
+
+PendingReply Connection::send(Message m, int timeoutMsecs)
+{
+    if (timeoutMsecs == DefaultTimeout) {
+        timeoutMsecs = d->m_defaultTimeout;
+    }
+
+    Error error = d->prepareSend(&m);
+
+    PendingReplyPrivate *pendingPriv = d->createPendingReply(m.serial());
 
+    if (error.isError() || d->m_state == ConnectionPrivate::Unconnected) {
         // An intentionally locally disconnected connection is not in an error state, but trying to send
         // a message over it is an error.
-        pendingPriv->m_error = error.isError() ? error : Error::LocalDisconnect;
-        pendingPriv->m_replyTimeout.start(0);
+        d->finishPendingReplyLater(pendingPriv, error.isError() ? error : Error::LocalDisconnect);
     } else {
+        if (timeoutMsecs >= 0) {
+            d->m_replyTimeouts.add(pendingPriv, timeoutMsecs);
+        }
         if (!d->m_mainThreadConnection) {
-            d->sendPreparedMessage(std::move(m));
+            const Error sendError = d->sendPreparedMessage(std::move(m));
+            if (sendError.isError()) {
+                d->finishPendingReplyLater(pendingPriv, sendError);
+            }
         } else {
+            SpinLocker linkLocker(&d->m_lock);
             CommutexLocker locker(&d->m_mainThreadLink);
             if (locker.hasLock()) {
                 std::unique_ptr<SendMessageWithPendingReplyEvent> evt(new SendMessageWithPendingReplyEvent);
@@ -536,7 +836,7 @@ PendingReply Connection::send(Message m, int timeoutMsecs)
                 EventDispatcherPrivate::get(d->m_mainThreadConnection->m_eventDispatcher)
                     ->queueEvent(std::move(evt));
             } else {
-                pendingPriv->m_error = Error::LocalDisconnect;
+                d->finishPendingReplyLater(pendingPriv, Error::LocalDisconnect);
             }
         }
     }
@@ -544,6 +844,160 @@ PendingReply Connection::send(Message m, int timeoutMsecs)
     return PendingReply(pendingPriv);
 }
 
+std::vector<PendingReply> Connection::sendBatch(std::vector<Message> messages, int timeoutMsecs)
+{
+    if (timeoutMsecs == DefaultTimeout) {
+        timeoutMsecs = d->m_defaultTimeout;
+    }
+
+    // take one range of serials for all messages that need one
+    uint32 serialsNeeded = 0;
+    for (const Message &m : messages) {
+        if (m.serial() == 0) {
+            serialsNeeded++;
+        }
+    }
+    uint32 nextSerial = 0;
+    const Error serialError = serialsNeeded ? d->reserveSerials(serialsNeeded, &nextSerial) : Error();
+
+    std::vector<PendingReply> pendingReplies;
+    pendingReplies.reserve(messages.size());
+    std::vector<Message> toSend;
+    toSend.reserve(messages.size());
+    std::vector<PendingReplyPrivate *> toSendPendingPrivs;
+    toSendPendingPrivs.reserve(messages.size());
+
+    for (Message &m : messages) {
+        Error error;
+        if (m.serial() == 0) {
+            if (serialError.isError()) {
+                error = serialError;
+            } else {
+                m.setSerial(nextSerial++);
+            }
+        }
+        if (!error.isError()) {
+            error = d->prepareSend(&m);
+        }
+
+        PendingReplyPrivate *pendingPriv = d->createPendingReply(m.serial());
+        if (error.isError() || d->m_state == ConnectionPrivate::Unconnected) {
+            d->finishPendingReplyLater(pendingPriv, error.isError() ? error : Error::LocalDisconnect);
+        } else {
+            if (timeoutMsecs >= 0) {
+                d->m_replyTimeouts.add(pendingPriv, timeoutMsecs);
+            }
+            toSend.push_back(std::move(m));
+            toSendPendingPrivs.push_back(pendingPriv);
+        }
+        pendingReplies.push_back(PendingReply(pendingPriv));
+    }
+
+    if (toSend.empty()) {
+        // nothing to do
+    } else if (!d->m_mainThreadConnection) {
+        // one write for as many messages as the transport takes at once
+        const Error sendError = d->sendPreparedMessages(std::move(toSend));
+        if (sendError.isError()) {
+            for (PendingReplyPrivate *pendingPriv : toSendPendingPrivs) {
+                d->finishPendingReplyLater(pendingPriv, sendError);
+            }
+        }
+    } else {
+        SpinLocker linkLocker(&d->m_lock);
+        CommutexLocker locker(&d->m_mainThreadLink);
+        if (locker.hasLock()) {
+            EventDispatcherPrivate *const mainDispatcher =
+                EventDispatcherPrivate::get(d->m_mainThreadConnection->m_eventDispatcher);
+            for (Message &m : toSend) {
+                std::unique_ptr<SendMessageWithPendingReplyEvent> evt(new SendMessageWithPendingReplyEvent);
+                evt->message = std::move(m);
+                evt->connection = d;
+                mainDispatcher->queueEvent(std::move(evt));
+            }
+        } else {
+            for (PendingReplyPrivate *pendingPriv : toSendPendingPrivs) {
+                d->finishPendingReplyLater(pendingPriv, Error::LocalDisconnect);
+            }
+        }
+    }
+
+    return pendingReplies;
+}
+
+PendingReply Connection::call(Message m, int timeoutMsecs)
+{
+    if (timeoutMsecs == DefaultTimeout) {
+        timeoutMsecs = d->m_defaultTimeout;
+    }
+
+    if (d->m_mainThreadConnection) {
+        // The main thread Connection does the I/O, and the reply comes back through our EventDispatcher.
+        // Unlike below, waiting for it runs everything else in the EventDispatcher, too.
+        PendingReply reply = send(std::move(m), timeoutMsecs);
+        const uint64 deadline = timeoutMsecs >= 0 ? PlatformTime::monotonicMsecs() + timeoutMsecs : 0;
+        while (!reply.isFinished()) {
+            int waitMsecs = -1;
+            if (timeoutMsecs >= 0) {
+                const uint64 now = PlatformTime::monotonicMsecs();
+                if (now >= deadline) {
+                    // don't wait for m_replyTimeouts, the timer may be due a little later
+                    reply.d->handleTimeout();
+                    break;
+                }
+                waitMsecs = int(deadline - now);
+            }
+            d->m_eventDispatcher->poll(waitMsecs);
+        }
+        return reply;
+    }
+
+    // The timeout is handled here, not by m_replyTimeouts, which only runs from the event loop
+    PendingReply reply = send(std::move(m), NoTimeout);
+    PendingReplyPrivate *const pendingPriv = reply.d;
+    if (pendingPriv->m_error.isError()) {
+        // a local error which send() would report from the event loop
+        pendingPriv->handleTimeout();
+        return reply;
+    }
+
+    const uint64 deadline = timeoutMsecs >= 0 ? PlatformTime::monotonicMsecs() + timeoutMsecs : 0;
+    const uint32 previousBlockingCallSerial = d->m_blockingCallSerial; // call() from a callback in call()
+    d->m_blockingCallSerial = pendingPriv->m_serial;
+
+    while (!pendingPriv->m_isFinished) {
+        if (d->m_deferredCloseTimer.isRunning()) {
+            // an error while sending, which the event loop isn't going to handle in time
+            d->m_deferredCloseTimer.stop();
+            d->close(Error::RemoteDisconnect);
+            continue;
+        }
+        if (!d->m_transport || !d->m_transport->isOpen()) {
+            // the reply can't arrive anymore
+            const bool found = d->maybeDispatchToPendingReply(pendingPriv->m_serial, Error::LocalDisconnect);
+            assert(found);
+            (void) found;
+            continue;
+        }
+        int waitMsecs = -1;
+        if (timeoutMsecs >= 0) {
+            const uint64 now = PlatformTime::monotonicMsecs();
+            if (now >= deadline) {
+                pendingPriv->handleTimeout();
+                continue;
+            }
+            waitMsecs = int(deadline - now);
+        }
+        d->handleIoBlocking(waitMsecs);
+    }
+
+    d->m_blockingCallSerial = previousBlockingCallSerial;
+    if (!d->m_blockingCallSerial && !d->m_deferredMessages.empty()) {
+        d->m_deferredMessagesTimer.start(0);
+    }
+    return reply;
+}
+
 Error Connection::sendNoReply(Message m)
 {
     // ### (when not called from send()) warn if sending a message without the noreply flag set?
@@ -558,8 +1012,9 @@ Error Connection::sendNoReply(Message m)
     // be in the queue
 
     if (!d->m_mainThreadConnection) {
-        d->sendPreparedMessage(std::move(m));
+        return d->sendPreparedMessage(std::move(m));
     } else {
+        SpinLocker linkLocker(&d->m_lock);
         CommutexLocker locker(&d->m_mainThreadLink);
         if (locker.hasLock()) {
             std::unique_ptr<SendMessageEvent> evt(new SendMessageEvent);
@@ -573,30 +1028,86 @@ Error Connection::sendNoReply(Message m)
     return Error::NoError;
 }
 
+Error Connection::sendFromAnyThread(Message m, IReplyReceiver *replyReceiver, int timeoutMsecs)
+{
+    return sendFromAnyThread(std::move(m), replyReceiver, nullptr, timeoutMsecs);
+}
+
+Error Connection::sendFromAnyThread(Message m, IReplyReceiver *replyReceiver, EventDispatcher *replyDispatcher,
+                                    int timeoutMsecs)
+{
+    // prepareSend() is thread-safe: the serial counter is atomic, and the link to the main Connection
+    // of a secondary Connection is protected by m_lock
+    Error error = d->prepareSend(&m);
+    if (error.isError()) {
+        return error;
+    }
+    std::unique_ptr<SendMessageFromAnyThreadEvent> evt(new SendMessageFromAnyThreadEvent);
+    evt->message = std::move(m);
+    evt->replyReceiver = replyReceiver;
+    evt->replyDispatcher = replyDispatcher;
+    evt->timeoutMsecs = timeoutMsecs;
+    EventDispatcherPrivate::get(d->m_eventDispatcher)->queueEvent(std::move(evt));
+    return Error::NoError;
+}
+
+Error Connection::sendNoReplyFromAnyThread(Message m)
+{
+    return sendFromAnyThread(std::move(m), nullptr);
+}
+
 size_t Connection::sendQueueLength() const
 {
     return d->m_sendQueue.size();
 }
 
-void Connection::waitForConnectionEstablished()
+size_t Connection::sendQueueByteCount() const
 {
-    if (d->m_state != ConnectionPrivate::Authenticating) {
-        return;
-    }
-    while (d->m_state == ConnectionPrivate::Authenticating) {
-        d->m_authClient->handleTransportCanRead();
-    }
-    if (d->m_state != ConnectionPrivate::AwaitingUniqueName) {
-        return;
-    }
-    // Send the hello message
-    assert(!d->m_sendQueue.empty()); // the hello message should be in the queue
-    MessagePrivate *helloPriv = MessagePrivate::get(&d->m_sendQueue.front());
-    helloPriv->handleTransportCanWrite();
+    return d->m_sendQueue.byteCount();
+}
 
-    // Receive the hello reply
-    while (d->m_state == ConnectionPrivate::AwaitingUniqueName) {
-        MessagePrivate::get(d->m_receivingMessage)->handleTransportCanRead();
+void Connection::setSendQueueWatermarks(size_t lowWatermark, size_t highWatermark)
+{
+    d->m_sendQueue.setWatermarks(std::min(lowWatermark, highWatermark), highWatermark);
+    d->checkSendQueueWatermarks();
+}
+
+size_t Connection::sendQueueLowWatermark() const
+{
+    return d->m_sendQueue.lowWatermark();
+}
+
+size_t Connection::sendQueueHighWatermark() const
+{
+    return d->m_sendQueue.highWatermark();
+}
+
+void Connection::setSendQueuePolicy(SendQueuePolicy policy)
+{
+    d->m_sendQueuePolicy = policy;
+}
+
+Connection::SendQueuePolicy Connection::sendQueuePolicy() const
+{
+    return d->m_sendQueuePolicy;
+}
+
+ISendQueueListener *Connection::sendQueueListener() const
+{
+    return d->m_sendQueueListener;
+}
+
+void Connection::setSendQueueListener(ISendQueueListener *listener)
+{
+    d->m_sendQueueListener = listener;
+}
+
+void Connection::waitForConnectionEstablished()
+{
+    // restarting authentication can go back to Connecting
+    while ((d->m_state == ConnectionPrivate::Connecting || d->m_state == ConnectionPrivate::Authenticating ||
+            d->m_state == ConnectionPrivate::AwaitingUniqueName) && d->handleIoBlocking(-1)) {
+        // handleIoBlocking() advances the state through handleIoReady() and handleCompletion()
     }
 }
 
@@ -612,7 +1123,7 @@ std::string Connection::uniqueName() const
 
 bool Connection::isConnected() const
 {
-    return d->m_transport && d->m_transport->isOpen();
+    return d->m_transport && d->m_transport->isOpen() && !d->m_transport->isConnecting();
 }
 
 EventDispatcher *Connection::eventDispatcher() const
@@ -628,6 +1139,15 @@ IMessageReceiver *Connection::spontaneousMessageReceiver() const
 void Connection::setSpontaneousMessageReceiver(IMessageReceiver *receiver)
 {
     d->m_client = receiver;
+    d->m_clientCallback.reset();
+    d->m_runningClientCallback = nullptr;
+}
+
+void Connection::setSpontaneousMessageCallback(SpontaneousMessageCallback callback)
+{
+    d->m_clientCallback = std::move(callback);
+    d->m_runningClientCallback = nullptr;
+    d->m_client = nullptr;
 }
 
 IConnectionStateListener *Connection::connectionStateListener() const
@@ -642,101 +1162,111 @@ void Connection::setConnectionStateListener(IConnectionStateListener *listener)
 
 void ConnectionPrivate::handleCompletion(void *task)
 {
+    if (task == &m_deferredCloseTimer) {
+        close(Error::RemoteDisconnect);
+        return;
+    }
+    if (task == &m_deferredMessagesTimer) {
+        dispatchDeferredMessages();
+        return;
+    }
+    if (task == &m_connectRetryTimer) {
+        retryConnectTransport();
+        return;
+    }
+    if (task == &m_sendQueueWatermarkTimer) {
+        const bool isAboveHighWatermark = m_sendQueue.isAboveHighWatermark();
+        if (isAboveHighWatermark != m_reportedAboveHighWatermark) {
+            m_reportedAboveHighWatermark = isAboveHighWatermark;
+            if (m_sendQueueListener && isAboveHighWatermark) {
+                m_sendQueueListener->handleSendQueueAboveHighWatermark(m_connection, m_sendQueue.byteCount());
+            } else if (m_sendQueueListener) {
+                m_sendQueueListener->handleSendQueueBelowLowWatermark(m_connection, m_sendQueue.byteCount());
+            }
+        }
+        return;
+    }
     switch (m_state) {
+    case Connecting: {
+        assert(task == m_transport);
+        if (m_transport->isOpen()) {
+            handleTransportConnected();
+        } else {
+            close(Error::RemoteDisconnect);
+        }
+        break;
+    }
     case Authenticating: {
         assert(task == m_authClient);
         assert(m_authClient->isFinished());
         if (!m_authClient->isAuthenticated()) {
-            close(Error::AuthenticationFailed);
+            const bool wasPipelined = m_authClient->mode() == AuthClient::Mode::Pipelined;
+            delete m_authClient;
+            m_authClient = nullptr;
+            if (!wasPipelined || !restartAuthentication()) {
+                close(Error::AuthenticationFailed);
+            }
+            break;
         }
         m_unixFdPassingEnabled = m_authClient->isUnixFdPassingEnabled();
+        const bool helloSent = m_authClient->mode() == AuthClient::Mode::Pipelined;
+        // When pipelining, the server's responses may arrive together with the hello reply
+        const chunk unprocessed = m_authClient->unprocessedData();
+        const std::vector<byte> messageData(unprocessed.ptr, unprocessed.ptr + unprocessed.length);
         delete m_authClient;
         m_authClient = nullptr;
-        if (m_state == Unconnected) {
-            break;
-        }
-
-        ConnectionStateChanger stateChanger(this, AwaitingUniqueName);
-
-        // Announce our presence to the bus and have it send some introductory information of its own
-        Message hello = Message::createCall("/org/freedesktop/DBus", "org.freedesktop.DBus", "Hello");
-        hello.setSerial(1);
-        hello.setExpectsReply(false);
-        hello.setDestination(std::string("org.freedesktop.DBus"));
-        MessagePrivate *const helloPriv = MessagePrivate::get(&hello);
 
-        m_helloReceiver = new HelloReceiver;
-        m_helloReceiver->m_helloReply = m_connection->send(std::move(hello));
-        // Small hack: Connection::send() refuses to really start sending if the connection isn't in
-        // Connected state. So force the sending here to actually get to Connected state.
-        helloPriv->send(m_transport);
-        // Also ensure that the hello message is sent before any other messages that may have been
-        // already enqueued by an API client
-        if (m_sendQueue.size() > 1) {
-            hello = std::move(m_sendQueue.back());
-            m_sendQueue.pop_back();
-            m_sendQueue.push_front(std::move(hello));
+        {
+            ConnectionStateChanger stateChanger(this, AwaitingUniqueName);
+            if (!helloSent) {
+                sendHello();
+            }
+            // get ready to receive the first message, the hello reply
+            startReceiving();
+            startSending();
         }
-        m_helloReceiver->m_helloReply.setReceiver(m_helloReceiver);
-        // get ready to receive the first message, the hello reply
-        receiveNextMessage();
 
+        // This may dispatch the hello reply and other messages, so do it after notifying the state change.
+        // Reading right away also picks up data that the AuthClient has left in the socket, which would
+        // otherwise go unnoticed with edge-triggered readiness notification.
+        if (helloSent && m_state == AwaitingUniqueName) {
+            if (!messageData.empty()) {
+                m_receiveBuffer->addReceivedData(chunk(const_cast<byte *>(messageData.data()),
+                                                       messageData.size()));
+            }
+            if (m_receiveBuffer->handleTransportCanRead() != IO::Status::OK) {
+                close(Error::RemoteDisconnect);
+            }
+        }
         break;
     }
     case AwaitingUniqueName: // the code paths for these two states only diverge in the PendingReply handler
     case Connected: {
         assert(!m_authClient);
-        if (!m_sendQueue.empty() && task == &m_sendQueue.front()) {
-            Message *msg = static_cast<Message* >(task);
-            if (msg->error().isError()) {
-                if (m_state == AwaitingUniqueName) {
-                    handleHelloFailed();
-                }
-                // TODO else also close the connection? (maybe depending on which error it is)
-            }
-            m_sendQueue.pop_front();
-            if (!m_sendQueue.empty()) {
-                MessagePrivate::get(&m_sendQueue.front())->send(m_transport);
-            }
-        } else {
-            assert(task == m_receivingMessage);
-            Message *const receivedMessage = m_receivingMessage;
+        // a message from m_receiveBuffer, which owns it - we may move from it, though
+        Message *const receivedMessage = static_cast<Message *>(task);
 
-            receiveNextMessage();
-
-            if (receivedMessage->type() == Message::InvalidMessage) {
-                if (m_state == AwaitingUniqueName) {
-                    handleHelloFailed();
-                }
-                delete receivedMessage;
-            } else if (!maybeDispatchToPendingReply(receivedMessage)) {
-                if (m_client) {
-                    m_client->handleSpontaneousMessageReceived(Message(std::move(*receivedMessage)),
-                                                               m_connection);
-                }
-                // dispatch to other threads listening to spontaneous messages, if any
-                for (auto it = m_secondaryThreadLinks.begin(); it != m_secondaryThreadLinks.end(); ) {
-                    SpontaneousMessageReceivedEvent *evt = new SpontaneousMessageReceivedEvent();
-                    if (std::next(it) != m_secondaryThreadLinks.end()) {
-                        evt->message = *receivedMessage;
-                    } else {
-                        evt->message = std::move(*receivedMessage);
-                    }
-
-                    CommutexLocker otherLocker(&it->second);
-                    if (otherLocker.hasLock()) {
-                        EventDispatcherPrivate::get(it->first->m_eventDispatcher)
-                            ->queueEvent(std::unique_ptr<Event>(evt));
-                        ++it;
-                    } else {
-                        ConnectionPrivate *connection = it->first;
-                        it = m_secondaryThreadLinks.erase(it);
-                        discardPendingRepliesForSecondaryThread(connection);
-                        delete evt;
-                    }
+        if (receivedMessage->type() == Message::InvalidMessage) {
+            if (m_state == AwaitingUniqueName) {
+                handleHelloFailed();
+            }
+        } else if (!m_deferredMessages.empty() || m_blockingCallSerial) {
+            // Keep the order of messages. The reply that call() is waiting for, and the hello reply that
+            // it may be waiting for indirectly, are not part of the normal order of delivery.
+            const bool isReply = receivedMessage->type() == Message::MethodReturnMessage ||
+                                 receivedMessage->type() == Message::ErrorMessage;
+            const uint32 replySerial = isReply ? receivedMessage->replySerial() : 0;
+            if (replySerial && (replySerial == m_blockingCallSerial ||
+                                (m_state == AwaitingUniqueName && replySerial == s_helloSerial))) {
+                dispatchReceivedMessage(receivedMessage);
+            } else {
+                m_deferredMessages.push_back(std::move(*receivedMessage));
+                if (!m_blockingCallSerial) {
+                    m_deferredMessagesTimer.start(0);
                 }
-                delete receivedMessage;
             }
+        } else {
+            dispatchReceivedMessage(receivedMessage);
         }
         break;
     }
@@ -746,6 +1276,83 @@ void ConnectionPrivate::handleCompletion(void *task)
     };
 }
 
+void ConnectionPrivate::dispatchReceivedMessage(Message *receivedMessage)
+{
+    if (maybeDispatchToPendingReply(receivedMessage)) {
+        return;
+    }
+    // dispatch to other threads listening to spontaneous messages, if any
+    for (auto it = m_secondaryThreadLinks.begin(); it != m_secondaryThreadLinks.end(); ) {
+        SpontaneousMessageReceivedEvent *evt = new SpontaneousMessageReceivedEvent();
+        evt->message = *receivedMessage;
+
+        CommutexLocker otherLocker(&it->second);
+        if (otherLocker.hasLock()) {
+            EventDispatcherPrivate::get(it->first->m_eventDispatcher)
+                ->queueEvent(std::unique_ptr<Event>(evt));
+            ++it;
+        } else {
+            ConnectionPrivate *connection = it->first;
+            it = m_secondaryThreadLinks.erase(it);
+            discardPendingRepliesForSecondaryThread(connection);
+            delete evt;
+        }
+    }
+    // The client may delete the Connection, so do this last
+    notifySpontaneousMessage(receivedMessage);
+}
+
+void ConnectionPrivate::notifySpontaneousMessage(Message *m)
+{
+    if (m_client) {
+        m_client->handleSpontaneousMessageReceived(Message(std::move(*m)), m_connection);
+    } else if (m_runningClientCallback) {
+        // re-entered from the callback, e.g. through EventDispatcher::poll()
+        (*m_runningClientCallback)(Message(std::move(*m)), m_connection);
+    } else if (m_clientCallback) {
+        // The callback may replace itself or delete the Connection. Keep the callable alive until it
+        // returns, and put it back afterwards unless it was replaced.
+        Connection::SpontaneousMessageCallback callback = std::move(m_clientCallback);
+        m_runningClientCallback = &callback;
+        bool isDeleted = false;
+        bool *const outerDeletedFlag = m_deletedFlag;
+        m_deletedFlag = &isDeleted;
+        callback(Message(std::move(*m)), m_connection);
+        if (isDeleted) {
+            if (outerDeletedFlag) {
+                *outerDeletedFlag = true;
+            }
+            return;
+        }
+        m_deletedFlag = outerDeletedFlag;
+        if (m_runningClientCallback == &callback) {
+            m_runningClientCallback = nullptr;
+            m_clientCallback = std::move(callback);
+        }
+    }
+}
+
+void ConnectionPrivate::dispatchDeferredMessages()
+{
+    // A callback can make another blocking call, which defers the remaining messages again.
+    // It can also delete the Connection.
+    bool isDeleted = false;
+    bool *const outerDeletedFlag = m_deletedFlag;
+    m_deletedFlag = &isDeleted;
+    while (!m_deferredMessages.empty() && !m_blockingCallSerial) {
+        Message msg = std::move(m_deferredMessages.front());
+        m_deferredMessages.pop_front();
+        dispatchReceivedMessage(&msg);
+        if (isDeleted) {
+            if (outerDeletedFlag) {
+                *outerDeletedFlag = true;
+            }
+            return;
+        }
+    }
+    m_deletedFlag = outerDeletedFlag;
+}
+
 bool ConnectionPrivate::maybeDispatchToPendingReply(Message *receivedMessage)
 {
     if (receivedMessage->type() != Message::MethodReturnMessage &&
@@ -753,23 +1360,20 @@ bool ConnectionPrivate::maybeDispatchToPendingReply(Message *receivedMessage)
         return false;
     }
 
-    auto it = m_pendingReplies.find(receivedMessage->replySerial());
-    if (it == m_pendingReplies.end()) {
+    PendingReplyRecord record;
+    if (!m_pendingReplies.take(receivedMessage->replySerial(), &record)) {
         return false;
     }
 
-    if (PendingReplyPrivate *pr = it->second.asPendingReply()) {
-        m_pendingReplies.erase(it);
+    if (PendingReplyPrivate *pr = record.asPendingReply()) {
         assert(!pr->m_isFinished);
-        pr->handleReceived(receivedMessage);
+        pr->handleReceived(new Message(std::move(*receivedMessage)));
     } else {
         // forward to other thread's Connection
-        ConnectionPrivate *connection = it->second.asConnection();
-        m_pendingReplies.erase(it);
+        ConnectionPrivate *connection = record.asConnection();
         assert(connection);
         PendingReplySuccessEvent *evt = new PendingReplySuccessEvent;
         evt->reply = std::move(*receivedMessage);
-        delete receivedMessage;
         EventDispatcherPrivate::get(connection->m_eventDispatcher)->queueEvent(std::unique_ptr<Event>(evt));
     }
     return true;
@@ -778,19 +1382,17 @@ bool ConnectionPrivate::maybeDispatchToPendingReply(Message *receivedMessage)
 bool ConnectionPrivate::maybeDispatchToPendingReply(uint32 serial, Error error)
 {
     assert(error.isError());
-    auto it = m_pendingReplies.find(serial);
-    if (it == m_pendingReplies.end()) {
+    PendingReplyRecord record;
+    if (!m_pendingReplies.take(serial, &record)) {
         return false;
     }
 
-    if (PendingReplyPrivate *pr = it->second.asPendingReply()) {
-        m_pendingReplies.erase(it);
+    if (PendingReplyPrivate *pr = record.asPendingReply()) {
         assert(!pr->m_isFinished);
         pr->handleError(error);
     } else {
         // forward to other thread's Connection
-        ConnectionPrivate *connection = it->second.asConnection();
-        m_pendingReplies.erase(it);
+        ConnectionPrivate *connection = record.asConnection();
         assert(connection);
         PendingReplyFailureEvent *evt = new PendingReplyFailureEvent;
         evt->m_serial = serial;
@@ -800,17 +1402,22 @@ bool ConnectionPrivate::maybeDispatchToPendingReply(uint32 serial, Error error)
     return true;
 }
 
-void ConnectionPrivate::receiveNextMessage()
+void ConnectionPrivate::startReceiving()
+{
+    assert(!m_receiveBuffer);
+    m_receiveBuffer = new ReceiveBuffer(m_transport);
+    m_receiveBuffer->setCompletionListener(this);
+}
+
+void ConnectionPrivate::startSending()
 {
-    m_receivingMessage = new Message;
-    MessagePrivate *const mpriv = MessagePrivate::get(m_receivingMessage);
-    mpriv->setCompletionListener(this);
-    mpriv->receive(m_transport);
+    m_sendQueue.start(m_transport);
 }
 
 void ConnectionPrivate::unregisterPendingReply(PendingReplyPrivate *p)
 {
     if (m_mainThreadConnection) {
+        SpinLocker linkLocker(&m_lock);
         CommutexLocker otherLocker(&m_mainThreadLink);
         if (otherLocker.hasLock()) {
             PendingReplyCancelEvent *evt = new PendingReplyCancelEvent;
@@ -819,15 +1426,14 @@ void ConnectionPrivate::unregisterPendingReply(PendingReplyPrivate *p)
                 ->queueEvent(std::unique_ptr<Event>(evt));
         }
     }
-#ifndef NDEBUG
-    auto it = m_pendingReplies.find(p->m_serial);
-    assert(it != m_pendingReplies.end());
-    if (!m_mainThreadConnection) {
-        assert(it->second.asPendingReply());
-        assert(it->second.asPendingReply() == p);
+    if (p->m_serial) {
+        PendingReplyRecord record;
+        const bool found = m_pendingReplies.take(p->m_serial, &record);
+        assert(found);
+        assert(m_mainThreadConnection || record.asPendingReply() == p);
+        (void) found;
     }
-#endif
-    m_pendingReplies.erase(p->m_serial);
+    m_replyTimeouts.remove(p);
 }
 
 void ConnectionPrivate::cancelAllPendingReplies(Error withError)
@@ -838,48 +1444,119 @@ void ConnectionPrivate::cancelAllPendingReplies(Error withError)
     // In case we have pending replies for secondary threads, and we cancel all pending replies,
     // that is because we're shutting down, which we told the secondary thread, and it will deal
     // with bulk cancellation of replies. We just throw away our records about them.
-    for (auto it = m_pendingReplies.begin() ; it != m_pendingReplies.end(); ) {
-        PendingReplyPrivate *pendingPriv = it->second.asPendingReply();
-        it = m_pendingReplies.erase(it);
-        if (pendingPriv) { // if from this thread
-            pendingPriv->handleError(withError);
+    // Removing an entry can move another one into its slot, so look at the same slot again. Callbacks can
+    // remove entries, which can move entries into slots that have already been visited, so repeat until
+    // the table is empty.
+    while (!m_pendingReplies.isEmpty()) {
+        for (uint32 i = 0; i < m_pendingReplies.slotCount(); ) {
+            if (!m_pendingReplies.isOccupied(i)) {
+                i++;
+                continue;
+            }
+            PendingReplyPrivate *pendingPriv = m_pendingReplies.recordAt(i).asPendingReply();
+            m_pendingReplies.removeAt(i);
+            if (pendingPriv) { // if from this thread
+                pendingPriv->handleError(withError);
+            }
         }
     }
+    // What is left are the replies of messages that failed before getting a serial
+    while (PendingReplyPrivate *pendingPriv = m_replyTimeouts.first()) {
+        m_replyTimeouts.remove(pendingPriv);
+        pendingPriv->handleError(withError);
+    }
     m_sendQueue.clear();
+    checkSendQueueWatermarks();
 }
 
 void ConnectionPrivate::discardPendingRepliesForSecondaryThread(ConnectionPrivate *connection)
 {
-    for (auto it = m_pendingReplies.begin() ; it != m_pendingReplies.end(); ) {
-        if (it->second.asConnection() == connection) {
-            it = m_pendingReplies.erase(it);
-            // notification and deletion are handled on the event's source thread
+    for (uint32 i = 0; i < m_pendingReplies.slotCount(); ) {
+        if (m_pendingReplies.isOccupied(i) && m_pendingReplies.recordAt(i).asConnection() == connection) {
+            // Notification and deletion are handled on the event's source thread.
+            // Removing can move another entry into slot i, so look at it again.
+            m_pendingReplies.removeAt(i);
         } else {
-            ++it;
+            i++;
         }
     }
 }
 
+// Owns the PendingReply of a message sent with Connection::sendFromAnyThread() and passes the result on
+class AnyThreadReplyForwarder : public IMessageReceiver
+{
+public:
+    AnyThreadReplyForwarder(IReplyReceiver *replyReceiver, EventDispatcher *replyDispatcher, uint32 serial)
+       : m_replyReceiver(replyReceiver),
+         m_replyDispatcher(replyDispatcher),
+         m_serial(serial)
+    {}
+
+    void handlePendingReplyFinished(PendingReply *pendingReply, Connection *) override
+    {
+        const Error error = pendingReply->error();
+        Message reply = pendingReply->reply() ? pendingReply->takeReply() : Message();
+        IReplyReceiver *const replyReceiver = m_replyReceiver;
+        EventDispatcher *const replyDispatcher = m_replyDispatcher;
+        const uint32 serial = m_serial;
+        // This is the last thing PendingReply does, so we may delete it (through its owner, us) now
+        delete this;
+        deliverAnyThreadReply(replyReceiver, replyDispatcher, serial, std::move(reply), error);
+    }
+
+    PendingReply m_pendingReply;
+
+private:
+    IReplyReceiver *m_replyReceiver;
+    EventDispatcher *m_replyDispatcher;
+    uint32 m_serial;
+};
+
 void ConnectionPrivate::processEvent(Event *evt)
 {
     // std::cerr << "ConnectionPrivate::processEvent() with event type " << evt->type << std::endl;
 
     switch (evt->type) {
     case Event::SendMessage:
+        // there is nobody to report errors to
+        m_isSendingForOtherThread = true;
         sendPreparedMessage(std::move(static_cast<SendMessageEvent *>(evt)->message));
+        m_isSendingForOtherThread = false;
         break;
 
     case Event::SendMessageWithPendingReply: {
         SendMessageWithPendingReplyEvent *pre = static_cast<SendMessageWithPendingReplyEvent *>(evt);
-        m_pendingReplies.emplace(pre->message.serial(), pre->connection);
-        sendPreparedMessage(std::move(pre->message));
+        const uint32 serial = pre->message.serial();
+        m_pendingReplies.insert(serial, pre->connection);
+        m_isSendingForOtherThread = true;
+        const Error error = sendPreparedMessage(std::move(pre->message));
+        m_isSendingForOtherThread = false;
+        if (error.isError()) {
+            maybeDispatchToPendingReply(serial, error);
+        }
         break;
     }
-    case Event::SpontaneousMessageReceived:
-        if (m_client) {
-            SpontaneousMessageReceivedEvent *smre = static_cast<SpontaneousMessageReceivedEvent *>(evt);
-            m_client->handleSpontaneousMessageReceived(Message(std::move(smre->message)), m_connection);
+    case Event::SendMessageFromAnyThread: {
+        SendMessageFromAnyThreadEvent *smate = static_cast<SendMessageFromAnyThreadEvent *>(evt);
+        if (!smate->replyReceiver) {
+            // there is nobody to report errors to
+            m_isSendingForOtherThread = true;
+            m_connection->sendNoReply(std::move(smate->message));
+            m_isSendingForOtherThread = false;
+            break;
         }
+        AnyThreadReplyForwarder *forwarder = new AnyThreadReplyForwarder(smate->replyReceiver,
+                                                                         smate->replyDispatcher,
+                                                                         smate->message.serial());
+        smate->replyReceiver = nullptr; // the forwarder is responsible for notifying it now
+        m_isSendingForOtherThread = true;
+        forwarder->m_pendingReply = m_connection->send(std::move(smate->message), smate->timeoutMsecs);
+        m_isSendingForOtherThread = false;
+        forwarder->m_pendingReply.setReceiver(forwarder);
+        break;
+    }
+    case Event::SpontaneousMessageReceived:
+        notifySpontaneousMessage(&static_cast<SpontaneousMessageReceivedEvent *>(evt)->message);
         break;
 
     case Event::PendingReplySuccess:
@@ -888,21 +1565,19 @@ void ConnectionPrivate::processEvent(Event *evt)
 
     case Event::PendingReplyFailure: {
         PendingReplyFailureEvent *prfe = static_cast<PendingReplyFailureEvent *>(evt);
-        const auto it = m_pendingReplies.find(prfe->m_serial);
-        if (it == m_pendingReplies.end()) {
+        PendingReplyRecord record;
+        if (!m_pendingReplies.take(prfe->m_serial, &record)) {
             // not a disaster, but when it happens in debug mode I want to check it out
             assert(false);
             break;
         }
-        PendingReplyPrivate *pendingPriv = it->second.asPendingReply();
-        m_pendingReplies.erase(it);
-        pendingPriv->handleError(prfe->m_error);
+        record.asPendingReply()->handleError(prfe->m_error);
         break;
     }
 
     case Event::PendingReplyCancel:
         // This comes from a secondary thread, which handles PendingReply notification itself.
-        m_pendingReplies.erase(static_cast<PendingReplyCancelEvent *>(evt)->serial);
+        m_pendingReplies.take(static_cast<PendingReplyCancelEvent *>(evt)->serial);
         break;
 
     case Event::SecondaryConnectionConnect: {
@@ -940,7 +1615,10 @@ void ConnectionPrivate::processEvent(Event *evt)
     }
     case Event::MainConnectionDisconnect: {
         // since the main thread *sent* us the event, it already knows to drop all our PendingReplies
-        m_mainThreadConnection = nullptr;
+        {
+            SpinLocker linkLocker(&m_lock);
+            m_mainThreadConnection = nullptr;
+        }
         MainConnectionDisconnectEvent *mcde = static_cast<MainConnectionDisconnectEvent *>(evt);
         cancelAllPendingReplies(mcde->error);
         break;
@@ -952,6 +1630,10 @@ void ConnectionPrivate::processEvent(Event *evt)
             ConnectionStateChanger stateChanger(this, Connected);
         }
         break;
+
+    case Event::AnyThreadReply:
+        assert(false); // EventDispatcher handles it
+        break;
     }
 }
 
@@ -25,9 +25,11 @@
 #define CONNECTION_H
 
 #include "commutex.h"
+#include "inlinecallback.h"
 #include "types.h"
 
 #include <string>
+#include <vector>
 
 class Connection;
 class ConnectAddress;
@@ -36,6 +38,8 @@ class Error;
 class EventDispatcher;
 class IConnectionStateListener;
 class IMessageReceiver;
+class IReplyReceiver;
+class ISendQueueListener;
 class ITransport;
 class Message;
 class PendingReply;
@@ -99,8 +103,55 @@ public:
     // Mostly same as above.
     // This one ignores the reply, if any. Reports any locally detectable errors in the return value.
     Error sendNoReply(Message m);
+    // Sends several messages like send(), and returns their PendingReplies in the same order. Takes the
+    // serials of all messages at once and writes them to the transport together as far as possible,
+    // which is considerably faster than one send() per message for calls to many objects.
+    std::vector<PendingReply> sendBatch(std::vector<Message> messages, int timeoutMsecs = DefaultTimeout);
+    // Sends a message like send(), then blocks until the reply has arrived, an error has occurred or the
+    // timeout has expired, and returns the finished PendingReply. The calling thread sleeps in the kernel,
+    // waiting only for I/O on this Connection; no timers or other I/O of the EventDispatcher are handled
+    // meanwhile. Other messages received during the call are delivered from the next event loop iteration
+    // in the order they were received.
+    // Limitation: in a secondary thread Connection, where the I/O happens in the main thread, the reply
+    // arrives through the EventDispatcher. So this runs the EventDispatcher until the reply has arrived
+    // or the timeout has expired, and all of its timers, I/O and other events are handled meanwhile.
+    PendingReply call(Message m, int timeoutMsecs = DefaultTimeout);
+
+    // Thread-safe variants of send() and sendNoReply(): they can be called from any thread, which needs
+    // no EventDispatcher. The message is serialized in the calling thread, then passed to the thread of
+    // this Connection's EventDispatcher through a lock-free queue and sent from there.
+    // The Connection must outlive the call. The reply or error is passed to replyReceiver, which is
+    // called in the Connection's thread. If an error is returned, replyReceiver will not be called.
+    Error sendFromAnyThread(Message m, IReplyReceiver *replyReceiver, int timeoutMsecs = DefaultTimeout);
+    // Like the above, but replyReceiver is called in the thread of replyDispatcher, from its poll(). That
+    // is typically the sending thread's own EventDispatcher, which doesn't need a Connection for this.
+    // replyDispatcher must outlive the delivery of the reply; replies that are still queued when it is
+    // destroyed are delivered from its destructor.
+    Error sendFromAnyThread(Message m, IReplyReceiver *replyReceiver, EventDispatcher *replyDispatcher,
+                            int timeoutMsecs = DefaultTimeout);
+    Error sendNoReplyFromAnyThread(Message m);
 
     size_t sendQueueLength() const;
+    // The number of bytes in the send queue that have not been written to the transport yet
+    size_t sendQueueByteCount() const;
+
+    // What happens to a message that would take the send queue above the high watermark
+    enum class SendQueuePolicy {
+        Unlimited = 0, // the message is queued; the ISendQueueListener, if any, is still notified
+        Reject, // the message is not sent, and its PendingReply or sendNoReply() fails with SendQueueFull
+        DropOldestSignals, // signals that have not started sending yet are discarded to make room
+        Block // the sending thread waits until the queue has drained to the low watermark
+    };
+    // A highWatermark of zero (the default) means no limit. Messages that other threads send through this
+    // Connection are subject to the policy, too, except that Block acts like Reject for them: they are
+    // sent from this Connection's thread, which must not be blocked on behalf of another thread.
+    void setSendQueueWatermarks(size_t lowWatermark, size_t highWatermark);
+    size_t sendQueueLowWatermark() const;
+    size_t sendQueueHighWatermark() const;
+    void setSendQueuePolicy(SendQueuePolicy policy);
+    SendQueuePolicy sendQueuePolicy() const;
+    ISendQueueListener *sendQueueListener() const;
+    void setSendQueueListener(ISendQueueListener *listener);
 
     void waitForConnectionEstablished();
     ConnectAddress connectAddress() const;
@@ -115,6 +166,10 @@ public:
 
     IMessageReceiver *spontaneousMessageReceiver() const;
     void setSpontaneousMessageReceiver(IMessageReceiver *receiver);
+    // An alternative to setSpontaneousMessageReceiver() that takes any callable. Small callables are stored
+    // without allocating memory. Setting a receiver removes the callback and vice versa.
+    typedef InlineCallback<void(Message message, Connection *connection)> SpontaneousMessageCallback;
+    void setSpontaneousMessageCallback(SpontaneousMessageCallback callback);
 
     IConnectionStateListener *connectionStateListener() const;
     void setConnectionStateListener(IConnectionStateListener *listener);
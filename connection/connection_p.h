@@ -30,7 +30,11 @@
 #include "eventdispatcher_p.h"
 #include "icompletionlistener.h"
 #include "iioeventforwarder.h"
+#include "pendingreplytable.h"
+#include "replytimeouts.h"
+#include "sendqueue.h"
 #include "spinlock.h"
+#include "timer.h"
 
 #include <deque>
 #include <unordered_map>
@@ -40,6 +44,7 @@ class AuthClient;
 class HelloReceiver;
 class IMessageReceiver;
 class ITransport;
+class ReceiveBuffer;
 class ClientConnectedHandler;
 
 /*
@@ -86,11 +91,14 @@ public:
     enum State {
         Unconnected = 0,
         ServerWaitingForClient,
+        Connecting, // the transport is connecting
         Authenticating,
         AwaitingUniqueName,
         Connected
     };
 
+    static const uint32 s_helloSerial = 1;
+
     static ConnectionPrivate *get(Connection *c) { return c->d; }
 
     ConnectionPrivate(Connection *connection, EventDispatcher *dispatcher);
@@ -98,8 +106,18 @@ public:
 
     // from IIOEventForwarder
     IO::Status handleIoReady(IO::RW rw) override;
-
+    // blocks until the transport is ready for the I/O that it is interested in, then handles it. Returns
+    // false if there was nothing to wait for or the timeout expired.
+    bool handleIoBlocking(int timeoutMsecs);
+    void watchNewTransport();
+    void retryConnectTransport();
+
+    // continues setting up the connection once m_transport is connected
+    void handleTransportConnected();
     void startAuthentication();
+    // after a failed pipelined handshake, reconnects and uses the ordered handshake
+    bool restartAuthentication();
+    void sendHello();
     void handleHelloReply();
     void handleHelloFailed();
     // invokes m_connectionStateListener, if any
@@ -108,14 +126,28 @@ public:
     void handleClientConnected();
 
     uint32 takeNextSerial();
+    // returns the first of count consecutive serials, none of which is zero
+    uint32 takeSerialRange(uint32 count);
+    // like takeSerialRange(), but takes them from the main thread Connection if there is one
+    Error reserveSerials(uint32 count, uint32 *firstSerial);
 
     Error prepareSend(Message *msg);
-    void sendPreparedMessage(Message msg);
+    // These apply the send queue policy, so they can fail with Error::SendQueueFull
+    Error sendPreparedMessage(Message msg);
+    Error sendPreparedMessages(std::vector<Message> msgs);
+    Error makeRoomInSendQueue(size_t byteCount);
+    void checkSendQueueWatermarks();
+    PendingReplyPrivate *createPendingReply(uint32 serial);
+    void finishPendingReplyLater(PendingReplyPrivate *pendingPriv, Error error);
 
     void handleCompletion(void *task) override;
-    bool maybeDispatchToPendingReply(Message *m);
+    bool maybeDispatchToPendingReply(Message *m); // moves from *m if it returns true
     bool maybeDispatchToPendingReply(uint32 serial, Error error);
-    void receiveNextMessage();
+    void dispatchReceivedMessage(Message *m); // may move from *m
+    void dispatchDeferredMessages();
+    void notifySpontaneousMessage(Message *m); // moves from *m
+    void startReceiving();
+    void startSending();
 
     void unregisterPendingReply(PendingReplyPrivate *p);
     void cancelAllPendingReplies(Error withError);
@@ -128,13 +160,31 @@ public:
     State m_state = Unconnected;
     bool m_closing = false;
     bool m_unixFdPassingEnabled = false;
+    bool m_pipelineAuthentication = true;
 
     Connection *m_connection = nullptr;
     IMessageReceiver *m_client = nullptr;
+    Connection::SpontaneousMessageCallback m_clientCallback; // used if there is no m_client
+    // m_clientCallback while it runs, moved out so that it can't be destroyed by replacing it
+    Connection::SpontaneousMessageCallback *m_runningClientCallback = nullptr;
     IConnectionStateListener *m_connectionStateListener = nullptr;
 
-    Message *m_receivingMessage = nullptr;
-    std::deque<Message> m_sendQueue; // waiting to be sent
+    ReceiveBuffer *m_receiveBuffer = nullptr;
+    SendQueue m_sendQueue;
+    // for transport errors that happen inside send(), where we can't call back into client code yet
+    Timer m_deferredCloseTimer;
+    // while Connection::call() waits for the reply with this serial, other messages go to m_deferredMessages
+    uint32 m_blockingCallSerial = 0;
+    std::deque<Message> m_deferredMessages;
+    Timer m_deferredMessagesTimer; // delivers m_deferredMessages from the event loop
+    bool *m_deletedFlag = nullptr; // set by ~Connection() while delivering messages to the client
+    Connection::SendQueuePolicy m_sendQueuePolicy = Connection::SendQueuePolicy::Unlimited;
+    ISendQueueListener *m_sendQueueListener = nullptr;
+    bool m_reportedAboveHighWatermark = false;
+    // while sending a message from processEvent() for another thread; the Block policy must not block then
+    bool m_isSendingForOtherThread = false;
+    Timer m_sendQueueWatermarkTimer; // notifies m_sendQueueListener from the event loop
+    Timer m_connectRetryTimer; // see ITransport::isConnectRetryPending()
 
     // only one of them can be non-null. exception: in the main thread, m_mainThreadConnection
     // equals this, so that the main thread knows it's the main thread and not just a thread-local
@@ -150,23 +200,9 @@ public:
     AuthClient *m_authClient = nullptr;
 
     int m_defaultTimeout = 25000;
+    ReplyTimeouts m_replyTimeouts;
 
-    class PendingReplyRecord
-    {
-    public:
-        PendingReplyRecord(PendingReplyPrivate *pr) : isForSecondaryThread(false), ptr(pr) {}
-        PendingReplyRecord(ConnectionPrivate *tp) : isForSecondaryThread(true), ptr(tp) {}
-
-        PendingReplyPrivate *asPendingReply() const
-            { return isForSecondaryThread ? nullptr : static_cast<PendingReplyPrivate *>(ptr); }
-        ConnectionPrivate *asConnection() const
-            { return isForSecondaryThread ? static_cast<ConnectionPrivate *>(ptr) : nullptr; }
-
-    private:
-        bool isForSecondaryThread;
-        void *ptr;
-    };
-    std::unordered_map<uint32, PendingReplyRecord> m_pendingReplies; // replies we're waiting for
+    PendingReplyTable m_pendingReplies; // replies we're waiting for
 
     Spinlock m_lock; // only one lock because things done with lock held are quick, and anyway you shouldn't
                      // be using one connection from multiple threads if you need best performance
@@ -176,6 +212,9 @@ public:
     std::unordered_map<ConnectionPrivate *, CommutexPeer> m_secondaryThreadLinks;
     std::vector<CommutexPeer> m_unredeemedCommRefs; // for createCommRef() and the constructor from CommRef
 
+    // Only for secondary thread Connections. m_lock protects m_mainThreadConnection and m_mainThreadLink
+    // (which changes when locking it fails) because sendFromAnyThread() uses them from other threads.
+    bool m_isSecondaryThreadConnection = false; // doesn't change after construction, so needs no lock
     ConnectionPrivate *m_mainThreadConnection = nullptr;
     CommutexPeer m_mainThreadLink;
 };
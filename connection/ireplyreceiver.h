@@ -0,0 +1,44 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef IREPLYRECEIVER_H
+#define IREPLYRECEIVER_H
+
+#include "error.h"
+#include "types.h"
+
+class Message;
+
+// Receives replies to messages sent with Connection::sendFromAnyThread()
+class DFERRY_EXPORT IReplyReceiver
+{
+public:
+    virtual ~IReplyReceiver();
+    // Called in the thread of the EventDispatcher that was passed to sendFromAnyThread(), or else of the
+    // Connection's EventDispatcher - not necessarily in the thread that sent the message. serial is the
+    // serial of the sent message. reply is empty if no reply was received; note that an error reply from the peer
+    // is received, and also causes error.isError().
+    virtual void handleReply(uint32 serial, Message reply, Error error) = 0;
+};
+
+#endif // IREPLYRECEIVER_H
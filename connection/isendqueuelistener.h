@@ -0,0 +1,43 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef ISENDQUEUELISTENER_H
+#define ISENDQUEUELISTENER_H
+
+#include "connection.h"
+
+// Notified when the amount of data waiting to be sent by a Connection crosses one of its send queue
+// watermarks, see Connection::setSendQueueWatermarks(). Notifications come from the event loop, never
+// from inside a send method; a state that was left again before the notification is not reported.
+class DFERRY_EXPORT ISendQueueListener
+{
+public:
+    virtual ~ISendQueueListener();
+    // The send queue has grown above the high watermark. A good reaction is to stop producing messages
+    // until handleSendQueueBelowLowWatermark() is called.
+    virtual void handleSendQueueAboveHighWatermark(Connection *connection, size_t byteCount) = 0;
+    // After being above the high watermark, the send queue has shrunk to the low watermark or below.
+    virtual void handleSendQueueBelowLowWatermark(Connection *connection, size_t byteCount) = 0;
+};
+
+#endif // ISENDQUEUELISTENER_H
@@ -27,16 +27,64 @@
 #include "imessagereceiver.h"
 #include "connection.h"
 #include "connection_p.h"
+#include "malloccache.h"
 
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 
+enum {
+    // Enough for a lot of concurrent calls, and at most about 20 KiB per thread
+    DefaultPendingReplyPoolCapacity = 256
+};
+
+namespace {
+
+struct PendingReplyPool
+{
+    ~PendingReplyPool()
+    {
+        // PendingReplies may still be destroyed in this thread, e.g. in destructors of thread_local objects
+        isDestroyed = true;
+    }
+
+    // A PendingReplyPrivate may be freed into another thread's pool than the one it came from. That is
+    // fine because the pool's blocks are plain malloc() allocations.
+    MallocPool<sizeof(PendingReplyPrivate)> blocks { DefaultPendingReplyPoolCapacity };
+    bool isDestroyed = false;
+};
+
+thread_local PendingReplyPool t_pendingReplyPool;
+
+} // namespace
+
+void *PendingReplyPrivate::operator new(size_t size)
+{
+    assert(size == sizeof(PendingReplyPrivate));
+    (void) size;
+    PendingReplyPool &pool = t_pendingReplyPool;
+    if (pool.isDestroyed) {
+        return malloc(sizeof(PendingReplyPrivate));
+    }
+    return pool.blocks.allocate();
+}
+
+void PendingReplyPrivate::operator delete(void *allocation)
+{
+    PendingReplyPool &pool = t_pendingReplyPool;
+    if (pool.isDestroyed) {
+        free(allocation);
+        return;
+    }
+    pool.blocks.free(allocation);
+}
+
 PendingReply::PendingReply()
    : d(nullptr)
 {
 }
 
-PendingReply::~PendingReply()
+static void deletePrivate(PendingReplyPrivate *d)
 {
     if (!d) {
         return;
@@ -51,6 +99,11 @@ PendingReply::~PendingReply()
         }
     }
     delete d;
+}
+
+PendingReply::~PendingReply()
+{
+    deletePrivate(d);
     d = nullptr;
 }
 
@@ -74,7 +127,7 @@ PendingReply &PendingReply::operator=(PendingReply &&other)
     if (this == &other) {
         return *this;
     }
-    delete d;
+    deletePrivate(d);
     d = other.d;
     other.d = nullptr;
     // note that in this class, !d is a valid state; otherwise this check wouldn't be necessary because
@@ -89,11 +142,22 @@ void PendingReplyPrivate::handleReceived(Message *reply)
 {
     m_isFinished = true;
     // Connection has already unregistered us because it knows this reply is done
-    Connection *const connection = m_connectionOrReply.connection->m_connection;
+    ConnectionPrivate *const connectionPriv = m_connectionOrReply.connection;
+    connectionPriv->m_replyTimeouts.remove(this);
+    Connection *const connection = connectionPriv->m_connection;
     m_connectionOrReply.reply = reply;
-    m_replyTimeout.stop();
+    notifyFinished(connection);
+}
+
+void PendingReplyPrivate::notifyFinished(Connection *connection)
+{
     if (m_receiver) {
         m_receiver->handlePendingReplyFinished(m_owner, connection);
+    } else if (m_finishedCallback) {
+        // The callback may destroy the PendingReply, and us with it. Keep the callable alive until it
+        // returns.
+        PendingReply::FinishedCallback callback = std::move(m_finishedCallback);
+        callback(m_owner, connection);
     }
 }
 
@@ -148,6 +212,7 @@ void PendingReply::setReceiver(IMessageReceiver *receiver)
 {
     if (d) {
         d->m_receiver = receiver;
+        d->m_finishedCallback.reset();
     } else {
         // if !d, this is a detached (invalid) instance, and that can't be changed.
         std::cerr << "PendingReply::setReceiver() on a detached instance does nothing.\n";
@@ -159,6 +224,21 @@ IMessageReceiver *PendingReply::receiver() const
     return d ? d->m_receiver : nullptr;
 }
 
+void PendingReply::setFinishedCallback(FinishedCallback callback)
+{
+    if (d) {
+        d->m_finishedCallback = std::move(callback);
+        d->m_receiver = nullptr;
+    } else {
+        std::cerr << "PendingReply::setFinishedCallback() on a detached instance does nothing.\n";
+    }
+}
+
+bool PendingReply::hasFinishedCallback() const
+{
+    return d && d->m_finishedCallback;
+}
+
 const Message *PendingReply::reply() const
 {
     return d->m_isFinished ? d->m_connectionOrReply.reply : nullptr;
@@ -175,10 +255,24 @@ Message PendingReply::takeReply()
     return reply;
 }
 
-void PendingReplyPrivate::handleCompletion(void *task)
+//static
+void PendingReply::setPoolCapacity(size_t capacity)
+{
+    PendingReplyPool &pool = t_pendingReplyPool;
+    if (!pool.isDestroyed) {
+        pool.blocks.setCapacity(capacity);
+    }
+}
+
+//static
+size_t PendingReply::poolCapacity()
+{
+    const PendingReplyPool &pool = t_pendingReplyPool;
+    return pool.isDestroyed ? 0 : pool.blocks.capacity();
+}
+
+void PendingReplyPrivate::handleTimeout()
 {
-    assert(task == &m_replyTimeout);
-    (void) task;
     assert(!m_isFinished);
     // if a reply comes after the timout, it's too late and the reply is probably served as a spontaneous
     // message by Connection
@@ -197,9 +291,9 @@ void PendingReplyPrivate::handleError(Error error)
         m_error = error;
     }
     m_isFinished = true;
-    Connection *const connection = m_connectionOrReply.connection->m_connection;
+    ConnectionPrivate *const connectionPriv = m_connectionOrReply.connection;
+    connectionPriv->m_replyTimeouts.remove(this);
+    Connection *const connection = connectionPriv->m_connection;
     m_connectionOrReply.reply = nullptr;
-    if (m_receiver) {
-        m_receiver->handlePendingReplyFinished(m_owner, connection);
-    }
+    notifyFinished(connection);
 }
@@ -25,6 +25,7 @@
 #define PENDINGREPLY_H
 
 #include "error.h"
+#include "inlinecallback.h"
 
 #include <memory>
 
@@ -67,9 +68,21 @@ public:
     void setReceiver(IMessageReceiver *receiver);
     IMessageReceiver *receiver() const;
 
+    // An alternative to setReceiver() that takes any callable, e.g. a lambda with per-call context in
+    // its captures. Small callables are stored without allocating memory. Setting a receiver removes
+    // the callback and vice versa.
+    typedef InlineCallback<void(PendingReply *reply, Connection *connection)> FinishedCallback;
+    void setFinishedCallback(FinishedCallback callback);
+    bool hasFinishedCallback() const;
+
     const Message *reply() const;
     Message takeReply();
 
+    // The private data of PendingReplies is allocated from a per-thread pool that keeps up to this many
+    // unused allocations for reuse (256 by default). These apply to the pool of the calling thread.
+    static void setPoolCapacity(size_t capacity);
+    static size_t poolCapacity();
+
     void dumpState(); // H4X
 
 private:
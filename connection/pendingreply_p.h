@@ -25,33 +25,33 @@
 #define PENDINGREPLY_P_H
 
 #include "error.h"
-#include "icompletionlistener.h"
 #include "message.h"
-#include "timer.h"
+#include "pendingreply.h"
+#include "types.h"
 
+class IMessageReceiver;
 class PendingReply;
 class ConnectionPrivate;
+struct PendingReplyList;
 
-class PendingReplyPrivate : public ICompletionListener
+class PendingReplyPrivate
 {
 public:
-    PendingReplyPrivate(EventDispatcher *dispatcher, int timeout)
-       : m_replyTimeout(dispatcher),
-         m_isFinished(false),
+    PendingReplyPrivate()
+       : m_isFinished(false),
          m_reserved(0)
-    {
-        if (timeout >= 0) {
-            m_replyTimeout.setRepeating(false);
-            m_replyTimeout.setCompletionListener(this);
-            m_replyTimeout.start(timeout);
-        }
-    }
+    {}
+
+    // PendingReplyPrivates are allocated from a per-thread pool, there is one for every call
+    static void *operator new(size_t size);
+    static void operator delete(void *allocation);
 
     // for Connection
     void handleReceived(Message *reply);
+    void notifyFinished(Connection *connection);
     void handleError(Error error);
-    // for m_replyTimeout
-    void handleCompletion(void *task) override;
+    // for ReplyTimeouts, which is also used to report errors asynchronously, even without a reply timeout
+    void handleTimeout();
 
     PendingReply *m_owner = nullptr;
     union {
@@ -59,8 +59,13 @@ public:
         Message *reply;
     } m_connectionOrReply;
     void *m_cookie = nullptr;
-    Timer m_replyTimeout;
     IMessageReceiver *m_receiver = nullptr;
+    PendingReply::FinishedCallback m_finishedCallback; // used if there is no m_receiver
+    // for ReplyTimeouts
+    uint64 m_deadline = 0;
+    PendingReplyList *m_timeoutList = nullptr;
+    PendingReplyPrivate *m_prevByDeadline = nullptr;
+    PendingReplyPrivate *m_nextByDeadline = nullptr;
     Error m_error;
     uint32 m_serial = 0;
     bool m_isFinished : 1;
@@ -0,0 +1,117 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "pendingreplytable.h"
+
+#include <cassert>
+
+enum {
+    InitialSlotCount = 16 // must be a power of two
+};
+
+PendingReplyTable::PendingReplyTable()
+   : m_slots(InitialSlotCount)
+{
+}
+
+bool PendingReplyTable::insert(uint32 serial, PendingReplyRecord record)
+{
+    assert(serial != 0);
+    // keep the load factor at most 1/2 so that the probe sequences stay short
+    if ((m_count + 1) * 2 > m_slots.size()) {
+        grow();
+    }
+    const uint32 mask = uint32(m_slots.size()) - 1;
+    uint32 index = serial & mask;
+    while (m_slots[index].serial != 0) {
+        if (m_slots[index].serial == serial) {
+            return false;
+        }
+        index = (index + 1) & mask;
+    }
+    m_slots[index].serial = serial;
+    m_slots[index].record = record;
+    m_count++;
+    return true;
+}
+
+uint32 PendingReplyTable::indexOf(uint32 serial) const
+{
+    const uint32 mask = uint32(m_slots.size()) - 1;
+    for (uint32 index = serial & mask; m_slots[index].serial != 0; index = (index + 1) & mask) {
+        if (m_slots[index].serial == serial) {
+            return index;
+        }
+    }
+    return slotCount();
+}
+
+bool PendingReplyTable::take(uint32 serial, PendingReplyRecord *record)
+{
+    if (serial == 0) {
+        return false;
+    }
+    const uint32 index = indexOf(serial);
+    if (index == slotCount()) {
+        return false;
+    }
+    if (record) {
+        *record = m_slots[index].record;
+    }
+    removeAt(index);
+    return true;
+}
+
+void PendingReplyTable::removeAt(uint32 index)
+{
+    assert(m_slots[index].serial != 0);
+    // Backward shift deletion: move entries after the new hole back into it where that does not put
+    // them before their home slot, so that no tombstones are needed.
+    const uint32 mask = uint32(m_slots.size()) - 1;
+    uint32 hole = index;
+    for (uint32 i = (hole + 1) & mask; m_slots[i].serial != 0; i = (i + 1) & mask) {
+        const uint32 home = m_slots[i].serial & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            m_slots[hole] = m_slots[i];
+            hole = i;
+        }
+    }
+    m_slots[hole].serial = 0;
+    m_count--;
+}
+
+void PendingReplyTable::grow()
+{
+    std::vector<Slot> oldSlots(m_slots.size() * 2);
+    oldSlots.swap(m_slots);
+    const uint32 mask = uint32(m_slots.size()) - 1;
+    for (const Slot &slot : oldSlots) {
+        if (slot.serial != 0) {
+            uint32 index = slot.serial & mask;
+            while (m_slots[index].serial != 0) {
+                index = (index + 1) & mask;
+            }
+            m_slots[index] = slot;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef PENDINGREPLYTABLE_H
+#define PENDINGREPLYTABLE_H
+
+#include "types.h"
+
+#include <vector>
+
+class ConnectionPrivate;
+class PendingReplyPrivate;
+
+class PendingReplyRecord
+{
+public:
+    PendingReplyRecord() : isForSecondaryThread(false), ptr(nullptr) {}
+    PendingReplyRecord(PendingReplyPrivate *pr) : isForSecondaryThread(false), ptr(pr) {}
+    PendingReplyRecord(ConnectionPrivate *tp) : isForSecondaryThread(true), ptr(tp) {}
+
+    PendingReplyPrivate *asPendingReply() const
+        { return isForSecondaryThread ? nullptr : static_cast<PendingReplyPrivate *>(ptr); }
+    ConnectionPrivate *asConnection() const
+        { return isForSecondaryThread ? static_cast<ConnectionPrivate *>(ptr) : nullptr; }
+
+private:
+    bool isForSecondaryThread;
+    void *ptr;
+};
+
+// Maps the serials of outstanding calls to their PendingReplyRecords. It is an open addressing hash table
+// with linear probing and the serial (modulo the table size) as hash. Serials are assigned in increasing
+// order, so outstanding calls are mostly in a window of consecutive serials that map to consecutive slots
+// without collisions. Unlike std::unordered_map, inserting and removing does not allocate memory.
+// Serial 0 is never used for a message, so it marks empty slots.
+class PendingReplyTable
+{
+public:
+    PendingReplyTable();
+
+    bool isEmpty() const { return m_count == 0; }
+    uint32 size() const { return m_count; }
+
+    // Does nothing and returns false if serial is already in the table
+    bool insert(uint32 serial, PendingReplyRecord record);
+    // Removes the entry for serial and, if record is not null, stores it there. Returns false if serial
+    // is not in the table.
+    bool take(uint32 serial, PendingReplyRecord *record = nullptr);
+
+    // Access by slot index, for bulk removal. Removing the entry in a slot can move another entry into
+    // the same slot, and inserting can change the number of slots.
+    uint32 slotCount() const { return uint32(m_slots.size()); }
+    bool isOccupied(uint32 index) const { return m_slots[index].serial != 0; }
+    PendingReplyRecord recordAt(uint32 index) const { return m_slots[index].record; }
+    void removeAt(uint32 index);
+
+private:
+    struct Slot
+    {
+        uint32 serial = 0;
+        PendingReplyRecord record;
+    };
+
+    uint32 indexOf(uint32 serial) const; // returns slotCount() if not found
+    void grow();
+
+    std::vector<Slot> m_slots; // the size is always a power of two
+    uint32 m_count = 0;
+};
+
+#endif // PENDINGREPLYTABLE_H
@@ -0,0 +1,253 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "receivebuffer.h"
+
+#include "icompletionlistener.h"
+#include "itransport.h"
+#include "message.h"
+#include "message_p.h"
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+enum {
+    // Large enough to receive many typical messages with one read call, small enough to not waste
+    // much memory per connection
+    ReadAheadSize = 16384
+};
+
+ReceiveBuffer::ReceiveBuffer(ITransport *transport)
+{
+    transport->setReadListener(this);
+}
+
+ReceiveBuffer::~ReceiveBuffer()
+{
+    if (m_deletedFlag) {
+        *m_deletedFlag = true;
+    }
+    free(m_buffer.ptr);
+    free(m_largeMessage.ptr);
+#ifdef __unix__
+    // file descriptors that no message has claimed (yet)
+    for (const ReceivedFd &receivedFd : m_unixFds) {
+        ::close(receivedFd.fd);
+    }
+#endif
+}
+
+void ReceiveBuffer::setCompletionListener(ICompletionListener *listener)
+{
+    m_completionListener = listener;
+}
+
+void ReceiveBuffer::addReceivedData(chunk data)
+{
+    assert(!m_largeMessage.ptr && m_dataBegin == 0 && m_dataEnd == 0);
+    if (!m_buffer.ptr) {
+        m_buffer.ptr = static_cast<byte *>(malloc(ReadAheadSize));
+        m_buffer.length = ReadAheadSize;
+    }
+    assert(data.length <= m_buffer.length);
+    memcpy(m_buffer.ptr, data.ptr, data.length);
+    m_dataEnd = data.length;
+    m_streamPos += data.length;
+}
+
+IO::Result ReceiveBuffer::readFromTransport(byte *buffer, uint32 maxSize)
+{
+    std::vector<int> fds;
+    const IO::Result ret = readTransport()->readWithFileDescriptors(buffer, maxSize, &fds);
+    m_streamPos += ret.length;
+    m_lastReadHadFds = !fds.empty();
+    for (int fd : fds) {
+        m_unixFds.push_back(ReceivedFd{ fd, m_streamPos });
+    }
+    return ret;
+}
+
+IO::Status ReceiveBuffer::handleTransportCanRead()
+{
+    ITransport *const transport = readTransport();
+    if (!transport) {
+        return IO::Status::InternalError;
+    }
+    if (!m_buffer.ptr) {
+        m_buffer.ptr = static_cast<byte *>(malloc(ReadAheadSize));
+        m_buffer.length = ReadAheadSize;
+    }
+
+    // A message handler may call back into us (e.g. through Connection::call()), so keep the flag of
+    // any outer call and tell it about our deletion as well
+    bool isDeleted = false;
+    bool *const outerDeletedFlag = m_deletedFlag;
+    m_deletedFlag = &isDeleted;
+    const IO::Status ret = readAndDeliverMessages(transport);
+    if (isDeleted) {
+        if (outerDeletedFlag) {
+            *outerDeletedFlag = true;
+        }
+        // The caller was (indirectly) deleted, too, in all cases that we know about, and must check
+        // for that itself. Don't make it do anything else, like error handling.
+        return IO::Status::OK;
+    }
+    m_deletedFlag = outerDeletedFlag;
+    return ret;
+}
+
+IO::Status ReceiveBuffer::readAndDeliverMessages(ITransport *transport)
+{
+    const bool *const isDeleted = m_deletedFlag;
+    while (true) {
+        IO::Result ioRes;
+        bool mightHaveMore = false;
+        if (m_largeMessage.ptr) {
+            const uint32 readMax = m_largeMessage.length - m_largeMessagePos;
+            ioRes = readFromTransport(m_largeMessage.ptr + m_largeMessagePos, readMax);
+            m_largeMessagePos += ioRes.length;
+            mightHaveMore = ioRes.length == readMax;
+            if (m_largeMessagePos == m_largeMessage.length) {
+                const chunk messageData = m_largeMessage;
+                m_largeMessage = chunk();
+                m_largeMessagePos = 0;
+                if (!deliverMessage(messageData, m_streamPos - messageData.length)) {
+                    return IO::Status::RemoteClosed;
+                }
+                if (*isDeleted) {
+                    return IO::Status::OK;
+                }
+            }
+        } else {
+            // move the incomplete message at the end of the previous read, if any, to the front
+            if (m_dataBegin) {
+                memmove(m_buffer.ptr, m_buffer.ptr + m_dataBegin, m_dataEnd - m_dataBegin);
+                m_dataEnd -= m_dataBegin;
+                m_dataBegin = 0;
+            }
+            const uint32 readMax = m_buffer.length - m_dataEnd;
+            ioRes = readFromTransport(m_buffer.ptr + m_dataEnd, readMax);
+            m_dataEnd += ioRes.length;
+            mightHaveMore = ioRes.length == readMax;
+            // Deliver the messages that are complete even if the read failed, they were sent before
+            // the error occurred.
+            if (!processBufferedMessages()) {
+                return IO::Status::RemoteClosed;
+            }
+            if (*isDeleted) {
+                return IO::Status::OK;
+            }
+        }
+
+        if (ioRes.status != IO::Status::OK) {
+            return ioRes.status;
+        }
+        // A short read means that the socket buffer was empty when reading; readiness notification
+        // (level- or edge-triggered) will tell us when there is more. The exception is receiving file
+        // descriptors: reading stops after the data that they were sent with.
+        if ((!mightHaveMore && !m_lastReadHadFds) || !transport->isOpen()) {
+            break;
+        }
+    }
+    return IO::Status::OK;
+}
+
+bool ReceiveBuffer::processBufferedMessages()
+{
+    const bool *const isDeleted = m_deletedFlag;
+    while (m_dataEnd - m_dataBegin >= MessagePrivate::s_extendedFixedHeaderLength) {
+        const uint32 available = m_dataEnd - m_dataBegin;
+        const uint32 messageLength =
+            MessagePrivate::messageLengthFromFixedHeaders(m_buffer.ptr + m_dataBegin);
+        if (!messageLength) {
+            return false;
+        }
+        if (messageLength > available) {
+            if (messageLength > m_buffer.length) {
+                // It is never going to fit, so give it its own buffer and read the rest directly into that
+                m_largeMessage.ptr = static_cast<byte *>(malloc(messageLength));
+                m_largeMessage.length = messageLength;
+                memcpy(m_largeMessage.ptr, m_buffer.ptr + m_dataBegin, available);
+                m_largeMessagePos = available;
+                m_dataBegin = 0;
+                m_dataEnd = 0;
+            }
+            break;
+        }
+
+        // A Message owns its buffer and the read-ahead buffer is reused for the next read, so this copy
+        // is needed. It is cheap compared to the syscalls that the read-ahead buffer saves.
+        chunk messageData(static_cast<byte *>(malloc(messageLength)), messageLength);
+        memcpy(messageData.ptr, m_buffer.ptr + m_dataBegin, messageLength);
+        const uint64 streamOffset = m_streamPos - available;
+        m_dataBegin += messageLength;
+        if (!deliverMessage(messageData, streamOffset)) {
+            return false;
+        }
+        if (*isDeleted) {
+            return true;
+        }
+    }
+
+    if (m_dataBegin == m_dataEnd) {
+        m_dataBegin = 0;
+        m_dataEnd = 0;
+    }
+    return true;
+}
+
+bool ReceiveBuffer::deliverMessage(chunk messageData, uint64 streamOffset)
+{
+    Message message;
+    MessagePrivate *const mpriv = MessagePrivate::get(&message);
+    if (!mpriv->deserializeAndTake(messageData)) {
+        return false;
+    }
+
+    // File descriptors that arrived completely before this message belonged to a previous message
+    // that did not declare them; that is a protocol violation. Too few file descriptors is one, too.
+    if (!m_unixFds.empty() && m_unixFds.front().arrivalEnd <= streamOffset) {
+        return false;
+    }
+    const uint32 fdCount = message.unixFdCount();
+    if (m_unixFds.size() < fdCount) {
+        return false;
+    }
+    if (fdCount) {
+        std::vector<int> *const argUnixFds = mpriv->argUnixFds();
+        for (uint32 i = 0; i < fdCount; i++) {
+            argUnixFds->push_back(m_unixFds[i].fd);
+        }
+        m_unixFds.erase(m_unixFds.begin(), m_unixFds.begin() + fdCount);
+    }
+
+    if (m_completionListener) {
+        m_completionListener->handleCompletion(&message);
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef RECEIVEBUFFER_H
+#define RECEIVEBUFFER_H
+
+#include "itransportlistener.h"
+
+#include "types.h"
+
+#include <vector>
+
+class ICompletionListener;
+
+// Reads as much as is available from the transport into a per-connection buffer and splits complete
+// messages out of it. This costs about one read syscall per batch of small messages instead of at
+// least two read syscalls per message. Messages that are too large for the buffer get their own
+// buffer as soon as their length is known and are read directly into that, without copying.
+class ReceiveBuffer : public ITransportListener
+{
+public:
+    explicit ReceiveBuffer(ITransport *transport);
+    ~ReceiveBuffer() override;
+
+    ReceiveBuffer(const ReceiveBuffer &) = delete;
+    ReceiveBuffer &operator=(const ReceiveBuffer &) = delete;
+
+    // reimplemented from ITransportListener
+    IO::Status handleTransportCanRead() override;
+
+    // The completion listener is called with a Message * as task argument for each received message.
+    // It may move from the message. Errors are not reported through the completion listener, but
+    // through the return value of handleTransportCanRead().
+    void setCompletionListener(ICompletionListener *listener);
+    // For data of the message stream that a previous read listener has read; it must not contain file
+    // descriptors. It is processed together with newly read data in the next handleTransportCanRead().
+    void addReceivedData(chunk data);
+
+private:
+    IO::Status readAndDeliverMessages(ITransport *transport);
+    IO::Result readFromTransport(byte *buffer, uint32 maxSize);
+    bool processBufferedMessages();
+    bool deliverMessage(chunk messageData, uint64 streamOffset);
+
+    struct ReceivedFd
+    {
+        int fd;
+        // stream offset of the end of the data that arrived together with the file descriptor. According
+        // to the D-Bus spec, a message's file descriptors arrive with its first byte, so a message
+        // can only own file descriptors that arrived after the message's start offset.
+        uint64 arrivalEnd;
+    };
+
+    chunk m_buffer; // ptr is allocated lazily, length is the capacity
+    uint32 m_dataBegin = 0; // start of the first incomplete message in m_buffer
+    uint32 m_dataEnd = 0; // end of valid data in m_buffer
+
+    chunk m_largeMessage; // for messages that don't fit into m_buffer
+    uint32 m_largeMessagePos = 0;
+
+    uint64 m_streamPos = 0; // total number of bytes received
+    std::vector<ReceivedFd> m_unixFds;
+    bool m_lastReadHadFds = false;
+    ICompletionListener *m_completionListener = nullptr;
+    // The completion listener may delete us, e.g. when a message handler deletes the Connection.
+    // The destructor sets *m_deletedFlag so that message delivery stops without touching member data.
+    bool *m_deletedFlag = nullptr;
+};
+
+#endif // RECEIVEBUFFER_H
@@ -0,0 +1,191 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "replytimeouts.h"
+
+#include "connection_p.h"
+#include "eventdispatcher_p.h"
+#include "pendingreply_p.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+ReplyTimeouts::ReplyTimeouts(EventDispatcher *dispatcher)
+   : m_eventDispatcher(dispatcher),
+     m_timer(dispatcher)
+{
+    m_timer.setRepeating(false);
+    m_timer.setCompletionListener(this);
+}
+
+ReplyTimeouts::~ReplyTimeouts()
+{
+    for (const std::unique_ptr<Queue> &queue : m_queues) {
+        while (queue->first) {
+            remove(queue->first);
+        }
+    }
+    if (m_deletionGuard) {
+        *m_deletionGuard = false;
+    }
+}
+
+void ReplyTimeouts::append(PendingReplyList *list, PendingReplyPrivate *pr)
+{
+    assert(!pr->m_timeoutList);
+    pr->m_timeoutList = list;
+    pr->m_prevByDeadline = list->last;
+    pr->m_nextByDeadline = nullptr;
+    if (list->last) {
+        list->last->m_nextByDeadline = pr;
+    } else {
+        list->first = pr;
+    }
+    list->last = pr;
+}
+
+void ReplyTimeouts::add(PendingReplyPrivate *pr, int timeout)
+{
+    assert(timeout >= 0);
+    pr->m_deadline = EventDispatcherPrivate::get(m_eventDispatcher)->currentTime() + uint64(timeout);
+
+    Queue *queue = nullptr;
+    for (const std::unique_ptr<Queue> &q : m_queues) {
+        if (q->timeout == timeout) {
+            queue = q.get();
+            break;
+        }
+    }
+    if (!queue) {
+        m_queues.emplace_back(new Queue);
+        queue = m_queues.back().get();
+        queue->timeout = timeout;
+    }
+
+    const bool wasEmpty = !queue->first;
+    append(queue, pr);
+    // Appending to a non-empty queue never changes the earliest deadline
+    if (wasEmpty && (!m_timer.isRunning() || pr->m_deadline < m_timerDeadline)) {
+        startTimer(pr->m_deadline);
+    }
+}
+
+void ReplyTimeouts::remove(PendingReplyPrivate *pr)
+{
+    PendingReplyList *const list = pr->m_timeoutList;
+    if (!list) {
+        return;
+    }
+    if (pr->m_prevByDeadline) {
+        pr->m_prevByDeadline->m_nextByDeadline = pr->m_nextByDeadline;
+    } else {
+        list->first = pr->m_nextByDeadline;
+    }
+    if (pr->m_nextByDeadline) {
+        pr->m_nextByDeadline->m_prevByDeadline = pr->m_prevByDeadline;
+    } else {
+        list->last = pr->m_prevByDeadline;
+    }
+    pr->m_timeoutList = nullptr;
+    pr->m_prevByDeadline = nullptr;
+    pr->m_nextByDeadline = nullptr;
+    // If pr had the earliest deadline, the timer will fire too early once, which is cheaper than
+    // looking for the new earliest deadline every time.
+}
+
+PendingReplyPrivate *ReplyTimeouts::first() const
+{
+    for (const std::unique_ptr<Queue> &queue : m_queues) {
+        if (queue->first) {
+            return queue->first;
+        }
+    }
+    return nullptr;
+}
+
+void ReplyTimeouts::startTimer(uint64 deadline)
+{
+    const uint64 currentTime = EventDispatcherPrivate::get(m_eventDispatcher)->currentTime();
+    const uint64 interval = deadline > currentTime ? deadline - currentTime : 0;
+    m_timerDeadline = deadline;
+    m_timer.start(int(std::min(interval, uint64(std::numeric_limits<int>::max()))));
+}
+
+void ReplyTimeouts::restartTimer()
+{
+    uint64 earliestDeadline = ~uint64(0);
+    for (auto it = m_queues.begin(); it != m_queues.end(); ) {
+        if ((*it)->first) {
+            earliestDeadline = std::min(earliestDeadline, (*it)->first->m_deadline);
+            ++it;
+        } else {
+            it = m_queues.erase(it);
+        }
+    }
+    if (earliestDeadline != ~uint64(0)) {
+        startTimer(earliestDeadline);
+    } else {
+        m_timer.stop();
+    }
+}
+
+void ReplyTimeouts::handleCompletion(void *task)
+{
+    assert(task == &m_timer);
+    (void) task;
+    const uint64 currentTime = EventDispatcherPrivate::get(m_eventDispatcher)->currentTime();
+
+    // Take all expired PendingReplies first, so that PendingReplies added in the callbacks (especially
+    // with zero timeout) are not handled in this run. Merging the queues by deadline keeps the order
+    // in which they expired.
+    PendingReplyList expired;
+    while (true) {
+        Queue *earliest = nullptr;
+        for (const std::unique_ptr<Queue> &queue : m_queues) {
+            if (queue->first && queue->first->m_deadline <= currentTime &&
+                (!earliest || queue->first->m_deadline < earliest->first->m_deadline)) {
+                earliest = queue.get();
+            }
+        }
+        if (!earliest) {
+            break;
+        }
+        PendingReplyPrivate *const pr = earliest->first;
+        remove(pr);
+        append(&expired, pr);
+    }
+
+    // Callbacks may remove and delete any PendingReply, and even delete the Connection and us with it
+    bool alive = true;
+    m_deletionGuard = &alive;
+    while (PendingReplyPrivate *const pr = expired.first) {
+        remove(pr);
+        pr->handleTimeout();
+        if (!alive) {
+            return;
+        }
+    }
+    m_deletionGuard = nullptr;
+    restartTimer();
+}
@@ -0,0 +1,88 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef REPLYTIMEOUTS_H
+#define REPLYTIMEOUTS_H
+
+#include "icompletionlistener.h"
+#include "timer.h"
+#include "types.h"
+
+#include <memory>
+#include <vector>
+
+class EventDispatcher;
+class PendingReplyPrivate;
+
+// A doubly linked list of PendingReplyPrivates, linked through their m_prevByDeadline and m_nextByDeadline
+struct PendingReplyList
+{
+    PendingReplyPrivate *first = nullptr;
+    PendingReplyPrivate *last = nullptr;
+};
+
+// Tracks the reply timeouts of all PendingReplies of a Connection with a single Timer, instead of one
+// Timer per PendingReply. Almost all calls use the same timeout, so the PendingReplies are kept in one
+// FIFO queue per timeout value, which is ordered by deadline because time only goes forward. The timer
+// is set for the earliest deadline at the front of the queues.
+// Timing out a PendingReply invokes PendingReplyPrivate::handleTimeout().
+class ReplyTimeouts : public ICompletionListener
+{
+public:
+    explicit ReplyTimeouts(EventDispatcher *dispatcher);
+    ~ReplyTimeouts() override;
+
+    ReplyTimeouts(const ReplyTimeouts &) = delete;
+    ReplyTimeouts &operator=(const ReplyTimeouts &) = delete;
+
+    // timeout must be >= 0. A timeout of zero is used to report errors asynchronously, in the next
+    // iteration of the event loop.
+    void add(PendingReplyPrivate *pr, int timeout);
+    // Does nothing if pr has not been added or has already timed out
+    void remove(PendingReplyPrivate *pr);
+    // Any PendingReply that has been added and not removed, or null if there is none
+    PendingReplyPrivate *first() const;
+
+    // for m_timer
+    void handleCompletion(void *task) override;
+
+private:
+    struct Queue : public PendingReplyList
+    {
+        int timeout;
+    };
+
+    static void append(PendingReplyList *list, PendingReplyPrivate *pr);
+    void startTimer(uint64 deadline);
+    void restartTimer();
+
+    EventDispatcher *m_eventDispatcher;
+    // Few distinct timeouts are used, so a linear search is fine. The queues are allocated separately
+    // because PendingReplyPrivate::m_timeoutList points to them.
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    Timer m_timer;
+    uint64 m_timerDeadline = 0; // only valid while m_timer is running
+    bool *m_deletionGuard = nullptr;
+};
+
+#endif // REPLYTIMEOUTS_H
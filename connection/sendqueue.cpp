@@ -0,0 +1,263 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "sendqueue.h"
+
+#include "itransport.h"
+#include "message_p.h"
+
+#include <cassert>
+
+enum {
+    // Stop adding messages to a write once this many bytes are gathered. More would rarely fit into
+    // the socket buffer anyway.
+    MaxBytesPerWrite = 256 * 1024,
+    // That is what the transports can send in one call, and at most two chunks per message
+    MaxChunksPerWrite = 64
+};
+
+SendQueue::SendQueue()
+{
+}
+
+SendQueue::~SendQueue()
+{
+}
+
+static uint32 unsentLength(Message *msg)
+{
+    const MessagePrivate *const mpriv = MessagePrivate::get(msg);
+    return mpriv->m_headerLength + mpriv->m_bodyLength - mpriv->m_bufferPos;
+}
+
+void SendQueue::start(ITransport *transport)
+{
+    m_transport = transport;
+    updateWriteInterest();
+}
+
+void SendQueue::push(Message msg)
+{
+    MessagePrivate *const mpriv = MessagePrivate::get(&msg);
+    assert(mpriv->m_state == MessagePrivate::Serialized);
+    mpriv->m_bufferPos = 0;
+    addBytes(mpriv->m_headerLength + mpriv->m_bodyLength);
+    m_queue.push_back(std::move(msg));
+}
+
+IO::Status SendQueue::enqueue(Message msg)
+{
+    const bool wasEmpty = m_queue.empty();
+    push(std::move(msg));
+    return writeIfWasEmpty(wasEmpty);
+}
+
+IO::Status SendQueue::enqueue(std::vector<Message> msgs)
+{
+    const bool wasEmpty = m_queue.empty();
+    for (Message &msg : msgs) {
+        push(std::move(msg));
+    }
+    return writeIfWasEmpty(wasEmpty);
+}
+
+IO::Status SendQueue::writeIfWasEmpty(bool wasEmpty)
+{
+    // If the queue was not empty, the queued messages are waiting for the transport to become writable
+    if (wasEmpty && !m_queue.empty() && m_transport) {
+        // The socket of an idle connection is almost always writable, so don't wait for the event loop
+        // to tell us. Write interest is only registered if not everything could be written.
+        const IO::Status status = writeQueued(m_transport);
+        // A PayloadError is reported again from the write notification, which is where the caller
+        // expects it
+        return status == IO::Status::PayloadError ? IO::Status::OK : status;
+    }
+    return IO::Status::OK;
+}
+
+void SendQueue::moveLastToFront()
+{
+    assert(!m_transport);
+    if (m_queue.size() > 1) {
+        Message last = std::move(m_queue.back());
+        m_queue.pop_back();
+        m_queue.push_front(std::move(last));
+    }
+}
+
+void SendQueue::popFront()
+{
+    removeBytes(unsentLength(&m_queue.front()));
+    m_queue.pop_front();
+    updateWriteInterest();
+}
+
+void SendQueue::markFrontWritten(uint32 length)
+{
+    MessagePrivate *const mpriv = MessagePrivate::get(&m_queue.front());
+    assert(mpriv->m_bufferPos + length <= mpriv->m_headerLength + mpriv->m_bodyLength);
+    mpriv->m_bufferPos += length;
+    removeBytes(length);
+    if (mpriv->m_bufferPos == mpriv->m_headerLength + mpriv->m_bodyLength) {
+        popFront();
+    }
+}
+
+void SendQueue::clear()
+{
+    m_queue.clear();
+    removeBytes(m_byteCount);
+    updateWriteInterest();
+}
+
+void SendQueue::setWatermarks(size_t lowWatermark, size_t highWatermark)
+{
+    assert(lowWatermark <= highWatermark || !highWatermark);
+    m_lowWatermark = lowWatermark;
+    m_highWatermark = highWatermark;
+    // keep the hysteresis: leaving the above high watermark state still requires reaching the low watermark
+    m_isAboveHighWatermark = m_highWatermark &&
+                             m_byteCount > (m_isAboveHighWatermark ? m_lowWatermark : m_highWatermark);
+}
+
+void SendQueue::addBytes(size_t count)
+{
+    m_byteCount += count;
+    if (m_highWatermark && m_byteCount > m_highWatermark) {
+        m_isAboveHighWatermark = true;
+    }
+}
+
+void SendQueue::removeBytes(size_t count)
+{
+    assert(count <= m_byteCount);
+    m_byteCount -= count;
+    if (m_byteCount <= m_lowWatermark || !m_highWatermark) {
+        m_isAboveHighWatermark = false;
+    }
+}
+
+size_t SendQueue::dropOldestSignals(size_t byteCount)
+{
+    size_t freed = 0;
+    for (auto it = m_queue.begin(); it != m_queue.end() && freed < byteCount; ) {
+        MessagePrivate *const mpriv = MessagePrivate::get(&*it);
+        if (it->type() == Message::SignalMessage && mpriv->m_bufferPos == 0) {
+            const uint32 length = unsentLength(&*it);
+            freed += length;
+            removeBytes(length);
+            it = m_queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    updateWriteInterest();
+    return freed;
+}
+
+void SendQueue::updateWriteInterest()
+{
+    if (!m_queue.empty()) {
+        if (m_transport) {
+            m_transport->setWriteListener(this);
+        }
+    } else if (writeTransport()) {
+        writeTransport()->setWriteListener(nullptr);
+    }
+}
+
+IO::Status SendQueue::handleTransportCanWrite()
+{
+    ITransport *const transport = writeTransport();
+    if (!transport) {
+        return IO::Status::OK;
+    }
+    return writeQueued(transport);
+}
+
+IO::Status SendQueue::writeQueued(ITransport *transport)
+{
+    // Write until the transport would block or the queue is empty. Writing is then bounded by the socket
+    // buffer size, and edge-triggered readiness notification requires it.
+    while (!m_queue.empty()) {
+        // gather as many messages as allowed
+        chunk parts[MaxChunksPerWrite];
+        uint32 partCount = 0;
+        uint32 batchLength = 0;
+        const std::vector<int> *fileDescriptors = nullptr;
+        for (Message &msg : m_queue) {
+            if (partCount + 2 > MaxChunksPerWrite || batchLength >= MaxBytesPerWrite) {
+                break;
+            }
+            MessagePrivate *const mpriv = MessagePrivate::get(&msg);
+            const std::vector<int> &msgFds = mpriv->m_mainArguments.fileDescriptors();
+            if (!msgFds.empty() && mpriv->m_bufferPos == 0) {
+                if (partCount) {
+                    break; // the file descriptors must go with the first byte of their message
+                }
+                if (msgFds.size() > transport->supportedPassingUnixFdsCount()) {
+                    mpriv->m_error.setCode(Error::SendingTooManyUnixFds);
+                    updateWriteInterest();
+                    return IO::Status::PayloadError;
+                }
+                fileDescriptors = &msgFds;
+            }
+            mpriv->m_state = MessagePrivate::Sending;
+            const uint32 newParts = mpriv->unsentData(parts + partCount);
+            for (uint32 i = partCount; i < partCount + newParts; i++) {
+                batchLength += parts[i].length;
+            }
+            partCount += newParts;
+        }
+
+        const IO::Result ioRes = fileDescriptors
+                                    ? transport->writeWithFileDescriptors(parts, partCount, *fileDescriptors)
+                                    : transport->write(parts, partCount);
+        if (ioRes.status != IO::Status::OK) {
+            return IO::Status::RemoteClosed;
+        }
+
+        // remove the completely sent messages, remember the position in a partially sent one
+        uint32 written = ioRes.length;
+        while (written) {
+            MessagePrivate *const mpriv = MessagePrivate::get(&m_queue.front());
+            const uint32 unsent = mpriv->m_headerLength + mpriv->m_bodyLength - mpriv->m_bufferPos;
+            if (written < unsent) {
+                mpriv->m_bufferPos += written;
+                removeBytes(written);
+                break;
+            }
+            written -= unsent;
+            removeBytes(unsent);
+            mpriv->m_state = MessagePrivate::Serialized;
+            m_queue.pop_front();
+        }
+
+        if (ioRes.length < batchLength) {
+            break; // the transport would block
+        }
+    }
+
+    updateWriteInterest();
+    return IO::Status::OK;
+}
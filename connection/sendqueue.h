@@ -0,0 +1,102 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+#include "itransportlistener.h"
+
+#include "message.h"
+
+#include <deque>
+#include <vector>
+
+// Holds serialized messages waiting to be sent and writes as many of them as possible with one gather
+// write when the transport is writable. Compared to sending each message separately, that saves one
+// write syscall and two I/O interest changes per message when messages are sent in bursts.
+// A message carrying file descriptors always starts a new write so that the file descriptors are
+// attached to the first byte of the message.
+class SendQueue : public ITransportListener
+{
+public:
+    SendQueue();
+    ~SendQueue() override;
+
+    SendQueue(const SendQueue &) = delete;
+    SendQueue &operator=(const SendQueue &) = delete;
+
+    // reimplemented from ITransportListener
+    // Returns IO::Status::PayloadError if front() can't be sent for reasons that only affect that
+    // message. The message stays queued and its error() is set; the caller should remove it.
+    IO::Status handleTransportCanWrite() override;
+
+    // Messages are only written after start() has been called. Enqueued messages must be serialized.
+    void start(ITransport *transport);
+    // If the queue was empty, this tries to write msg right away. Returns an error if that failed
+    // because of a transport error; the transport is closed then. Sending a message does not cause
+    // any callbacks, so this can't either.
+    IO::Status enqueue(Message msg);
+    // Like enqueue(), but for several messages that are then written together as far as possible
+    IO::Status enqueue(std::vector<Message> msgs);
+    // Moves the most recently enqueued message to the front. Only allowed before start().
+    void moveLastToFront();
+
+    bool isStarted() const { return m_transport != nullptr; }
+    bool isEmpty() const { return m_queue.empty(); }
+    size_t size() const { return m_queue.size(); }
+    // the number of bytes that remain to be written
+    size_t byteCount() const { return m_byteCount; }
+
+    // The queue is above the high watermark from when byteCount() exceeds highWatermark until it drops
+    // to lowWatermark or below again. A highWatermark of zero means no limit.
+    void setWatermarks(size_t lowWatermark, size_t highWatermark);
+    size_t lowWatermark() const { return m_lowWatermark; }
+    size_t highWatermark() const { return m_highWatermark; }
+    bool isAboveHighWatermark() const { return m_isAboveHighWatermark; }
+    // Removes signals, oldest first, that have not been partially written yet until at least byteCount
+    // bytes have been freed or no such signals are left. Returns the number of bytes freed.
+    size_t dropOldestSignals(size_t byteCount);
+    Message &front() { return m_queue.front(); }
+    void popFront();
+    // Records that the first length bytes of front() have been written by other means, e.g. pipelined
+    // with the authentication handshake. Removes front() if it was written completely.
+    void markFrontWritten(uint32 length);
+    void clear();
+
+private:
+    void push(Message msg);
+    IO::Status writeIfWasEmpty(bool wasEmpty);
+    IO::Status writeQueued(ITransport *transport);
+    void updateWriteInterest();
+    void addBytes(size_t count);
+    void removeBytes(size_t count);
+
+    ITransport *m_transport = nullptr;
+    std::deque<Message> m_queue;
+    size_t m_byteCount = 0;
+    size_t m_lowWatermark = 0;
+    size_t m_highWatermark = 0;
+    bool m_isAboveHighWatermark = false;
+};
+
+#endif // SENDQUEUE_H
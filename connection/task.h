@@ -0,0 +1,238 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef TASK_H
+#define TASK_H
+
+// Optional coroutine support, available when compiling client code as C++20 or later. The library
+// itself does not need it.
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include "imessagereceiver.h"
+#include "pendingreply.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// co_await on a PendingReply suspends the coroutine until the PendingReply is finished. The coroutine is
+// resumed directly from the completion callback of the PendingReply, i.e. in the thread of the
+// EventDispatcher of the Connection that sent the message, without another event loop iteration.
+// While suspended, the awaiter is the receiver of the PendingReply; a previously set receiver is not
+// notified.
+class PendingReplyAwaiterBase : public IMessageReceiver
+{
+public:
+    PendingReplyAwaiterBase(const PendingReplyAwaiterBase &) = delete;
+    void operator=(const PendingReplyAwaiterBase &) = delete;
+
+    bool await_ready() const { return m_reply->isFinished(); }
+    void await_suspend(std::coroutine_handle<> continuation)
+    {
+        m_continuation = continuation;
+        m_reply->setReceiver(this);
+    }
+
+    void handlePendingReplyFinished(PendingReply *, Connection *) override
+    {
+        m_reply->setReceiver(nullptr);
+        m_continuation.resume(); // this may destroy the awaiter and the PendingReply
+    }
+
+protected:
+    PendingReplyAwaiterBase(PendingReply *reply) : m_reply(reply) {}
+    PendingReply *m_reply;
+    std::coroutine_handle<> m_continuation;
+};
+
+// co_await on a named PendingReply returns a reference to it
+class PendingReplyRefAwaiter : public PendingReplyAwaiterBase
+{
+public:
+    explicit PendingReplyRefAwaiter(PendingReply *reply) : PendingReplyAwaiterBase(reply) {}
+    PendingReply &await_resume() { return *m_reply; }
+};
+
+// co_await on a temporary PendingReply, e.g. co_await connection.send(...), returns it by value. The
+// PendingReply is kept in the awaiter, which lives in the coroutine frame, so there is no allocation.
+class PendingReplyValueAwaiter : public PendingReplyAwaiterBase
+{
+public:
+    explicit PendingReplyValueAwaiter(PendingReply &&reply)
+       : PendingReplyAwaiterBase(&m_ownReply),
+         m_ownReply(std::move(reply))
+    {}
+    PendingReply await_resume() { return std::move(m_ownReply); }
+
+private:
+    PendingReply m_ownReply;
+};
+
+inline PendingReplyRefAwaiter operator co_await(PendingReply &reply)
+{
+    return PendingReplyRefAwaiter(&reply);
+}
+
+inline PendingReplyValueAwaiter operator co_await(PendingReply &&reply)
+{
+    return PendingReplyValueAwaiter(std::move(reply));
+}
+
+template<typename T = void>
+class Task;
+
+class TaskPromiseBase
+{
+public:
+    // Start right away, in the calling thread. A Task that co_awaits PendingReplies continues in the
+    // thread of their Connection, which should therefore be the calling thread.
+    std::suspend_never initial_suspend() noexcept { return {}; }
+
+    class FinalAwaiter
+    {
+    public:
+        bool await_ready() noexcept { return false; }
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+        {
+            TaskPromiseBase &promise = finished.promise();
+            if (promise.m_continuation) {
+                return promise.m_continuation;
+            }
+            if (promise.m_isDetached) {
+                finished.destroy();
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    // Like the rest of the library, Tasks don't use exceptions
+    void unhandled_exception() { std::terminate(); }
+
+    std::coroutine_handle<> m_continuation; // the coroutine that co_awaits the Task, if any
+    bool m_isDetached = false; // the Task object was destroyed before the coroutine finished
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object();
+    void return_value(T value) { m_value.emplace(std::move(value)); }
+    T takeResult() { return std::move(*m_value); }
+
+private:
+    std::optional<T> m_value;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object();
+    void return_void() {}
+    void takeResult() {}
+};
+
+// The return type of a coroutine that co_awaits PendingReplies or other Tasks. It runs until the first
+// co_await right away. The Task object can be co_awaited to get the coroutine's result, or destroyed
+// to let the coroutine continue on its own; the coroutine frame is freed when it finishes.
+template<typename T>
+class Task
+{
+public:
+    using promise_type = TaskPromise<T>;
+
+    Task() = default;
+    Task(Task &&other) : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    Task &operator=(Task &&other)
+    {
+        if (this != &other) {
+            release();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() { release(); }
+
+    Task(const Task &) = delete;
+    void operator=(const Task &) = delete;
+
+    bool isNull() const { return !m_handle; }
+    bool isFinished() const { return !m_handle || m_handle.done(); }
+
+    class Awaiter
+    {
+    public:
+        explicit Awaiter(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+        bool await_ready() const { return m_handle.done(); }
+        void await_suspend(std::coroutine_handle<> continuation)
+        {
+            m_handle.promise().m_continuation = continuation;
+        }
+        T await_resume() { return m_handle.promise().takeResult(); }
+
+    private:
+        std::coroutine_handle<promise_type> m_handle;
+    };
+    // co_await on a Task returns the result of its coroutine. A Task can only be co_awaited once.
+    Awaiter operator co_await() { return Awaiter(m_handle); }
+
+private:
+    friend class TaskPromise<T>;
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    void release()
+    {
+        if (!m_handle) {
+            return;
+        }
+        if (m_handle.done()) {
+            m_handle.destroy();
+        } else {
+            m_handle.promise().m_isDetached = true;
+        }
+        m_handle = nullptr;
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif // TASK_H
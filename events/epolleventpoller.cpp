@@ -26,32 +26,35 @@
 #include "eventdispatcher_p.h"
 #include "iioeventlistener.h"
 
-#include <sys/epoll.h>
-#include <fcntl.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
-#include <cstdio>
+
+enum {
+    InitialEventsPerPoll = 32,
+    MaxEventsPerPoll = 4096
+};
 
 EpollEventPoller::EpollEventPoller(EventDispatcher *dispatcher)
    : IEventPoller(dispatcher),
-     m_epollFd(epoll_create(10))
+     m_epollFd(epoll_create1(EPOLL_CLOEXEC)),
+     m_interruptEventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+     m_pendingInterrupt(IEventPoller::NoInterrupt),
+     m_events(InitialEventsPerPoll)
 {
-    // set up a pipe that can interrupt the polling from another thread
-    // (we could also use the Linux-only eventfd() - pipes are at least portable to epoll-like mechanisms)
-    pipe2(m_interruptPipe, O_NONBLOCK);
-
+    // the eventfd can interrupt the polling from another thread
     struct epoll_event epevt;
     epevt.events = EPOLLIN;
     epevt.data.u64 = 0; // clear high bits in the union
-    epevt.data.fd = m_interruptPipe[0];
-    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_interruptPipe[0], &epevt);
+    epevt.data.ptr = this; // no IIoEventListener is ever at this address
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_interruptEventFd, &epevt);
 }
 
 EpollEventPoller::~EpollEventPoller()
 {
-    close(m_interruptPipe[0]);
-    close(m_interruptPipe[1]);
+    close(m_interruptEventFd);
     close(m_epollFd);
 }
 
@@ -59,51 +62,69 @@ IEventPoller::InterruptAction EpollEventPoller::poll(int timeout)
 {
     IEventPoller::InterruptAction ret = IEventPoller::NoInterrupt;
 
-    static const int maxEvPerPoll = 8;
-    struct epoll_event results[maxEvPerPoll];
-    int nresults = epoll_wait(m_epollFd, results, maxEvPerPoll, timeout);
+    const int nresults = epoll_wait(m_epollFd, m_events.data(), int(m_events.size()), timeout);
     if (nresults < 0) {
         // error?
         return ret;
     }
 
-    for (int i = 0; i < nresults; i++) {
-        struct epoll_event *evt = results + i;
+    EventDispatcherPrivate *const dispatcherPriv = EventDispatcherPrivate::get(m_dispatcher);
+    m_dispatchEnd = nresults;
+    for (m_dispatchPos = 0; m_dispatchPos < m_dispatchEnd; m_dispatchPos++) {
+        struct epoll_event *evt = &m_events[m_dispatchPos];
+        if (evt->data.ptr == this) {
+            ret = std::max(ret, takeInterrupt());
+            continue;
+        }
         // Check the same notification conditions as select: a client can call read() or write() without
         // blocking if the socket was closed in some way.
-        if (evt->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
-            if (evt->data.fd != m_interruptPipe[0]) {
-                EventDispatcherPrivate::get(m_dispatcher)->notifyListenerForIo(evt->data.fd, IO::RW::Read);
-            } else {
-                // interrupt; read bytes from pipe to clear buffers and get the interrupt type
-                ret = IEventPoller::ProcessAuxEvents;
-                char buf;
-                while (read(m_interruptPipe[0], &buf, 1) > 0) {
-                    if (buf == 'S') {
-                        ret = IEventPoller::Stop;
-                    }
-                }
-                // ### discarding the rest of the events
-                // this works in our currently only use case, interrupting poll once to reap a thread
-                if (ret == IEventPoller::Stop) {
-                    return ret;
-                }
-            }
+        // A listener that is removed during dispatch gets its remaining events nulled out, including
+        // this one, so check again after each notification.
+        if ((evt->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && evt->data.ptr) {
+            dispatcherPriv->notifyListenerForIo(static_cast<IIoEventListener *>(evt->data.ptr),
+                                                IO::RW::Read);
         }
-        if (evt->events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
-            EventDispatcherPrivate::get(m_dispatcher)->notifyListenerForIo(evt->data.fd, IO::RW::Write);
+        if ((evt->events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && evt->data.ptr) {
+            dispatcherPriv->notifyListenerForIo(static_cast<IIoEventListener *>(evt->data.ptr),
+                                                IO::RW::Write);
         }
     }
+    m_dispatchPos = 0;
+    m_dispatchEnd = 0;
+
+    if (nresults == int(m_events.size()) && m_events.size() < MaxEventsPerPoll) {
+        // there were probably more events ready, fetch more of them at once next time
+        m_events.resize(m_events.size() * 2);
+    }
     return ret;
 }
 
+IEventPoller::InterruptAction EpollEventPoller::takeInterrupt()
+{
+    // Reset the eventfd *before* taking the pending action: an interrupt() that comes in after that
+    // will find NoInterrupt pending, and write to the eventfd again.
+    uint64_t counter;
+    while (read(m_interruptEventFd, &counter, sizeof(counter)) > 0) {
+    }
+    return IEventPoller::InterruptAction(m_pendingInterrupt.exchange(IEventPoller::NoInterrupt));
+}
+
 void EpollEventPoller::interrupt(IEventPoller::InterruptAction action)
 {
     assert(action == IEventPoller::ProcessAuxEvents || action == IEventPoller::Stop);
 
-    // write a byte to the write end so the poll waiting on the read end returns
-    char buf = (action == IEventPoller::Stop) ? 'S' : 'N';
-    write(m_interruptPipe[1], &buf, 1);
+    int pending = m_pendingInterrupt.load();
+    do {
+        if (pending >= action) {
+            // a wakeup for this (or something stronger) is already under way
+            return;
+        }
+    } while (!m_pendingInterrupt.compare_exchange_weak(pending, action));
+
+    if (pending == IEventPoller::NoInterrupt) {
+        const uint64_t one = 1;
+        write(m_interruptEventFd, &one, sizeof(one));
+    }
 }
 
 static uint32_t epeventsFromIoRw(uint32 ioRw)
@@ -114,10 +135,31 @@ static uint32_t epeventsFromIoRw(uint32 ioRw)
 
 void EpollEventPoller::addFileDescriptor(FileDescriptor fd, uint32 ioRw)
 {
+    // The listener has already been inserted when we are called. Keep a pointer to it in the epoll
+    // data so that dispatching an event doesn't need a lookup.
+    const EventDispatcherPrivate *const dispatcherPriv = EventDispatcherPrivate::get(m_dispatcher);
+    auto it = dispatcherPriv->m_ioListeners.find(fd);
+    assert(it != dispatcherPriv->m_ioListeners.end());
+
+    FdState state;
+    state.listener = it->second;
+    state.ioRw = ioRw;
+    state.edgeTriggered = false;
+#ifdef DFERRY_EPOLL_EDGE_TRIGGERED
+    // Edge-triggered notification is only safe for listeners that read / write until EAGAIN.
+    state.edgeTriggered = state.listener->drainsIoOnReady();
+#endif
+    m_fdStates[fd] = state;
+    if (!state.edgeTriggered && !ioRw) {
+        return; // see setReadWriteInterest()
+    }
+
     struct epoll_event epevt;
-    epevt.events = epeventsFromIoRw(ioRw);
+    // With EPOLLET, always register for both directions. EventDispatcher filters out notifications for
+    // directions without interest, so changing interest mostly doesn't need a syscall.
+    epevt.events = state.edgeTriggered ? uint32(EPOLLIN | EPOLLOUT | EPOLLET) : epeventsFromIoRw(ioRw);
     epevt.data.u64 = 0; // clear high bits in the union
-    epevt.data.fd = fd;
+    epevt.data.ptr = state.listener;
     epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &epevt);
 }
 
@@ -125,6 +167,16 @@ void EpollEventPoller::removeFileDescriptor(FileDescriptor fd)
 {
     // Connection should call us *before* resetting its fd on failure
     assert(fd >= 0);
+    auto it = m_fdStates.find(fd);
+    if (it != m_fdStates.end()) {
+        // Events that were already fetched must not reach the listener, which may be deleted soon
+        for (int i = m_dispatchPos; i < m_dispatchEnd; i++) {
+            if (m_events[i].data.ptr == it->second.listener) {
+                m_events[i].data.ptr = nullptr;
+            }
+        }
+        m_fdStates.erase(it);
+    }
     struct epoll_event epevt; // required in Linux < 2.6.9 even though it's ignored
     epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, &epevt);
 }
@@ -134,9 +186,39 @@ void EpollEventPoller::setReadWriteInterest(FileDescriptor fd, uint32 ioRw)
     if (!fd) {
         return;
     }
+    auto it = m_fdStates.find(fd);
+    if (it == m_fdStates.end()) {
+        return;
+    }
+    FdState &state = it->second;
+    const uint32 addedIoRw = ioRw & ~state.ioRw;
+    if (ioRw == state.ioRw || (state.edgeTriggered && !addedIoRw)) {
+        state.ioRw = ioRw;
+        return;
+    }
+    const uint32 previousIoRw = state.ioRw;
+    state.ioRw = ioRw;
+
+    int op = EPOLL_CTL_MOD;
+    if (!state.edgeTriggered) {
+        // Level-triggered epoll reports errors and hangup regardless of the requested events, so a closed
+        // socket without interest would wake up every poll() with nothing to do. Only keep the fd in the
+        // epoll set while there is interest.
+        if (!ioRw) {
+            struct epoll_event epevt; // required in Linux < 2.6.9 even though it's ignored
+            epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, &epevt);
+            return;
+        }
+        if (!previousIoRw) {
+            op = EPOLL_CTL_ADD;
+        }
+    }
+
     struct epoll_event epevt;
-    epevt.events = epeventsFromIoRw(ioRw);
+    // In edge-triggered mode, this is a re-arm: an edge may have gone by while there was no interest in
+    // its direction, and EPOLL_CTL_MOD reports the current readiness again.
+    epevt.events = state.edgeTriggered ? uint32(EPOLLIN | EPOLLOUT | EPOLLET) : epeventsFromIoRw(ioRw);
     epevt.data.u64 = 0; // clear high bits in the union
-    epevt.data.fd = fd;
-    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &epevt);
+    epevt.data.ptr = state.listener;
+    epoll_ctl(m_epollFd, op, fd, &epevt);
 }
@@ -26,7 +26,13 @@
 
 #include "ieventpoller.h"
 
-#include <map>
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+class IIoEventListener;
 
 class EpollEventPoller : public IEventPoller
 {
@@ -42,10 +48,29 @@ public:
     void setReadWriteInterest(FileDescriptor fd, uint32 ioRw) override;
 
 private:
-    void notifyRead(int fd);
+    IEventPoller::InterruptAction takeInterrupt();
+
+    struct FdState
+    {
+        IIoEventListener *listener;
+        uint32 ioRw;
+        bool edgeTriggered;
+    };
 
-    int m_interruptPipe[2];
     FileDescriptor m_epollFd;
+    FileDescriptor m_interruptEventFd;
+    // the strongest InterruptAction requested since the last wakeup; the eventfd is only written when
+    // this changes from NoInterrupt, so that many interrupt() calls cause only one wakeup.
+    std::atomic<int> m_pendingInterrupt;
+    // The interest last passed to epoll_ctl(), to avoid redundant syscalls
+    std::unordered_map<FileDescriptor, FdState> m_fdStates;
+
+    // results of epoll_wait(); grows when it was filled completely
+    std::vector<epoll_event> m_events;
+    // the events of the current poll() that haven't been dispatched yet, to invalidate the ones
+    // of removed listeners
+    int m_dispatchPos = 0;
+    int m_dispatchEnd = 0;
 };
 
 #endif // EPOLLEVENTPOLLER_H
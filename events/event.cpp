@@ -1,5 +1,185 @@
 #include "event.h"
 
+#include "eventdispatcher_p.h"
+#include "ireplyreceiver.h"
+
+#include <atomic>
+#include <cstdlib>
+
+namespace {
+
+constexpr size_t maxOf(size_t a)
+{
+    return a;
+}
+
+template<typename... Ts>
+constexpr size_t maxOf(size_t a, Ts... rest)
+{
+    return a > maxOf(rest...) ? a : maxOf(rest...);
+}
+
+constexpr size_t PooledBlockSize = maxOf(sizeof(SendMessageEvent), sizeof(SendMessageWithPendingReplyEvent),
+                                         sizeof(SpontaneousMessageReceivedEvent),
+                                         sizeof(PendingReplySuccessEvent), sizeof(PendingReplyFailureEvent),
+                                         sizeof(PendingReplyCancelEvent), sizeof(MainConnectionDisconnectEvent),
+                                         sizeof(SecondaryConnectionConnectEvent),
+                                         sizeof(SecondaryConnectionDisconnectEvent),
+                                         sizeof(UniqueNameReceivedEvent),
+                                         sizeof(SendMessageFromAnyThreadEvent),
+                                         sizeof(AnyThreadReplyEvent));
+
+struct FreeBlock
+{
+    FreeBlock *next;
+};
+
+// Each thread caches up to ThreadCacheCapacity freed blocks without any synchronization, like
+// MallocCache. Events are typically freed in a different thread than the one that allocated them, so
+// a thread with a full cache hands a batch of blocks to a global stack, from where a thread that runs
+// out of blocks takes all of them at once - taking single blocks would be prone to the ABA problem.
+// The global stack is capped, too; blocks beyond that go back to malloc.
+constexpr int ThreadCacheCapacity = 128;
+constexpr int ReturnBatchSize = ThreadCacheCapacity / 2;
+constexpr int ReturnedBlocksCapacity = 4 * ThreadCacheCapacity;
+
+std::atomic<FreeBlock *> s_returnedBlocks { nullptr };
+// Approximate, and briefly too low (possibly negative) while a batch is being pushed
+std::atomic<int> s_returnedBlockCount { 0 };
+
+void freeBlockList(FreeBlock *block)
+{
+    while (block) {
+        FreeBlock *const next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+struct ThreadBlockCache
+{
+    ~ThreadBlockCache()
+    {
+        freeBlockList(blocks);
+        blocks = nullptr;
+        // Events may still be created or deleted in this thread, e.g. in destructors of static objects
+        isDestroyed = true;
+    }
+
+    void takeReturnedBlocks()
+    {
+        blocks = s_returnedBlocks.exchange(nullptr, std::memory_order_acquire);
+        count = 0;
+        for (FreeBlock *block = blocks; block; block = block->next) {
+            count++;
+        }
+        s_returnedBlockCount.fetch_sub(count, std::memory_order_relaxed);
+    }
+
+    void returnBatch()
+    {
+        FreeBlock *const first = blocks;
+        FreeBlock *last = first;
+        for (int i = 1; i < ReturnBatchSize; i++) {
+            last = last->next;
+        }
+        blocks = last->next;
+        count -= ReturnBatchSize;
+        last->next = nullptr;
+
+        if (s_returnedBlockCount.load(std::memory_order_relaxed) >= ReturnedBlocksCapacity) {
+            freeBlockList(first);
+            return;
+        }
+        last->next = s_returnedBlocks.load(std::memory_order_relaxed);
+        while (!s_returnedBlocks.compare_exchange_weak(last->next, first, std::memory_order_release,
+                                                      std::memory_order_relaxed)) {
+        }
+        s_returnedBlockCount.fetch_add(ReturnBatchSize, std::memory_order_relaxed);
+    }
+
+    FreeBlock *blocks = nullptr;
+    int count = 0;
+    bool isDestroyed = false;
+};
+
+thread_local ThreadBlockCache t_blockCache;
+
+// frees the returned blocks that are left at exit
+struct ReturnedBlocksCleanup
+{
+    ~ReturnedBlocksCleanup()
+    {
+        freeBlockList(s_returnedBlocks.exchange(nullptr));
+    }
+} s_returnedBlocksCleanup;
+
+} // namespace
+
 Event::~Event()
 {
 }
+
+SendMessageFromAnyThreadEvent::~SendMessageFromAnyThreadEvent()
+{
+    if (replyReceiver) {
+        deliverAnyThreadReply(replyReceiver, replyDispatcher, message.serial(), Message(),
+                              Error::LocalDisconnect);
+    }
+}
+
+void deliverAnyThreadReply(IReplyReceiver *replyReceiver, EventDispatcher *replyDispatcher, uint32 serial,
+                           Message reply, Error error)
+{
+    if (!replyDispatcher) {
+        replyReceiver->handleReply(serial, std::move(reply), error);
+        return;
+    }
+    std::unique_ptr<AnyThreadReplyEvent> evt(new AnyThreadReplyEvent);
+    evt->replyReceiver = replyReceiver;
+    evt->serial = serial;
+    evt->reply = std::move(reply);
+    evt->error = error;
+    EventDispatcherPrivate::get(replyDispatcher)->queueEvent(std::move(evt));
+}
+
+void *Event::operator new(size_t size)
+{
+    if (size > PooledBlockSize) {
+        return malloc(size);
+    }
+    ThreadBlockCache &cache = t_blockCache;
+    if (cache.isDestroyed) {
+        return malloc(PooledBlockSize);
+    }
+    if (!cache.blocks) {
+        cache.takeReturnedBlocks();
+        if (!cache.blocks) {
+            return malloc(PooledBlockSize);
+        }
+    }
+    FreeBlock *const block = cache.blocks;
+    cache.blocks = block->next;
+    cache.count--;
+    return block;
+}
+
+void Event::operator delete(void *ptr, size_t size)
+{
+    if (size > PooledBlockSize) {
+        free(ptr);
+        return;
+    }
+    ThreadBlockCache &cache = t_blockCache;
+    if (cache.isDestroyed) {
+        free(ptr);
+        return;
+    }
+    if (cache.count >= ThreadCacheCapacity) {
+        cache.returnBatch();
+    }
+    FreeBlock *const block = static_cast<FreeBlock *>(ptr);
+    block->next = cache.blocks;
+    cache.blocks = block;
+    cache.count++;
+}
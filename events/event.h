@@ -7,9 +7,11 @@
 
 class Commutex;
 class ConnectionPrivate;
+class EventDispatcher;
+class IReplyReceiver;
 
-// these are exclusively sent from and to Connection instances so far, nevertheless it seems logical
-// to dispatch events in EventDispatcher, what with the name...
+// these are mostly sent from and to Connection instances, nevertheless it seems logical to dispatch events
+// in EventDispatcher, what with the name... AnyThreadReply is handled by EventDispatcher itself.
 struct Event
 {
     enum Type : uint32 {
@@ -22,13 +24,21 @@ struct Event
         MainConnectionDisconnect,
         SecondaryConnectionConnect,
         SecondaryConnectionDisconnect,
-        UniqueNameReceived
+        UniqueNameReceived,
+        SendMessageFromAnyThread, // 10
+        AnyThreadReply
     };
 
     Event(Type t) : type(t) {}
     virtual ~Event() = 0;
 
+    // Events are allocated from a pool because they are created and destroyed at a high rate, often in
+    // different threads
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+
     Type type;
+    Event *next = nullptr; // for the event queue in EventDispatcherPrivate
 };
 
 struct SendMessageEvent : public Event
@@ -94,4 +104,31 @@ struct UniqueNameReceivedEvent : public Event
     std::string uniqueName;
 };
 
+struct SendMessageFromAnyThreadEvent : public Event
+{
+    SendMessageFromAnyThreadEvent() : Event(Event::SendMessageFromAnyThread) {}
+    // If replyReceiver is still set, the event wasn't processed because the Connection is gone, and
+    // replyReceiver is notified about that
+    ~SendMessageFromAnyThreadEvent() override;
+    Message message;
+    IReplyReceiver *replyReceiver = nullptr; // null if no reply is expected
+    EventDispatcher *replyDispatcher = nullptr; // if null, replyReceiver is called in the sending thread
+    int timeoutMsecs = 0;
+};
+
+// Delivers the result of a message sent with Connection::sendFromAnyThread() in the thread of a
+// different EventDispatcher than the Connection's
+struct AnyThreadReplyEvent : public Event
+{
+    AnyThreadReplyEvent() : Event(Event::AnyThreadReply) {}
+    IReplyReceiver *replyReceiver;
+    uint32 serial;
+    Message reply;
+    Error error;
+};
+
+// Calls replyReceiver right away if replyDispatcher is null, else from replyDispatcher's event loop
+void deliverAnyThreadReply(IReplyReceiver *replyReceiver, EventDispatcher *replyDispatcher, uint32 serial,
+                           Message reply, Error error);
+
 #endif // EVENT_H
@@ -27,6 +27,9 @@
 #ifndef DFERRY_NO_NATIVE_POLL
 #ifdef __linux__
 #include "epolleventpoller.h"
+#ifdef HAVE_IO_URING
+#include "iouringeventpoller.h"
+#endif
 #elif defined _WIN32
 #include "selecteventpoller_win32.h"
 #else
@@ -38,12 +41,14 @@
 #include "foreigneventloopintegrator.h"
 #include "ieventpoller.h"
 #include "iioeventlistener.h"
+#include "ireplyreceiver.h"
 #include "platformtime.h"
 #include "connection_p.h"
 #include "timer.h"
 
 #include <algorithm>
 #include <cassert>
+#include <limits>
 
 #include <iostream>
 
@@ -51,11 +56,26 @@
 
 #ifndef DFERRY_NO_NATIVE_POLL
 EventDispatcher::EventDispatcher()
+   : EventDispatcher(Backend::Default)
+{
+}
+
+EventDispatcher::EventDispatcher(Backend backend)
    : d(new EventDispatcherPrivate)
 {
 #ifdef __linux__
-    d->m_poller = new EpollEventPoller(this);
+#ifdef HAVE_IO_URING
+    if (backend == Backend::IoUring) {
+        d->m_poller = IoUringEventPoller::create(this);
+    }
+#else
+    (void)backend;
+#endif
+    if (!d->m_poller) {
+        d->m_poller = new EpollEventPoller(this);
+    }
 #else
+    (void)backend;
     // TODO high performance IO multiplexers for non-Linux platforms
     d->m_poller = new SelectEventPoller(this);
 #endif
@@ -85,9 +105,16 @@ EventDispatcherPrivate::~EventDispatcherPrivate()
         }
     }
 
-    for (auto it = m_timers.cbegin(); it != m_timers.cend(); ++it) {
-        it->second->m_eventDispatcher = nullptr;
-        it->second->m_isRunning = false;
+    m_timerWheel.forEachTimer([this] (Timer *timer) {
+        m_timerWheel.remove(timer);
+        timer->m_eventDispatcher = nullptr;
+        timer->m_isRunning = false;
+    });
+
+    // Events that were never processed. There is no Connection to notify anymore, so replies for
+    // sendFromAnyThread() are delivered and the rest is deleted. Deleting events may queue more replies.
+    while (m_queuedEvents.load(std::memory_order_acquire)) {
+        processAuxEvents();
     }
 
     if (!m_integrator) {
@@ -113,15 +140,27 @@ bool EventDispatcher::poll(int timeout)
 #ifdef EVENTDISPATCHER_DEBUG
     printf("EventDispatcher::poll(): timeout=%d, nextDue=%d.\n", timeout, nextDue);
 #endif
+    // Nothing reads the time before waiting, so from the first read after waiting, the cached time
+    // is good enough for the rest of this iteration
+    d->m_isTimeCached = true;
+    d->m_cachedTime = 0;
     IEventPoller::InterruptAction interrupAction = d->m_poller->poll(timeout);
 
-    if (interrupAction == IEventPoller::Stop) {
-        return false;
-    } else if (interrupAction == IEventPoller::ProcessAuxEvents && d->m_connectionToNotify) {
+    // Don't rely on interrupAction to find out about queued events: pollers merge a pending
+    // ProcessAuxEvents into Stop, and queueEvent() only wakes us when the queue was empty, so a queue
+    // that is left non-empty here would never cause another wakeup.
+    if (d->m_queuedEvents.load(std::memory_order_relaxed)) {
         d->processAuxEvents();
     }
-    d->triggerDueTimers();
-    return true;
+
+    bool ret = true;
+    if (interrupAction == IEventPoller::Stop) {
+        ret = false;
+    } else {
+        d->triggerDueTimers();
+    }
+    d->m_isTimeCached = false;
+    return ret;
 }
 
 void EventDispatcher::interrupt()
@@ -155,11 +194,16 @@ void EventDispatcherPrivate::updateIoInterestInternal(IIoEventListener *iol, uin
     m_poller->setReadWriteInterest(iol->fileDescriptor(), ioRw);
 }
 
+IIoCompletionSource *EventDispatcherPrivate::ioCompletionSource()
+{
+    return m_poller ? m_poller->ioCompletionSource() : nullptr;
+}
+
 void EventDispatcherPrivate::notifyListenerForIo(FileDescriptor fd, IO::RW ioRw)
 {
     std::unordered_map<FileDescriptor, IIoEventListener *>::iterator it = m_ioListeners.find(fd);
     if (it != m_ioListeners.end()) {
-        it->second->handleIoReady(ioRw);
+        notifyListenerForIo(it->second, ioRw);
     } else {
 #ifdef IEVENTDISPATCHER_DEBUG
         // while interesting for debugging, this is not an error if a connection was in the epoll
@@ -170,146 +214,56 @@ void EventDispatcherPrivate::notifyListenerForIo(FileDescriptor fd, IO::RW ioRw)
     }
 }
 
-int EventDispatcherPrivate::timeToFirstDueTimer() const
+void EventDispatcherPrivate::notifyListenerForIo(IIoEventListener *iol, IO::RW ioRw)
 {
-    std::multimap<uint64, Timer*>::const_iterator it = m_timers.cbegin();
-    if (it != m_timers.cend() && it->second == nullptr) {
-        // this is the dead entry of the currently triggered, currently being deleted Timer
-        ++it;
+    // Pollers may report events that the listener isn't interested in, e.g. hangup or edge-triggered
+    // events that the kernel reports regardless of current interest
+    if (iol->ioInterest() & uint32(ioRw)) {
+        iol->handleIoReady(ioRw);
     }
+}
 
-    if (it == m_timers.cend()) {
+int EventDispatcherPrivate::timeToFirstDueTimer() const
+{
+    const uint64 nextWakeupTime = m_timerWheel.nextWakeupTime();
+    if (nextWakeupTime == ~uint64(0)) {
         return -1;
     }
-
-    uint64 nextTimeout = it->first >> 10;
-    uint64 currentTime = PlatformTime::monotonicMsecs();
-
-    if (currentTime >= nextTimeout) {
+    const uint64 currentTime = PlatformTime::monotonicMsecs();
+    if (currentTime >= nextWakeupTime) {
         return 0;
     }
-    return nextTimeout - currentTime;
+    return int(std::min(nextWakeupTime - currentTime, uint64(std::numeric_limits<int>::max())));
 }
 
-uint EventDispatcherPrivate::nextTimerSerial()
+uint64 EventDispatcherPrivate::currentTime()
 {
-    if (m_currentTimerSerial > s_maxTimerSerial) {
-        tryCompactTimerSerials();
+    if (!m_isTimeCached) {
+        return PlatformTime::monotonicMsecs();
     }
-    return m_currentTimerSerial++;
-}
-
-void EventDispatcherPrivate::tryCompactTimerSerials()
-{
-    // don't bother trying to compact when there won't be much room anyway (we are probably heading for an
-    // unavoidable overflow / duplicates)
-    const size_t timersCount = m_timers.size();
-    if (timersCount >= s_maxTimerSerial * 0.9) {
-        std::cerr << timersCount << "are too many active timers! Timers timing out at the same time are "
-                                    "not guaranteed to trigger in a predictable order anymore.\n";
-        m_currentTimerSerial = 0;
-        return;
-    }
-
-    bool pickNextTimer = false;
-    int numDeadEntries = 0;
-    auto it = m_timers.begin();
-    for (uint newSerial = 0; newSerial < timersCount; newSerial++) {
-        Timer *const timer = it->second;
-        it = m_timers.erase(it);
-        if (!pickNextTimer) {
-            if (timer && timer->m_isRunning) {
-                timer->m_serial = newSerial;
-                m_timers.emplace(timer->tag(), timer);
-            } else {
-                // Drop this timer (it was removed while triggered) and use the serial for the next timer.
-                // In that situation, we are being called from inside that timer's callback. Prepare for
-                // iteration in triggerDueTimers() to continue after the current timer.
-                newSerial--;
-                m_adjustedIteratorOfNextTimer = m_timers.end();
-                numDeadEntries++;
-                pickNextTimer = true;
-            }
-        } else {
-            // Only one timer can be currently triggered, which produces a "dead" map entry. Any other
-            // timers are either running, or have already been removed from the map. Check this here.
-            assert(timer);
-            assert(timer->m_isRunning);
-            timer->m_serial = newSerial;
-            m_adjustedIteratorOfNextTimer = m_timers.emplace(timer->tag(), timer);
-            pickNextTimer = false;
-        }
-    }
-
-    assert(numDeadEntries <= 1);
-
-    m_serialsCompacted = true;
-    m_currentTimerSerial = timersCount;
-}
-
-void EventDispatcherPrivate::printTimerMap() const
-{
-    for (auto it = m_timers.cbegin(); it != m_timers.cend(); ++it) {
-        std::cerr << "tag: " << it->first
-                  << " dueTime: " << (it->first >> 10) << " serial: " << (it->first & 0x3ff)
-                  << " pointer: " << it->second << '\n';
+    if (!m_cachedTime) {
+        m_cachedTime = PlatformTime::monotonicMsecs();
     }
+    return m_cachedTime;
 }
 
 void EventDispatcherPrivate::addTimer(Timer *timer)
 {
-    timer->m_serial = nextTimerSerial();
-
-
-    uint64 dueTime;
-    if (timer->m_interval != 0 || !m_triggerTime) {
-        //std::cerr << "addTimer regular path " << timer << '\n';
-        dueTime = PlatformTime::monotonicMsecs() + uint64(timer->m_interval);
-    } else {
-        // A timer is added from a timer callback - make sure it only runs in the *next* iteration
-        // of the event loop. Timer users expect a timer to run at the earliest when the event loop
-        // runs *again*, not in this iteration.
-        //std::cerr << "addTimer staging path " << timer << '\n';
-        dueTime = 0;
-    }
-
-    timer->m_nextDueTime = dueTime;
-
-    //std::cerr << "  addTimer before:\n";
-    //printTimerMap();
-    m_timers.emplace(timer->tag(), timer);
+    // A zero interval timer that is added from a timer callback is due at the time of the current
+    // triggerDueTimers() run, so it goes into the TimerWheel's list of due timers. That list has already
+    // been taken for the current run, so it only runs in the *next* iteration of the event loop. Timer
+    // users expect a timer to run at the earliest when the event loop runs *again*.
+    timer->m_nextDueTime = currentTime() + uint64(timer->m_interval);
+    m_timerWheel.add(timer);
     maybeSetTimeoutForIntegrator();
-    //std::cerr << "  addTimer after:\n";
-    //printTimerMap();
 }
 
 void EventDispatcherPrivate::removeTimer(Timer *timer)
 {
-    assert(timer->tag() != 0);
-
-    // If inside a timer instance T's callback, this is only called from T's destructor, never from
-    // T.setRunning(false). In the setRunning(false) case, removing is handled in triggerDueTimers()
-    // right after invoking the callback by looking at T.m_isRunning. In the destructor case, this
-    // sets the Timer pointer to nullptr (see below).
-    // It is possible that the technique for handling the destructor case could also handle the
-    // setRunning(false) case, something to consider... (Note: tryCompactTimerSerials kinda does that
-    // already.)
-    auto iterRange = m_timers.equal_range(timer->tag());
-    for (; iterRange.first != iterRange.second; ++iterRange.first) {
-        if (iterRange.first->second == timer) {
-            if (!timer->m_reentrancyGuard) {
-                m_timers.erase(iterRange.first);
-            } else {
-                // This means that this is an "emergency remove" of a timer being deleted while in its
-                // callback. Mark it as dead so we won't dereference it. The map entry will be erased
-                // in triggerDueTimers() shortly after the callback returns.
-                iterRange.first->second = nullptr;
-            }
-            maybeSetTimeoutForIntegrator();
-            return;
-        }
-    }
-    assert(false); // the timer should never request a remove when it has not been added
+    // A timer that is currently in its callback is not in any list, so this does nothing for it.
+    // After the callback, triggerDueTimers() looks at its m_isRunning and re-adds it if necessary.
+    m_timerWheel.remove(timer);
+    maybeSetTimeoutForIntegrator();
 }
 
 void EventDispatcherPrivate::maybeSetTimeoutForIntegrator()
@@ -321,84 +275,74 @@ void EventDispatcherPrivate::maybeSetTimeoutForIntegrator()
 
 void EventDispatcherPrivate::triggerDueTimers()
 {
-    m_triggerTime = PlatformTime::monotonicMsecs();
-
-    for (auto it = m_timers.begin(); it != m_timers.end();) {
-        const uint64 timerTimeout = it->first >> 10;
-        if (timerTimeout > m_triggerTime) {
-            break;
-        }
-        // careful here - protect against adding and removing any timer while inside its trigger()!
-        // we do this by keeping the iterator at the current position (so changing any other timer
-        // doesn't invalidate it) and blocking changes to the timer behind that iterator
-        // (so we don't mess with its data should it have been deleted outright in the callback)
+    const bool wasTimeCached = m_isTimeCached;
+    if (!wasTimeCached) {
+        // called by a foreign event loop, not from poll() - what poll() may have left is outdated
+        m_cachedTime = 0;
+    }
+    m_isTimeCached = true; // also for timers added in the callbacks
+    const uint64 triggerTime = currentTime();
 
-        m_serialsCompacted = false;
+    m_timerWheel.advance(triggerTime);
+    TimerList dueTimers;
+    m_timerWheel.takeDue(&dueTimers);
 
-        Timer *timer = it->second;
-        //std::cerr << "triggerDueTimers() - tag: " << it->first <<" pointer: " << timer << '\n';
+    while (Timer *timer = dueTimers.first) {
+        // Any timer, including this one, may be added, removed or deleted in the callback. This one is
+        // not in any list while triggered; the others are unlinked from dueTimers if removed.
+        m_timerWheel.remove(timer);
         assert(timer->m_isRunning);
-
-        // invariant:
-        // timer.dueTime <= m_triggerTime <= currentTime(here) <= <timerAddedInTrigger>.dueTime
-        // (the latter except for zero interval timers added in a timer callback, which go into
-        // the staging area)
-        if (timer->m_nextDueTime != 0) { // == 0: timer is in staging area
-            timer->trigger();
+        if (!timer->trigger()) {
+            continue; // deleted in its callback
         }
-
-        if (m_serialsCompacted)
-        {
-            it = m_adjustedIteratorOfNextTimer;
-            continue;
-        }
-
-        timer = it->second; // reload, removeTimer() may set it to nullptr
-        if (timer && timer->m_isRunning) {
+        if (timer->m_isRunning) {
             // ### we are rescheduling timers based on triggerTime even though real time can be
             // much later - is this the desired behavior? I think so...
-            if (timer->m_interval == 0 && timer->m_nextDueTime != 0) {
-                // If we reinserted a timer with m_interval == 0, we might iterate over it again in this run
-                // of triggerDueTimers(). If we just leave it where it is and keep iterating, we prevent
-                // that problem, and it's good for performance, too!
-                // If m_nextDueTime is zero, the timer was inserted during the last run of triggerDueTimers,
-                // and it *should* be reinserted, so that the timer is triggered in this and future runs.
-                ++it;
-            } else {
-                timer->m_nextDueTime = m_triggerTime + timer->m_interval;
-                it = m_timers.erase(it);
-                m_timers.emplace(timer->tag(), timer);
-            }
-        } else {
-            it = m_timers.erase(it);
+            timer->m_nextDueTime = triggerTime + uint64(timer->m_interval);
+            m_timerWheel.add(timer);
         }
     }
-    m_triggerTime = 0;
+    m_isTimeCached = wasTimeCached;
     maybeSetTimeoutForIntegrator();
 }
 
 void EventDispatcherPrivate::queueEvent(std::unique_ptr<Event> evt)
 {
     // std::cerr << "EventDispatcherPrivate::queueEvent() " << evt->type << " " << this << std::endl;
-    {
-        SpinLocker locker(&m_queuedEventsLock);
-        m_queuedEvents.emplace_back(std::move(evt));
+    Event *const event = evt.release();
+    event->next = m_queuedEvents.load(std::memory_order_relaxed);
+    while (!m_queuedEvents.compare_exchange_weak(event->next, event, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+    }
+    // If the queue wasn't empty, a wakeup is already pending and the events that are already queued
+    // haven't been taken yet, so ours will be processed together with them
+    if (!event->next) {
+        wakeForEvents();
     }
-    wakeForEvents();
 }
 
 void EventDispatcherPrivate::processAuxEvents()
 {
     // std::cerr << "EventDispatcherPrivate::processAuxEvents() " << this << std::endl;
-    // don't hog the lock while processing the events
-    std::vector<std::unique_ptr<Event>> events;
-    {
-        SpinLocker locker(&m_queuedEventsLock);
-        std::swap(events, m_queuedEvents);
+    Event *newestFirst = m_queuedEvents.exchange(nullptr, std::memory_order_acquire);
+    Event *oldestFirst = nullptr;
+    while (newestFirst) {
+        Event *const next = newestFirst->next;
+        newestFirst->next = oldestFirst;
+        oldestFirst = newestFirst;
+        newestFirst = next;
     }
-    if (m_connectionToNotify) {
-        for (const std::unique_ptr<Event> &evt : events) {
+    while (oldestFirst) {
+        std::unique_ptr<Event> evt(oldestFirst);
+        oldestFirst = oldestFirst->next;
+        if (evt->type == Event::AnyThreadReply) {
+            // this needs no Connection; the reply may well be for a Connection in another thread
+            AnyThreadReplyEvent *const reply = static_cast<AnyThreadReplyEvent *>(evt.get());
+            reply->replyReceiver->handleReply(reply->serial, std::move(reply->reply), reply->error);
+        } else if (m_connectionToNotify) {
             m_connectionToNotify->processEvent(evt.get());
         }
+        // Without a Connection, nothing can handle the event. Deleting it is what would happen at the
+        // latest in ~EventDispatcherPrivate(), and it notifies the waiters of some event types.
     }
 }
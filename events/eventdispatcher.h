@@ -33,7 +33,12 @@ class DFERRY_EXPORT EventDispatcher
 {
 public:
 #ifndef DFERRY_NO_NATIVE_POLL
+    enum class Backend {
+        Default,
+        IoUring // Linux only, falls back to Default where io_uring is not available
+    };
     EventDispatcher();
+    explicit EventDispatcher(Backend backend);
 #endif
     // Does not take ownership of (i.e. does not delete in ~EventDispatcher()) integrator
     EventDispatcher(ForeignEventLoopIntegrator *integrator);
@@ -29,10 +29,11 @@
 #include "iioeventsource.h"
 #include "message.h"
 #include "platform.h"
-#include "spinlock.h"
+#include "platformtime.h"
+#include "timerwheel.h"
 #include "types.h"
 
-#include <map>
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -55,9 +56,9 @@ public:
     ~EventDispatcherPrivate();
 
     int timeToFirstDueTimer() const;
-    uint nextTimerSerial();
-    void tryCompactTimerSerials();
     void triggerDueTimers();
+    // The monotonic time in milliseconds. While dispatching events, it is only read from the clock once.
+    uint64 currentTime();
 
 protected:
     // IIoEventSource
@@ -66,15 +67,16 @@ protected:
     void updateIoInterestInternal(IIoEventListener *iol, uint32 ioRw) override;
 
 public:
+    IIoCompletionSource *ioCompletionSource() override;
     bool addIoEventListener(IIoEventListener *iol);
     bool removeIoEventListener(IIoEventListener *iol);
     void setReadWriteInterest(IIoEventListener *iol, bool read, bool write);
     // for IEventPoller
     friend class IEventPoller;
     void notifyListenerForIo(FileDescriptor fd, IO::RW ioRw);
+    void notifyListenerForIo(IIoEventListener *iol, IO::RW ioRw);
     // for Timer
     friend class Timer;
-    void printTimerMap() const;
     void addTimer(Timer *timer);
     void removeTimer(Timer *timer);
     // for ForeignEventLoopIntegrator (calls into it, not called from it)
@@ -90,25 +92,18 @@ public:
     ForeignEventLoopIntegrator *m_integrator = nullptr;
     std::unordered_map<FileDescriptor, IIoEventListener*> m_ioListeners;
 
-    // Attention! When changing s_maxTimerSerial, or the general approach to ensuring that timers time out
-    // in the correct order, make sure that testSerialWraparound() still tests the ordering technique where
-    // it's likely to break.
-    static const int s_maxTimerSerial = 0x3ff; // 10 bits set
-    uint m_currentTimerSerial = 0;
-    // the highest 54 bits in "due" encode due time, the lowest 10 bits act like a serial number to reduce
-    // (not eliminate - the serial eventually wraps around) collisions of timers with the same timeout
-    // (this is not expressed as a struct/class to avoid compiler pessimization in the multimap code)
-    std::multimap<uint64 /* due */, Timer*> m_timers;
-    // for logic to prevent executing a timer in the dispatch run it was added
-    uint64 m_triggerTime = 0;
-    bool m_serialsCompacted = false;
-    decltype(m_timers)::iterator m_adjustedIteratorOfNextTimer;
+    TimerWheel m_timerWheel { PlatformTime::monotonicMsecs() };
+    // m_cachedTime is valid only while m_isTimeCached is set, in EventDispatcher::poll() and while timers
+    // are triggered. Then m_cachedTime == 0 means that currentTime() hasn't read the clock yet.
+    bool m_isTimeCached = false;
+    uint64 m_cachedTime = 0;
 
     // for inter thread event delivery to Connection
     ConnectionPrivate *m_connectionToNotify = nullptr;
 
-    Spinlock m_queuedEventsLock;
-    std::vector<std::unique_ptr<Event>> m_queuedEvents;
+    // Lock-free multi-producer, single-consumer queue: producers push onto the head of a list, the
+    // consumer takes the whole list and reverses it. Linked through Event::next.
+    std::atomic<Event *> m_queuedEvents { nullptr };
 };
 
 #endif
@@ -32,3 +32,8 @@ IEventPoller::~IEventPoller()
 {
     m_dispatcher = nullptr;
 }
+
+IIoCompletionSource *IEventPoller::ioCompletionSource()
+{
+    return nullptr;
+}
@@ -29,6 +29,7 @@
 #include "platform.h"
 #include "types.h"
 
+class IIoCompletionSource;
 class IioEventListener;
 
 class IEventPoller
@@ -53,6 +54,9 @@ public:
     virtual void removeFileDescriptor(FileDescriptor fd) = 0;
     virtual void setReadWriteInterest(FileDescriptor fd, uint32 ioRw) = 0;
 
+    // optional, see IIoCompletionSource; the default implementation returns nullptr
+    virtual IIoCompletionSource *ioCompletionSource();
+
 protected:
     EventDispatcher *m_dispatcher;
 };
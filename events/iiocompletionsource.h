@@ -0,0 +1,91 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef IIOCOMPLETIONSOURCE_H
+#define IIOCOMPLETIONSOURCE_H
+
+#include "iovaluetypes.h"
+#include "platform.h"
+#include "types.h"
+
+#include <vector>
+
+class IIoCompletionListener;
+
+// Completion-based I/O on stream sockets, an optional capability of an event poller (currently only
+// IoUringEventPoller), see IIoEventSource::ioCompletionSource().
+// Instead of reporting that a socket is readable or writable, the event source receives into buffers
+// that it owns and sends data that was handed to it. Sends are submitted in a batch together with
+// waiting for events, so there is no read or write syscall per operation at all.
+// The IIoEventListener of the file descriptor is still notified through the usual
+// IIoEventListener::handleIoReady() when receives have completed, and when sending is possible while
+// there is interest in writing. The IIoCompletionListener, usually the same object, gets the data.
+class IIoCompletionSource
+{
+public:
+    virtual ~IIoCompletionSource();
+
+    // Switches fd, whose IIoEventListener must already be registered, from readiness notification to
+    // completion-based I/O until it is removed. Received file descriptors are passed on if
+    // maxFileDescriptors is not zero. Returns false if that is not possible; nothing changes then.
+    virtual bool startCompletionIo(FileDescriptor fd, IIoCompletionListener *listener,
+                                   uint32 maxFileDescriptors) = 0;
+    // Receiving stops when no buffers are left and resumes when enough of them have been released.
+    // In between, the socket must be read directly; readiness is reported as usual for that.
+    virtual bool isReceiveStarved(FileDescriptor fd) const = 0;
+    // Hands back a buffer passed to IIoCompletionListener::handleReceiveCompleted()
+    virtual void releaseReceiveBuffer(uint32 bufferId) = 0;
+
+    // Copies as much of data as allowed by the limit on unsent data per file descriptor and queues it
+    // for sending in order. fileDescriptors are duplicated and sent with the first byte. Returns the
+    // number of bytes taken, which is zero if no more data can be queued; see canSend().
+    // Data that was taken is still sent after fd has been removed.
+    virtual uint32 send(FileDescriptor fd, const chunk *data, uint32 chunkCount,
+                        const std::vector<int> &fileDescriptors) = 0;
+    virtual bool canSend(FileDescriptor fd) const = 0;
+
+    // Blocks until operations on fd have completed or, while receiving is starved, fd is readable, or
+    // until timeoutMsecs have passed if it is not -1. Returns the kinds of I/O (IO::RW flags) that can
+    // make progress because of that, which is 0 after a timeout. Completions for fd are passed to its
+    // IIoCompletionListener, all other events are dispatched from the next poll.
+    virtual uint32 waitForCompletions(FileDescriptor fd, int timeoutMsecs) = 0;
+};
+
+class IIoCompletionListener
+{
+public:
+    virtual ~IIoCompletionListener();
+
+    // data points into buffer bufferId, which must be released through
+    // IIoCompletionSource::releaseReceiveBuffer() after use. The receiver owns fileDescriptors.
+    virtual void handleReceiveCompleted(chunk data, uint32 bufferId, std::vector<int> fileDescriptors) = 0;
+    // The connection was closed by the peer or failed. No more receives will complete.
+    virtual void handleReceiveFinished() = 0;
+    // Queued data could not be sent. No more data can be sent.
+    virtual void handleSendFailed() = 0;
+    // The file descriptor was removed from the source. Received data that has not been read yet is
+    // dropped; its buffers must be released during this call.
+    virtual void handleCompletionIoStopped() = 0;
+};
+
+#endif // IIOCOMPLETIONSOURCE_H
@@ -59,11 +59,21 @@ FileDescriptor IIoEventForwarder::fileDescriptor() const
     return m_downstream->fileDescriptor();
 }
 
+bool IIoEventForwarder::drainsIoOnReady() const
+{
+    return m_downstream && m_downstream->drainsIoOnReady();
+}
+
 IIoEventListener *IIoEventForwarder::downstreamListener()
 {
     return m_downstream;
 }
 
+IIoCompletionSource *IIoEventForwarder::ioCompletionSource()
+{
+    return ioEventSource() ? ioEventSource()->ioCompletionSource() : nullptr;
+}
+
 #if 0
 // Sample implementation for subclasses
 IO::Status IIoEventForwarderSubclass::handleIoReady(IO::RW rw)
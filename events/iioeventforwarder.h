@@ -47,10 +47,14 @@ public:
 
     // IIOEventListener
     FileDescriptor fileDescriptor() const override;
+    bool drainsIoOnReady() const override;
 
     // This only works due to the one-to-one limitation explained above.
     IIoEventListener *downstreamListener();
 
+    // IIoEventSource
+    IIoCompletionSource *ioCompletionSource() override;
+
 protected:
     // IIOEventSource
     void addIoListenerInternal(IIoEventListener *iol, uint32 ioRw) override;
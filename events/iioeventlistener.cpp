@@ -50,6 +50,11 @@ uint32 IIoEventListener::ioInterest() const
     return m_ioInterest;
 }
 
+bool IIoEventListener::drainsIoOnReady() const
+{
+    return false;
+}
+
 void IIoEventListener::setIoInterest(uint32 ioRw)
 {
     if (m_ioInterest == ioRw) {
@@ -30,7 +30,7 @@
 
 class IIoEventSource;
 
-class IIoEventListener
+class DFERRY_EXPORT IIoEventListener
 {
 public:
     virtual ~IIoEventListener();
@@ -46,6 +46,9 @@ public:
     uint32 ioInterest() const;
     virtual IO::Status handleIoReady(IO::RW rw) = 0;
     virtual FileDescriptor fileDescriptor() const = 0;
+    // Returns true if handleIoReady() reads or writes until the operation would block (or there is nothing
+    // left to write). Edge-triggered readiness notification can only be used for such listeners.
+    virtual bool drainsIoOnReady() const;
 
 protected:
     void setIoInterest(uint32 ioRw);
@@ -52,6 +52,11 @@ void IIoEventSource::removeIoListener(IIoEventListener *iol)
     removeIoListenerInternal(iol);
 }
 
+IIoCompletionSource *IIoEventSource::ioCompletionSource()
+{
+    return nullptr;
+}
+
 void IIoEventSource::updateIoInterest(IIoEventListener *iol)
 {
     if (iol->m_eventSource != this) {
@@ -27,6 +27,7 @@
 #include "iovaluetypes.h"
 #include "types.h"
 
+class IIoCompletionSource;
 class IIoEventListener;
 
 // TODO: explain the context for this - layered sources and listeners and such
@@ -40,7 +41,7 @@ class IIoEventListener;
 // leading to the I/O operation leading to the close(). That lowest level IIoEventListener must also
 // unregister itself, etc, up to the highest level IIoEventSource (usually EventDispatcherPrivate).
 
-class IIoEventSource
+class DFERRY_EXPORT IIoEventSource
 {
 public:
     virtual ~IIoEventSource();
@@ -50,6 +51,9 @@ public:
     // before enabling it on its new source.
     void addIoListener(IIoEventListener *iol);
     void removeIoListener(IIoEventListener *iol);
+    // Returns the completion-based I/O interface of the event poller at the end of the chain of sources,
+    // or nullptr if it doesn't have one. It is only valid while the listener is registered.
+    virtual IIoCompletionSource *ioCompletionSource();
 
 protected:
     // add / remove only make sense for stateful APIs such as Linux epoll, so they don't have to be
@@ -0,0 +1,1062 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "iouringeventpoller.h"
+
+#include "eventdispatcher_p.h"
+#include "iioeventlistener.h"
+#include "platformtime.h"
+
+#include <fcntl.h>
+#include <linux/time_types.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+enum {
+    RingEntries = 256,
+    // Buffers for receiving. Listeners usually read received data right away, so they are mostly
+    // needed for bursts.
+    ReceiveBufferCount = 64, // must be a power of two
+    ReceiveBufferSize = 8192,
+    ReceiveBufferGroup = 0,
+    // after running out of buffers, receiving resumes when this many are free again
+    ReceiveResumeBufferCount = ReceiveBufferCount / 4,
+    // the same as in LocalSocket
+    MaxReceivedFds = 16
+};
+
+// the limit of data not sent yet per file descriptor, much like a socket send buffer
+static const size_t MaxUnsentBytes = 256 * 1024;
+
+enum RequestType : uint32 {
+    PollRequest = 0,
+    ReceiveRequest,
+    SendRequest
+};
+
+static const uint32 GenerationMask = (1u << 30) - 1;
+
+// user_data of requests is (generation << 34) | (type << 32) | fd; these values can't clash with that
+// because file descriptors are never 0xffffffff, 0xfffffffe or 0xfffffffd
+static const uint64_t InterruptUserData = ~uint64_t(0);
+static const uint64_t CancelUserData = ~uint64_t(0) - 1;
+static const uint64_t ProbeUserData = ~uint64_t(0) - 2;
+
+static uint64_t requestUserData(RequestType type, FileDescriptor fd, uint32 generation)
+{
+    return (uint64_t(generation) << 34) | (uint64_t(type) << 32) | uint32(fd);
+}
+
+static int ioUringSetup(unsigned entries, io_uring_params *params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ioUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+                        const void *arg, size_t argSize)
+{
+    return int(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+static int ioUringRegister(int ringFd, unsigned opcode, const void *arg, unsigned argCount)
+{
+    return int(syscall(__NR_io_uring_register, ringFd, opcode, arg, argCount));
+}
+
+static uint32 pollMaskFromIoRw(uint32 ioRw)
+{
+    return ((ioRw & uint32(IO::RW::Read)) ? uint32(POLLIN) : 0) |
+           ((ioRw & uint32(IO::RW::Write)) ? uint32(POLLOUT) : 0);
+}
+
+static void closeFileDescriptors(std::vector<int> *fds)
+{
+    for (const int fd : *fds) {
+        ::close(fd);
+    }
+    fds->clear();
+}
+
+IoUringEventPoller::PendingSends::~PendingSends()
+{
+    for (SendOp &op : ops) {
+        closeFileDescriptors(&op.fileDescriptors);
+    }
+    if (ownsFd && fd >= 0) {
+        ::close(fd);
+    }
+}
+
+IoUringEventPoller *IoUringEventPoller::create(EventDispatcher *dispatcher)
+{
+    IoUringEventPoller *const ret = new IoUringEventPoller(dispatcher);
+    if (!ret->setup()) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+IoUringEventPoller::IoUringEventPoller(EventDispatcher *dispatcher)
+   : IEventPoller(dispatcher),
+     m_pendingInterrupt(IEventPoller::NoInterrupt)
+{
+    memset(&m_receiveMsg, 0, sizeof(m_receiveMsg));
+}
+
+bool IoUringEventPoller::setup()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ringFd = ioUringSetup(RingEntries, &params);
+    if (m_ringFd < 0) {
+        return false; // not supported by the kernel, or forbidden e.g. by a seccomp filter
+    }
+    // SINGLE_MMAP is implied by EXT_ARG (Linux 5.11), which we need for waiting with a timeout.
+    // NODROP ensures that no completions are lost when the completion queue overflows.
+    const uint32 requiredFeatures = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & requiredFeatures) != requiredFeatures) {
+        return false;
+    }
+
+    const size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_ringMemorySize = std::max(sqRingSize, cqRingSize);
+    m_ringMemory = mmap(nullptr, m_ringMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_ringFd, IORING_OFF_SQ_RING);
+    if (m_ringMemory == MAP_FAILED) {
+        m_ringMemory = nullptr;
+        return false;
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *const sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            m_ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    byte *const ring = static_cast<byte *>(m_ringMemory);
+    m_sqHead = reinterpret_cast<unsigned *>(ring + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqArray = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+
+    m_cqHead = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(ring + params.cq_off.cqes);
+
+    m_interruptEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_interruptEventFd < 0) {
+        return false;
+    }
+    // optional
+    m_hasCompletionIo = setupCompletionIo();
+    return true;
+}
+
+bool IoUringEventPoller::setupCompletionIo()
+{
+    // Provided buffer rings appeared in Linux 5.19. Like the buffers, the ring must be page aligned.
+    void *const bufferRing = mmap(nullptr, ReceiveBufferCount * sizeof(io_uring_buf),
+                                  PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufferRing == MAP_FAILED) {
+        return false;
+    }
+    m_bufferRing = static_cast<io_uring_buf *>(bufferRing);
+    void *const buffers = mmap(nullptr, ReceiveBufferCount * ReceiveBufferSize, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        return false;
+    }
+    m_buffers = static_cast<byte *>(buffers);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(m_bufferRing);
+    reg.ring_entries = ReceiveBufferCount;
+    reg.bgid = ReceiveBufferGroup;
+    if (ioUringRegister(m_ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return false;
+    }
+    for (uint32 i = 0; i < ReceiveBufferCount; i++) {
+        releaseReceiveBuffer(i);
+    }
+
+    // Receive file descriptors into the buffers like LocalSocket::readWithFileDescriptors() does.
+    // No iovec: with buffer selection, the buffer is the iovec.
+    m_receiveMsg.msg_controllen = CMSG_LEN(MaxReceivedFds * sizeof(int));
+    return probeMultishotReceive();
+}
+
+bool IoUringEventPoller::probeMultishotReceive()
+{
+    // Multishot receive requests appeared in Linux 6.0, one version after provided buffer rings. There
+    // is no feature flag for them, so try one on a socket without data, then cancel it.
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        return false;
+    }
+    io_uring_sqe *sqe = nextSqe();
+    prepareReceive(sqe, fds[0], false);
+    sqe->user_data = ProbeUserData;
+    sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = ProbeUserData;
+    sqe->user_data = CancelUserData;
+
+    int probeResult = 1; // not a possible result of a canceled receive without data
+    while (probeResult == 1) {
+        if (submit(1, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        for (unsigned head = *m_cqHead; head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE); head++) {
+            const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+            if (cqe.user_data == ProbeUserData) {
+                probeResult = cqe.res;
+            }
+            __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        }
+    }
+    ::close(fds[0]);
+    ::close(fds[1]);
+    // -EINVAL if the multishot flag is unknown
+    return probeResult == -ECANCELED;
+}
+
+IoUringEventPoller::~IoUringEventPoller()
+{
+    if (m_ringFd >= 0 && m_pendingOpCount) {
+        cancelAllRequests();
+    }
+    // closing the ring fd cancels all requests
+    if (m_ringFd >= 0) {
+        close(m_ringFd);
+    }
+    if (m_interruptEventFd >= 0) {
+        close(m_interruptEventFd);
+    }
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_ringMemory) {
+        munmap(m_ringMemory, m_ringMemorySize);
+    }
+    if (m_bufferRing) {
+        munmap(m_bufferRing, ReceiveBufferCount * sizeof(io_uring_buf));
+    }
+    if (m_buffers) {
+        munmap(m_buffers, ReceiveBufferCount * ReceiveBufferSize);
+    }
+}
+
+void IoUringEventPoller::cancelAllRequests()
+{
+    // Requests may still use memory that we own. First let queued sends go out, which mostly completes
+    // them right away as a write() before close() would, then cancel the rest and wait for that.
+    submit(0, 0);
+    m_isDestroying = true;
+    reapCompletions();
+    if (!m_pendingOpCount) {
+        return;
+    }
+    io_uring_sqe *const sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = CancelUserData;
+    // canceling takes effect immediately, this just avoids hanging if something is very wrong
+    for (int i = 0; i < 10 && m_pendingOpCount; i++) {
+        submit(1, 100);
+        reapCompletions();
+    }
+    assert(!m_pendingOpCount);
+}
+
+io_uring_sqe *IoUringEventPoller::nextSqe()
+{
+    unsigned tail = *m_sqTail;
+    if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries) {
+        // full; make room
+        submit(0, 0);
+        tail = *m_sqTail;
+    }
+    const unsigned index = tail & m_sqMask;
+    io_uring_sqe *const sqe = m_sqes + index;
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+int IoUringEventPoller::submit(uint32 minComplete, int timeout)
+{
+    // the kernel advances the head when it consumes submission queue entries
+    const unsigned unsubmitted = *m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    unsigned flags = 0;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    __kernel_timespec ts;
+    if (minComplete) {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    } else if (!unsubmitted) {
+        return 0;
+    }
+    // errors such as -ETIME or -EINTR need no handling here
+    return ioUringEnter(m_ringFd, unsubmitted, minComplete, flags, flags ? &arg : nullptr,
+                        flags ? sizeof(arg) : 0);
+}
+
+IEventPoller::InterruptAction IoUringEventPoller::poll(int timeout)
+{
+    if (!m_interruptArmed) {
+        io_uring_sqe *const sqe = nextSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_interruptEventFd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = InterruptUserData;
+        m_interruptArmed = true;
+    }
+    updatePollRequests();
+
+    // Submit and wait in one syscall. Don't wait if there are completions from earlier submissions
+    // that haven't been handled yet, including those from waitForCompletions().
+    const bool haveCompletions = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE) != *m_cqHead ||
+                                 !m_fdsToNotify.empty() || m_interruptCompleted;
+    submit(haveCompletions || timeout == 0 ? 0 : 1, timeout);
+    reapCompletions();
+
+    IEventPoller::InterruptAction ret = IEventPoller::NoInterrupt;
+    if (m_interruptCompleted) {
+        m_interruptCompleted = false;
+        ret = takeInterrupt();
+    }
+    dispatchPendingIo();
+    return ret;
+}
+
+void IoUringEventPoller::reapCompletions()
+{
+    // Handling completions doesn't call IIoEventListeners, so the completion queue doesn't change
+    // while we are here, except for new completions at the tail
+    while (true) {
+        const unsigned head = *m_cqHead;
+        if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        const io_uring_cqe cqe = m_cqes[head & m_cqMask];
+        __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        handleCompletion(cqe);
+    }
+}
+
+void IoUringEventPoller::handleCompletion(const io_uring_cqe &cqe)
+{
+    if (cqe.user_data == CancelUserData || cqe.user_data == ProbeUserData) {
+        return;
+    }
+    if (cqe.user_data == InterruptUserData) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            m_interruptArmed = false;
+        }
+        m_interruptCompleted = true;
+        return;
+    }
+
+    const FileDescriptor fd = FileDescriptor(uint32(cqe.user_data));
+    const RequestType type = RequestType((cqe.user_data >> 32) & 3);
+    const uint32 generation = uint32(cqe.user_data >> 34);
+    FdState *state = size_t(fd) < m_fdStates.size() ? &m_fdStates[fd] : nullptr;
+    if (state && (!state->listener || state->generation != generation)) {
+        state = nullptr; // from a canceled request
+    }
+    switch (type) {
+    case ReceiveRequest:
+        handleReceiveCompletion(cqe, fd, state);
+        break;
+    case SendRequest:
+        // a send may complete after its file descriptor was removed, it is found by its user_data
+        handleSendCompletion(cqe, fd);
+        break;
+    default:
+        handlePollCompletion(cqe, fd, state);
+        break;
+    }
+}
+
+void IoUringEventPoller::handlePollCompletion(const io_uring_cqe &cqe, FileDescriptor fd, FdState *state)
+{
+    if (!state) {
+        return;
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        // oneshot request completed, or the kernel ended a multishot request
+        state->armed = false;
+        queueUpdate(fd);
+    }
+    if (cqe.res == -ECANCELED) {
+        return;
+    }
+    // Other errors are passed on as both directions being ready, so that the listener's read or write
+    // call fails and lets it handle the problem
+    const uint32 revents = cqe.res < 0 ? uint32(POLLERR) : uint32(cqe.res);
+    // Same notification conditions as select and epoll
+    uint32 ioRw = 0;
+    if (revents & (POLLIN | POLLERR | POLLHUP)) {
+        ioRw |= uint32(IO::RW::Read);
+    }
+    if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+        ioRw |= uint32(IO::RW::Write);
+    }
+    queueNotification(fd, ioRw);
+}
+
+void IoUringEventPoller::queueNotification(FileDescriptor fd, uint32 ioRw)
+{
+    FdState &state = m_fdStates[fd];
+    state.pendingIo |= ioRw;
+    if (!state.notifyQueued) {
+        state.notifyQueued = true;
+        m_fdsToNotify.push_back(fd);
+    }
+    if (fd == m_waitFd) {
+        m_waitIo |= ioRw;
+    }
+}
+
+void IoUringEventPoller::dispatchPendingIo()
+{
+    EventDispatcherPrivate *const dispatcherPriv = EventDispatcherPrivate::get(m_dispatcher);
+    // Notifications queued by listeners, e.g. while blocking in waitForCompletions(), are dispatched
+    // in the next poll(), which won't wait then
+    std::swap(m_fdsNotifying, m_fdsToNotify);
+    for (const FileDescriptor fd : m_fdsNotifying) {
+        FdState *state = &m_fdStates[fd];
+        state->notifyQueued = false;
+        const uint32 ioRw = state->pendingIo;
+        state->pendingIo = 0;
+        IIoEventListener *const listener = state->listener;
+        const uint32 generation = state->generation;
+        if (!listener) {
+            continue;
+        }
+        if (ioRw & uint32(IO::RW::Read)) {
+            dispatcherPriv->notifyListenerForIo(listener, IO::RW::Read);
+        }
+        // The listener may have been removed, and m_fdStates may have been reallocated
+        state = size_t(fd) < m_fdStates.size() ? &m_fdStates[fd] : nullptr;
+        if (state && state->listener == listener && state->generation == generation &&
+            (ioRw & uint32(IO::RW::Write))) {
+            dispatcherPriv->notifyListenerForIo(listener, IO::RW::Write);
+        }
+    }
+    m_fdsNotifying.clear();
+}
+
+IEventPoller::InterruptAction IoUringEventPoller::takeInterrupt()
+{
+    // Reset the eventfd *before* taking the pending action, see EpollEventPoller
+    uint64_t counter;
+    while (read(m_interruptEventFd, &counter, sizeof(counter)) > 0) {
+    }
+    return IEventPoller::InterruptAction(m_pendingInterrupt.exchange(IEventPoller::NoInterrupt));
+}
+
+void IoUringEventPoller::interrupt(IEventPoller::InterruptAction action)
+{
+    assert(action == IEventPoller::ProcessAuxEvents || action == IEventPoller::Stop);
+
+    int pending = m_pendingInterrupt.load();
+    do {
+        if (pending >= action) {
+            return;
+        }
+    } while (!m_pendingInterrupt.compare_exchange_weak(pending, action));
+
+    if (pending == IEventPoller::NoInterrupt) {
+        const uint64_t one = 1;
+        write(m_interruptEventFd, &one, sizeof(one));
+    }
+}
+
+void IoUringEventPoller::queueUpdate(FileDescriptor fd)
+{
+    FdState &state = m_fdStates[fd];
+    if (!state.queued) {
+        state.queued = true;
+        m_fdsToUpdate.push_back(fd);
+    }
+}
+
+void IoUringEventPoller::updatePollRequests()
+{
+    for (const FileDescriptor fd : m_fdsToUpdate) {
+        FdState *const state = &m_fdStates[fd];
+        state->queued = false;
+        if (!state->listener) {
+            continue;
+        }
+        if (state->completionListener) {
+            updateReceiveRequest(fd, state);
+            // There is no request to wait for writability, it is known right away. A write listener
+            // that has just shown interest, e.g. with data queued while connecting, needs to hear it.
+            if ((state->ioRw & uint32(IO::RW::Write)) && canSend(fd)) {
+                queueNotification(fd, uint32(IO::RW::Write));
+            }
+            continue;
+        }
+        // A multishot request stays armed for both directions; EventDispatcher filters out notifications
+        // without interest. Re-arm it when interest was added because an edge may have gone by.
+        uint32 pollMask;
+        if (state->multishot) {
+            pollMask = state->ioRw ? uint32(POLLIN | POLLOUT) : 0;
+        } else {
+            pollMask = pollMaskFromIoRw(state->ioRw);
+        }
+        if (state->armed && (state->armedPollMask != pollMask || state->needsRearm)) {
+            cancelPoll(fd, state);
+        }
+        state->needsRearm = false;
+        if (!state->armed && pollMask) {
+            armPoll(fd, state, pollMask);
+        }
+    }
+    m_fdsToUpdate.clear();
+}
+
+void IoUringEventPoller::armPoll(FileDescriptor fd, FdState *state, uint32 pollMask)
+{
+    io_uring_sqe *const sqe = nextSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+#ifdef BIGENDIAN
+    sqe->poll32_events = (pollMask << 16) | (pollMask >> 16);
+#else
+    sqe->poll32_events = pollMask;
+#endif
+    sqe->len = state->multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = requestUserData(PollRequest, fd, state->generation);
+    state->armed = true;
+    state->armedPollMask = pollMask;
+}
+
+void IoUringEventPoller::cancelPoll(FileDescriptor fd, FdState *state)
+{
+    io_uring_sqe *const sqe = nextSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = requestUserData(PollRequest, fd, state->generation);
+    sqe->user_data = CancelUserData;
+    // the completion(s) of the canceled request will have an outdated generation
+    state->generation = (state->generation + 1) & GenerationMask;
+    state->armed = false;
+}
+
+void IoUringEventPoller::cancelRequest(uint64_t userData)
+{
+    io_uring_sqe *const sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = userData;
+    sqe->user_data = CancelUserData;
+}
+
+void IoUringEventPoller::addFileDescriptor(FileDescriptor fd, uint32 ioRw)
+{
+    assert(fd >= 0);
+    // The listener has already been inserted when we are called
+    const EventDispatcherPrivate *const dispatcherPriv = EventDispatcherPrivate::get(m_dispatcher);
+    auto it = dispatcherPriv->m_ioListeners.find(fd);
+    assert(it != dispatcherPriv->m_ioListeners.end());
+
+    if (size_t(fd) >= m_fdStates.size()) {
+        m_fdStates.resize(fd + 1);
+    }
+    FdState &state = m_fdStates[fd];
+    assert(!state.listener);
+    state.listener = it->second;
+    state.ioRw = ioRw;
+    state.multishot = state.listener->drainsIoOnReady();
+    state.armed = false;
+    state.needsRearm = false;
+    state.pendingIo = 0;
+    queueUpdate(fd);
+}
+
+void IoUringEventPoller::removeFileDescriptor(FileDescriptor fd)
+{
+    // Connection should call us *before* resetting its fd on failure
+    assert(fd >= 0);
+    if (size_t(fd) >= m_fdStates.size() || !m_fdStates[fd].listener) {
+        return;
+    }
+    FdState &state = m_fdStates[fd];
+    IIoCompletionListener *const completionListener = state.completionListener;
+    if (completionListener) {
+        if (state.receiveArmed) {
+            cancelRequest(requestUserData(ReceiveRequest, fd, state.generation));
+            state.receiveArmed = false;
+        }
+        detachSends(&state);
+        state.completionListener = nullptr;
+    }
+    if (state.armed) {
+        cancelPoll(fd, &state);
+    } else {
+        state.generation = (state.generation + 1) & GenerationMask;
+    }
+    // Requests hold a reference to the file, so cancel them right away. Otherwise, closing the file
+    // descriptor wouldn't close a socket until the next poll().
+    submit(0, 0);
+    state.listener = nullptr;
+    state.pendingIo = 0;
+    // if queued, updatePollRequests() and dispatchPendingIo() will skip it
+    if (completionListener) {
+        completionListener->handleCompletionIoStopped();
+    }
+}
+
+void IoUringEventPoller::setReadWriteInterest(FileDescriptor fd, uint32 ioRw)
+{
+    if (fd < 0 || size_t(fd) >= m_fdStates.size() || !m_fdStates[fd].listener) {
+        return;
+    }
+    FdState &state = m_fdStates[fd];
+    if (ioRw == state.ioRw) {
+        return;
+    }
+    if (state.multishot && (ioRw & ~state.ioRw)) {
+        state.needsRearm = true;
+    }
+    state.ioRw = ioRw;
+    queueUpdate(fd);
+}
+
+IIoCompletionSource *IoUringEventPoller::ioCompletionSource()
+{
+    return m_hasCompletionIo ? this : nullptr;
+}
+
+IoUringEventPoller::FdState *IoUringEventPoller::completionIoState(FileDescriptor fd)
+{
+    if (fd < 0 || size_t(fd) >= m_fdStates.size() || !m_fdStates[fd].completionListener) {
+        return nullptr;
+    }
+    return &m_fdStates[fd];
+}
+
+const IoUringEventPoller::FdState *IoUringEventPoller::completionIoState(FileDescriptor fd) const
+{
+    return const_cast<IoUringEventPoller *>(this)->completionIoState(fd);
+}
+
+bool IoUringEventPoller::startCompletionIo(FileDescriptor fd, IIoCompletionListener *listener,
+                                           uint32 maxFileDescriptors)
+{
+    if (!m_hasCompletionIo || maxFileDescriptors > MaxReceivedFds || fd < 0 ||
+        size_t(fd) >= m_fdStates.size() || !m_fdStates[fd].listener) {
+        return false;
+    }
+    FdState &state = m_fdStates[fd];
+    if (state.completionListener) {
+        return state.completionListener == listener;
+    }
+    state.completionListener = listener;
+    state.receiveFds = maxFileDescriptors > 0;
+    state.receiveArmed = false;
+    state.receiveStarved = false;
+    state.receiveFinished = false;
+    if (state.armed) {
+        cancelPoll(fd, &state);
+    }
+    queueUpdate(fd);
+    return true;
+}
+
+void IoUringEventPoller::prepareReceive(io_uring_sqe *sqe, FileDescriptor fd, bool receiveFds)
+{
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = ReceiveBufferGroup;
+    if (receiveFds) {
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = reinterpret_cast<uint64_t>(&m_receiveMsg);
+        sqe->msg_flags = MSG_CMSG_CLOEXEC;
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+    }
+}
+
+void IoUringEventPoller::updateReceiveRequest(FileDescriptor fd, FdState *state)
+{
+    if (state->receiveArmed || state->receiveFinished) {
+        return;
+    }
+    if (state->receiveStarved && m_freeBufferCount < ReceiveResumeBufferCount) {
+        // the listener reads directly until there are enough buffers again
+        if (!state->armed) {
+            armPoll(fd, state, POLLIN);
+        }
+        return;
+    }
+    if (state->armed) {
+        cancelPoll(fd, state);
+    }
+    state->receiveStarved = false;
+    io_uring_sqe *const sqe = nextSqe();
+    prepareReceive(sqe, fd, state->receiveFds);
+    sqe->user_data = requestUserData(ReceiveRequest, fd, state->generation);
+    state->receiveArmed = true;
+    m_pendingOpCount++;
+}
+
+bool IoUringEventPoller::isReceiveStarved(FileDescriptor fd) const
+{
+    const FdState *const state = completionIoState(fd);
+    return state && state->receiveStarved;
+}
+
+void IoUringEventPoller::releaseReceiveBuffer(uint32 bufferId)
+{
+    assert(bufferId < ReceiveBufferCount);
+    io_uring_buf *const buf = &m_bufferRing[m_bufferRingTail & (ReceiveBufferCount - 1)];
+    buf->addr = reinterpret_cast<uint64_t>(m_buffers + bufferId * ReceiveBufferSize);
+    buf->len = ReceiveBufferSize;
+    buf->bid = uint16(bufferId);
+    m_bufferRingTail++;
+    // the tail overlays the reserved field of the first entry
+    __atomic_store_n(&m_bufferRing[0].resv, uint16(m_bufferRingTail), __ATOMIC_RELEASE);
+
+    if (++m_freeBufferCount == ReceiveResumeBufferCount) {
+        for (const FileDescriptor fd : m_starvedFds) {
+            if (completionIoState(fd)) {
+                queueUpdate(fd);
+            }
+        }
+        m_starvedFds.clear();
+    }
+}
+
+chunk IoUringEventPoller::parseReceivedMessage(byte *buffer, uint32 length,
+                                               std::vector<int> *fileDescriptors)
+{
+    // The layout is io_uring_recvmsg_out, name, control messages, data. The sizes of name and control
+    // messages are the ones requested in m_receiveMsg.
+    const size_t controlOffset = sizeof(io_uring_recvmsg_out) + m_receiveMsg.msg_namelen;
+    const size_t dataOffset = controlOffset + m_receiveMsg.msg_controllen;
+    if (length < dataOffset) {
+        return chunk();
+    }
+    const io_uring_recvmsg_out *const out = reinterpret_cast<io_uring_recvmsg_out *>(buffer);
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = buffer + controlOffset;
+    msg.msg_controllen = out->controllen;
+    for (cmsghdr *c_msg = CMSG_FIRSTHDR(&msg); c_msg; c_msg = CMSG_NXTHDR(&msg, c_msg)) {
+        if (c_msg->cmsg_level == SOL_SOCKET && c_msg->cmsg_type == SCM_RIGHTS) {
+            const size_t count = (c_msg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int *const fdPayload = reinterpret_cast<int *>(CMSG_DATA(c_msg));
+            fileDescriptors->insert(fileDescriptors->end(), fdPayload, fdPayload + count);
+        }
+    }
+    return chunk(buffer + dataOffset, length - dataOffset);
+}
+
+void IoUringEventPoller::handleReceiveCompletion(const io_uring_cqe &cqe, FileDescriptor fd, FdState *state)
+{
+    const bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+    const uint32 bufferId = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    const bool isLast = !(cqe.flags & IORING_CQE_F_MORE);
+    if (hasBuffer) {
+        m_freeBufferCount--;
+    }
+    if (isLast) {
+        m_pendingOpCount--;
+    }
+    if (!state || !state->completionListener) {
+        // from a canceled request
+        if (hasBuffer) {
+            releaseReceiveBuffer(bufferId);
+        }
+        return;
+    }
+
+    chunk data;
+    std::vector<int> fds;
+    if (hasBuffer && cqe.res > 0) {
+        byte *const buffer = m_buffers + bufferId * ReceiveBufferSize;
+        if (state->receiveFds) {
+            data = parseReceivedMessage(buffer, uint32(cqe.res), &fds);
+        } else {
+            data = chunk(buffer, uint32(cqe.res));
+        }
+    }
+    if (data.length) {
+        state->completionListener->handleReceiveCompleted(data, bufferId, std::move(fds));
+        queueNotification(fd, uint32(IO::RW::Read));
+    } else {
+        closeFileDescriptors(&fds); // can't happen, file descriptors arrive with data
+        if (hasBuffer) {
+            releaseReceiveBuffer(bufferId);
+        }
+    }
+    if (!isLast) {
+        return;
+    }
+
+    state->receiveArmed = false;
+    if (cqe.res == -ENOBUFS) {
+        // Received data is waiting to be read, and more is coming in than can be buffered. Let the
+        // listener read directly for now, which is also fair to other file descriptors.
+        state->receiveStarved = true;
+        m_starvedFds.push_back(fd);
+        queueUpdate(fd);
+        queueNotification(fd, uint32(IO::RW::Read));
+    } else if (data.length) {
+        // the kernel may end a multishot request for reasons such as a full completion queue
+        queueUpdate(fd);
+    } else {
+        // end of stream or an error
+        state->receiveFinished = true;
+        state->completionListener->handleReceiveFinished();
+        queueNotification(fd, uint32(IO::RW::Read));
+    }
+}
+
+uint32 IoUringEventPoller::send(FileDescriptor fd, const chunk *data, uint32 chunkCount,
+                                const std::vector<int> &fileDescriptors)
+{
+    FdState *const state = completionIoState(fd);
+    assert(state);
+    if (!state) {
+        return 0;
+    }
+    if (!state->sends) {
+        state->sends.reset(new PendingSends);
+        state->sends->fd = fd;
+        state->sends->userData = requestUserData(SendRequest, fd, state->generation);
+    }
+    PendingSends *const sends = state->sends.get();
+    if (sends->byteCount >= MaxUnsentBytes) {
+        return 0;
+    }
+    size_t length = 0;
+    for (uint32 i = 0; i < chunkCount; i++) {
+        length += data[i].length;
+    }
+    length = std::min(length, MaxUnsentBytes - sends->byteCount);
+    if (!length) {
+        return 0;
+    }
+
+    // File descriptors go with the first byte of a request, and a request that is in flight can't
+    // be changed anymore
+    if (sends->ops.empty() || !fileDescriptors.empty() || (sends->inFlight && sends->ops.size() == 1)) {
+        sends->ops.emplace_back();
+        SendOp &op = sends->ops.back();
+        // the caller may close its file descriptors as soon as we return, as after sendmsg()
+        for (const int passedFd : fileDescriptors) {
+            const int dupFd = fcntl(passedFd, F_DUPFD_CLOEXEC, 0);
+            if (dupFd < 0) {
+                closeFileDescriptors(&op.fileDescriptors);
+                sends->ops.pop_back();
+                return 0; // try again later
+            }
+            op.fileDescriptors.push_back(dupFd);
+        }
+    }
+    std::vector<byte> &opData = sends->ops.back().data;
+    opData.reserve(opData.size() + length);
+    size_t remaining = length;
+    for (uint32 i = 0; i < chunkCount && remaining; i++) {
+        const size_t count = std::min(size_t(data[i].length), remaining);
+        opData.insert(opData.end(), data[i].ptr, data[i].ptr + count);
+        remaining -= count;
+    }
+    sends->byteCount += length;
+    submitSend(sends);
+    return uint32(length);
+}
+
+bool IoUringEventPoller::canSend(FileDescriptor fd) const
+{
+    const FdState *const state = completionIoState(fd);
+    return state && (!state->sends || state->sends->byteCount < MaxUnsentBytes);
+}
+
+void IoUringEventPoller::submitSend(PendingSends *sends)
+{
+    if (sends->inFlight || sends->ops.empty()) {
+        return;
+    }
+    const SendOp &op = sends->ops.front();
+    io_uring_sqe *const sqe = nextSqe();
+    sqe->fd = sends->fd;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = sends->userData;
+    if (op.fileDescriptors.empty()) {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = reinterpret_cast<uint64_t>(op.data.data() + sends->frontSent);
+        sqe->len = uint32(op.data.size() - sends->frontSent);
+    } else {
+        assert(sends->frontSent == 0);
+        const size_t fdPayloadSize = op.fileDescriptors.size() * sizeof(int);
+        sends->control.assign((CMSG_SPACE(fdPayloadSize) + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+        sends->iov.iov_base = const_cast<byte *>(op.data.data());
+        sends->iov.iov_len = op.data.size();
+        memset(&sends->msg, 0, sizeof(sends->msg));
+        sends->msg.msg_iov = &sends->iov;
+        sends->msg.msg_iovlen = 1;
+        sends->msg.msg_control = sends->control.data();
+        sends->msg.msg_controllen = CMSG_SPACE(fdPayloadSize);
+
+        cmsghdr *const c_msg = CMSG_FIRSTHDR(&sends->msg);
+        c_msg->cmsg_len = CMSG_LEN(fdPayloadSize);
+        c_msg->cmsg_level = SOL_SOCKET;
+        c_msg->cmsg_type = SCM_RIGHTS;
+        memcpy(CMSG_DATA(c_msg), op.fileDescriptors.data(), fdPayloadSize);
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = reinterpret_cast<uint64_t>(&sends->msg);
+        sqe->len = 1;
+    }
+    sends->inFlight = true;
+    m_pendingOpCount++;
+}
+
+void IoUringEventPoller::handleSendCompletion(const io_uring_cqe &cqe, FileDescriptor fd)
+{
+    m_pendingOpCount--;
+    FdState *state = size_t(fd) < m_fdStates.size() ? &m_fdStates[fd] : nullptr;
+    PendingSends *sends = nullptr;
+    auto detached = m_detachedSends.end();
+    if (state && state->sends && state->sends->userData == cqe.user_data) {
+        sends = state->sends.get();
+    } else {
+        state = nullptr;
+        detached = std::find_if(m_detachedSends.begin(), m_detachedSends.end(),
+                                [&cqe] (const std::unique_ptr<PendingSends> &s) {
+                                    return s->userData == cqe.user_data; });
+        assert(detached != m_detachedSends.end());
+        if (detached == m_detachedSends.end()) {
+            return;
+        }
+        sends = detached->get();
+    }
+    sends->inFlight = false;
+
+    if (cqe.res <= 0 || m_isDestroying) {
+        // The connection is broken (or we are going away); nothing more can be sent
+        for (SendOp &op : sends->ops) {
+            closeFileDescriptors(&op.fileDescriptors);
+        }
+        sends->ops.clear();
+        sends->frontSent = 0;
+        sends->byteCount = 0;
+        if (state) {
+            if (cqe.res <= 0) {
+                state->completionListener->handleSendFailed();
+                queueNotification(fd, uint32(IO::RW::Read) | uint32(IO::RW::Write));
+            }
+        } else {
+            m_detachedSends.erase(detached);
+        }
+        return;
+    }
+
+    const bool wasFull = sends->byteCount >= MaxUnsentBytes;
+    SendOp &op = sends->ops.front();
+    // the file descriptors have been sent with the first byte, the receiver has its own copies now
+    closeFileDescriptors(&op.fileDescriptors);
+    sends->frontSent += size_t(cqe.res);
+    sends->byteCount -= size_t(cqe.res);
+    if (sends->frontSent == op.data.size()) {
+        sends->ops.pop_front();
+        sends->frontSent = 0;
+    }
+    submitSend(sends);
+    if (state) {
+        if (wasFull) {
+            queueNotification(fd, uint32(IO::RW::Write));
+        }
+    } else if (!sends->inFlight) {
+        m_detachedSends.erase(detached);
+    }
+}
+
+void IoUringEventPoller::detachSends(FdState *state)
+{
+    std::unique_ptr<PendingSends> sends = std::move(state->sends);
+    if (!sends || !sends->inFlight) {
+        assert(!sends || sends->ops.empty());
+        return;
+    }
+    // Data that the listener considers written should still arrive, as after write() and close() of a
+    // socket. The in-flight request keeps the socket open; a duplicate is needed for further requests.
+    if (sends->ops.size() > 1) {
+        sends->fd = fcntl(sends->fd, F_DUPFD_CLOEXEC, 0);
+        sends->ownsFd = true;
+        // if that failed, the next request will fail and everything will be discarded
+    }
+    m_detachedSends.push_back(std::move(sends));
+}
+
+uint32 IoUringEventPoller::waitForCompletions(FileDescriptor fd, int timeoutMsecs)
+{
+    const uint64 deadline = PlatformTime::monotonicMsecs() + uint64(std::max(timeoutMsecs, 0));
+    m_waitFd = fd;
+    m_waitIo = 0;
+    updatePollRequests();
+    submit(0, 0);
+    reapCompletions();
+    while (!m_waitIo) {
+        int remaining = -1;
+        if (timeoutMsecs >= 0) {
+            const uint64 now = PlatformTime::monotonicMsecs();
+            if (now >= deadline) {
+                break;
+            }
+            remaining = int(deadline - now);
+        }
+        updatePollRequests();
+        submit(1, remaining);
+        reapCompletions();
+    }
+    m_waitFd = -1;
+    return m_waitIo;
+}
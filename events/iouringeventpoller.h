@@ -0,0 +1,205 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef IOURINGEVENTPOLLER_H
+#define IOURINGEVENTPOLLER_H
+
+#include "ieventpoller.h"
+#include "iiocompletionsource.h"
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class IIoEventListener;
+
+// Readiness notification through io_uring poll requests. Compared to EpollEventPoller, interest
+// changes don't need a syscall each; they are submitted in one batch together with waiting for events.
+// Listeners that drain the socket on each notification (IIoEventListener::drainsIoOnReady()) get a
+// multishot poll that stays armed, others get a oneshot poll that is re-armed after each notification,
+// which gives the same level-triggered behavior as epoll without EPOLLET.
+// File descriptors switched to completion-based I/O (see IIoCompletionSource) have a multishot receive
+// request armed instead that picks buffers from a ring shared with the kernel, and their sends are
+// submitted together with everything else.
+class IoUringEventPoller : public IEventPoller, public IIoCompletionSource
+{
+public:
+    // Returns nullptr if io_uring or a required feature of it is not available
+    static IoUringEventPoller *create(EventDispatcher *dispatcher);
+    ~IoUringEventPoller() override;
+
+    IEventPoller::InterruptAction poll(int timeout) override;
+    void interrupt(IEventPoller::InterruptAction) override;
+
+    // reimplemented from IEventPoller
+    void addFileDescriptor(FileDescriptor fd, uint32 ioRw) override;
+    void removeFileDescriptor(FileDescriptor fd) override;
+    void setReadWriteInterest(FileDescriptor fd, uint32 ioRw) override;
+    // Returns nullptr if the kernel doesn't support everything that is needed for it
+    IIoCompletionSource *ioCompletionSource() override;
+
+    // reimplemented from IIoCompletionSource
+    bool startCompletionIo(FileDescriptor fd, IIoCompletionListener *listener,
+                           uint32 maxFileDescriptors) override;
+    bool isReceiveStarved(FileDescriptor fd) const override;
+    void releaseReceiveBuffer(uint32 bufferId) override;
+    uint32 send(FileDescriptor fd, const chunk *data, uint32 chunkCount,
+                const std::vector<int> &fileDescriptors) override;
+    bool canSend(FileDescriptor fd) const override;
+    uint32 waitForCompletions(FileDescriptor fd, int timeoutMsecs) override;
+
+private:
+    explicit IoUringEventPoller(EventDispatcher *dispatcher);
+    bool setup();
+    bool setupCompletionIo();
+    bool probeMultishotReceive();
+
+    struct SendOp
+    {
+        std::vector<byte> data;
+        std::vector<int> fileDescriptors; // duplicates, sent with the first byte of data
+    };
+
+    // The data of a send request must stay valid until the request has completed, which may be after
+    // the file descriptor has been removed, so this is separate from FdState. Only one request per
+    // file descriptor is in flight at a time because the order of concurrent sends is not guaranteed.
+    struct PendingSends
+    {
+        ~PendingSends();
+        FileDescriptor fd = -1;
+        bool ownsFd = false; // a duplicate, after the original file descriptor was removed
+        uint64_t userData = 0;
+        std::deque<SendOp> ops;
+        size_t frontSent = 0; // of ops.front()
+        size_t byteCount = 0; // not sent yet
+        bool inFlight = false;
+        // for IORING_OP_SENDMSG
+        msghdr msg;
+        iovec iov;
+        std::vector<uint64_t> control; // uint64_t for the alignment of cmsghdr
+    };
+
+    struct FdState
+    {
+        IIoEventListener *listener = nullptr;
+        // part of the user_data of requests, to recognize completions of canceled requests
+        uint32 generation = 0;
+        uint32 ioRw = 0;
+        uint32 armedPollMask = 0;
+        bool multishot = false;
+        bool armed = false;
+        bool needsRearm = false; // multishot only: readiness may have been ignored while uninterested
+        bool queued = false; // in m_fdsToUpdate
+        bool notifyQueued = false; // in m_fdsToNotify
+        uint32 pendingIo = 0; // IO::RW flags to notify the listener of
+
+        // completion-based I/O
+        IIoCompletionListener *completionListener = nullptr;
+        bool receiveFds = false;
+        bool receiveArmed = false;
+        bool receiveStarved = false; // ran out of buffers, the listener reads directly for now
+        bool receiveFinished = false;
+        std::unique_ptr<PendingSends> sends;
+    };
+
+    io_uring_sqe *nextSqe();
+    int submit(uint32 minComplete, int timeout);
+    void reapCompletions();
+    void queueUpdate(FileDescriptor fd);
+    void updatePollRequests();
+    void armPoll(FileDescriptor fd, FdState *state, uint32 pollMask);
+    void cancelPoll(FileDescriptor fd, FdState *state);
+    void cancelRequest(uint64_t userData);
+    void cancelAllRequests();
+    IEventPoller::InterruptAction takeInterrupt();
+    void handleCompletion(const io_uring_cqe &cqe);
+    void handlePollCompletion(const io_uring_cqe &cqe, FileDescriptor fd, FdState *state);
+    void queueNotification(FileDescriptor fd, uint32 ioRw);
+    void dispatchPendingIo();
+
+    FdState *completionIoState(FileDescriptor fd);
+    const FdState *completionIoState(FileDescriptor fd) const;
+    void prepareReceive(io_uring_sqe *sqe, FileDescriptor fd, bool receiveFds);
+    void updateReceiveRequest(FileDescriptor fd, FdState *state);
+    void handleReceiveCompletion(const io_uring_cqe &cqe, FileDescriptor fd, FdState *state);
+    chunk parseReceivedMessage(byte *buffer, uint32 length, std::vector<int> *fileDescriptors);
+    void submitSend(PendingSends *sends);
+    void handleSendCompletion(const io_uring_cqe &cqe, FileDescriptor fd);
+    void detachSends(FdState *state);
+
+    FileDescriptor m_ringFd = -1;
+    FileDescriptor m_interruptEventFd = -1;
+    bool m_interruptArmed = false;
+    bool m_interruptCompleted = false;
+    // the strongest InterruptAction requested since the last wakeup, see EpollEventPoller
+    std::atomic<int> m_pendingInterrupt;
+
+    // memory shared with the kernel; the completion queue ring is in the same mapping as the
+    // submission queue ring
+    void *m_ringMemory = nullptr;
+    std::size_t m_ringMemorySize = 0;
+    io_uring_sqe *m_sqes = nullptr;
+    std::size_t m_sqesSize = 0;
+
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned *m_sqArray = nullptr;
+
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+
+    // indexed by file descriptor, which are small integers
+    std::vector<FdState> m_fdStates;
+    std::vector<FileDescriptor> m_fdsToUpdate;
+    std::vector<FileDescriptor> m_fdsToNotify;
+    std::vector<FileDescriptor> m_fdsNotifying;
+
+    // completion-based I/O
+    bool m_hasCompletionIo = false;
+    bool m_isDestroying = false;
+    // receive buffers provided to the kernel through a ring; also shared memory. The ring is an array
+    // of io_uring_buf, not io_uring_buf_ring, whose flexible array member is misplaced in C++.
+    io_uring_buf *m_bufferRing = nullptr;
+    byte *m_buffers = nullptr;
+    uint32 m_bufferRingTail = 0;
+    uint32 m_freeBufferCount = 0;
+    msghdr m_receiveMsg; // parameters of IORING_OP_RECVMSG
+    std::vector<FileDescriptor> m_starvedFds;
+    std::vector<std::unique_ptr<PendingSends>> m_detachedSends;
+    // receives and sends that use memory that we own and haven't completed yet
+    uint32 m_pendingOpCount = 0;
+    // for waitForCompletions()
+    FileDescriptor m_waitFd = -1;
+    uint32 m_waitIo = 0;
+};
+
+#endif // IOURINGEVENTPOLLER_H
@@ -41,15 +41,15 @@ Timer::Timer(EventDispatcher *dispatcher)
      m_isRunning(false),
      m_isRepeating(true),
      m_nextDueTime(0),
-     m_serial(0)
+     m_list(nullptr),
+     m_prev(nullptr),
+     m_next(nullptr)
 {
 }
 
 Timer::~Timer()
 {
-    // Rationale for "|| m_reentrancyGuard": While triggered, we must be removed from the event
-    // dispatcher's timer map before it may dereference the then dangling pointer to this Timer.
-    if (m_isRunning || m_reentrancyGuard) {
+    if (m_isRunning) {
         EventDispatcherPrivate::get(m_eventDispatcher)->removeTimer(this);
     }
 
@@ -152,11 +152,11 @@ int Timer::remainingTime() const
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdangling-pointer"
 #endif
-void Timer::trigger()
+bool Timer::trigger()
 {
     assert(m_isRunning);
     if (m_reentrancyGuard) {
-        return;
+        return true;
     }
     if (!m_isRepeating) {
         m_isRunning = false;
@@ -174,6 +174,7 @@ void Timer::trigger()
         assert(m_reentrancyGuard);
         m_reentrancyGuard = nullptr;
     }
+    return alive;
 }
 #ifdef GCC_12
 #pragma GCC diagnostic pop
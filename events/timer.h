@@ -29,6 +29,8 @@
 class EventDispatcher;
 class EventDispatcherPrivate;
 class ICompletionListener;
+struct TimerList;
+class TimerWheel;
 
 class DFERRY_EXPORT Timer
 {
@@ -60,17 +62,19 @@ public:
 
 private:
     friend class EventDispatcherPrivate;
-    void trigger();
+    friend class TimerWheel;
+    bool trigger(); // returns false if the timer was destroyed in the callback
     EventDispatcher *m_eventDispatcher; // TODO make a per-thread event dispatcher implicit?
     ICompletionListener *m_completionListener;
     bool *m_reentrancyGuard;
     int m_interval;
     bool m_isRunning : 1;
     bool m_isRepeating : 1;
-    uint32 m_reserved : sizeof(uint32) - 2;
-    inline uint64 tag() { return (m_nextDueTime << 10) + m_serial; }
-    uint64 m_nextDueTime : 54;
-    uint32 m_serial : 10;
+    uint64 m_nextDueTime;
+    // the TimerWheel list that this timer is in, if any
+    TimerList *m_list;
+    Timer *m_prev;
+    Timer *m_next;
 };
 
 #endif // TIMER_H
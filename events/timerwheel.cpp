@@ -0,0 +1,268 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "timerwheel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static int lowestSetBit(uint64 word)
+{
+    assert(word);
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return int(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+TimerWheel::TimerWheel(uint64 currentTime)
+   : m_time(currentTime)
+{
+    for (int i = 0; i < LevelCount * SlotsPerLevel; i++) {
+        m_slots[i].slot = i;
+    }
+    memset(m_occupiedSlots, 0, sizeof(m_occupiedSlots));
+}
+
+void TimerWheel::append(TimerList *list, Timer *timer)
+{
+    assert(!timer->m_list);
+    timer->m_list = list;
+    timer->m_prev = list->last;
+    timer->m_next = nullptr;
+    if (list->last) {
+        list->last->m_next = timer;
+    } else {
+        list->first = timer;
+    }
+    list->last = timer;
+}
+
+void TimerWheel::add(Timer *timer)
+{
+    const uint64 due = timer->m_nextDueTime;
+    if (due <= m_time) {
+        append(&m_due, timer);
+        return;
+    }
+    if (m_nextDueTime && due < m_nextDueTime) {
+        m_nextDueTime = due;
+    }
+    // The level is the lowest one on which the due time is in the current block
+    const uint64 differentBits = due ^ m_time;
+    for (int level = 0; level < LevelCount; level++) {
+        if ((differentBits >> (LevelBits * (level + 1))) == 0) {
+            const int index = int((due >> (LevelBits * level)) & SlotMask);
+            m_occupiedSlots[level][index / 64] |= uint64(1) << (index % 64);
+            append(&m_slots[level * SlotsPerLevel + index], timer);
+            return;
+        }
+    }
+    append(&m_overflow, timer);
+}
+
+void TimerWheel::remove(Timer *timer)
+{
+    TimerList *const list = timer->m_list;
+    if (!list) {
+        return;
+    }
+    if (timer->m_nextDueTime == m_nextDueTime) {
+        m_nextDueTime = 0;
+    }
+    if (timer->m_prev) {
+        timer->m_prev->m_next = timer->m_next;
+    } else {
+        list->first = timer->m_next;
+    }
+    if (timer->m_next) {
+        timer->m_next->m_prev = timer->m_prev;
+    } else {
+        list->last = timer->m_prev;
+    }
+    timer->m_list = nullptr;
+    timer->m_prev = nullptr;
+    timer->m_next = nullptr;
+
+    if (!list->first) {
+        clearOccupiedBit(list);
+    }
+}
+
+void TimerWheel::clearOccupiedBit(const TimerList *list)
+{
+    if (list->slot >= 0) {
+        const int level = list->slot / SlotsPerLevel;
+        const int index = list->slot % SlotsPerLevel;
+        m_occupiedSlots[level][index / 64] &= ~(uint64(1) << (index % 64));
+    }
+}
+
+void TimerWheel::moveToDue(TimerList *list)
+{
+    if (!list->first) {
+        return;
+    }
+    for (Timer *timer = list->first; timer; timer = timer->m_next) {
+        timer->m_list = &m_due;
+    }
+    if (m_due.last) {
+        m_due.last->m_next = list->first;
+        list->first->m_prev = m_due.last;
+    } else {
+        m_due.first = list->first;
+    }
+    m_due.last = list->last;
+    list->first = nullptr;
+    list->last = nullptr;
+
+    clearOccupiedBit(list);
+    m_nextDueTime = 0;
+}
+
+void TimerWheel::takeDue(TimerList *list)
+{
+    assert(list->slot < 0);
+    for (Timer *timer = m_due.first; timer; ) {
+        Timer *const next = timer->m_next;
+        timer->m_list = nullptr;
+        append(list, timer);
+        timer = next;
+    }
+    m_due.first = nullptr;
+    m_due.last = nullptr;
+}
+
+void TimerWheel::redistribute(TimerList *list)
+{
+    Timer *timer = list->first;
+    list->first = nullptr;
+    list->last = nullptr;
+    clearOccupiedBit(list);
+    // Going through the list in order and appending keeps the order of timers with the same due time.
+    // The target lists are either empty or only contain timers from higher levels that have been
+    // redistributed right before, which were added even earlier.
+    while (timer) {
+        Timer *const next = timer->m_next;
+        timer->m_list = nullptr;
+        add(timer);
+        timer = next;
+    }
+}
+
+int TimerWheel::firstOccupiedSlot(int level) const
+{
+    // All occupied slots are after the slot that contains m_time: due timers are in m_due, and timers
+    // in earlier slots would belong to the next block of the next level.
+    for (int i = 0; i < BitmapWords; i++) {
+        const uint64 word = m_occupiedSlots[level][i];
+        if (word) {
+            return i * 64 + lowestSetBit(word);
+        }
+    }
+    return -1;
+}
+
+void TimerWheel::enterNextBlock()
+{
+    assert((m_time & SlotMask) == SlotMask);
+    m_time++;
+    // Find the highest level on which a new block has been entered, then redistribute the slots of the
+    // new blocks from the top down.
+    int level = 1;
+    while (level < LevelCount && ((m_time >> (LevelBits * level)) & SlotMask) == 0) {
+        level++;
+    }
+    if (level == LevelCount) {
+        redistribute(&m_overflow);
+        level--;
+    }
+    for (; level >= 1; level--) {
+        const int index = int((m_time >> (LevelBits * level)) & SlotMask);
+        redistribute(&m_slots[level * SlotsPerLevel + index]);
+    }
+}
+
+void TimerWheel::advance(uint64 currentTime)
+{
+    while (m_time < currentTime) {
+        if ((m_time & SlotMask) == SlotMask) {
+            // Timers that are due right at the start of the block go to m_due while redistributing
+            enterNextBlock();
+            continue;
+        }
+        const uint64 blockStart = m_time & ~uint64(SlotMask);
+        const int index = firstOccupiedSlot(0);
+        if (index >= 0 && blockStart + uint64(index) <= currentTime) {
+            assert(blockStart + uint64(index) > m_time);
+            m_time = blockStart + uint64(index);
+            moveToDue(&m_slots[index]);
+        } else {
+            m_time = std::min(currentTime, blockStart + SlotMask);
+        }
+    }
+}
+
+uint64 TimerWheel::nextWakeupTime() const
+{
+    if (m_due.first) {
+        return 0;
+    }
+    if (m_nextDueTime) {
+        return m_nextDueTime;
+    }
+    // The levels and the slots in each level cover consecutive ranges of time, so the earliest timer is
+    // in the first occupied slot of the lowest occupied level. On level 0, all timers in a slot have the
+    // same due time.
+    const TimerList *list = nullptr;
+    for (int level = 0; level < LevelCount && !list; level++) {
+        const int index = firstOccupiedSlot(level);
+        if (index >= 0) {
+            list = &m_slots[level * SlotsPerLevel + index];
+            if (level == 0) {
+                m_nextDueTime = list->first->m_nextDueTime;
+                return m_nextDueTime;
+            }
+        }
+    }
+    if (!list) {
+        list = &m_overflow;
+    }
+    if (!list->first) {
+        return ~uint64(0);
+    }
+    uint64 ret = ~uint64(0);
+    for (const Timer *timer = list->first; timer; timer = timer->m_next) {
+        ret = std::min(ret, timer->m_nextDueTime);
+    }
+    m_nextDueTime = ret;
+    return ret;
+}
@@ -0,0 +1,111 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "timer.h"
+#include "types.h"
+
+// A doubly linked list of Timers, linked through Timer::m_prev and Timer::m_next
+struct TimerList
+{
+    Timer *first = nullptr;
+    Timer *last = nullptr;
+    int slot = -1; // index into TimerWheel::m_slots for the wheel's slots, -1 for other lists
+};
+
+// Hierarchical timing wheel with millisecond resolution. Each level has 256 slots, a slot on level n
+// covers 256^n milliseconds. Level 0 holds the timers that are due in the current 256 ms block, level 1
+// those in the current 65536 ms block, and so on. When time advances into a new block, the slot of the
+// next level up is redistributed to the lower levels. Timers that are due more than 2^32 ms (about 49
+// days) ahead go into an overflow list.
+// Adding and removing are O(1). Timers with the same due time are in the same list, in the order in
+// which they were added, so they become due in that order.
+class TimerWheel
+{
+public:
+    explicit TimerWheel(uint64 currentTime);
+
+    // Adds a timer according to its m_nextDueTime. If that is not in the future of the wheel's time,
+    // it goes directly into the due list.
+    void add(Timer *timer);
+    // Removes the timer from whatever list it is in, if any - that may also be a list passed to takeDue()
+    void remove(Timer *timer);
+
+    // Moves all timers that are due at or before currentTime to the due list, in order of due time
+    void advance(uint64 currentTime);
+    // Moves the contents of the due list to the end of list
+    void takeDue(TimerList *list);
+
+    // The earliest due time of all timers, 0 if there is a due timer, ~0 if there is no timer at all.
+    // Finding it can take a search through the timers of one slot, the result is cached until it changes.
+    uint64 nextWakeupTime() const;
+
+    template<typename F>
+    void forEachTimer(F func) const;
+
+private:
+    enum {
+        LevelBits = 8,
+        SlotsPerLevel = 1 << LevelBits,
+        SlotMask = SlotsPerLevel - 1,
+        LevelCount = 4,
+        BitmapWords = SlotsPerLevel / 64
+    };
+
+    static void append(TimerList *list, Timer *timer);
+    // removes all timers from the list and adds them again, which moves them to a lower level
+    void redistribute(TimerList *list);
+    void moveToDue(TimerList *list);
+    void clearOccupiedBit(const TimerList *list); // for wheel slots only, no-op for other lists
+    int firstOccupiedSlot(int level) const; // returns -1 if the level is empty
+    void enterNextBlock();
+
+    uint64 m_time; // timers due at or before this time are in m_due
+    TimerList m_due;
+    TimerList m_overflow;
+    TimerList m_slots[LevelCount * SlotsPerLevel];
+    // which slots are non-empty, to find the next due timer quickly
+    uint64 m_occupiedSlots[LevelCount][BitmapWords];
+    mutable uint64 m_nextDueTime = 0; // cache for nextWakeupTime(), 0 if unknown
+};
+
+template<typename F>
+void TimerWheel::forEachTimer(F func) const
+{
+    const auto forEachInList = [&func] (const TimerList &list) {
+        for (Timer *timer = list.first; timer; ) {
+            Timer *const next = timer->m_next; // func may unlink timer
+            func(timer);
+            timer = next;
+        }
+    };
+    forEachInList(m_due);
+    forEachInList(m_overflow);
+    for (const TimerList &list : m_slots) {
+        forEachInList(list);
+    }
+}
+
+#endif // TIMERWHEEL_H
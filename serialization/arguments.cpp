@@ -30,6 +30,7 @@
 #include "message.h"
 #include "platform.h"
 #include "stringtools.h"
+#include "stringvalidation.h"
 
 #include <algorithm>
 #include <cassert>
@@ -605,13 +606,7 @@ bool Arguments::isStringValid(cstring string)
     if (!string.ptr || string.length + 1 >= MaxArrayLength || string.ptr[string.length] != 0) {
         return false;
     }
-    // check that there are no embedded nulls, exploiting the highly optimized strlen...
-    return strlen(string.ptr) == string.length;
-}
-
-static inline bool isObjectNameLetter(char c)
-{
-    return likely((c >= 'a' && c <= 'z') || c == '_' || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'));
+    return isValidUtf8WithoutNul(string);
 }
 
 // static
@@ -620,41 +615,13 @@ bool Arguments::isObjectPathValid(cstring path)
     if (!path.ptr || path.length + 1 >= MaxArrayLength || path.ptr[path.length] != 0) {
         return false;
     }
-    char prevLetter = path.ptr[0];
-    if (prevLetter != '/') {
-        return false;
-    }
-    if (path.length == 1) {
-        return true; // "/" special case
-    }
-    for (uint32 i = 1; i < path.length; i++) {
-        char currentLetter = path.ptr[i];
-        if (prevLetter == '/') {
-            if (!isObjectNameLetter(currentLetter)) {
-                return false;
-            }
-        } else {
-            if (currentLetter != '/' && !isObjectNameLetter(currentLetter)) {
-                return false;
-            }
-        }
-        prevLetter = currentLetter;
-    }
-    return prevLetter != '/';
+    return isValidObjectPath(path);
 }
 
 // static
 bool Arguments::isObjectPathElementValid(cstring pathElement)
 {
-    if (!pathElement.length) {
-        return false;
-    }
-    for (uint32 i = 0; i < pathElement.length; i++) {
-        if (!isObjectNameLetter(pathElement.ptr[i])) {
-            return false;
-        }
-    }
-    return true;
+    return isValidObjectPathElement(pathElement);
 }
 
 static bool parseBasicType(cstring *s)
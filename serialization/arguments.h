@@ -34,6 +34,7 @@
 class Error;
 class Message;
 class MessagePrivate;
+class StructArrayLayout;
 
 //#define WITH_DICT_ENTRY
 
@@ -154,6 +155,16 @@ public:
 
     static void copyOneElement(Reader *reader, Writer *writer);
 
+    // Describes how an array of structs with a fixed size on the wire, for example "a(uuxd)", is laid
+    // out in memory, for Reader::readStructArray() and Writer::writeStructArray(). The struct may only
+    // contain primitive types except booleans and Unix file descriptors, and nested structs of those.
+    struct StructLayout
+    {
+        cstring signature; // of one struct including the parentheses, null-terminated
+        const uint32 *fieldOffsets; // offset in memory of each primitive field, in signature order
+        uint32 stride; // distance in memory between consecutive structs, usually sizeof(TheStruct)
+    };
+
 private:
     struct podCstring // Same as cstring but without ctor.
                       // Can't put the cstring type into a union because it has a constructor :/
@@ -274,7 +285,9 @@ public:
         // with replaceData().
         // If the array is empty, that does not constitute a special case with this function: It will return
         // the type in the first return value as usual and an empty chunk in the second return value.
-        // (### it might be possible to extend this feature to all fixed-length types including structs)
+        // Byte-swapped data can only be returned for arrays of bytes; see
+        // Message::convertToNativeByteOrder() to avoid that restriction.
+        // For arrays of structs with a fixed size on the wire, see readStructArray().
         std::pair<Arguments::IoState, chunk> readPrimitiveArray();
         // In state BeginArray, check if the array is a primitive array, in order to check whether to use
         // readPrimitiveArray(). Returns a primitive type if readPrimitiveArray() will succeed, BeginArray
@@ -284,6 +297,26 @@ public:
         // instead of the type of primitive.
         Arguments::IoState peekPrimitiveArray(EmptyArrayOption option = SkipIfEmpty) const;
 
+        // In state BeginArray of an array of structs described by layout, returns true and the number of
+        // elements in count. Otherwise returns false, which does not put the reader in InvalidData state.
+        bool peekStructArray(const StructLayout &layout, uint32 *count) const;
+        // Reads a whole array of structs described by layout into output, which must have room for the
+        // number of elements returned by peekStructArray(), and leaves the array. The data is copied in
+        // one piece if the layout in memory matches the one on the wire, and field by field otherwise.
+        // Byte-swapped data is supported. Returns false if peekStructArray() would return false, without
+        // changing state, or if the padding is not zero, which does put the reader in InvalidData state.
+        bool readStructArray(const StructLayout &layout, void *output);
+        template<typename T>
+        bool readStructArray(const StructLayout &layout, std::vector<T> *output)
+        {
+            uint32 count;
+            if (layout.stride != sizeof(T) || !peekStructArray(layout, &count)) {
+                return false;
+            }
+            output->resize(count);
+            return readStructArray(layout, static_cast<void *>(output->data()));
+        }
+
 #ifdef WITH_DICT_ENTRY
         void beginDictEntry();
         void endDictEntry();
@@ -300,6 +333,8 @@ public:
         void beginArrayOrDict(bool isDict, EmptyArrayOption option);
         void skipArrayOrDictSignature(bool isDict);
         void skipArrayOrDict(bool isDict);
+        bool skipFixedSizeStruct();
+        bool resolveStructArray(const StructLayout &layout, StructArrayLayout *resolved, uint32 *count) const;
 
         Private *d;
 
@@ -374,6 +409,16 @@ public:
         void writeUnixFd(int32 fd);
 
         void writePrimitiveArray(IoState type, chunk data);
+        // Writes count structs described by layout from input as an array, in one piece if the layout in
+        // memory matches the one on the wire, and field by field otherwise. An empty array is written
+        // with its type. Invalid layouts result in Error::NotPrimitiveType.
+        void writeStructArray(const StructLayout &layout, const void *input, uint32 count);
+        template<typename T>
+        void writeStructArray(const StructLayout &layout, const std::vector<T> &input)
+        {
+            assert(layout.stride == sizeof(T));
+            writeStructArray(layout, static_cast<const void *>(input.data()), uint32(input.size()));
+        }
 
         // Return the current serialized data; if the current state of writing has any aggregates open
         // OR is in an error state, return an empty chunk (instead of invalid serialized data).
@@ -418,6 +463,7 @@ public:
     class Private;
 
 private:
+    friend class TypedArgumentsBase;
     Private *d;
 };
 
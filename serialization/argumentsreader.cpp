@@ -29,8 +29,11 @@
 #include "malloccache.h"
 #include "message.h"
 #include "platform.h"
+#include "signatureprogram.h"
+#include "structarray.h"
 
 #include <cstddef>
+#include <cstring>
 
 #ifdef HAVE_BOOST
 #include <boost/container/small_vector.hpp>
@@ -55,6 +58,16 @@ public:
     uint32 m_nilArrayNesting; // this keeps track of how many nil arrays we are in
     Error m_error;
     Nesting m_nesting;
+    std::shared_ptr<const SignatureProgram> m_program; // of the main signature
+
+    // Returns the program for m_signature if available, which is not the case inside variants
+    const SignatureProgram *currentProgram() const
+    {
+        if (m_program && m_program->isCompiled() && m_signature.ptr == m_args->d->m_signature.ptr) {
+            return m_program.get();
+        }
+        return nullptr;
+    }
 
     struct ArrayInfo
     {
@@ -170,7 +183,9 @@ void Arguments::Reader::beginRead()
     d->m_data = d->m_args->d->m_data;
     // as a slightly hacky optimizaton, we allow empty Argumentss to allocate no space for d->m_buffer.
     if (d->m_signature.length) {
-        VALID_IF(Arguments::isSignatureValid(d->m_signature), Error::InvalidSignature);
+        VALID_IF(d->m_signature.ptr[d->m_signature.length] == '\0', Error::InvalidSignature);
+        d->m_program = SignatureProgram::get(d->m_signature);
+        VALID_IF(d->m_program->isValid(Arguments::MethodSignature), Error::InvalidSignature);
     }
     advanceState();
 }
@@ -207,6 +222,13 @@ uint32 Arguments::Reader::currentSignaturePosition() const
 
 cstring Arguments::Reader::currentSingleCompleteTypeSignature() const
 {
+    if (const SignatureProgram *program = d->currentProgram()) {
+        if (d->m_signaturePosition >= d->m_signature.length ||
+            !program->op(d->m_signaturePosition).skip) {
+            return cstring();
+        }
+        return cstring(d->m_signature.ptr + d->m_signaturePosition, program->op(d->m_signaturePosition).skip);
+    }
     const uint32 startingLength = d->m_signature.length - d->m_signaturePosition;
     cstring sigCopy = { d->m_signature.ptr + d->m_signaturePosition, startingLength };
     Nesting nest;
@@ -318,7 +340,7 @@ void Arguments::Reader::doReadString(uint32 lengthPrefixSize)
     } else if (m_state == ObjectPath) {
         isValidString = Arguments::isObjectPathValid(cstring(m_u.String.ptr, m_u.String.length));
     } else if (m_state == Signature) {
-        isValidString = Arguments::isSignatureValid(cstring(m_u.String.ptr, m_u.String.length));
+        isValidString = SignatureProgram::isSignatureValid(cstring(m_u.String.ptr, m_u.String.length));
     }
     VALID_IF(isValidString, Error::MalformedMessageData);
 }
@@ -476,7 +498,7 @@ void Arguments::Reader::advanceState()
             if (unlikely(d->m_dataPosition > d->m_data.length)) {
                 goto out_needMoreData;
             }
-            VALID_IF(Arguments::isSignatureValid(signature, Arguments::VariantSignature),
+            VALID_IF(SignatureProgram::isSignatureValid(signature, Arguments::VariantSignature),
                      Error::MalformedMessageData);
         }
         // do not clobber nesting before potentially going to out_needMoreData!
@@ -564,12 +586,17 @@ void Arguments::Reader::skipArrayOrDictSignature(bool isDict)
         d->m_signaturePosition--;
     }
 
-    // parse the full (i.e. starting with the 'a') array (or dict) signature in order to skip it -
-    // barring bugs, must have been too deep nesting inside variants if parsing fails
-    cstring remainingSig(d->m_signature.ptr + d->m_signaturePosition,
-                         d->m_signature.length - d->m_signaturePosition);
-    VALID_IF(parseSingleCompleteType(&remainingSig, &d->m_nesting), Error::MalformedMessageData);
-    d->m_signaturePosition = d->m_signature.length - remainingSig.length;
+    if (const SignatureProgram *program = d->currentProgram()) {
+        // the main signature has been fully validated, including nesting, and we are not in a variant
+        d->m_signaturePosition += program->op(d->m_signaturePosition).skip;
+    } else {
+        // parse the full (i.e. starting with the 'a') array (or dict) signature in order to skip it -
+        // barring bugs, must have been too deep nesting inside variants if parsing fails
+        cstring remainingSig(d->m_signature.ptr + d->m_signaturePosition,
+                             d->m_signature.length - d->m_signaturePosition);
+        VALID_IF(parseSingleCompleteType(&remainingSig, &d->m_nesting), Error::MalformedMessageData);
+        d->m_signaturePosition = d->m_signature.length - remainingSig.length;
+    }
 
     // Compensate for pre-increment in advanceState()
     d->m_signaturePosition--;
@@ -713,6 +740,46 @@ Arguments::IoState Arguments::Reader::peekPrimitiveArray(EmptyArrayOption option
     return elementType.state();
 }
 
+bool Arguments::Reader::resolveStructArray(const StructLayout &layout, StructArrayLayout *resolved,
+                                           uint32 *count) const
+{
+    if (m_state != BeginArray) {
+        return false;
+    }
+    // the element signature must be the struct signature; both are valid single complete types, so it
+    // is enough to compare up to the length of the struct signature
+    const uint32 elementSignaturePosition = d->m_signaturePosition + 1;
+    if (d->m_signature.length - elementSignaturePosition < layout.signature.length ||
+        memcmp(d->m_signature.ptr + elementSignaturePosition, layout.signature.ptr,
+               layout.signature.length) != 0) {
+        return false;
+    }
+    return resolved->init(layout) && resolved->countForArrayLength(m_u.Uint32 - d->m_dataPosition, count);
+}
+
+bool Arguments::Reader::peekStructArray(const StructLayout &layout, uint32 *count) const
+{
+    StructArrayLayout resolved;
+    return resolveStructArray(layout, &resolved, count);
+}
+
+bool Arguments::Reader::readStructArray(const StructLayout &layout, void *output)
+{
+    StructArrayLayout resolved;
+    uint32 count;
+    if (!resolveStructArray(layout, &resolved, &count)) {
+        return false;
+    }
+    if (!resolved.scatter(static_cast<byte *>(output), d->m_data.ptr + d->m_dataPosition, count,
+                          d->m_args->d->m_isByteSwapped)) {
+        m_state = InvalidData;
+        d->m_error.setCode(Error::MalformedMessageData);
+        return false;
+    }
+    skipArrayOrDict(false);
+    return m_state != InvalidData;
+}
+
 bool Arguments::Reader::beginDict(EmptyArrayOption option)
 {
     if (unlikely(m_state != BeginDict)) {
@@ -820,11 +887,36 @@ void Arguments::Reader::skipStruct()
     if (unlikely(m_state != BeginStruct)) {
         m_state = InvalidData;
         d->m_error.setCode(Error::ReadWrongType);
-    } else {
+    } else if (!skipFixedSizeStruct()) {
         skipCurrentElement();
     }
 }
 
+bool Arguments::Reader::skipFixedSizeStruct()
+{
+    // In state BeginStruct, the data position is aligned and the signature position is at the '('.
+    // Like skipArray(), this doesn't look at the skipped data, so e.g. booleans are not validated.
+    const SignatureProgram *program = d->currentProgram();
+    if (!program) {
+        return false;
+    }
+    const SignatureProgram::Op &op = program->op(d->m_signaturePosition);
+    if (!op.fixedSize) {
+        return false;
+    }
+    if (likely(!d->m_nilArrayNesting)) {
+        if (d->m_dataPosition + op.fixedSize > d->m_data.length) {
+            return false; // let the slow path deal with it
+        }
+        d->m_dataPosition += op.fixedSize;
+    }
+    d->m_nesting.endParen();
+    // to the ')', compensating for the pre-increment in advanceState()
+    d->m_signaturePosition += op.skip - 1;
+    advanceState();
+    return true;
+}
+
 void Arguments::Reader::endStruct()
 {
     VALID_IF(m_state == EndStruct, Error::ReadWrongType);
@@ -897,6 +989,9 @@ void Arguments::Reader::skipCurrentElement()
             isDone = true;
             break;
         case Arguments::BeginStruct:
+            if (skipFixedSizeStruct()) {
+                break;
+            }
             beginStruct();
             nestingLevel++;
             break;
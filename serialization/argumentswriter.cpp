@@ -26,6 +26,8 @@
 
 #include "basictypeio.h"
 #include "malloccache.h"
+#include "signatureprogram.h"
+#include "structarray.h"
 
 #include <cstring>
 
@@ -134,9 +136,15 @@ public:
         // (QueuedDataInfo::LargestSize == 60) would start at an 8-byte aligned position (so 64)
         // instead of 60 where we want it in order to just write a contiguous block of data.
         memcpy(m_data + m_dataPosition, data.ptr, data.length);
-        m_dataPosition += data.length;
+        commitBulkData(data.length);
+    }
+
+    // Like appendBulkData(), for data that has already been written at m_dataPosition
+    void commitBulkData(uint32 length)
+    {
+        m_dataPosition += length;
         if (insideVariant()) {
-            for (uint32 l = data.length; l; ) {
+            for (uint32 l = length; l; ) {
                 uint32 chunkSize = std::min(l, uint32(QueuedDataInfo::LargestSize));
                 m_queuedData.push_back(QueuedDataInfo(1, chunkSize));
                 l -= chunkSize;
@@ -417,7 +425,7 @@ void Arguments::Writer::doWriteString(IoState type, uint32 lengthPrefixSize)
         VALID_IF(Arguments::isObjectPathValid(cstring(m_u.String.ptr, m_u.String.length)),
                  Error::InvalidObjectPath);
     } else if (type == Signature) {
-        VALID_IF(Arguments::isSignatureValid(cstring(m_u.String.ptr, m_u.String.length)),
+        VALID_IF(SignatureProgram::isSignatureValid(cstring(m_u.String.ptr, m_u.String.length)),
                  Error::InvalidSignature);
     }
 
@@ -964,6 +972,90 @@ void Arguments::Writer::writePrimitiveArray(IoState type, chunk data)
     endArray();
 }
 
+template<typename T>
+static T structFieldValue(const byte *element, const StructArrayLayout::Field &field)
+{
+    T ret = 0;
+    if (element) {
+        memcpy(&ret, element + field.memoryOffset, sizeof(T));
+    }
+    return ret;
+}
+
+void Arguments::Writer::writeStructArray(const StructLayout &layout, const void *input, uint32 count)
+{
+    StructArrayLayout resolved;
+    if (!resolved.init(layout)) {
+        m_state = InvalidData;
+        d->m_error.setCode(Error::NotPrimitiveType);
+        return;
+    }
+    if (resolved.arrayLength(count) > Arguments::MaxArrayLength) {
+        m_state = InvalidData;
+        d->m_error.setCode(Error::ArrayOrDictTooLong);
+        return;
+    }
+
+    beginArray(count ? NonEmptyArray : WriteTypesOfEmptyArray);
+
+    // Write the first element through the regular API, which takes care of the signature and of the
+    // bookkeeping inside variants. In an empty array, it only provides the types.
+    const byte *const memory = static_cast<const byte *>(input);
+    const byte *const first = count ? memory : nullptr;
+    const std::vector<StructArrayLayout::Field> &fields = resolved.fields();
+    uint32 fieldIndex = 0;
+    for (uint32 i = 0; i < layout.signature.length; i++) {
+        switch (layout.signature.ptr[i]) {
+        case '(':
+            beginStruct();
+            break;
+        case ')':
+            endStruct();
+            break;
+        case 'y':
+            writeByte(structFieldValue<byte>(first, fields[fieldIndex++]));
+            break;
+        case 'n':
+            writeInt16(structFieldValue<int16>(first, fields[fieldIndex++]));
+            break;
+        case 'q':
+            writeUint16(structFieldValue<uint16>(first, fields[fieldIndex++]));
+            break;
+        case 'i':
+            writeInt32(structFieldValue<int32>(first, fields[fieldIndex++]));
+            break;
+        case 'u':
+            writeUint32(structFieldValue<uint32>(first, fields[fieldIndex++]));
+            break;
+        case 'x':
+            writeInt64(structFieldValue<int64>(first, fields[fieldIndex++]));
+            break;
+        case 't':
+            writeUint64(structFieldValue<uint64>(first, fields[fieldIndex++]));
+            break;
+        case 'd':
+            writeDouble(structFieldValue<double>(first, fields[fieldIndex++]));
+            break;
+        default:
+            assert(false); // rejected by StructArrayLayout::init()
+            break;
+        }
+    }
+
+    // ... and the rest in one go
+    if (count > 1 && !d->m_nilArrayNesting && m_state != InvalidData) {
+        d->alignData(StructAlignment);
+        const uint32 length = uint32(resolved.arrayLength(count - 1));
+        d->reserveData(d->m_dataPosition + length, &m_state);
+        if (m_state != InvalidData) {
+            resolved.gather(d->m_data + d->m_dataPosition, memory + layout.stride, count - 1);
+            d->commitBulkData(length);
+        }
+    }
+
+    endArray();
+}
+
 Arguments Arguments::Writer::finish()
 {
     // what needs to happen here:
@@ -27,6 +27,7 @@
 #include "types.h"
 
 #include <algorithm> // for std::min on Windows...
+#include <cstring>
 
 static inline uint32 align(uint32 index, uint32 alignment)
 {
@@ -37,10 +38,15 @@ static inline uint32 align(uint32 index, uint32 alignment)
 static inline bool isPaddingZero(const chunk &buffer, uint32 padStart, uint32 padEnd)
 {
     padEnd = std::min(padEnd, buffer.length);
-    for (; padStart < padEnd; padStart++) {
-        if (unlikely(buffer.ptr[padStart] != '\0')) {
+    // Padding is at most 7 bytes, so it fits into one 64 bit word. Vector instructions don't help here.
+    while (padStart < padEnd) {
+        const uint32 count = std::min(padEnd - padStart, uint32(sizeof(uint64)));
+        uint64 word = 0;
+        memcpy(&word, buffer.ptr + padStart, count);
+        if (unlikely(word != 0)) {
             return false;
         }
+        padStart += count;
     }
     return true;
 }
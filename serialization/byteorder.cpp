@@ -0,0 +1,460 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "byteorder.h"
+
+#include "arguments.h"
+#include "arguments_p.h"
+#include "basictypeio.h"
+#include "signatureprogram.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define HAVE_SSE2_KERNELS
+#include <emmintrin.h>
+#if defined(__GNUC__) // also true for Clang
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+// The kernels swap count elements of the size in their template argument, which is 2, 4 or 8.
+// They expect the elements to be naturally aligned, which is always the case in marshalled data.
+
+template<uint32 elementSize>
+static inline void swapElementScalar(byte *p);
+
+template<>
+inline void swapElementScalar<2>(byte *p)
+{
+    basic::writeUint16(p, basic::readUint16(p, true));
+}
+
+template<>
+inline void swapElementScalar<4>(byte *p)
+{
+    basic::writeUint32(p, basic::readUint32(p, true));
+}
+
+template<>
+inline void swapElementScalar<8>(byte *p)
+{
+    basic::writeUint64(p, basic::readUint64(p, true));
+}
+
+template<uint32 elementSize>
+static void swapElementsScalar(byte *data, uint32 count)
+{
+    for (uint32 i = 0; i < count; i++) {
+        swapElementScalar<elementSize>(data + i * elementSize);
+    }
+}
+
+#ifdef HAVE_SSE2_KERNELS
+// SSE2 has no byte shuffle, but 16 bit word shuffles and shifts are enough to reverse bytes
+static inline __m128i swapWordBytesSse2(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+template<uint32 elementSize>
+static inline __m128i swapVectorSse2(__m128i v);
+
+template<>
+inline __m128i swapVectorSse2<2>(__m128i v)
+{
+    return swapWordBytesSse2(v);
+}
+
+template<>
+inline __m128i swapVectorSse2<4>(__m128i v)
+{
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+    return swapWordBytesSse2(v);
+}
+
+template<>
+inline __m128i swapVectorSse2<8>(__m128i v)
+{
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+    return swapWordBytesSse2(v);
+}
+
+template<uint32 elementSize>
+static void swapElementsSse2(byte *data, uint32 count)
+{
+    const uint32 length = count * elementSize;
+    uint32 i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i *const p = reinterpret_cast<__m128i *>(data + i);
+        _mm_storeu_si128(p, swapVectorSse2<elementSize>(_mm_loadu_si128(p)));
+    }
+    swapElementsScalar<elementSize>(data + i, (length - i) / elementSize);
+}
+#endif // HAVE_SSE2_KERNELS
+
+#ifdef HAVE_AVX2_KERNELS
+template<uint32 elementSize>
+__attribute__((target("avx2")))
+static void swapElementsAvx2(byte *data, uint32 count)
+{
+    // _mm256_shuffle_epi8 works within 128 bit lanes, which is fine because elements don't cross them
+    const __m256i mask = elementSize == 2 ?
+        _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                         1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14) :
+                         elementSize == 4 ?
+        _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                         3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12) :
+        _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const uint32 length = count * elementSize;
+    uint32 i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i *const p = reinterpret_cast<__m256i *>(data + i);
+        _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), mask));
+    }
+    swapElementsSse2<elementSize>(data + i, (length - i) / elementSize);
+}
+#endif // HAVE_AVX2_KERNELS
+
+#ifdef HAVE_NEON_KERNELS
+template<uint32 elementSize>
+static inline uint8x16_t swapVectorNeon(uint8x16_t v);
+
+template<>
+inline uint8x16_t swapVectorNeon<2>(uint8x16_t v)
+{
+    return vrev16q_u8(v);
+}
+
+template<>
+inline uint8x16_t swapVectorNeon<4>(uint8x16_t v)
+{
+    return vrev32q_u8(v);
+}
+
+template<>
+inline uint8x16_t swapVectorNeon<8>(uint8x16_t v)
+{
+    return vrev64q_u8(v);
+}
+
+template<uint32 elementSize>
+static void swapElementsNeon(byte *data, uint32 count)
+{
+    const uint32 length = count * elementSize;
+    uint32 i = 0;
+    for (; i + 16 <= length; i += 16) {
+        vst1q_u8(data + i, swapVectorNeon<elementSize>(vld1q_u8(data + i)));
+    }
+    swapElementsScalar<elementSize>(data + i, (length - i) / elementSize);
+}
+#endif // HAVE_NEON_KERNELS
+
+struct SwapKernels
+{
+    void (*swap16)(byte *data, uint32 count);
+    void (*swap32)(byte *data, uint32 count);
+    void (*swap64)(byte *data, uint32 count);
+};
+
+static SwapKernels selectKernels()
+{
+    SwapKernels ret;
+#if defined(HAVE_AVX2_KERNELS)
+    if (__builtin_cpu_supports("avx2")) {
+        ret.swap16 = swapElementsAvx2<2>;
+        ret.swap32 = swapElementsAvx2<4>;
+        ret.swap64 = swapElementsAvx2<8>;
+        return ret;
+    }
+#endif
+#if defined(HAVE_SSE2_KERNELS)
+    ret.swap16 = swapElementsSse2<2>;
+    ret.swap32 = swapElementsSse2<4>;
+    ret.swap64 = swapElementsSse2<8>;
+#elif defined(HAVE_NEON_KERNELS)
+    ret.swap16 = swapElementsNeon<2>;
+    ret.swap32 = swapElementsNeon<4>;
+    ret.swap64 = swapElementsNeon<8>;
+#else
+    ret.swap16 = swapElementsScalar<2>;
+    ret.swap32 = swapElementsScalar<4>;
+    ret.swap64 = swapElementsScalar<8>;
+#endif
+    return ret;
+}
+
+static const SwapKernels &kernels()
+{
+    static const SwapKernels k = selectKernels();
+    return k;
+}
+
+void swapElementBytes(byte *data, uint32 count, uint32 elementSize)
+{
+    switch (elementSize) {
+    case 1:
+        break;
+    case 2:
+        kernels().swap16(data, count);
+        break;
+    case 4:
+        kernels().swap32(data, count);
+        break;
+    case 8:
+        kernels().swap64(data, count);
+        break;
+    default:
+        assert(false);
+    }
+}
+
+// Walks the data according to the signature. In a dry run, it only checks that the data can be
+// converted, so that a conversion never stops halfway through and leaves a mix of byte orders.
+class ByteOrderConverter
+{
+public:
+    ByteOrderConverter(chunk data, bool isDryRun)
+       : m_data(data),
+         m_pos(0),
+         m_isDryRun(isDryRun)
+    {}
+
+    bool convertArguments(cstring signature);
+
+private:
+    bool convertSingleCompleteType(cstring *signature);
+    bool convertArray(cstring *signature);
+    bool skipTo(uint32 alignment);
+    bool convertPrimitive(uint32 size);
+    bool convertLength(uint32 *length);
+
+    chunk m_data;
+    uint32 m_pos;
+    bool m_isDryRun;
+    Nesting m_nesting;
+};
+
+bool ByteOrderConverter::convertArguments(cstring signature)
+{
+    while (signature.length) {
+        if (!convertSingleCompleteType(&signature)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ByteOrderConverter::skipTo(uint32 alignment)
+{
+    const uint32 newPos = align(m_pos, alignment);
+    if (newPos > m_data.length) {
+        return false;
+    }
+    m_pos = newPos;
+    return true;
+}
+
+bool ByteOrderConverter::convertPrimitive(uint32 size)
+{
+    if (!skipTo(size) || m_data.length - m_pos < size) {
+        return false;
+    }
+    if (!m_isDryRun) {
+        swapElementBytes(m_data.ptr + m_pos, 1, size);
+    }
+    m_pos += size;
+    return true;
+}
+
+bool ByteOrderConverter::convertLength(uint32 *length)
+{
+    if (!skipTo(sizeof(uint32)) || m_data.length - m_pos < sizeof(uint32)) {
+        return false;
+    }
+    *length = basic::readUint32(m_data.ptr + m_pos, true);
+    return convertPrimitive(sizeof(uint32));
+}
+
+static void chopFirst(cstring *s)
+{
+    s->ptr++;
+    s->length--;
+}
+
+bool ByteOrderConverter::convertSingleCompleteType(cstring *signature)
+{
+    const char letter = *signature->ptr;
+    switch (letter) {
+    case 'y':
+    case 'b':
+    case 'n':
+    case 'q':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 't':
+    case 'd':
+    case 'h':
+        chopFirst(signature);
+        return convertPrimitive(typeInfo(letter).alignment);
+    case 's':
+    case 'o': {
+        chopFirst(signature);
+        uint32 length;
+        if (!convertLength(&length)) {
+            return false;
+        }
+        // 64 bit arithmetic so that garbage lengths can't overflow into something plausible
+        if (uint64(length) + 1 > m_data.length - m_pos) {
+            return false;
+        }
+        m_pos += length + 1;
+        return true; }
+    case 'g':
+    case 'v': {
+        chopFirst(signature);
+        if (m_pos >= m_data.length) {
+            return false;
+        }
+        const uint32 length = m_data.ptr[m_pos];
+        if (length + 2 > m_data.length - m_pos) {
+            return false;
+        }
+        cstring innerSignature(reinterpret_cast<const char *>(m_data.ptr + m_pos + 1), length);
+        m_pos += length + 2;
+        if (letter == 'g') {
+            return true;
+        }
+        if (!SignatureProgram::isSignatureValid(innerSignature, Arguments::VariantSignature) ||
+            !m_nesting.beginVariant()) {
+            return false;
+        }
+        const bool ok = convertSingleCompleteType(&innerSignature);
+        m_nesting.endVariant();
+        return ok; }
+    case '(': {
+        chopFirst(signature);
+        if (!skipTo(StructAlignment) || !m_nesting.beginParen()) {
+            return false;
+        }
+        while (signature->length && *signature->ptr != ')') {
+            if (!convertSingleCompleteType(signature)) {
+                return false;
+            }
+        }
+        if (!signature->length) {
+            return false;
+        }
+        chopFirst(signature);
+        m_nesting.endParen();
+        return true; }
+    case 'a':
+        return convertArray(signature);
+    default:
+        return false;
+    }
+}
+
+bool ByteOrderConverter::convertArray(cstring *signature)
+{
+    // find the end of the array type in the signature, which has been validated before
+    cstring afterArray = *signature;
+    Nesting scratchNesting;
+    if (!parseSingleCompleteType(&afterArray, &scratchNesting)) {
+        return false;
+    }
+    const cstring elementSignature(signature->ptr + 1, uint32(afterArray.ptr - signature->ptr) - 1);
+    *signature = afterArray;
+
+    uint32 length;
+    if (!convertLength(&length) || length > Arguments::MaxArrayLength) {
+        return false;
+    }
+    const char elementLetter = *elementSignature.ptr;
+    const TypeInfo elementType = typeInfo(elementLetter);
+    // the padding to the first element is there even if the array is empty
+    if (!skipTo(elementType.alignment) || length > m_data.length - m_pos) {
+        return false;
+    }
+    const uint32 arrayEnd = m_pos + length;
+
+    if (elementType.isPrimitive) {
+        // the fast path: one bulk swap of all the elements
+        const uint32 elementSize = elementType.alignment;
+        if (length % elementSize) {
+            return false;
+        }
+        if (!m_isDryRun) {
+            swapElementBytes(m_data.ptr + m_pos, length / elementSize, elementSize);
+        }
+        m_pos = arrayEnd;
+        return true;
+    }
+
+    if (!m_nesting.beginArray()) {
+        return false;
+    }
+    const bool isDict = elementLetter == '{';
+    if (isDict && !m_nesting.beginParen()) {
+        return false;
+    }
+    while (m_pos < arrayEnd) {
+        if (isDict) {
+            // key and value
+            cstring entrySignature(elementSignature.ptr + 1, elementSignature.length - 2);
+            if (!skipTo(StructAlignment) || !convertSingleCompleteType(&entrySignature) ||
+                !convertSingleCompleteType(&entrySignature)) {
+                return false;
+            }
+        } else {
+            cstring signatureCopy = elementSignature;
+            if (!convertSingleCompleteType(&signatureCopy)) {
+                return false;
+            }
+        }
+    }
+    if (isDict) {
+        m_nesting.endParen();
+    }
+    m_nesting.endArray();
+    return m_pos == arrayEnd;
+}
+
+bool convertToNativeByteOrder(cstring signature, chunk data)
+{
+    {
+        ByteOrderConverter dryRun(data, true);
+        if (!dryRun.convertArguments(signature)) {
+            return false;
+        }
+    }
+    ByteOrderConverter converter(data, false);
+    const bool ok = converter.convertArguments(signature);
+    assert(ok);
+    (void)ok;
+    return true;
+}
@@ -0,0 +1,43 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef BYTEORDER_H
+#define BYTEORDER_H
+
+#include "types.h"
+
+// Conversion of marshalled data from the other byte order to the byte order of this machine, in place.
+// The inner loop for arrays of primitives uses SSE2 shifts and shuffles, AVX2 byte shuffles or NEON byte reversal where
+// available, selected at runtime, with a scalar fallback.
+
+// Reverses the bytes of each of count elements of elementSize (1, 2, 4 or 8) bytes
+void swapElementBytes(byte *data, uint32 count, uint32 elementSize);
+
+// Converts data, which must contain arguments with the given signature in non-native byte order,
+// to native byte order. The signature must be valid. Variant signatures in the data are validated.
+// Returns false and leaves data unchanged if the data is malformed in a way that prevents conversion,
+// i.e. if lengths are out of bounds or inconsistent. Other problems such as invalid strings or
+// nonzero padding are left for Arguments::Reader to detect.
+bool convertToNativeByteOrder(cstring signature, chunk data);
+
+#endif // BYTEORDER_H
@@ -26,13 +26,10 @@
 
 #include "arguments_p.h"
 #include "basictypeio.h"
+#include "byteorder.h"
 #include "malloccache.h"
 #include "stringtools.h"
-
-#ifndef DFERRY_SERDES_ONLY
-#include "icompletionlistener.h"
-#include "itransport.h"
-#endif
+#include "stringvalidation.h"
 
 #include <cassert>
 #include <cstring>
@@ -743,216 +740,63 @@ const Arguments &Message::arguments() const
     return d->m_mainArguments;
 }
 
-static const uint32 s_properFixedHeaderLength = 12;
-static const uint32 s_extendedFixedHeaderLength = 16;
-
-#ifndef DFERRY_SERDES_ONLY
-void MessagePrivate::receive(ITransport *transport)
+bool Message::convertToNativeByteOrder()
 {
-    if (m_state >= FirstIoState) { // Can only do one I/O operation at a time
-        return;
+    if (d->m_state >= MessagePrivate::FirstIoState) {
+        return false;
     }
-    transport->setReadListener(this);
-    m_state = MessagePrivate::Receiving;
-    m_headerLength = 0;
-    m_bodyLength = 0;
+    return d->convertToNativeByteOrder();
 }
 
+static const uint32 s_properFixedHeaderLength = MessagePrivate::s_properFixedHeaderLength;
+static const uint32 s_extendedFixedHeaderLength = MessagePrivate::s_extendedFixedHeaderLength;
+
+#ifndef DFERRY_SERDES_ONLY
 bool Message::isReceiving() const
 {
     return d->m_state == MessagePrivate::Receiving;
 }
 
-void MessagePrivate::send(ITransport *transport)
-{
-    if (!serialize()) {
-        m_state = Serialized;
-        assert(m_error.isError());
-        if (!m_error.isError()) {
-            // TODO This error code makes no sense here. We don't have a "generic error" code, and a specific
-            // error code should have been set by whatever code detected the error. Hence the assertion.
-            m_error = Error::MalformedReply;
-        }
-        // Note: We don't call notifyCompletionListener(); since all our timers are internal, we can
-        // expect them to check for errors after this returns. Specifically, Connection::send() has
-        // access to the timer in the PendingReply, so it can produce a deferred error notification
-        // just like success notifications are deferred.
-        return;
-    }
-    if (m_state != MessagePrivate::Sending) {
-        transport->setWriteListener(this);
-        m_state = MessagePrivate::Sending;
-    }
-}
-
 bool Message::isSending() const
 {
     return d->m_state == MessagePrivate::Sending;
 }
 
-void MessagePrivate::setCompletionListener(ICompletionListener *listener)
-{
-    m_completionListener = listener;
-}
-
-void MessagePrivate::notifyCompletionListener()
-{
-    if (m_completionListener) {
-        m_completionListener->handleCompletion(m_message);
-    }
-}
+#endif // !DFERRY_SERDES_ONLY
 
-IO::Status MessagePrivate::handleTransportCanRead()
+uint32 MessagePrivate::unsentData(chunk *parts) const
 {
-    if (m_state != Receiving) {
-        return IO::Status::InternalError;
+    // The header is in m_buffer, the body in m_mainArguments. After deserialization, the body is
+    // in m_buffer as well, but m_mainArguments still points to the right place.
+    uint32 partCount = 0;
+    if (m_bufferPos < m_headerLength) {
+        parts[partCount++] = chunk(m_buffer.ptr + m_bufferPos, m_headerLength - m_bufferPos);
     }
-    IO::Status ret = IO::Status::OK;
-    IO::Result ioRes;
-    do {
-        uint32 readMax = 0;
-        if (!m_headerLength) {
-            // the message might only consist of the header, so we must be careful to avoid reading
-            // data meant for the next message
-            readMax = s_extendedFixedHeaderLength - m_bufferPos;
-        } else {
-            // reading variable headers and/or body
-            readMax = m_headerLength + m_bodyLength - m_bufferPos;
-        }
-        reserveBuffer(m_bufferPos + readMax);
-
-        const bool headersDone = m_headerLength > 0 && m_bufferPos >= m_headerLength;
-
-        if (m_bufferPos == 0) {
-            // According to the DBus spec, file descriptors can arrive anywhere in the message, but
-            // (assuming the message is written in one sendmsg() call) according to UNIX domain socket
-            // documentation, file descriptors will arrive in the first byte of the sent block they are
-            // attached to. We go with the UNIX domain socket documentation.
-            // TODO review and test this for very large messages that cannot be sent in one call
-            ioRes = readTransport()->readWithFileDescriptors(m_buffer.ptr + m_bufferPos, readMax,
-                                                             argUnixFds());
-        } else {
-            ioRes = readTransport()->read(m_buffer.ptr + m_bufferPos, readMax);
-        }
-        m_bufferPos += ioRes.length;
-        assert(m_bufferPos <= m_buffer.length);
-
-        if (!headersDone) {
-            if (m_headerLength == 0 && m_bufferPos >= s_extendedFixedHeaderLength) {
-                if (!deserializeFixedHeaders()) {
-                    ret = IO::Status::RemoteClosed;
-                    m_error = Error::MalformedReply;
-                    break;
-                }
-            }
-            if (m_headerLength > 0 && m_bufferPos >= m_headerLength) {
-                // ### If we expected to receive the FDs at any point in the message (as opposed to just the
-                //     first byte), we'd have to verify FD count later. But we don't, so this is expedient.
-                if (!deserializeVariableHeaders() ||
-                        m_varHeaders.intHeader(Message::UnixFdsHeader) != argUnixFds()->size()) {
-                    ret = IO::Status::RemoteClosed;
-                    m_error = Error::MalformedReply;
-                    break;
-                }
-            }
-        }
-        if (m_headerLength > 0 && m_bufferPos >= m_headerLength + m_bodyLength) {
-            // all done!
-            assert(m_bufferPos == m_headerLength + m_bodyLength);
-            m_state = Serialized;
-            chunk bodyData(m_buffer.ptr + m_headerLength, m_bodyLength);
-            m_mainArguments = Arguments(nullptr, m_varHeaders.stringHeaderRaw(Message::SignatureHeader),
-                                        bodyData, std::move(*argUnixFds()), m_isByteSwapped);
-            assert(ioRes.status == IO::Status::OK && ret == IO::Status::OK);
-            readTransport()->setReadListener(nullptr);
-            notifyCompletionListener(); // do not access members after this because it might delete us!
-            break;
-        }
-        if (!readTransport()->isOpen()) {
-            ret = IO::Status::RemoteClosed;
-            break;
-        }
-    } while (ioRes.status == IO::Status::OK);
-
-    if (ret != IO::Status::OK) {
-        clear();
-        readTransport()->setReadListener(nullptr);
-        if (!m_error.isError()) {
-            // catch-all, we know that SOME error happened
-            m_error = Error::RemoteDisconnect;
-        }
-        notifyCompletionListener();
+    const chunk body = m_mainArguments.data();
+    const uint32 bodyPos = m_bufferPos > m_headerLength ? m_bufferPos - m_headerLength : 0;
+    if (bodyPos < body.length) {
+        parts[partCount++] = chunk(body.ptr + bodyPos, body.length - bodyPos);
     }
-    return ret;
+    return partCount;
 }
 
-IO::Status MessagePrivate::handleTransportCanWrite()
-{
-    if (m_state != Sending) {
-        return IO::Status::InternalError;
-    }
-    while (true) {
-        assert(m_buffer.length >= m_bufferPos);
-        const uint32 toWrite = m_buffer.length - m_bufferPos;
-        if (!toWrite) {
-            m_state = Serialized;
-            writeTransport()->setWriteListener(nullptr);
-            notifyCompletionListener();
-            break;
-        }
-        IO::Result ioRes;
-        if (m_bufferPos == 0) {
-            const size_t sendFdsCount = m_mainArguments.fileDescriptors().size();
-            if (sendFdsCount == 0) {
-                ioRes = writeTransport()->write(chunk(m_buffer.ptr + m_bufferPos, toWrite));
-            } else if (sendFdsCount > writeTransport()->supportedPassingUnixFdsCount()) {
-                m_error.setCode(Error::SendingTooManyUnixFds);
-                m_state = Serialized;
-                writeTransport()->setWriteListener(nullptr);
-                // ### Oh well, now we have a special Error value to pass through the stack
-                // (for error handling), but also notifyCompletionListener() for sucessful completion
-                // handling. Can we get rid of one or the other, or are there actually good reasons for
-                // the difference?
-                // Pro separation:
-                // - the arguments I came up with for not doing error handling through callbacks
-                // - the ...convenience?... of using callbacks
-                // - possibly better performance of happy path
-                //
-                // Contra separation:
-                // - two different mechanisms for similar things...
-                // - inconsistency - though is that really a problem? the situations are different.
-                // - suddenly IO code needs to ~know (at least pass through and be technically exposed to)
-                //   error values it doesn't know and can't handle itself; theoretically could use some
-                //   error value wrapping mechanism to pass through opaque errors).
-                return IO::Status::PayloadError; // the connection is fine, only this message has a problem
-            } else {
-                ioRes = writeTransport()
-                    ->writeWithFileDescriptors(chunk(m_buffer.ptr + m_bufferPos, toWrite),
-                                               m_mainArguments.fileDescriptors());
-            }
-        } else {
-            ioRes = writeTransport()->write(chunk(m_buffer.ptr + m_bufferPos, toWrite));
-        }
-        if (ioRes.status != IO::Status::OK) {
-            m_error = Error::RemoteDisconnect;
-            m_state = Serialized; // in a way... serialization has completed, unsuccessfully
-            writeTransport()->setWriteListener(nullptr);
-            notifyCompletionListener();
-            return IO::Status::RemoteClosed;
-        }
-        m_bufferPos += ioRes.length;
-    }
-    return IO::Status::OK;
-}
-#endif // !DFERRY_SERDES_ONLY
-
 chunk Message::serializeAndView()
 {
     chunk ret; // one return variable to enable return value optimization (RVO) in gcc
     if (!d->serialize()) {
         return ret;
     }
-    ret = d->m_buffer;
+    const chunk body = d->m_mainArguments.data();
+    const uint32 messageLength = d->m_headerLength + body.length;
+    if (body.length && body.ptr != d->m_buffer.ptr + d->m_headerLength) {
+        // Sending doesn't need the message in one piece, so we only put it together here on demand
+        byte *contiguous = static_cast<byte *>(malloc(messageLength));
+        memcpy(contiguous, d->m_buffer.ptr, d->m_headerLength);
+        memcpy(contiguous + d->m_headerLength, body.ptr, body.length);
+        free(d->m_buffer.ptr);
+        d->m_buffer = chunk(contiguous, messageLength);
+    }
+    ret = chunk(d->m_buffer.ptr, messageLength);
     return ret;
 }
 
@@ -962,10 +806,10 @@ std::vector<byte> Message::save()
     if (!d->serialize()) {
         return ret;
     }
-    ret.reserve(d->m_buffer.length);
-    for (uint32 i = 0; i < d->m_buffer.length; i++) {
-        ret.push_back(d->m_buffer.ptr[i]);
-    }
+    const chunk body = d->m_mainArguments.data();
+    ret.reserve(d->m_headerLength + body.length);
+    ret.insert(ret.end(), d->m_buffer.ptr, d->m_buffer.ptr + d->m_headerLength);
+    ret.insert(ret.end(), body.ptr, body.ptr + body.length);
     return ret;
 }
 
@@ -975,31 +819,37 @@ void Message::deserializeAndTake(chunk memOwnership)
         free(memOwnership.ptr);
         return;
     }
-    d->m_headerLength = 0;
-    d->m_bodyLength = 0;
+    d->deserializeAndTake(memOwnership);
+}
+
+bool MessagePrivate::deserializeAndTake(chunk memOwnership)
+{
+    m_headerLength = 0;
+    m_bodyLength = 0;
 
-    d->clearBuffer();
-    d->m_buffer = memOwnership;
-    d->m_bufferPos = d->m_buffer.length;
+    clearBuffer();
+    m_buffer = memOwnership;
+    m_bufferPos = m_buffer.length;
 
-    bool ok = d->m_buffer.length >= s_extendedFixedHeaderLength;
-    ok = ok && d->deserializeFixedHeaders();
-    ok = ok && d->m_buffer.length >= d->m_headerLength;
-    ok = ok && d->deserializeVariableHeaders();
-    ok = ok && d->m_buffer.length == d->m_headerLength + d->m_bodyLength;
+    bool ok = m_buffer.length >= s_extendedFixedHeaderLength;
+    ok = ok && deserializeFixedHeaders();
+    ok = ok && m_buffer.length >= m_headerLength;
+    ok = ok && deserializeVariableHeaders();
+    ok = ok && m_buffer.length == m_headerLength + m_bodyLength;
 
     if (!ok) {
-        if (!d->m_error.isError()) {
-            d->m_error = Error::MalformedReply;
+        if (!m_error.isError()) {
+            m_error = Error::MalformedReply;
         }
-        d->clear();
-        return;
+        clear();
+        return false;
     }
 
-    chunk bodyData(d->m_buffer.ptr + d->m_headerLength, d->m_bodyLength);
-    d->m_mainArguments = Arguments(nullptr, d->m_varHeaders.stringHeaderRaw(SignatureHeader),
-                                   bodyData, d->m_isByteSwapped);
-    d->m_state = MessagePrivate::Serialized;
+    chunk bodyData(m_buffer.ptr + m_headerLength, m_bodyLength);
+    m_mainArguments = Arguments(nullptr, m_varHeaders.stringHeaderRaw(Message::SignatureHeader),
+                                bodyData, m_isByteSwapped);
+    m_state = Serialized;
+    return true;
 }
 
 // This does not return bool because full validation of the main arguments would take quite
@@ -1073,6 +923,22 @@ Error MessagePrivate::checkRequiredHeaders() const
     return Error::NoError;
 }
 
+//static
+uint32 MessagePrivate::messageLengthFromFixedHeaders(const byte *p)
+{
+    const byte endianness = p[0];
+    if (endianness != 'l' && endianness != 'B') {
+        return 0;
+    }
+    const bool isByteSwapped = endianness != s_thisMachineEndianness;
+    const uint32 bodyLength = basic::readUint32(p + 4, isByteSwapped);
+    const uint32 varArrayLength = basic::readUint32(p + 4 + 2 * sizeof(uint32), isByteSwapped);
+    // 64 bit arithmetic so that garbage lengths can't overflow into something plausible
+    const uint64 headerLength = (uint64(s_extendedFixedHeaderLength) + varArrayLength + 7) & ~uint64(7);
+    const uint64 messageLength = headerLength + bodyLength;
+    return messageLength <= Arguments::MaxMessageLength ? uint32(messageLength) : 0;
+}
+
 bool MessagePrivate::deserializeFixedHeaders()
 {
     assert(m_bufferPos >= s_extendedFixedHeaderLength);
@@ -1101,6 +967,21 @@ bool MessagePrivate::deserializeFixedHeaders()
     return m_headerLength + m_bodyLength <= Arguments::MaxMessageLength;
 }
 
+// Bus names (destination and sender) are not checked here - the bus daemon checks them, and in
+// peer-to-peer connections they have no meaning. Error names should follow the rules for interface
+// names, but they are sometimes used for human-readable messages, so they are accepted as they are.
+static bool isNameHeaderValid(Message::VariableHeader header, cstring value)
+{
+    switch (header) {
+    case Message::InterfaceHeader:
+        return isValidInterfaceName(value);
+    case Message::MethodHeader:
+        return isValidMemberName(value);
+    default:
+        return true;
+    }
+}
+
 bool MessagePrivate::deserializeVariableHeaders()
 {
     // use Arguments to parse the variable header fields
@@ -1145,7 +1026,9 @@ bool MessagePrivate::deserializeVariableHeaders()
                 ok = ok && m_varHeaders.setStringHeader_deser(eHeader, reader.readSignature());
             } else {
                 ok = ok && reader.state() == Arguments::String;
-                ok = ok && m_varHeaders.setStringHeader_deser(eHeader, reader.readString());
+                const cstring value = ok ? reader.readString() : cstring();
+                ok = ok && isNameHeaderValid(eHeader, value);
+                ok = ok && m_varHeaders.setStringHeader_deser(eHeader, value);
             }
         } else {
             ok = ok && reader.state() == Arguments::Uint32;
@@ -1161,11 +1044,8 @@ bool MessagePrivate::deserializeVariableHeaders()
     reader.endArray();
 
     // check that header->body padding is in fact zero filled
-    base = m_buffer.ptr;
-    for (uint32 i = m_headerLength - m_headerPadding; i < m_headerLength; i++) {
-        if (base[i] != '\0') {
-            return false;
-        }
+    if (!isPaddingZero(m_buffer, m_headerLength - m_headerPadding, m_headerLength)) {
+        return false;
     }
 
     return reader.isFinished();
@@ -1180,6 +1060,18 @@ bool MessagePrivate::serialize()
         return false;
     }
 
+    // After deserialization, the main arguments point into m_buffer, so they need their own copy
+    // before m_buffer is released
+    if (m_buffer.ptr) {
+        const byte *const argsSignature = reinterpret_cast<const byte *>(m_mainArguments.signature().ptr);
+        const byte *const argsData = m_mainArguments.data().ptr;
+        const byte *const bufferEnd = m_buffer.ptr + m_headerLength + m_bodyLength;
+        if ((argsSignature >= m_buffer.ptr && argsSignature < bufferEnd) ||
+            (argsData >= m_buffer.ptr && argsData < bufferEnd)) {
+            m_mainArguments = Arguments(m_mainArguments);
+        }
+    }
+
     clearBuffer();
 
     if (m_error.isError() || !requiredHeadersPresent()) {
@@ -1209,7 +1101,9 @@ bool MessagePrivate::serialize()
         return false;
     }
 
-    reserveBuffer(messageLength);
+    // Only the header goes into m_buffer. The body is sent directly from m_mainArguments' buffer,
+    // see SendQueue; it is never copied for sending.
+    reserveBuffer(m_headerLength);
 
     serializeFixedHeaders();
 
@@ -1223,16 +1117,10 @@ bool MessagePrivate::serialize()
     for (uint32 i = unalignedHeaderLength; i < m_headerLength; i++) {
         m_buffer.ptr[i] = '\0';
     }
-    // copy message body (if any - arguments are not mandatory)
-    if (m_mainArguments.data().length) {
-        memcpy(m_buffer.ptr + m_headerLength, m_mainArguments.data().ptr, m_mainArguments.data().length);
-    }
-    m_bufferPos = m_headerLength + m_mainArguments.data().length;
-    assert(m_bufferPos <= m_buffer.length);
 
-    // for the upcoming message sending, "reuse" m_bufferPos for read position (formerly write position),
-    // and m_buffer.length for end of data to read (formerly buffer capacity)
-    m_buffer.length = m_bufferPos;
+    // for the upcoming message sending, m_bufferPos is the send position in the whole message
+    // (header and body), and m_buffer.length is the end of header data (formerly buffer capacity)
+    m_buffer.length = m_headerLength;
     m_bufferPos = 0;
 
     m_dirty = false;
@@ -1240,6 +1128,41 @@ bool MessagePrivate::serialize()
     return true;
 }
 
+bool MessagePrivate::convertToNativeByteOrder()
+{
+    // Only received messages can be in the other byte order, and then header and body are in m_buffer.
+    // If the message was modified afterwards, the body might not be there anymore, and the header in
+    // m_buffer might have been replaced by a re-serialized one.
+    const bool isHeaderSwapped = m_buffer.ptr && m_buffer.ptr[0] != s_thisMachineEndianness;
+    const chunk bodyData(m_buffer.ptr + m_headerLength, m_bodyLength);
+    const bool isBodySwapped = m_mainArguments.isByteSwapped();
+    if (isBodySwapped) {
+        if (!m_buffer.ptr || m_mainArguments.data().ptr != bodyData.ptr) {
+            return false;
+        }
+        // This is the only step that can fail, so do it first to leave everything unchanged on failure
+        if (!::convertToNativeByteOrder(m_mainArguments.signature(), bodyData)) {
+            return false;
+        }
+        Arguments::Private::get(&m_mainArguments)->m_isByteSwapped = false;
+    }
+
+    if (isHeaderSwapped) {
+        byte *const p = m_buffer.ptr;
+        p[0] = s_thisMachineEndianness;
+        swapElementBytes(p + 4, 1, sizeof(uint32)); // body length
+        // the serial and the variable headers, using the same fake int32 as deserializeVariableHeaders()
+        byte *base = p + s_properFixedHeaderLength - sizeof(int32);
+        chunk headerData(base, m_headerLength - m_headerPadding - s_properFixedHeaderLength + sizeof(int32));
+        // the variable headers have been validated during deserialization
+        const bool ok = ::convertToNativeByteOrder(cstring("ia(yv)"), headerData);
+        assert(ok);
+        (void)ok;
+    }
+    m_isByteSwapped = false;
+    return true;
+}
+
 void MessagePrivate::serializeFixedHeaders()
 {
     assert(m_buffer.length >= s_extendedFixedHeaderLength);
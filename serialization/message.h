@@ -135,6 +135,13 @@ public:
     // setArguments also sets the signature header of the message
     void setArguments(Arguments arguments);
     const Arguments &arguments() const;
+    // Converts a received message that is in the other byte order to the byte order of this machine,
+    // in place. Afterwards, reading the arguments doesn't need to swap bytes, and
+    // Arguments::Reader::readPrimitiveArray() works for all primitive types. This is optional and
+    // pays off when a large part of the arguments is read, especially arrays of primitives.
+    // Returns true if the message is now in native byte order, including when it already was.
+    // Returns false and leaves the message unchanged if it is malformed or doing I/O.
+    bool convertToNativeByteOrder();
 
     std::vector<byte> save();
     void load(const std::vector<byte> &data);
@@ -28,12 +28,9 @@
 
 #include "arguments.h"
 #include "error.h"
-#include "itransportlistener.h"
 
 #include <type_traits>
 
-class ICompletionListener;
-
 class VarHeaderStorage {
 public:
     VarHeaderStorage();
@@ -77,24 +74,25 @@ public:
     uint32 m_headerPresenceBitmap = 0;
 };
 
-class MessagePrivate : public ITransportListener
+class MessagePrivate
 {
 public:
     static MessagePrivate *get(Message *m) { return m->d; }
 
     MessagePrivate(Message *parent);
     MessagePrivate(const MessagePrivate &other, Message *parent);
-    ~MessagePrivate() override;
+    ~MessagePrivate();
 
-    IO::Status handleTransportCanRead() override;
-    IO::Status handleTransportCanWrite() override;
+    // Sending is done by SendQueue, receiving by ReceiveBuffer. They use the low-level methods below.
 
-    // ITransport is non-public API, so these make no sense in the public interface
-    void receive(ITransport *transport); // fills in this message from transport
-    void send(ITransport *transport); // sends this message over transport
-    // for receive or send completion (it should be clear which because receiving and sending can't
-    // happen simultaneously)
-    void setCompletionListener(ICompletionListener *listener);
+    // The fixed headers plus the length of the variable headers array, which is enough to calculate
+    // the length of the whole message
+    static const uint32 s_properFixedHeaderLength = 12;
+    static const uint32 s_extendedFixedHeaderLength = 16;
+    // Returns the total length of the message that starts with the s_extendedFixedHeaderLength bytes
+    // at fixedHeaders, or 0 if the fixed headers are invalid or the message is too long.
+    static uint32 messageLengthFromFixedHeaders(const byte *fixedHeaders);
+    bool deserializeAndTake(chunk memOwnership);
 
     bool requiredHeadersPresent();
     Error checkRequiredHeaders() const;
@@ -102,14 +100,16 @@ public:
     bool deserializeVariableHeaders();
     bool serialize();
     void serializeFixedHeaders();
+    // Fills parts with the not yet sent serialized data: (part of) the header and (part of) the body.
+    // Returns the number of parts used, at most 2.
+    uint32 unsentData(chunk *parts) const;
     Arguments serializeVariableHeaders();
+    bool convertToNativeByteOrder();
 
     void clearBuffer();
     void clear(bool onlyReleaseResources = false);
     void reserveBuffer(uint32 newSize);
 
-    void notifyCompletionListener();
-
     std::vector<int> *argUnixFds();
 
     Message *m_message;
@@ -144,8 +144,6 @@ public:
     Arguments m_mainArguments;
 
     VarHeaderStorage m_varHeaders;
-
-    ICompletionListener *m_completionListener;
 };
 
 #endif // MESSAGE_P_H
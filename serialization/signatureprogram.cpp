@@ -0,0 +1,134 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "signatureprogram.h"
+
+#include "basictypeio.h"
+
+#include <cassert>
+#include <cstring>
+#include <unordered_map>
+
+enum {
+    // Typical traffic has a few dozen distinct signatures. If there are many more, the peer is probably
+    // misbehaving, and we start over rather than growing without bounds.
+    MaxCachedPrograms = 256
+};
+
+SignatureProgram::SignatureProgram(cstring signature)
+   : m_signature(signature.ptr, signature.length),
+     m_isValidMethodSignature(false),
+     m_isValidVariantSignature(false)
+{
+    cstring sig = this->signature(); // points to m_signature which is null-terminated
+    m_isValidMethodSignature = Arguments::isSignatureValid(sig, Arguments::MethodSignature);
+    if (!m_isValidMethodSignature) {
+        return; // a valid variant signature is also a valid method signature
+    }
+    m_isValidVariantSignature = Arguments::isSignatureValid(sig, Arguments::VariantSignature);
+
+    // Op::skip could overflow otherwise. Such signatures are always rejected in messages anyway.
+    if (m_signature.length() > Arguments::MaxSignatureLength) {
+        return;
+    }
+    m_ops.resize(m_signature.length());
+    for (uint32 position = 0; position < m_signature.length(); ) {
+        position = compileSingleCompleteType(position);
+    }
+}
+
+// The signature has been validated before, so this does not need to check anything.
+// Returns the position after the single complete type.
+uint32 SignatureProgram::compileSingleCompleteType(uint32 position)
+{
+    const uint32 begin = position;
+    const char letter = m_signature[position];
+    m_ops[begin].type = typeInfo(letter);
+    m_ops[begin].fixedSize = m_ops[begin].type.isPrimitive ? m_ops[begin].type.alignment : 0;
+
+    if (letter == '(') {
+        uint32 structSize = 0;
+        bool isFixedSize = true;
+        for (position++; m_signature[position] != ')'; ) {
+            const uint32 elementBegin = position;
+            position = compileSingleCompleteType(position);
+            const Op &element = m_ops[elementBegin];
+            isFixedSize = isFixedSize && element.fixedSize;
+            structSize = align(structSize, element.type.alignment) + element.fixedSize;
+        }
+        m_ops[position].type = typeInfo(')');
+        m_ops[position].skip = 0;
+        m_ops[position].fixedSize = 0;
+        position++;
+        m_ops[begin].fixedSize = isFixedSize ? structSize : 0;
+    } else if (letter == 'a') {
+        position++;
+        if (m_signature[position] == '{') {
+            const uint32 dictEntryBegin = position;
+            m_ops[dictEntryBegin].type = typeInfo('{');
+            m_ops[dictEntryBegin].fixedSize = 0;
+            position = compileSingleCompleteType(position + 1); // key
+            position = compileSingleCompleteType(position); // value
+            m_ops[position].type = typeInfo('}');
+            m_ops[position].skip = 0;
+            m_ops[position].fixedSize = 0;
+            position++;
+            m_ops[dictEntryBegin].skip = byte(position - dictEntryBegin);
+        } else {
+            position = compileSingleCompleteType(position);
+        }
+    } else {
+        position++;
+    }
+    m_ops[begin].skip = byte(position - begin);
+    return position;
+}
+
+// static
+std::shared_ptr<const SignatureProgram> SignatureProgram::get(cstring signature)
+{
+    thread_local static std::unordered_map<std::string, std::shared_ptr<const SignatureProgram>> cache;
+    thread_local static std::string key; // reused to avoid an allocation per lookup for long signatures
+
+    key.assign(signature.ptr, signature.length);
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    if (cache.size() >= MaxCachedPrograms) {
+        cache.clear(); // programs still in use are kept alive by their users
+    }
+    std::shared_ptr<const SignatureProgram> program = std::make_shared<SignatureProgram>(signature);
+    cache.emplace(key, program);
+    return program;
+}
+
+// static
+bool SignatureProgram::isSignatureValid(cstring signature, Arguments::SignatureType type)
+{
+    // the cache key does not include the terminating null, so check it here
+    if (!signature.ptr || signature.ptr[signature.length] != 0) {
+        return false;
+    }
+    return get(signature)->isValid(type);
+}
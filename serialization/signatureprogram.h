@@ -0,0 +1,75 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef SIGNATUREPROGRAM_H
+#define SIGNATUREPROGRAM_H
+
+#include "arguments.h"
+#include "arguments_p.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// A signature, validated once and "compiled" into a flat array with one entry per signature character.
+// Programs are cached per thread, so the many repetitions of the same few signatures in typical traffic
+// are only parsed once.
+class DFERRY_EXPORT SignatureProgram
+{
+public:
+    struct Op
+    {
+        TypeInfo type;
+        // Length of the single complete type starting here, for skipping it. 0 at ')' and '}'.
+        byte skip;
+        // Size on the wire of the single complete type starting here, starting from an aligned position.
+        // 0 if it contains strings, arrays or variants. Used to skip structs without parsing them.
+        uint16 fixedSize;
+    };
+
+    // Returns the cached program, compiling it first if necessary. Never returns null; the result for
+    // an invalid signature is cached, too.
+    static std::shared_ptr<const SignatureProgram> get(cstring signature);
+    // Same result as Arguments::isSignatureValid(), but using the cache
+    static bool isSignatureValid(cstring signature,
+                                 Arguments::SignatureType type = Arguments::MethodSignature);
+
+    explicit SignatureProgram(cstring signature);
+
+    bool isValid(Arguments::SignatureType type) const
+    { return type == Arguments::MethodSignature ? m_isValidMethodSignature : m_isValidVariantSignature; }
+    cstring signature() const { return cstring(m_signature.c_str(), uint32(m_signature.length())); }
+    // Only valid signatures of up to MaxSignatureLength are compiled to ops
+    bool isCompiled() const { return !m_ops.empty(); }
+    const Op &op(uint32 position) const { return m_ops[position]; }
+
+private:
+    uint32 compileSingleCompleteType(uint32 position);
+
+    std::string m_signature;
+    std::vector<Op> m_ops;
+    bool m_isValidMethodSignature;
+    bool m_isValidVariantSignature;
+};
+
+#endif // SIGNATUREPROGRAM_H
@@ -0,0 +1,365 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "stringvalidation.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define HAVE_SSE2_KERNELS
+#include <emmintrin.h>
+#if defined(__GNUC__) // also true for Clang
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+enum {
+    MaxNameLength = 255
+};
+
+#if defined(HAVE_SSE2_KERNELS)
+static inline uint32 countTrailingZeros(uint32 x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return uint32(__builtin_ctz(x));
+#endif
+}
+#endif
+
+// The kernels return the number of leading bytes that satisfy the condition in their name
+
+static uint32 skipAsciiWithoutNulScalar(const byte *s, uint32 length)
+{
+    uint32 i = 0;
+    // 0 wraps around to a large value, so this checks for 1 <= s[i] <= 0x7f
+    while (i < length && uint32(s[i]) - 1 < 0x7f) {
+        i++;
+    }
+    return i;
+}
+
+static inline bool isNameCharacter(byte c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static uint32 skipNameCharactersScalar(const byte *s, uint32 length)
+{
+    uint32 i = 0;
+    while (i < length && isNameCharacter(s[i])) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef HAVE_SSE2_KERNELS
+static uint32 skipAsciiWithoutNulSse2(const byte *s, uint32 length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32 i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        // the high bit of non-ASCII bytes and the result of the comparison with null
+        const uint32 bad = uint32(_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, zero))));
+        if (bad) {
+            return i + countTrailingZeros(bad);
+        }
+    }
+    return i + skipAsciiWithoutNulScalar(s + i, length - i);
+}
+
+// Signed comparisons, which is fine because all characters in the ranges are ASCII, and non-ASCII
+// characters are negative and thus outside of all ranges.
+static inline __m128i inRangeSse2(__m128i v, char low, char high)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(low - 1))),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(char(high + 1)), v));
+}
+
+static uint32 skipNameCharactersSse2(const byte *s, uint32 length)
+{
+    uint32 i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        // setting the 0x20 bit maps upper case letters to lower case letters and nothing else to them
+        const __m128i letter = inRangeSse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+        const __m128i digit = inRangeSse2(v, '0', '9');
+        const __m128i underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+        const uint32 good = uint32(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), underscore)));
+        if (good != 0xffff) {
+            return i + countTrailingZeros(~good);
+        }
+    }
+    return i + skipNameCharactersScalar(s + i, length - i);
+}
+#endif // HAVE_SSE2_KERNELS
+
+#ifdef HAVE_AVX2_KERNELS
+__attribute__((target("avx2")))
+static uint32 skipAsciiWithoutNulAvx2(const byte *s, uint32 length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint32 i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+        const uint32 bad = uint32(_mm256_movemask_epi8(_mm256_or_si256(v, _mm256_cmpeq_epi8(v, zero))));
+        if (bad) {
+            return i + countTrailingZeros(bad);
+        }
+    }
+    return i + skipAsciiWithoutNulSse2(s + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i inRangeAvx2(__m256i v, char low, char high)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(char(low - 1))),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(char(high + 1)), v));
+}
+
+__attribute__((target("avx2")))
+static uint32 skipNameCharactersAvx2(const byte *s, uint32 length)
+{
+    uint32 i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+        const __m256i letter = inRangeAvx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+        const __m256i digit = inRangeAvx2(v, '0', '9');
+        const __m256i underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+        const uint32 good = uint32(_mm256_movemask_epi8(
+                                _mm256_or_si256(_mm256_or_si256(letter, digit), underscore)));
+        if (good != 0xffffffff) {
+            return i + countTrailingZeros(~good);
+        }
+    }
+    return i + skipNameCharactersSse2(s + i, length - i);
+}
+#endif // HAVE_AVX2_KERNELS
+
+#ifdef HAVE_NEON_KERNELS
+static uint32 skipAsciiWithoutNulNeon(const byte *s, uint32 length)
+{
+    uint32 i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const uint8x16_t v = vld1q_u8(s + i);
+        if (vmaxvq_u8(v) >= 0x80 || vminvq_u8(v) == 0) {
+            // NEON has no cheap equivalent of movemask, so find the position with scalar code
+            return i + skipAsciiWithoutNulScalar(s + i, 16);
+        }
+    }
+    return i + skipAsciiWithoutNulScalar(s + i, length - i);
+}
+
+static inline uint8x16_t inRangeNeon(uint8x16_t v, byte low, byte high)
+{
+    return vandq_u8(vcgeq_u8(v, vdupq_n_u8(low)), vcleq_u8(v, vdupq_n_u8(high)));
+}
+
+static uint32 skipNameCharactersNeon(const byte *s, uint32 length)
+{
+    uint32 i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const uint8x16_t v = vld1q_u8(s + i);
+        const uint8x16_t letter = inRangeNeon(vorrq_u8(v, vdupq_n_u8(0x20)), 'a', 'z');
+        const uint8x16_t digit = inRangeNeon(v, '0', '9');
+        const uint8x16_t underscore = vceqq_u8(v, vdupq_n_u8('_'));
+        if (vminvq_u8(vorrq_u8(vorrq_u8(letter, digit), underscore)) != 0xff) {
+            return i + skipNameCharactersScalar(s + i, 16);
+        }
+    }
+    return i + skipNameCharactersScalar(s + i, length - i);
+}
+#endif // HAVE_NEON_KERNELS
+
+struct ValidationKernels
+{
+    uint32 (*skipAsciiWithoutNul)(const byte *s, uint32 length);
+    uint32 (*skipNameCharacters)(const byte *s, uint32 length);
+};
+
+static ValidationKernels selectKernels()
+{
+    ValidationKernels ret;
+#if defined(HAVE_AVX2_KERNELS)
+    if (__builtin_cpu_supports("avx2")) {
+        ret.skipAsciiWithoutNul = skipAsciiWithoutNulAvx2;
+        ret.skipNameCharacters = skipNameCharactersAvx2;
+        return ret;
+    }
+#endif
+#if defined(HAVE_SSE2_KERNELS)
+    ret.skipAsciiWithoutNul = skipAsciiWithoutNulSse2;
+    ret.skipNameCharacters = skipNameCharactersSse2;
+#elif defined(HAVE_NEON_KERNELS)
+    ret.skipAsciiWithoutNul = skipAsciiWithoutNulNeon;
+    ret.skipNameCharacters = skipNameCharactersNeon;
+#else
+    ret.skipAsciiWithoutNul = skipAsciiWithoutNulScalar;
+    ret.skipNameCharacters = skipNameCharactersScalar;
+#endif
+    return ret;
+}
+
+static const ValidationKernels &kernels()
+{
+    static const ValidationKernels k = selectKernels();
+    return k;
+}
+
+static inline bool isContinuationByte(byte c)
+{
+    return (c & 0xc0) == 0x80;
+}
+
+// Returns the length of the valid multi-byte UTF-8 sequence at the start of s, or 0 if there is none.
+// See the table of well-formed byte sequences in the Unicode standard, section 3.9.
+static uint32 utf8SequenceLength(const byte *s, uint32 length)
+{
+    const byte b0 = s[0];
+    if (b0 >= 0xc2 && b0 <= 0xdf) {
+        return length >= 2 && isContinuationByte(s[1]) ? 2 : 0;
+    }
+    if (b0 >= 0xe0 && b0 <= 0xef) {
+        if (length < 3) {
+            return 0;
+        }
+        // excluding overlong encodings and surrogates
+        const byte low = b0 == 0xe0 ? 0xa0 : 0x80;
+        const byte high = b0 == 0xed ? 0x9f : 0xbf;
+        return s[1] >= low && s[1] <= high && isContinuationByte(s[2]) ? 3 : 0;
+    }
+    if (b0 >= 0xf0 && b0 <= 0xf4) {
+        if (length < 4) {
+            return 0;
+        }
+        // excluding overlong encodings and code points above U+10FFFF
+        const byte low = b0 == 0xf0 ? 0x90 : 0x80;
+        const byte high = b0 == 0xf4 ? 0x8f : 0xbf;
+        return s[1] >= low && s[1] <= high && isContinuationByte(s[2]) && isContinuationByte(s[3]) ? 4 : 0;
+    }
+    return 0; // null, stray continuation bytes, overlong 2-byte sequences and invalid lead bytes
+}
+
+bool isValidUtf8WithoutNul(cstring str)
+{
+    const byte *const s = reinterpret_cast<const byte *>(str.ptr);
+    const uint32 length = str.length;
+    uint32 (*const skipAsciiWithoutNul)(const byte *, uint32) = kernels().skipAsciiWithoutNul;
+
+    uint32 i = 0;
+    while (true) {
+        i += skipAsciiWithoutNul(s + i, length - i);
+        if (i == length) {
+            return true;
+        }
+        const uint32 sequenceLength = utf8SequenceLength(s + i, length - i);
+        if (!sequenceLength) {
+            return false;
+        }
+        i += sequenceLength;
+    }
+}
+
+bool isValidObjectPath(cstring path)
+{
+    const byte *const s = reinterpret_cast<const byte *>(path.ptr);
+    const uint32 length = path.length;
+    if (!length || s[0] != '/') {
+        return false;
+    }
+    if (length == 1) {
+        return true; // "/" special case
+    }
+    uint32 (*const skipNameCharacters)(const byte *, uint32) = kernels().skipNameCharacters;
+
+    for (uint32 i = 1; ; i++) { // i++ skips the '/' between elements
+        const uint32 elementLength = skipNameCharacters(s + i, length - i);
+        if (!elementLength) {
+            return false; // empty element, including a trailing '/', or invalid character
+        }
+        i += elementLength;
+        if (i == length) {
+            return true;
+        }
+        if (s[i] != '/') {
+            return false;
+        }
+    }
+}
+
+bool isValidObjectPathElement(cstring element)
+{
+    return element.length &&
+           kernels().skipNameCharacters(reinterpret_cast<const byte *>(element.ptr), element.length) ==
+               element.length;
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+bool isValidInterfaceName(cstring name)
+{
+    const byte *const s = reinterpret_cast<const byte *>(name.ptr);
+    const uint32 length = name.length;
+    if (!length || length > MaxNameLength) {
+        return false;
+    }
+    uint32 (*const skipNameCharacters)(const byte *, uint32) = kernels().skipNameCharacters;
+
+    uint32 elementCount = 0;
+    for (uint32 i = 0; ; i++) { // i++ skips the '.' between elements
+        if (i == length || isDigit(s[i])) {
+            return false;
+        }
+        const uint32 elementLength = skipNameCharacters(s + i, length - i);
+        if (!elementLength) {
+            return false;
+        }
+        elementCount++;
+        i += elementLength;
+        if (i == length) {
+            return elementCount >= 2;
+        }
+        if (s[i] != '.') {
+            return false;
+        }
+    }
+}
+
+bool isValidMemberName(cstring name)
+{
+    return name.length && name.length <= MaxNameLength && !isDigit(name.ptr[0]) &&
+           kernels().skipNameCharacters(reinterpret_cast<const byte *>(name.ptr), name.length) == name.length;
+}
@@ -0,0 +1,45 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef STRINGVALIDATION_H
+#define STRINGVALIDATION_H
+
+#include "types.h"
+
+// Validation of strings and names according to the D-Bus spec. The inner loops use SSE2, AVX2 or NEON
+// where available, selected at runtime, with a scalar fallback.
+// None of these functions require or check null termination; that is left to the callers.
+
+// Valid UTF-8 (no overlong encodings, surrogates or code points above U+10FFFF) without null characters
+bool isValidUtf8WithoutNul(cstring str);
+// "/" or "/element1/element2/...", elements consisting of [A-Za-z0-9_]
+bool isValidObjectPath(cstring path);
+// One element of an object path
+bool isValidObjectPathElement(cstring element);
+// At least two elements separated by '.', elements consisting of [A-Za-z0-9_] and not starting with a
+// digit, at most 255 bytes. Error names are supposed to follow the same rules.
+bool isValidInterfaceName(cstring name);
+// One element of an interface name
+bool isValidMemberName(cstring name);
+
+#endif // STRINGVALIDATION_H
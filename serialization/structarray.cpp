@@ -0,0 +1,216 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "structarray.h"
+
+#include "arguments_p.h"
+#include "basictypeio.h"
+#include "signatureprogram.h"
+
+#include <cassert>
+#include <cstring>
+
+bool StructArrayLayout::init(const Arguments::StructLayout &layout)
+{
+    const cstring signature = layout.signature;
+    if (!signature.length || signature.ptr[0] != '(' || !layout.stride ||
+        !SignatureProgram::isSignatureValid(signature, Arguments::VariantSignature)) {
+        return false;
+    }
+    // a single struct without strings, arrays or variants (booleans and Unix fds are rejected below)
+    const std::shared_ptr<const SignatureProgram> program = SignatureProgram::get(signature);
+    if (!program->isCompiled() || program->op(0).skip != signature.length || !program->op(0).fixedSize) {
+        return false;
+    }
+
+    m_fields.clear();
+    uint32 wirePos = 0;
+    for (uint32 i = 0; i < signature.length; i++) {
+        const char letter = signature.ptr[i];
+        switch (letter) {
+        case '(':
+            wirePos = align(wirePos, StructAlignment);
+            break;
+        case ')':
+            break;
+        case 'y':
+        case 'n':
+        case 'q':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 't':
+        case 'd': {
+            Field field;
+            field.size = typeInfo(letter).alignment;
+            field.wireOffset = align(wirePos, field.size);
+            field.memoryOffset = layout.fieldOffsets[m_fields.size()];
+            if (uint64(field.memoryOffset) + field.size > layout.stride) {
+                return false;
+            }
+            m_fields.push_back(field);
+            wirePos = field.wireOffset + field.size;
+            break; }
+        default:
+            return false;
+        }
+    }
+    assert(wirePos == program->op(0).fixedSize);
+    m_wireSize = program->op(0).fixedSize;
+    m_wireStride = align(wirePos, StructAlignment);
+    m_memoryStride = layout.stride;
+
+    // find the padding, i.e. the bytes not covered by any field
+    m_padding.clear();
+    uint32 fieldsEnd = 0;
+    for (const Field &field : m_fields) {
+        if (field.wireOffset > fieldsEnd) {
+            m_padding.push_back(Gap{ fieldsEnd, field.wireOffset });
+        }
+        fieldsEnd = field.wireOffset + field.size;
+    }
+    if (m_wireStride > fieldsEnd) {
+        m_padding.push_back(Gap{ fieldsEnd, m_wireStride });
+    }
+
+    m_isMemcpyable = m_padding.empty() && m_memoryStride == m_wireStride;
+    for (const Field &field : m_fields) {
+        m_isMemcpyable = m_isMemcpyable && field.memoryOffset == field.wireOffset;
+    }
+    return true;
+}
+
+uint64 StructArrayLayout::arrayLength(uint32 count) const
+{
+    return count ? uint64(count - 1) * m_wireStride + m_wireSize : 0;
+}
+
+bool StructArrayLayout::countForArrayLength(uint32 length, uint32 *count) const
+{
+    if (!length) {
+        *count = 0;
+        return true;
+    }
+    if (length < m_wireSize || (length - m_wireSize) % m_wireStride) {
+        return false;
+    }
+    *count = (length - m_wireSize) / m_wireStride + 1;
+    return true;
+}
+
+// Fixed-size copies compile to single loads and stores, unlike memcpy() with a variable size
+static inline void copyField(byte *dest, const byte *src, uint32 size)
+{
+    switch (size) {
+    case 1:
+        *dest = *src;
+        break;
+    case 2:
+        memcpy(dest, src, 2);
+        break;
+    case 4:
+        memcpy(dest, src, 4);
+        break;
+    default:
+        memcpy(dest, src, 8);
+        break;
+    }
+}
+
+// src is aligned because it points into marshalled data; dest may be unaligned
+static inline void copyFieldSwapped(byte *dest, const byte *src, uint32 size)
+{
+    switch (size) {
+    case 1:
+        *dest = *src;
+        break;
+    case 2: {
+        const uint16 value = basic::readUint16(src, true);
+        memcpy(dest, &value, 2);
+        break; }
+    case 4: {
+        const uint32 value = basic::readUint32(src, true);
+        memcpy(dest, &value, 4);
+        break; }
+    default: {
+        const uint64 value = basic::readUint64(src, true);
+        memcpy(dest, &value, 8);
+        break; }
+    }
+}
+
+void StructArrayLayout::gather(byte *wire, const byte *memory, uint32 count) const
+{
+    if (!count) {
+        return;
+    }
+    if (m_isMemcpyable) {
+        memcpy(wire, memory, size_t(arrayLength(count)));
+        return;
+    }
+    if (!m_padding.empty()) {
+        memset(wire, 0, size_t(arrayLength(count)));
+    }
+    for (uint32 i = 0; i < count; i++) {
+        for (const Field &field : m_fields) {
+            copyField(wire + field.wireOffset, memory + field.memoryOffset, field.size);
+        }
+        wire += m_wireStride;
+        memory += m_memoryStride;
+    }
+}
+
+bool StructArrayLayout::scatter(byte *memory, const byte *wire, uint32 count, bool isByteSwapped) const
+{
+    if (!count) {
+        return true;
+    }
+    if (m_isMemcpyable && !isByteSwapped) {
+        memcpy(memory, wire, size_t(arrayLength(count)));
+        return true;
+    }
+    // isPaddingZero() clips to the end of the data, which takes care of the missing padding after
+    // the last element
+    const chunk wireData(const_cast<byte *>(wire), uint32(arrayLength(count)));
+    uint32 elementBegin = 0;
+    for (uint32 i = 0; i < count; i++) {
+        for (const Gap &gap : m_padding) {
+            if (!isPaddingZero(wireData, elementBegin + gap.begin, elementBegin + gap.end)) {
+                return false;
+            }
+        }
+        const byte *const element = wire + elementBegin;
+        if (isByteSwapped) {
+            for (const Field &field : m_fields) {
+                copyFieldSwapped(memory + field.memoryOffset, element + field.wireOffset, field.size);
+            }
+        } else {
+            for (const Field &field : m_fields) {
+                copyField(memory + field.memoryOffset, element + field.wireOffset, field.size);
+            }
+        }
+        elementBegin += m_wireStride;
+        memory += m_memoryStride;
+    }
+    return true;
+}
@@ -0,0 +1,75 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef STRUCTARRAY_H
+#define STRUCTARRAY_H
+
+#include "arguments.h"
+
+#include <vector>
+
+// An Arguments::StructLayout, checked and resolved into the positions of the fields on the wire,
+// for bulk reading and writing of arrays of structs with a fixed size on the wire
+class StructArrayLayout
+{
+public:
+    // Returns false if the struct does not have a fixed size on the wire, contains booleans or Unix
+    // file descriptors (which need validation or translation), or the memory layout is inconsistent.
+    bool init(const Arguments::StructLayout &layout);
+
+    // Size of the array contents for count elements. Elements are 8 byte aligned, but there is
+    // no padding after the last one.
+    uint64 arrayLength(uint32 count) const;
+    // Returns false if length is not the array contents size for any number of elements
+    bool countForArrayLength(uint32 length, uint32 *count) const;
+
+    // Memory to wire format, with zeroed padding
+    void gather(byte *wire, const byte *memory, uint32 count) const;
+    // Wire format to memory, converting from the other byte order if isByteSwapped.
+    // Returns false if padding on the wire is not zero.
+    bool scatter(byte *memory, const byte *wire, uint32 count, bool isByteSwapped) const;
+
+    struct Field
+    {
+        uint32 wireOffset;
+        uint32 memoryOffset;
+        uint32 size;
+    };
+    const std::vector<Field> &fields() const { return m_fields; }
+
+private:
+    struct Gap
+    {
+        uint32 begin;
+        uint32 end;
+    };
+
+    std::vector<Field> m_fields;
+    std::vector<Gap> m_padding; // relative to the start of an element, up to the start of the next one
+    uint32 m_wireSize;
+    uint32 m_wireStride;
+    uint32 m_memoryStride;
+    bool m_isMemcpyable; // identical layout in memory and on the wire, without any padding
+};
+
+#endif // STRUCTARRAY_H
@@ -0,0 +1,645 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef TYPEDARGUMENTS_H
+#define TYPEDARGUMENTS_H
+
+#include "arguments.h"
+#include "error.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// TypedWriter and TypedReader serialize and deserialize argument lists whose types are known at compile
+// time, for example TypedWriter<int32, std::string, std::vector<uint64>>. The signature and the alignment
+// layout are computed at compile time, and values are written and read by straight-line code for exactly
+// those types - there is no per-value signature parsing and state tracking like in Arguments::Writer and
+// Arguments::Reader. The wire format is of course the same, so the two APIs can be mixed freely.
+//
+// Supported C++ types and their D-Bus equivalents:
+// bool (b), byte (y), int16 (n), uint16 (q), int32 (i), uint32 (u), int64 (x), uint64 (t), double (d),
+// std::string (s), std::vector<T> (aT), std::map<K, V> (a{KV}) and std::tuple<Ts...> (a struct).
+// Variants, object paths, signatures and Unix file descriptors need the dynamic API.
+
+template <char... letters>
+struct TypedSignature
+{
+    static constexpr uint32 length = sizeof...(letters);
+    static const char *string()
+    {
+        static const char s[] = { letters..., '\0' };
+        return s;
+    }
+};
+
+template <typename... Signatures>
+struct TypedSignatureConcat;
+
+template <>
+struct TypedSignatureConcat<>
+{
+    typedef TypedSignature<> type;
+};
+
+template <char... letters>
+struct TypedSignatureConcat<TypedSignature<letters...>>
+{
+    typedef TypedSignature<letters...> type;
+};
+
+template <char... letters1, char... letters2, typename... Rest>
+struct TypedSignatureConcat<TypedSignature<letters1...>, TypedSignature<letters2...>, Rest...>
+{
+    typedef typename TypedSignatureConcat<TypedSignature<letters1..., letters2...>, Rest...>::type type;
+};
+
+constexpr uint32 typedMaxOf()
+{
+    return 0;
+}
+
+template <typename... Rest>
+constexpr uint32 typedMaxOf(uint32 first, Rest... rest)
+{
+    return first > typedMaxOf(rest...) ? first : typedMaxOf(rest...);
+}
+
+// First pass of TypedWriter: computes the size of the serialized data, and validates it on the way
+struct TypedSizer
+{
+    TypedSizer() : position(0), error(Error::NoError) {}
+
+    void align(uint32 alignment) { position = (position + alignment - 1) & ~uint64(alignment - 1); }
+    void addFixed(uint32 alignment, uint32 size) { align(alignment); position += size; }
+
+    uint64 position; // 64 bits so that it can't overflow before the size checks fail
+    Error::Code error;
+};
+
+// Second pass of TypedWriter: writes into a buffer of the size computed by TypedSizer
+struct TypedWriteCursor
+{
+    void align(uint32 alignment)
+    {
+        const uint32 padEnd = (position + alignment - 1) & ~(alignment - 1);
+        for (; position < padEnd; position++) {
+            data[position] = '\0';
+        }
+    }
+
+    template <typename T>
+    void writeFixed(T value)
+    {
+        align(sizeof(T));
+        memcpy(data + position, &value, sizeof(T));
+        position += sizeof(T);
+    }
+
+    byte *data;
+    uint32 position;
+};
+
+// Reading state of TypedReader. All reads are bounds checked, and padding must be zero as in
+// Arguments::Reader.
+struct TypedReadCursor
+{
+    bool fail()
+    {
+        error = Error::MalformedMessageData;
+        return false;
+    }
+
+    bool align(uint32 alignment)
+    {
+        const uint32 padEnd = (position + alignment - 1) & ~(alignment - 1);
+        if (unlikely(padEnd > length)) {
+            return fail();
+        }
+        for (; position < padEnd; position++) {
+            if (unlikely(data[position] != '\0')) {
+                return fail();
+            }
+        }
+        return true;
+    }
+
+    template <typename T>
+    static T load(const byte *raw, bool swap)
+    {
+        byte buf[sizeof(T)];
+        memcpy(buf, raw, sizeof(T));
+        if (unlikely(swap)) {
+            for (size_t i = 0; i < sizeof(T) / 2; i++) {
+                const byte temp = buf[i];
+                buf[i] = buf[sizeof(T) - 1 - i];
+                buf[sizeof(T) - 1 - i] = temp;
+            }
+        }
+        T ret;
+        memcpy(&ret, buf, sizeof(T));
+        return ret;
+    }
+
+    template <typename T>
+    bool readFixed(T *value)
+    {
+        if (unlikely(!align(sizeof(T)) || length - position < sizeof(T))) {
+            return fail();
+        }
+        *value = load<T>(data + position, isByteSwapped);
+        position += sizeof(T);
+        return true;
+    }
+
+    const byte *data;
+    uint32 length;
+    uint32 position;
+    bool isByteSwapped;
+    Error::Code error;
+};
+
+// TypedArgument<T> describes how T maps to D-Bus: the signature, alignment, limits for the signature
+// checks, and the functions to size, write and read a value.
+template <typename T, typename Enable = void>
+struct TypedArgument
+{
+    static_assert(sizeof(T) == 0, "This type can not be used with TypedWriter / TypedReader");
+};
+
+template <typename T, char letter>
+struct TypedPrimitiveArgument
+{
+    typedef TypedSignature<letter> Signature;
+    static constexpr uint32 alignment = sizeof(T);
+    static constexpr uint32 fixedSize = sizeof(T); // zero for types with variable size
+    static constexpr bool isBasicType = true; // allowed as dict key
+    static constexpr bool isMemcpyable = true; // wire format in native byte order == memory layout
+    static constexpr uint32 arrayDepth = 0;
+    static constexpr uint32 structDepth = 0;
+
+    static void measure(TypedSizer *sizer, const T &) { sizer->addFixed(alignment, fixedSize); }
+    static void write(TypedWriteCursor *cursor, const T &value) { cursor->writeFixed<T>(value); }
+    static bool read(TypedReadCursor *cursor, T *value) { return cursor->readFixed<T>(value); }
+};
+
+template <> struct TypedArgument<byte> : TypedPrimitiveArgument<byte, 'y'> {};
+template <> struct TypedArgument<int16> : TypedPrimitiveArgument<int16, 'n'> {};
+template <> struct TypedArgument<uint16> : TypedPrimitiveArgument<uint16, 'q'> {};
+template <> struct TypedArgument<int32> : TypedPrimitiveArgument<int32, 'i'> {};
+template <> struct TypedArgument<uint32> : TypedPrimitiveArgument<uint32, 'u'> {};
+template <> struct TypedArgument<int64> : TypedPrimitiveArgument<int64, 'x'> {};
+template <> struct TypedArgument<uint64> : TypedPrimitiveArgument<uint64, 't'> {};
+template <> struct TypedArgument<double> : TypedPrimitiveArgument<double, 'd'> {};
+
+// bool is 32 bits on the wire, and only 0 and 1 are valid
+template <>
+struct TypedArgument<bool>
+{
+    typedef TypedSignature<'b'> Signature;
+    static constexpr uint32 alignment = 4;
+    static constexpr uint32 fixedSize = 4;
+    static constexpr bool isBasicType = true;
+    static constexpr bool isMemcpyable = false;
+    static constexpr uint32 arrayDepth = 0;
+    static constexpr uint32 structDepth = 0;
+
+    static void measure(TypedSizer *sizer, bool) { sizer->addFixed(alignment, fixedSize); }
+    static void write(TypedWriteCursor *cursor, bool value) { cursor->writeFixed<uint32>(value ? 1 : 0); }
+    static bool read(TypedReadCursor *cursor, bool *value)
+    {
+        uint32 num;
+        if (unlikely(!cursor->readFixed<uint32>(&num) || num > 1)) {
+            return cursor->fail();
+        }
+        *value = num == 1;
+        return true;
+    }
+};
+
+template <>
+struct TypedArgument<std::string>
+{
+    typedef TypedSignature<'s'> Signature;
+    static constexpr uint32 alignment = 4;
+    static constexpr uint32 fixedSize = 0;
+    static constexpr bool isBasicType = true;
+    static constexpr bool isMemcpyable = false;
+    static constexpr uint32 arrayDepth = 0;
+    static constexpr uint32 structDepth = 0;
+
+    static void measure(TypedSizer *sizer, const std::string &value)
+    {
+        if (unlikely(value.length() >= Arguments::MaxArrayLength ||
+                     !Arguments::isStringValid(cstring(value.c_str(), uint32(value.length()))))) {
+            sizer->error = Error::InvalidString;
+        }
+        sizer->addFixed(4, 4);
+        sizer->position += value.length() + 1;
+    }
+
+    static void write(TypedWriteCursor *cursor, const std::string &value)
+    {
+        const uint32 length = uint32(value.length());
+        cursor->writeFixed<uint32>(length);
+        memcpy(cursor->data + cursor->position, value.c_str(), length + 1);
+        cursor->position += length + 1;
+    }
+
+    static bool read(TypedReadCursor *cursor, std::string *value)
+    {
+        uint32 length;
+        if (unlikely(!cursor->readFixed<uint32>(&length) || length >= cursor->length - cursor->position)) {
+            return cursor->fail();
+        }
+        const char *str = reinterpret_cast<const char *>(cursor->data + cursor->position);
+        if (unlikely(!Arguments::isStringValid(cstring(str, length)))) {
+            return cursor->fail();
+        }
+        value->assign(str, length);
+        cursor->position += length + 1;
+        return true;
+    }
+};
+
+// Arrays: length prefix, padding to the element alignment (even if the array is empty), elements.
+// Arrays of primitives in native byte order are copied in one piece.
+template <typename T>
+struct TypedArgument<std::vector<T>>
+{
+    typedef TypedArgument<T> Element;
+    typedef typename TypedSignatureConcat<TypedSignature<'a'>, typename Element::Signature>::type Signature;
+    static constexpr uint32 alignment = 4;
+    static constexpr uint32 fixedSize = 0;
+    static constexpr bool isBasicType = false;
+    static constexpr bool isMemcpyable = false;
+    static constexpr uint32 arrayDepth = Element::arrayDepth + 1;
+    static constexpr uint32 structDepth = Element::structDepth;
+
+    static void measure(TypedSizer *sizer, const std::vector<T> &value)
+    {
+        sizer->addFixed(4, 4);
+        sizer->align(Element::alignment);
+        const uint64 dataStart = sizer->position;
+        if (Element::fixedSize) {
+            sizer->position += uint64(value.size()) * Element::fixedSize;
+        } else {
+            for (const T &element : value) {
+                Element::measure(sizer, element);
+            }
+        }
+        if (unlikely(sizer->position - dataStart > Arguments::MaxArrayLength)) {
+            sizer->error = Error::ArrayOrDictTooLong;
+        }
+    }
+
+    static void write(TypedWriteCursor *cursor, const std::vector<T> &value)
+    {
+        cursor->align(4);
+        const uint32 lengthPosition = cursor->position;
+        cursor->position += 4;
+        cursor->align(Element::alignment);
+        const uint32 dataStart = cursor->position;
+        writeElements(cursor, value, std::integral_constant<bool, Element::isMemcpyable>());
+        const uint32 length = cursor->position - dataStart;
+        memcpy(cursor->data + lengthPosition, &length, sizeof(uint32));
+    }
+
+    static bool read(TypedReadCursor *cursor, std::vector<T> *value)
+    {
+        uint32 length;
+        if (unlikely(!cursor->readFixed<uint32>(&length) || length > Arguments::MaxArrayLength ||
+                     !cursor->align(Element::alignment) || length > cursor->length - cursor->position)) {
+            return cursor->fail();
+        }
+        value->clear();
+        return readElements(cursor, length, value, std::integral_constant<bool, Element::isMemcpyable>());
+    }
+
+private:
+    static void writeElements(TypedWriteCursor *cursor, const std::vector<T> &value, std::true_type)
+    {
+        const uint32 length = uint32(value.size() * sizeof(T));
+        if (length) {
+            memcpy(cursor->data + cursor->position, static_cast<const void *>(&value.front()), length);
+        }
+        cursor->position += length;
+    }
+
+    static void writeElements(TypedWriteCursor *cursor, const std::vector<T> &value, std::false_type)
+    {
+        for (const T &element : value) {
+            Element::write(cursor, element);
+        }
+    }
+
+    static bool readElements(TypedReadCursor *cursor, uint32 length, std::vector<T> *value, std::true_type)
+    {
+        if (cursor->isByteSwapped) {
+            return readElements(cursor, length, value, std::false_type());
+        }
+        if (unlikely(length % sizeof(T))) {
+            return cursor->fail();
+        }
+        value->resize(length / sizeof(T));
+        if (length) {
+            memcpy(static_cast<void *>(&value->front()), cursor->data + cursor->position, length);
+        }
+        cursor->position += length;
+        return true;
+    }
+
+    static bool readElements(TypedReadCursor *cursor, uint32 length, std::vector<T> *value, std::false_type)
+    {
+        const uint32 dataEnd = cursor->position + length;
+        while (cursor->position < dataEnd) {
+            T element;
+            if (unlikely(!Element::read(cursor, &element))) {
+                return false;
+            }
+            value->push_back(std::move(element));
+        }
+        return likely(cursor->position == dataEnd) || cursor->fail();
+    }
+};
+
+// Dicts are arrays of 8 byte aligned key-value pairs
+template <typename K, typename V>
+struct TypedArgument<std::map<K, V>>
+{
+    typedef TypedArgument<K> Key;
+    typedef TypedArgument<V> Value;
+    static_assert(Key::isBasicType, "Dict keys must be of a basic type");
+    typedef typename TypedSignatureConcat<TypedSignature<'a', '{'>, typename Key::Signature,
+                                          typename Value::Signature, TypedSignature<'}'>>::type Signature;
+    static constexpr uint32 alignment = 4;
+    static constexpr uint32 fixedSize = 0;
+    static constexpr bool isBasicType = false;
+    static constexpr bool isMemcpyable = false;
+    static constexpr uint32 arrayDepth = Value::arrayDepth + 1;
+    static constexpr uint32 structDepth = Value::structDepth;
+
+    static void measure(TypedSizer *sizer, const std::map<K, V> &value)
+    {
+        sizer->addFixed(4, 4);
+        sizer->align(8);
+        const uint64 dataStart = sizer->position;
+        for (const auto &entry : value) {
+            sizer->align(8);
+            Key::measure(sizer, entry.first);
+            Value::measure(sizer, entry.second);
+        }
+        if (unlikely(sizer->position - dataStart > Arguments::MaxArrayLength)) {
+            sizer->error = Error::ArrayOrDictTooLong;
+        }
+    }
+
+    static void write(TypedWriteCursor *cursor, const std::map<K, V> &value)
+    {
+        cursor->align(4);
+        const uint32 lengthPosition = cursor->position;
+        cursor->position += 4;
+        cursor->align(8);
+        const uint32 dataStart = cursor->position;
+        for (const auto &entry : value) {
+            cursor->align(8);
+            Key::write(cursor, entry.first);
+            Value::write(cursor, entry.second);
+        }
+        const uint32 length = cursor->position - dataStart;
+        memcpy(cursor->data + lengthPosition, &length, sizeof(uint32));
+    }
+
+    static bool read(TypedReadCursor *cursor, std::map<K, V> *value)
+    {
+        uint32 length;
+        if (unlikely(!cursor->readFixed<uint32>(&length) || length > Arguments::MaxArrayLength ||
+                     !cursor->align(8) || length > cursor->length - cursor->position)) {
+            return cursor->fail();
+        }
+        value->clear();
+        const uint32 dataEnd = cursor->position + length;
+        while (cursor->position < dataEnd) {
+            K key;
+            V val;
+            if (unlikely(!cursor->align(8) || !Key::read(cursor, &key) || !Value::read(cursor, &val))) {
+                return cursor->fail();
+            }
+            (*value)[std::move(key)] = std::move(val);
+        }
+        return likely(cursor->position == dataEnd) || cursor->fail();
+    }
+};
+
+template <size_t index, size_t count, typename Tuple>
+struct TypedTupleElements
+{
+    typedef typename std::tuple_element<index, Tuple>::type ElementType;
+    typedef TypedArgument<ElementType> Element;
+    typedef TypedTupleElements<index + 1, count, Tuple> Next;
+    typedef typename TypedSignatureConcat<typename Element::Signature, typename Next::Signature>::type
+            Signature;
+    static constexpr uint32 arrayDepth = typedMaxOf(Element::arrayDepth, Next::arrayDepth);
+    static constexpr uint32 structDepth = typedMaxOf(Element::structDepth, Next::structDepth);
+
+    static void measure(TypedSizer *sizer, const Tuple &value)
+    {
+        Element::measure(sizer, std::get<index>(value));
+        Next::measure(sizer, value);
+    }
+
+    static void write(TypedWriteCursor *cursor, const Tuple &value)
+    {
+        Element::write(cursor, std::get<index>(value));
+        Next::write(cursor, value);
+    }
+
+    static bool read(TypedReadCursor *cursor, Tuple *value)
+    {
+        return Element::read(cursor, &std::get<index>(*value)) && Next::read(cursor, value);
+    }
+};
+
+template <size_t count, typename Tuple>
+struct TypedTupleElements<count, count, Tuple>
+{
+    typedef TypedSignature<> Signature;
+    static constexpr uint32 arrayDepth = 0;
+    static constexpr uint32 structDepth = 0;
+
+    static void measure(TypedSizer *, const Tuple &) {}
+    static void write(TypedWriteCursor *, const Tuple &) {}
+    static bool read(TypedReadCursor *, Tuple *) { return true; }
+};
+
+// Structs are 8 byte aligned
+template <typename... Ts>
+struct TypedArgument<std::tuple<Ts...>>
+{
+    static_assert(sizeof...(Ts) != 0, "Empty structs are not allowed in D-Bus");
+    typedef std::tuple<Ts...> Tuple;
+    typedef TypedTupleElements<0, sizeof...(Ts), Tuple> Elements;
+    typedef typename TypedSignatureConcat<TypedSignature<'('>, typename Elements::Signature,
+                                          TypedSignature<')'>>::type Signature;
+    static constexpr uint32 alignment = 8;
+    static constexpr uint32 fixedSize = 0;
+    static constexpr bool isBasicType = false;
+    static constexpr bool isMemcpyable = false;
+    static constexpr uint32 arrayDepth = Elements::arrayDepth;
+    static constexpr uint32 structDepth = Elements::structDepth + 1;
+
+    static void measure(TypedSizer *sizer, const Tuple &value)
+    {
+        sizer->align(8);
+        Elements::measure(sizer, value);
+    }
+
+    static void write(TypedWriteCursor *cursor, const Tuple &value)
+    {
+        cursor->align(8);
+        Elements::write(cursor, value);
+    }
+
+    static bool read(TypedReadCursor *cursor, Tuple *value)
+    {
+        return cursor->align(8) && Elements::read(cursor, value);
+    }
+};
+
+// Compile-time information about a whole argument list, shared by TypedWriter and TypedReader
+template <typename... Ts>
+struct TypedArgumentList
+{
+    typedef typename TypedSignatureConcat<typename TypedArgument<Ts>::Signature...>::type Signature;
+    static_assert(Signature::length <= Arguments::MaxSignatureLength, "Signature is too long");
+    static_assert(typedMaxOf(TypedArgument<Ts>::arrayDepth...) <= 32, "Arrays are nested too deeply");
+    static_assert(typedMaxOf(TypedArgument<Ts>::structDepth...) <= 32, "Structs are nested too deeply");
+
+    static cstring signature() { return cstring(Signature::string(), Signature::length); }
+};
+
+class DFERRY_EXPORT TypedArgumentsBase
+{
+protected:
+    static Arguments errorArguments(Error::Code code);
+};
+
+// Usage: Arguments args = TypedWriter<int32, std::string>::write(1234, "foo");
+// As with Arguments::Writer::finish(), a failure results in an Arguments instance with error() set.
+template <typename... Ts>
+class TypedWriter : public TypedArgumentsBase
+{
+public:
+    typedef TypedArgumentList<Ts...> List;
+
+    static cstring signature() { return List::signature(); }
+
+    static Arguments write(const Ts &... values)
+    {
+        TypedSizer sizer;
+        const int dummy1[] = { 0, (TypedArgument<Ts>::measure(&sizer, values), 0)... };
+        (void)dummy1;
+        if (unlikely(sizer.error != Error::NoError)) {
+            return errorArguments(sizer.error);
+        }
+        if (unlikely(sizer.position > Arguments::MaxMessageLength)) {
+            return errorArguments(Error::ArgumentsTooLong);
+        }
+        if (!sizer.position) {
+            return Arguments();
+        }
+
+        // Same memory layout as in Arguments' copy constructor: signature, padding to 8 bytes, data
+        const uint32 signatureLength = List::Signature::length;
+        const uint32 dataOffset = (signatureLength + 1 + 7) & ~uint32(7);
+        const uint32 dataLength = uint32(sizer.position);
+        byte *const buffer = reinterpret_cast<byte *>(malloc(dataOffset + dataLength));
+        memcpy(buffer, List::Signature::string(), signatureLength + 1);
+        memset(buffer + signatureLength + 1, 0, dataOffset - signatureLength - 1);
+
+        TypedWriteCursor cursor;
+        cursor.data = buffer + dataOffset;
+        cursor.position = 0;
+        const int dummy2[] = { 0, (TypedArgument<Ts>::write(&cursor, values), 0)... };
+        (void)dummy2;
+        assert(cursor.position == dataLength);
+
+        return Arguments(buffer, cstring(buffer, signatureLength), chunk(buffer + dataOffset, dataLength));
+    }
+};
+
+// Usage:
+// int32 i;
+// std::string s;
+// TypedReader<int32, std::string> reader(args);
+// if (reader.read(&i, &s)) { ... } else { reader.error() tells what went wrong }
+template <typename... Ts>
+class TypedReader
+{
+public:
+    typedef TypedArgumentList<Ts...> List;
+
+    explicit TypedReader(const Arguments &args)
+       : m_args(args),
+         m_error(Error::NoError)
+    {}
+
+    static cstring signature() { return List::signature(); }
+
+    // Returns false and sets error() if the signature of the Arguments does not match or if the data is
+    // malformed. The values are then partially written.
+    bool read(Ts *... values)
+    {
+        const cstring actualSignature = m_args.signature();
+        if (actualSignature.length != List::Signature::length ||
+            (actualSignature.length &&
+             memcmp(actualSignature.ptr, List::Signature::string(), actualSignature.length) != 0)) {
+            m_error = Error::ReadWrongType;
+            return false;
+        }
+        const chunk data = m_args.data();
+        TypedReadCursor cursor;
+        cursor.data = data.ptr;
+        cursor.length = data.length;
+        cursor.position = 0;
+        cursor.isByteSwapped = m_args.isByteSwapped();
+        cursor.error = Error::NoError;
+        bool ok = true;
+        const int dummy[] = { 0, (ok = ok && TypedArgument<Ts>::read(&cursor, values), 0)... };
+        (void)dummy;
+        m_error = ok ? Error::NoError : Error(Error::MalformedMessageData);
+        return ok;
+    }
+
+    Error error() const { return m_error; }
+
+private:
+    const Arguments &m_args;
+    Error m_error;
+};
+
+#endif // TYPEDARGUMENTS_H
@@ -0,0 +1,273 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "arguments.h"
+#include "connectaddress.h"
+#include "connection.h"
+#include "eventdispatcher.h"
+#include "message.h"
+
+#include "../testutil.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tests the client side of the authentication handshake against a scripted fake bus
+
+#ifdef __linux__
+static const char *s_fakeBusName = "dferry.Test.AuthClient";
+static const char *s_okLine = "OK 0123456789abcdef0123456789abcdef\r\n";
+static const char *s_uniqueName = ":1.42";
+static const std::string s_authExternalStart("\0AUTH EXTERNAL ", 15); // the NUL byte goes first
+
+static bool startsWith(const std::string &str, const std::string &prefix)
+{
+    return str.compare(0, prefix.length(), prefix) == 0;
+}
+
+static socklen_t fakeBusAddress(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = PF_UNIX;
+    const size_t nameLength = strlen(s_fakeBusName);
+    memcpy(addr->sun_path + 1, s_fakeBusName, nameLength); // abstract, starting with '\0'
+    return socklen_t(sizeof(sa_family_t) + 1 + nameLength);
+}
+
+static void setReceiveTimeout(int fd)
+{
+    // don't hang if the client doesn't do what the script expects; this also applies to accept()
+    struct timeval timeout;
+    timeout.tv_sec = 5;
+    timeout.tv_usec = 0;
+    TEST(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+}
+
+static int createFakeBus()
+{
+    const int fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    TEST(fd >= 0);
+    struct sockaddr_un addr;
+    const socklen_t addrLength = fakeBusAddress(&addr);
+    TEST(bind(fd, reinterpret_cast<struct sockaddr *>(&addr), addrLength) == 0);
+    TEST(listen(fd, 4) == 0);
+    setReceiveTimeout(fd);
+    return fd;
+}
+
+static int acceptClient(int serverFd, std::vector<int> *accepted)
+{
+    const int fd = accept(serverFd, nullptr, nullptr);
+    TEST(fd >= 0);
+    setReceiveTimeout(fd);
+    accepted->push_back(fd);
+    return fd;
+}
+
+// Reads from the client until *received ends with terminator. Assumes that the client doesn't send
+// anything after terminator without waiting for a response, which is true for the handshake.
+static void receiveUntil(int fd, std::string *received, const std::string &terminator)
+{
+    while (received->length() < terminator.length() ||
+           received->compare(received->length() - terminator.length(), terminator.length(),
+                             terminator) != 0) {
+        char buf[512];
+        const ssize_t nbytes = recv(fd, buf, sizeof(buf), 0);
+        TEST(nbytes > 0);
+        received->append(buf, size_t(nbytes));
+    }
+}
+
+// The client may send the Hello message right after BEGIN; the fake bus doesn't look at it
+static void receiveThroughBegin(int fd, std::string *received)
+{
+    const std::string begin("BEGIN\r\n");
+    while (received->find(begin) == std::string::npos) {
+        char buf[512];
+        const ssize_t nbytes = recv(fd, buf, sizeof(buf), 0);
+        TEST(nbytes > 0);
+        received->append(buf, size_t(nbytes));
+    }
+}
+
+static void sendAll(int fd, const std::string &data)
+{
+    TEST(send(fd, data.c_str(), data.length(), MSG_NOSIGNAL) == ssize_t(data.length()));
+}
+
+static std::string helloReply()
+{
+    Message reply;
+    reply.setType(Message::MethodReturnMessage);
+    reply.setSerial(1);
+    reply.setReplySerial(1); // the serial of the Hello message
+    reply.setSender("org.freedesktop.DBus");
+    Arguments::Writer writer;
+    writer.writeString(s_uniqueName);
+    reply.setArguments(writer.finish());
+    const std::vector<byte> data = reply.save();
+    return std::string(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+static ConnectAddress fakeBusClientAddress()
+{
+    ConnectAddress clientAddr;
+    clientAddr.setType(ConnectAddress::Type::AbstractUnixPath);
+    clientAddr.setRole(ConnectAddress::Role::BusClient);
+    clientAddr.setPath(s_fakeBusName);
+    return clientAddr;
+}
+
+static void waitForState(EventDispatcher *eventDispatcher, Connection *connection,
+                         Connection::State state)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (connection->state() != state) {
+        TEST(std::chrono::steady_clock::now() < deadline);
+        eventDispatcher->poll(10);
+    }
+}
+
+static void closeAll(const std::vector<int> &fds)
+{
+    for (int fd : fds) {
+        close(fd);
+    }
+}
+
+static void testHelloReplyWithHandshakeResponses()
+{
+    // The responses to the pipelined handshake and the Hello reply arrive in one piece
+    const int serverFd = createFakeBus();
+    std::vector<int> accepted;
+    std::thread busThread([serverFd, &accepted] () {
+        const int fd = acceptClient(serverFd, &accepted);
+        std::string received;
+        receiveThroughBegin(fd, &received);
+        // everything was sent without waiting for responses
+        TEST(startsWith(received, s_authExternalStart));
+        TEST(received.find("NEGOTIATE_UNIX_FD\r\nBEGIN\r\n") != std::string::npos);
+        sendAll(fd, std::string(s_okLine) + "AGREE_UNIX_FD\r\n" + helloReply());
+    });
+
+    EventDispatcher eventDispatcher;
+    {
+        Connection conn(&eventDispatcher, fakeBusClientAddress());
+        waitForState(&eventDispatcher, &conn, Connection::Connected);
+        TEST(conn.uniqueName() == s_uniqueName);
+        busThread.join();
+    }
+    TEST(accepted.size() == 1);
+    closeAll(accepted);
+    close(serverFd);
+}
+
+static void testRejectedPipelinedHandshake()
+{
+    // After the server rejects the pipelined handshake, the client reconnects and waits for each
+    // response before sending the next command
+    const int serverFd = createFakeBus();
+    std::vector<int> accepted;
+    std::thread busThread([serverFd, &accepted] () {
+        {
+            const int fd = acceptClient(serverFd, &accepted);
+            std::string received;
+            receiveThroughBegin(fd, &received);
+            sendAll(fd, "REJECTED ANONYMOUS\r\n");
+        }
+        const int fd = acceptClient(serverFd, &accepted);
+        std::string received;
+        receiveUntil(fd, &received, "\r\n");
+        TEST(startsWith(received, s_authExternalStart));
+        TEST(received.find("NEGOTIATE_UNIX_FD") == std::string::npos);
+        sendAll(fd, s_okLine);
+
+        received.clear();
+        receiveUntil(fd, &received, "\r\n");
+        TEST(received == "NEGOTIATE_UNIX_FD\r\n");
+        sendAll(fd, "AGREE_UNIX_FD\r\n");
+
+        received.clear();
+        receiveThroughBegin(fd, &received);
+        TEST(startsWith(received, "BEGIN\r\n"));
+        sendAll(fd, helloReply());
+    });
+
+    EventDispatcher eventDispatcher;
+    {
+        Connection conn(&eventDispatcher, fakeBusClientAddress());
+        waitForState(&eventDispatcher, &conn, Connection::Connected);
+        TEST(conn.uniqueName() == s_uniqueName);
+        busThread.join();
+    }
+    TEST(accepted.size() == 2);
+    closeAll(accepted);
+    close(serverFd);
+}
+
+static void testOverlongLine()
+{
+    // A response line longer than AuthClient's limit of 4096 bytes makes authentication fail instead
+    // of reading forever. It fails once in the pipelined and once in the ordered handshake.
+    const int serverFd = createFakeBus();
+    std::vector<int> accepted;
+    std::thread busThread([serverFd, &accepted] () {
+        for (int i = 0; i < 2; i++) {
+            const int fd = acceptClient(serverFd, &accepted);
+            sendAll(fd, std::string(5000, 'x'));
+        }
+    });
+
+    EventDispatcher eventDispatcher;
+    {
+        Connection conn(&eventDispatcher, fakeBusClientAddress());
+        waitForState(&eventDispatcher, &conn, Connection::Unconnected);
+        TEST(!conn.isConnected());
+        busThread.join();
+    }
+    TEST(accepted.size() == 2);
+    closeAll(accepted);
+    close(serverFd);
+}
+#endif
+
+int main(int, char *[])
+{
+#ifdef __linux__
+    testHelloReplyWithHandshakeResponses();
+    testRejectedPipelinedHandshake();
+    testOverlongLine();
+#endif
+    std::cout << "Passed!\n";
+}
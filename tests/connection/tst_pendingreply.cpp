@@ -24,15 +24,22 @@
 #include "arguments.h"
 #include "connectaddress.h"
 #include "eventdispatcher.h"
+#include "icompletionlistener.h"
 #include "imessagereceiver.h"
+#include "malloccache.h"
 #include "message.h"
 #include "pendingreply.h"
 #include "connection.h"
+#include "timer.h"
 
 #include "../testutil.h"
 
+#include <cstdint>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 static void addressMessageToBus(Message *msg)
 {
@@ -124,11 +131,451 @@ static void testTimeout()
     }
 }
 
+class TimeoutOrderCheck : public IMessageReceiver
+{
+public:
+    void handlePendingReplyFinished(PendingReply *reply, Connection *connection) override
+    {
+        TEST(reply->error().code() == Error::Timeout);
+        const int index = int(reinterpret_cast<intptr_t>(reply->cookie()));
+        TEST(m_timedOutCount < int(sizeof(m_expectedOrder) / sizeof(int)));
+        TEST(index == m_expectedOrder[m_timedOutCount]);
+        m_timedOutCount++;
+        if (m_timedOutCount == int(sizeof(m_expectedOrder) / sizeof(int))) {
+            connection->eventDispatcher()->interrupt();
+        }
+    }
+
+    // timeouts: 300, 100, 300, 100, 200, 100, 300 - and #3 and #4 are canceled
+    const int m_expectedOrder[5] = { 1, 5, 0, 2, 6 };
+    int m_timedOutCount = 0;
+};
+
+static void testTimeoutOrder()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    while (conn.uniqueName().empty()) {
+        eventDispatcher.poll();
+    }
+
+    constexpr int callCount = 7;
+    const int timeouts[callCount] = { 300, 100, 300, 100, 200, 100, 300 };
+    PendingReply replies[callCount];
+    TimeoutOrderCheck timeoutCheck;
+    for (int i = 0; i < callCount; i++) {
+        Message msg = Message::createCall("/some/dummy/path", "org.no_interface", "non_existent_method");
+        msg.setDestination(conn.uniqueName());
+        replies[i] = conn.send(std::move(msg), timeouts[i]);
+        replies[i].setCookie(reinterpret_cast<void *>(intptr_t(i)));
+        replies[i].setReceiver(&timeoutCheck);
+    }
+    // cancel the only call with the 200 ms timeout and one in the middle of the 100 ms calls
+    replies[3] = PendingReply();
+    replies[4] = PendingReply();
+
+    while (eventDispatcher.poll()) {
+    }
+    TEST(timeoutCheck.m_timedOutCount == 5);
+}
+
+class CountingReplyCheck : public IMessageReceiver
+{
+public:
+    void handlePendingReplyFinished(PendingReply *reply, Connection *connection) override
+    {
+        TEST(reply->isFinished());
+        TEST(reply->reply());
+        TEST(reply->reply()->type() == Message::ErrorMessage);
+        m_finishedCount++;
+        if (m_finishedCount == m_expectedCount) {
+            connection->eventDispatcher()->interrupt();
+        }
+    }
+
+    int m_finishedCount = 0;
+    int m_expectedCount = 0;
+};
+
+static void testManyPendingReplies()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+
+    // Many calls outstanding at the same time, some of them canceled, to exercise the bookkeeping of
+    // pending replies in Connection. The bus replies with an error to each call.
+    constexpr int callCount = 500;
+    std::vector<PendingReply> replies(callCount);
+    CountingReplyCheck replyCheck;
+    for (int i = 0; i < callCount; i++) {
+        Message msg;
+        addressMessageToBus(&msg);
+        msg.setMethod("NonExistentMethod");
+        replies[i] = conn.send(std::move(msg));
+        replies[i].setReceiver(&replyCheck);
+    }
+    for (int i = 0; i < callCount; i += 3) {
+        replies[i] = PendingReply();
+    }
+    replyCheck.m_expectedCount = callCount - (callCount + 2) / 3;
+
+    while (eventDispatcher.poll()) {
+    }
+    TEST(replyCheck.m_finishedCount == replyCheck.m_expectedCount);
+}
+
+class BatchReplyCheck : public IMessageReceiver
+{
+public:
+    void handlePendingReplyFinished(PendingReply *reply, Connection *connection) override
+    {
+        const int index = int(reinterpret_cast<intptr_t>(reply->cookie()));
+        if (index == m_invalidIndex) {
+            TEST(reply->isError());
+            TEST(!reply->reply());
+        } else {
+            TEST(reply->hasNonErrorReply());
+            TEST(reply->reply()->type() == Message::MethodReturnMessage);
+            // replies from the bus come in the order of the calls
+            TEST(index > m_lastIndex);
+            m_lastIndex = index;
+        }
+        m_finishedCount++;
+        if (m_finishedCount == m_expectedCount) {
+            connection->eventDispatcher()->interrupt();
+        }
+    }
+
+    int m_invalidIndex = -1;
+    int m_lastIndex = -1;
+    int m_finishedCount = 0;
+    int m_expectedCount = 0;
+};
+
+static void testSendBatch(bool waitForConnected)
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    if (waitForConnected) {
+        conn.waitForConnectionEstablished();
+    }
+
+    constexpr int callCount = 200;
+    BatchReplyCheck replyCheck;
+    replyCheck.m_invalidIndex = 42;
+    replyCheck.m_expectedCount = callCount;
+
+    std::vector<Message> messages;
+    for (int i = 0; i < callCount; i++) {
+        Message msg;
+        addressMessageToBus(&msg);
+        if (i != replyCheck.m_invalidIndex) {
+            msg.setMethod("GetId");
+        } // else it fails to serialize because a method call needs a method name
+        messages.push_back(std::move(msg));
+    }
+
+    std::vector<PendingReply> replies = conn.sendBatch(std::move(messages));
+    TEST(replies.size() == callCount);
+    for (int i = 0; i < callCount; i++) {
+        // errors before sending are detected right away, but still reported asynchronously
+        TEST(replies[i].isError() == (i == replyCheck.m_invalidIndex));
+        TEST(!replies[i].isFinished());
+        replies[i].setCookie(reinterpret_cast<void *>(intptr_t(i)));
+        replies[i].setReceiver(&replyCheck);
+    }
+
+    while (eventDispatcher.poll()) {
+    }
+    TEST(replyCheck.m_finishedCount == callCount);
+}
+
+class SpontaneousMessageCounter : public IMessageReceiver
+{
+public:
+    void handleSpontaneousMessageReceived(Message msg, Connection *) override
+    {
+        // ignore the NameAcquired signal from the bus
+        if (msg.type() == Message::MethodCallMessage) {
+            m_count++;
+        }
+    }
+    int m_count = 0;
+};
+
+class TimerCounter : public ICompletionListener
+{
+public:
+    void handleCompletion(void *) override { m_count++; }
+    int m_count = 0;
+};
+
+static void testCall(bool waitForConnected)
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    if (waitForConnected) {
+        conn.waitForConnectionEstablished();
+        TEST(!conn.uniqueName().empty());
+    }
+    SpontaneousMessageCounter messageCounter;
+    conn.setSpontaneousMessageReceiver(&messageCounter);
+
+    // call() must not run timers
+    TimerCounter timerCounter;
+    Timer timer(&eventDispatcher);
+    timer.setCompletionListener(&timerCounter);
+    timer.start(0);
+
+    {
+        Message msg;
+        addressMessageToBus(&msg);
+        msg.setMethod("GetId");
+        PendingReply reply = conn.call(std::move(msg));
+        TEST(reply.isFinished());
+        TEST(reply.hasNonErrorReply());
+        TEST(reply.reply()->type() == Message::MethodReturnMessage);
+        TEST(!conn.uniqueName().empty());
+    }
+    {
+        // A message to ourselves arrives during the following calls. It must not be delivered until the
+        // event loop runs.
+        Message msg = Message::createCall("/some/dummy/path", "org.no_interface", "non_existent_method");
+        msg.setDestination(conn.uniqueName());
+        TEST(!conn.sendNoReply(std::move(msg)).isError());
+
+        msg = Message::createCall("/some/dummy/path", "org.no_interface", "non_existent_method");
+        msg.setDestination(conn.uniqueName());
+        PendingReply reply = conn.call(std::move(msg), 200);
+        TEST(reply.isFinished());
+        TEST(reply.error().code() == Error::Timeout);
+    }
+    {
+        Message msg;
+        addressMessageToBus(&msg); // no method name: fails to serialize
+        PendingReply reply = conn.call(std::move(msg));
+        TEST(reply.isFinished());
+        TEST(reply.isError());
+        TEST(!reply.reply());
+    }
+    TEST(messageCounter.m_count == 0);
+    TEST(timerCounter.m_count == 0);
+
+    while (messageCounter.m_count < 2) {
+        eventDispatcher.poll();
+    }
+    TEST(messageCounter.m_count == 2);
+    TEST(timerCounter.m_count == 1);
+}
+
+static void testFinishedCallback()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+
+    int spontaneousCount = 0;
+    conn.setSpontaneousMessageCallback([&spontaneousCount](Message msg, Connection *) {
+        if (msg.type() == Message::MethodCallMessage) {
+            spontaneousCount++;
+        }
+    });
+
+    int finishedCount = 0;
+    std::vector<PendingReply> replies;
+    for (int i = 0; i < 3; i++) {
+        Message msg;
+        addressMessageToBus(&msg);
+        msg.setMethod("GetId");
+        replies.push_back(conn.send(std::move(msg)));
+    }
+
+    // small and trivially copyable
+    replies[0].setFinishedCallback([&finishedCount, &replies](PendingReply *reply, Connection *) {
+        TEST(reply == &replies[0]);
+        TEST(reply->hasNonErrorReply());
+        finishedCount++;
+    });
+    // small, but needs to be destroyed
+    std::shared_ptr<int> shared = std::make_shared<int>(1);
+    replies[1].setFinishedCallback([shared, &finishedCount](PendingReply *reply, Connection *) {
+        TEST(*shared == 1);
+        TEST(reply->hasNonErrorReply());
+        finishedCount++;
+    });
+    TEST(shared.use_count() == 2);
+    // too large to store inline
+    const std::string context = "a string that is too long for the small string optimization";
+    replies[2].setFinishedCallback([context, &finishedCount](PendingReply *reply, Connection *) {
+        TEST(context.length() > 20);
+        TEST(reply->hasNonErrorReply());
+        finishedCount++;
+    });
+    TEST(replies[2].hasFinishedCallback());
+
+    // a receiver replaces the callback
+    Message msg;
+    addressMessageToBus(&msg);
+    msg.setMethod("GetId");
+    PendingReply replacedReply = conn.send(std::move(msg));
+    replacedReply.setFinishedCallback([](PendingReply *, Connection *) { TEST(false); });
+    ReplyCheck replyCheck;
+    replacedReply.setReceiver(&replyCheck);
+    TEST(!replacedReply.hasFinishedCallback());
+
+    // a callback that destroys its PendingReply
+    msg = Message();
+    addressMessageToBus(&msg);
+    msg.setMethod("GetId");
+    std::unique_ptr<PendingReply> ownedReply(new PendingReply(conn.send(std::move(msg))));
+    ownedReply->setFinishedCallback([&ownedReply, &finishedCount](PendingReply *, Connection *) {
+        ownedReply.reset();
+        finishedCount++;
+    });
+
+    // a message to ourselves for the spontaneous message callback
+    msg = Message::createCall("/some/dummy/path", "org.no_interface", "non_existent_method");
+    msg.setDestination(conn.uniqueName());
+    TEST(!conn.sendNoReply(std::move(msg)).isError());
+
+    while (finishedCount < 4 || spontaneousCount < 1 || !replacedReply.isFinished()) {
+        eventDispatcher.poll();
+    }
+    TEST(finishedCount == 4);
+    TEST(spontaneousCount == 1);
+    TEST(!ownedReply);
+    // the callback has been destroyed after calling it
+    TEST(shared.use_count() == 1);
+}
+
+static void sendCallToSelf(Connection *conn)
+{
+    Message msg = Message::createCall("/some/dummy/path", "org.no_interface", "non_existent_method");
+    msg.setDestination(conn->uniqueName());
+    TEST(!conn->sendNoReply(std::move(msg)).isError());
+}
+
+static void testReplaceSpontaneousMessageCallback()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+
+    int firstCount = 0;
+    int secondCount = 0;
+    std::shared_ptr<int> shared = std::make_shared<int>(1);
+    conn.setSpontaneousMessageCallback([shared, &firstCount, &secondCount](Message msg, Connection *connection) {
+        if (msg.type() != Message::MethodCallMessage) {
+            return;
+        }
+        firstCount++;
+        connection->setSpontaneousMessageCallback([&secondCount](Message msg, Connection *) {
+            if (msg.type() == Message::MethodCallMessage) {
+                secondCount++;
+            }
+        });
+        // the replaced callback is destroyed only after it returns
+        TEST(*shared == 1);
+        TEST(shared.use_count() == 2);
+    });
+
+    sendCallToSelf(&conn);
+    sendCallToSelf(&conn);
+    while (firstCount + secondCount < 2) {
+        eventDispatcher.poll();
+    }
+    TEST(firstCount == 1);
+    TEST(secondCount == 1);
+    TEST(shared.use_count() == 1);
+}
+
+static void testPoolReuse()
+{
+    // the pool behind PendingReplyPrivate
+    MallocPool<64> pool(2);
+    void *const first = pool.allocate();
+    void *const second = pool.allocate();
+    void *const third = pool.allocate();
+    pool.free(first);
+    pool.free(second);
+    pool.free(third); // over capacity, freed right away
+    TEST(pool.allocate() == second);
+    TEST(pool.allocate() == first);
+    pool.free(first);
+    pool.setCapacity(0); // frees the cached block
+    TEST(pool.capacity() == 0);
+    pool.free(second);
+
+    TEST(PendingReply::poolCapacity() == 256);
+    PendingReply::setPoolCapacity(4);
+    TEST(PendingReply::poolCapacity() == 4);
+    std::thread otherThread([] () {
+        // per thread
+        TEST(PendingReply::poolCapacity() == 256);
+    });
+    otherThread.join();
+    PendingReply::setPoolCapacity(256);
+}
+
+static PendingReply getId(Connection *conn)
+{
+    Message msg;
+    addressMessageToBus(&msg);
+    msg.setMethod("GetId");
+    PendingReply reply = conn->call(std::move(msg));
+    TEST(reply.hasNonErrorReply());
+    return reply;
+}
+
+struct ThreadLocalReply
+{
+    PendingReply reply;
+};
+
+static void testPoolFromOtherThread()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+
+    // A finished PendingReply from this thread's pool is freed into the other thread's pool, which
+    // frees it at thread exit
+    PendingReply reply = getId(&conn);
+    std::thread otherThread([&reply] () {
+        PendingReply movedReply = std::move(reply);
+    });
+    otherThread.join();
+    TEST(reply.isNull());
+
+    // A PendingReply that is destroyed after its thread's pool, which is destroyed at thread exit
+    std::thread exitingThread([] () {
+        static thread_local ThreadLocalReply threadLocalReply; // constructed before the pool
+        EventDispatcher eventDispatcher;
+        Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+        conn.waitForConnectionEstablished();
+        threadLocalReply.reply = getId(&conn);
+        // only test the PendingReply, Message has its own thread_local caches
+        threadLocalReply.reply.takeReply();
+    });
+    exitingThread.join();
+}
+
 int main(int, char *[])
 {
     testBusAddress(false);
     testBusAddress(true);
     testTimeout();
+    testTimeoutOrder();
+    testManyPendingReplies();
+    testSendBatch(false);
+    testSendBatch(true);
+    testCall(false);
+    testCall(true);
+    testFinishedCallback();
+    testReplaceSpontaneousMessageCallback();
+    testPoolReuse();
+    testPoolFromOtherThread();
     // TODO testBadCall
     std::cout << "Passed!\n";
 }
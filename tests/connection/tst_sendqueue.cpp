@@ -0,0 +1,290 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "arguments.h"
+#include "connectaddress.h"
+#include "connection.h"
+#include "error.h"
+#include "eventdispatcher.h"
+#include "imessagereceiver.h"
+#include "ireplyreceiver.h"
+#include "isendqueuelistener.h"
+#include "message.h"
+
+#include "../testutil.h"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+static const size_t s_lowWatermark = 64 * 1024;
+static const size_t s_highWatermark = 256 * 1024;
+static const uint32 s_payloadSize = 16 * 1024;
+
+static Arguments createPayload(uint32 index)
+{
+    Arguments::Writer writer;
+    writer.writeUint32(index);
+    std::vector<byte> payload(s_payloadSize, byte(index));
+    writer.writePrimitiveArray(Arguments::Byte, chunk(payload.data(), payload.size()));
+    return writer.finish();
+}
+
+static Message createSignal(uint32 index)
+{
+    Message msg = Message::createSignal("/foo", "org.foo.interface", "flood");
+    msg.setArguments(createPayload(index));
+    return msg;
+}
+
+class SignalCounter : public IMessageReceiver
+{
+public:
+    void handleSpontaneousMessageReceived(Message msg, Connection *) override
+    {
+        Arguments::Reader reader(msg.arguments());
+        m_lastIndex = reader.readUint32();
+        m_count++;
+    }
+    std::atomic<uint32> m_count { 0 };
+    uint32 m_lastIndex = 0;
+};
+
+class WatermarkListener : public ISendQueueListener
+{
+public:
+    void handleSendQueueAboveHighWatermark(Connection *connection, size_t byteCount) override
+    {
+        TEST(!m_isAbove);
+        TEST(byteCount == connection->sendQueueByteCount());
+        m_isAbove = true;
+        m_aboveCount++;
+    }
+    void handleSendQueueBelowLowWatermark(Connection *connection, size_t byteCount) override
+    {
+        TEST(m_isAbove);
+        TEST(byteCount == connection->sendQueueByteCount());
+        TEST(byteCount <= s_lowWatermark);
+        m_isAbove = false;
+        m_belowCount++;
+    }
+    bool m_isAbove = false;
+    int m_aboveCount = 0;
+    int m_belowCount = 0;
+};
+
+static ConnectAddress peerAddress(const char *path, ConnectAddress::Role role)
+{
+    ConnectAddress address;
+    address.setType(ConnectAddress::Type::AbstractUnixPath);
+    address.setRole(role);
+    address.setPath(path);
+    return address;
+}
+
+// The server is in the same thread, so it doesn't read anything while the client is sending
+static void testPolicy(Connection::SendQueuePolicy policy)
+{
+    EventDispatcher dispatcher;
+    Connection server(&dispatcher, peerAddress("dferry.Test.SendQueue", ConnectAddress::Role::PeerServer));
+    Connection client(&dispatcher, peerAddress("dferry.Test.SendQueue", ConnectAddress::Role::PeerClient));
+    SignalCounter signalCounter;
+    server.setSpontaneousMessageReceiver(&signalCounter);
+    WatermarkListener watermarkListener;
+    client.setSendQueueListener(&watermarkListener);
+    client.setSendQueueWatermarks(s_lowWatermark, s_highWatermark);
+    client.setSendQueuePolicy(policy);
+    TEST(client.sendQueueLowWatermark() == s_lowWatermark);
+    TEST(client.sendQueueHighWatermark() == s_highWatermark);
+    TEST(client.sendQueuePolicy() == policy);
+
+    client.waitForConnectionEstablished();
+    TEST(client.isConnected());
+    TEST(client.sendQueueByteCount() == 0);
+
+    // much more than fits into the socket buffers
+    const uint32 sendCount = 400;
+    uint32 acceptedCount = 0;
+    for (uint32 i = 0; i < sendCount; i++) {
+        const Error error = client.sendNoReply(createSignal(i));
+        if (error.isError()) {
+            TEST(policy == Connection::SendQueuePolicy::Reject);
+            TEST(error.code() == Error::SendQueueFull);
+        } else {
+            acceptedCount++;
+        }
+        if (policy != Connection::SendQueuePolicy::Unlimited) {
+            TEST(client.sendQueueByteCount() <= s_highWatermark);
+        }
+    }
+    TEST(client.sendQueueByteCount() > s_lowWatermark);
+    if (policy == Connection::SendQueuePolicy::Unlimited) {
+        TEST(client.sendQueueByteCount() > s_highWatermark);
+    }
+    // notifications only come from the event loop
+    TEST(watermarkListener.m_aboveCount == 0);
+
+    while (client.sendQueueLength() || signalCounter.m_count < acceptedCount) {
+        dispatcher.poll();
+        if (policy == Connection::SendQueuePolicy::DropOldestSignals &&
+            !client.sendQueueLength() && signalCounter.m_lastIndex == sendCount - 1) {
+            break; // no more are coming
+        }
+    }
+    TEST(client.sendQueueByteCount() == 0);
+    if (policy != Connection::SendQueuePolicy::Reject) {
+        // the newest signal is never dropped
+        TEST(signalCounter.m_lastIndex == sendCount - 1);
+    }
+
+    switch (policy) {
+    case Connection::SendQueuePolicy::Unlimited:
+        TEST(signalCounter.m_count == sendCount);
+        TEST(watermarkListener.m_aboveCount == 1);
+        break;
+    case Connection::SendQueuePolicy::Reject:
+        TEST(acceptedCount < sendCount);
+        TEST(signalCounter.m_count == acceptedCount);
+        TEST(watermarkListener.m_aboveCount == 0); // messages that would go above are rejected
+        break;
+    case Connection::SendQueuePolicy::DropOldestSignals:
+        TEST(signalCounter.m_count < sendCount);
+        TEST(watermarkListener.m_aboveCount == 0);
+        break;
+    default:
+        TEST(false);
+    }
+    TEST(watermarkListener.m_belowCount == watermarkListener.m_aboveCount);
+}
+
+// The server is in another thread; blocking waits for it to read
+static void testBlockPolicy()
+{
+    const uint32 sendCount = 400;
+    SignalCounter signalCounter;
+    std::atomic<bool> serverReady { false };
+    std::thread serverThread([&signalCounter, &serverReady]() {
+        EventDispatcher dispatcher;
+        Connection server(&dispatcher, peerAddress("dferry.Test.SendQueueBlock",
+                                                   ConnectAddress::Role::PeerServer));
+        server.setSpontaneousMessageReceiver(&signalCounter);
+        serverReady = true;
+        while (signalCounter.m_count < sendCount) {
+            dispatcher.poll();
+        }
+    });
+    while (!serverReady) {
+        std::this_thread::yield();
+    }
+
+    EventDispatcher dispatcher;
+    Connection client(&dispatcher, peerAddress("dferry.Test.SendQueueBlock", ConnectAddress::Role::PeerClient));
+    client.setSendQueueWatermarks(s_lowWatermark, s_highWatermark);
+    client.setSendQueuePolicy(Connection::SendQueuePolicy::Block);
+    client.waitForConnectionEstablished();
+    TEST(client.isConnected());
+
+    for (uint32 i = 0; i < sendCount; i++) {
+        TEST(!client.sendNoReply(createSignal(i)).isError());
+        TEST(client.sendQueueByteCount() <= s_highWatermark);
+    }
+    while (client.sendQueueLength()) {
+        dispatcher.poll();
+    }
+    serverThread.join();
+    TEST(signalCounter.m_count == sendCount);
+    TEST(signalCounter.m_lastIndex == sendCount - 1);
+}
+
+class CallReplier : public IMessageReceiver
+{
+public:
+    void handleSpontaneousMessageReceived(Message call, Connection *connection) override
+    {
+        TEST(!connection->sendNoReply(Message::createReplyTo(call)).isError());
+    }
+};
+
+class ReplyCounter : public IReplyReceiver
+{
+public:
+    void handleReply(uint32, Message, Error error) override
+    {
+        if (error.isError()) {
+            TEST(error.code() == Error::SendQueueFull);
+            m_rejectedCount++;
+        } else {
+            m_successCount++;
+        }
+    }
+    uint32 m_successCount = 0;
+    uint32 m_rejectedCount = 0;
+};
+
+// Messages from other threads are sent from the event loop, which must not block for them. The server
+// is in the same thread, so blocking would never end.
+static void testBlockPolicyFromOtherThread()
+{
+    EventDispatcher dispatcher;
+    Connection server(&dispatcher, peerAddress("dferry.Test.SendQueueBlockOther",
+                                               ConnectAddress::Role::PeerServer));
+    Connection client(&dispatcher, peerAddress("dferry.Test.SendQueueBlockOther",
+                                               ConnectAddress::Role::PeerClient));
+    CallReplier callReplier;
+    server.setSpontaneousMessageReceiver(&callReplier);
+    client.setSendQueueWatermarks(s_lowWatermark, s_highWatermark);
+    client.setSendQueuePolicy(Connection::SendQueuePolicy::Block);
+    client.waitForConnectionEstablished();
+    TEST(client.isConnected());
+
+    // all messages are queued before the event loop runs, so they are sent without reading in between
+    const uint32 sendCount = 100;
+    ReplyCounter replyCounter;
+    std::thread senderThread([&client, &replyCounter]() {
+        for (uint32 i = 0; i < sendCount; i++) {
+            Message call = Message::createCall("/foo", "org.foo.interface", "flood");
+            call.setArguments(createPayload(i));
+            TEST(!client.sendFromAnyThread(std::move(call), &replyCounter).isError());
+        }
+    });
+    senderThread.join();
+
+    while (replyCounter.m_successCount + replyCounter.m_rejectedCount < sendCount) {
+        dispatcher.poll();
+    }
+    TEST(replyCounter.m_successCount > 0);
+    TEST(replyCounter.m_rejectedCount > 0);
+}
+
+int main(int, char *[])
+{
+#ifdef __linux__
+    testPolicy(Connection::SendQueuePolicy::Unlimited);
+    testPolicy(Connection::SendQueuePolicy::Reject);
+    testPolicy(Connection::SendQueuePolicy::DropOldestSignals);
+    testBlockPolicy();
+    testBlockPolicyFromOtherThread();
+#endif
+    std::cout << "Passed!\n";
+}
@@ -34,8 +34,19 @@
 
 #include "../testutil.h"
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
@@ -112,7 +123,9 @@ enum TestConstants
     ServerCloseTestRun = 2,
     TestRunCount = 3,
 
-    ReplyTimeoutMsecs = 25000 // TODO back to 250
+    ReplyTimeoutMsecs = 25000, // TODO back to 250
+
+    ParallelConnectionCount = 32
 };
 
 //////////////////////// client thread (a secondary thread) /////////////////////
@@ -326,11 +339,232 @@ static void testAcceptMultiple(int testRunIndex)
     }
 }
 
+class AcceptAllHandler : public INewConnectionListener
+{
+public:
+    void handleNewConnection(Server *server) override
+    {
+        std::unique_ptr<Connection> conn(server->takeNextClient());
+        TEST(conn);
+        m_connections.push_back(std::move(*conn));
+    }
+
+    std::vector<Connection> m_connections;
+};
+
+static void testConnectInParallel()
+{
+    // Connecting does not block, so many connections can be established at the same time from one thread
+    EventDispatcher eventDispatcher;
+
+    ConnectAddress addr;
+    addr.setRole(ConnectAddress::Role::PeerServer);
+#ifdef __unix__
+    addr.setType(ConnectAddress::Type::TmpDir);
+    addr.setPath("/tmp");
+#else
+    addr.setType(ConnectAddress::Type::Tcp);
+    addr.setPort(36817);
+#endif
+
+    Server server(&eventDispatcher, addr);
+    TEST(server.isListening());
+    AcceptAllHandler acceptAllHandler;
+    server.setNewConnectionListener(&acceptAllHandler);
+
+    ConnectAddress clientAddr = server.concreteAddress();
+    clientAddr.setRole(ConnectAddress::Role::PeerClient);
+
+    std::vector<Connection> clients;
+    for (int i = 0; i < ParallelConnectionCount; i++) {
+        clients.push_back(Connection(&eventDispatcher, clientAddr));
+        TEST(clients.back().state() != Connection::Unconnected);
+    }
+
+    const auto allConnected = [&clients] () {
+        return std::all_of(clients.begin(), clients.end(),
+                           [] (const Connection &c) { return c.state() == Connection::Connected; });
+    };
+    while (!allConnected() || acceptAllHandler.m_connections.size() < size_t(ParallelConnectionCount)) {
+        eventDispatcher.poll();
+    }
+    for (const Connection &client : clients) {
+        TEST(client.isConnected());
+    }
+}
+
+class DeletingHandler : public INewConnectionListener, public IMessageReceiver
+{
+public:
+    // INewConnectionListener
+    void handleNewConnection(Server *server) override
+    {
+        m_connection.reset(server->takeNextClient());
+        TEST(m_connection);
+        m_connection->setSpontaneousMessageReceiver(this);
+    }
+
+    // IMessageReceiver
+    void handleSpontaneousMessageReceived(Message, Connection *conn) override
+    {
+        TEST(conn == m_connection.get());
+        m_receivedCount++;
+        m_connection.reset();
+    }
+
+    std::unique_ptr<Connection> m_connection;
+    int m_receivedCount = 0;
+};
+
+static void testDeleteInMessageHandler()
+{
+    // Messages that arrive together are delivered from one read; deleting the Connection in the handler
+    // of the first one must stop delivery without touching the deleted Connection
+    EventDispatcher eventDispatcher;
+
+    ConnectAddress addr;
+    addr.setRole(ConnectAddress::Role::PeerServer);
+#ifdef __unix__
+    addr.setType(ConnectAddress::Type::TmpDir);
+    addr.setPath("/tmp");
+#else
+    addr.setType(ConnectAddress::Type::Tcp);
+    addr.setPort(36818);
+#endif
+
+    Server server(&eventDispatcher, addr);
+    DeletingHandler deletingHandler;
+    server.setNewConnectionListener(&deletingHandler);
+
+    ConnectAddress clientAddr = server.concreteAddress();
+    clientAddr.setRole(ConnectAddress::Role::PeerClient);
+    Connection client(&eventDispatcher, clientAddr);
+    while (!client.isConnected() || !deletingHandler.m_connection) {
+        eventDispatcher.poll();
+    }
+
+    for (int i = 0; i < 10; i++) {
+        client.sendNoReply(Message::createSignal("/foo", "org.foo.interface", "bar"));
+    }
+    while (client.state() != Connection::Unconnected) {
+        eventDispatcher.poll();
+    }
+    TEST(!deletingHandler.m_connection);
+    TEST(deletingHandler.m_receivedCount == 1);
+}
+
+#ifdef __linux__
+static const char *s_backlogServerName = "dferry.Test.ConnectRetry";
+
+static socklen_t backlogServerAddress(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = PF_UNIX;
+    const size_t nameLength = strlen(s_backlogServerName);
+    memcpy(addr->sun_path + 1, s_backlogServerName, nameLength); // abstract, starting with '\0'
+    return socklen_t(sizeof(sa_family_t) + 1 + nameLength);
+}
+
+// A listening socket that doesn't accept anything by itself, with a minimal listen backlog
+static int createBacklogServer()
+{
+    const int fd = socket(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    TEST(fd >= 0);
+    struct sockaddr_un addr;
+    const socklen_t addrLength = backlogServerAddress(&addr);
+    TEST(bind(fd, reinterpret_cast<struct sockaddr *>(&addr), addrLength) == 0);
+    TEST(listen(fd, 0) == 0);
+    return fd;
+}
+
+static void fillBacklog()
+{
+    struct sockaddr_un addr;
+    const socklen_t addrLength = backlogServerAddress(&addr);
+    for (int fillerCount = 0; ; fillerCount++) {
+        TEST(fillerCount < 100);
+        const int filler = socket(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        TEST(filler >= 0);
+        const bool connected = connect(filler, reinterpret_cast<struct sockaddr *>(&addr), addrLength) == 0;
+        const int connectErrno = errno;
+        // a connection stays in the backlog until accepted, closing this end doesn't change that
+        close(filler);
+        if (!connected) {
+            TEST(connectErrno == EAGAIN);
+            break;
+        }
+    }
+}
+
+static void acceptAll(int serverFd, std::vector<int> *accepted)
+{
+    int fd;
+    while ((fd = accept(serverFd, nullptr, nullptr)) >= 0) {
+        accepted->push_back(fd);
+    }
+}
+
+static void testConnectWithFullBacklog()
+{
+    // While the server's listen backlog is full, the client keeps trying to connect, without blocking
+    EventDispatcher eventDispatcher;
+    const int serverFd = createBacklogServer();
+    std::vector<int> accepted;
+    fillBacklog();
+
+    ConnectAddress clientAddr;
+    clientAddr.setType(ConnectAddress::Type::AbstractUnixPath);
+    clientAddr.setRole(ConnectAddress::Role::PeerClient);
+    clientAddr.setPath(s_backlogServerName);
+
+    {
+        Connection client(&eventDispatcher, clientAddr);
+        TEST(client.state() == Connection::Connecting);
+        for (int i = 0; i < 5; i++) {
+            eventDispatcher.poll(10);
+        }
+        TEST(client.state() == Connection::Connecting);
+        TEST(!client.isConnected());
+
+        acceptAll(serverFd, &accepted);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (client.state() != Connection::Connected) {
+            TEST(std::chrono::steady_clock::now() < deadline);
+            eventDispatcher.poll(10);
+        }
+        TEST(client.isConnected());
+    }
+
+    // The same, but waiting in waitForConnectionEstablished()
+    fillBacklog();
+    {
+        Connection client(&eventDispatcher, clientAddr);
+        TEST(client.state() == Connection::Connecting);
+        std::thread acceptThread([serverFd, &accepted] () {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            acceptAll(serverFd, &accepted);
+        });
+        client.waitForConnectionEstablished();
+        TEST(client.isConnected());
+        acceptThread.join();
+    }
+
+    for (int fd : accepted) {
+        close(fd);
+    }
+    close(serverFd);
+}
+#endif
 
 int main(int, char *[])
 {
     for (int i = 0; i < TestRunCount; i++) {
         testAcceptMultiple(i);
     }
+    testConnectInParallel();
+    testDeleteInMessageHandler();
+#ifdef __linux__
+    testConnectWithFullBacklog();
+#endif
     std::cout << "Passed!\n";
 }
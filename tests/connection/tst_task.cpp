@@ -0,0 +1,139 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "task.h"
+
+#include "connectaddress.h"
+#include "connection.h"
+#include "eventdispatcher.h"
+#include "message.h"
+#include "pendingreply.h"
+
+#include "../testutil.h"
+
+#include <iostream>
+
+static Message createGetIdCall()
+{
+    Message msg = Message::createCall("/org/freedesktop/DBus", "org.freedesktop.DBus", "GetId");
+    msg.setDestination("org.freedesktop.DBus");
+    return msg;
+}
+
+static Task<bool> getId(Connection *conn)
+{
+    PendingReply reply = co_await conn->send(createGetIdCall());
+    TEST(reply.isFinished());
+    co_return reply.hasNonErrorReply() && reply.reply()->type() == Message::MethodReturnMessage;
+}
+
+static Task<> countGetIds(Connection *conn, int count, int *successCount)
+{
+    for (int i = 0; i < count; i++) {
+        if (co_await getId(conn)) {
+            (*successCount)++;
+        }
+    }
+    conn->eventDispatcher()->interrupt();
+}
+
+static void testSequential()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+
+    int successCount = 0;
+    Task<> task = countGetIds(&conn, 10, &successCount);
+    TEST(!task.isFinished());
+    while (!task.isFinished()) {
+        eventDispatcher.poll();
+    }
+    TEST(successCount == 10);
+}
+
+static Task<> getIdDetached(Connection *conn, int *finishedCount)
+{
+    TEST(co_await getId(conn));
+    (*finishedCount)++;
+}
+
+static void testConcurrent()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+
+    constexpr int taskCount = 1000;
+    int finishedCount = 0;
+    for (int i = 0; i < taskCount; i++) {
+        // the Task object is destroyed right away, the coroutine continues on its own
+        getIdDetached(&conn, &finishedCount);
+    }
+    TEST(finishedCount == 0);
+    while (finishedCount < taskCount) {
+        eventDispatcher.poll();
+    }
+    TEST(finishedCount == taskCount);
+}
+
+static Task<Error> callWithTimeout(Connection *conn)
+{
+    // a call to ourselves, where nobody is going to answer
+    Message msg = Message::createCall("/some/dummy/path", "org.no_interface", "non_existent_method");
+    msg.setDestination(conn->uniqueName());
+    PendingReply reply = conn->send(std::move(msg), 100);
+    PendingReply &sameReply = co_await reply;
+    TEST(&sameReply == &reply);
+    co_return reply.error();
+}
+
+static void testTimeoutAndFinished()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+
+    Task<Error> task = callWithTimeout(&conn);
+    while (!task.isFinished()) {
+        eventDispatcher.poll();
+    }
+
+    // an already finished PendingReply doesn't suspend
+    PendingReply finishedReply = conn.call(createGetIdCall());
+    TEST(finishedReply.isFinished());
+    bool resumed = false;
+    auto awaitFinished = [](PendingReply *reply, bool *resumed) -> Task<> {
+        co_await *reply;
+        *resumed = true;
+    };
+    Task<> finishedTask = awaitFinished(&finishedReply, &resumed);
+    TEST(resumed);
+    TEST(finishedTask.isFinished());
+}
+
+int main(int, char *[])
+{
+    testSequential();
+    testConcurrent();
+    testTimeoutAndFinished();
+    std::cout << "Passed!\n";
+}
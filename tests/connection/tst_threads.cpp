@@ -25,8 +25,10 @@
 #include "connectaddress.h"
 #include "eventdispatcher.h"
 #include "imessagereceiver.h"
+#include "ireplyreceiver.h"
 #include "message.h"
 #include "pendingreply.h"
+#include "platformtime.h"
 #include "stringtools.h"
 #include "connection.h"
 
@@ -35,6 +37,7 @@
 #include <atomic>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 static const char *echoPath = "/echo";
 // make the name "fairly unique" because the interface name is our only protection against replying
@@ -224,15 +227,259 @@ static void testThreadedTimeout()
     timeoutThread.join();
 }
 
+static void callThreadRun(Connection::CommRef mainConnectionRef, std::atomic<bool> *done)
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, std::move(mainConnectionRef));
+    while (!conn.uniqueName().length()) {
+        eventDispatcher.poll();
+    }
+
+    Message getId = Message::createCall("/org/freedesktop/DBus", "org.freedesktop.DBus", "GetId");
+    getId.setDestination(std::string("org.freedesktop.DBus"));
+    PendingReply reply = conn.call(std::move(getId));
+    TEST(reply.isFinished());
+    TEST(reply.hasNonErrorReply());
+
+    Message notRepliedTo = Message::createCall(echoPath, echoInterface, echoMethod);
+    notRepliedTo.setDestination(conn.uniqueName());
+    const uint64 startTime = PlatformTime::monotonicMsecs();
+    PendingReply deadReply = conn.call(std::move(notRepliedTo), 50);
+    const uint64 elapsed = PlatformTime::monotonicMsecs() - startTime;
+    TEST(deadReply.isFinished());
+    TEST(deadReply.error().code() == Error::Timeout);
+    TEST(elapsed >= 50);
+    TEST(elapsed < 1000);
+    *done = true;
+}
+
+static void testThreadedCall()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+
+    std::atomic<bool> done(false);
+    std::thread callThread(callThreadRun, conn.createCommRef(), &done);
+
+    while (!done) {
+        eventDispatcher.poll();
+    }
+
+    callThread.join();
+}
+
+//////////////// Sending from threads without event loop ////////////////
+
+class EchoReplier : public IMessageReceiver
+{
+public:
+    void handleSpontaneousMessageReceived(Message call, Connection *connection) override
+    {
+        if (call.interface() != echoInterface) {
+            return;
+        }
+        if (call.expectsReply()) {
+            Message reply = Message::createReplyTo(call);
+            reply.setArguments(call.arguments());
+            TEST(!connection->sendNoReply(std::move(reply)).isError());
+        } else {
+            m_noReplyCallsReceived++;
+        }
+    }
+
+    uint32 m_noReplyCallsReceived = 0;
+};
+
+class CountingReplyReceiver : public IReplyReceiver
+{
+public:
+    void handleReply(uint32 serial, Message reply, Error error) override
+    {
+        TEST(!error.isError());
+        TEST(reply.replySerial() == serial);
+        Arguments args = reply.arguments();
+        Arguments::Reader reader(args);
+        TEST(reader.readUint32() < s_threadCount * s_messagesPerThread);
+        TEST(reader.isFinished());
+        m_repliesReceived++;
+    }
+
+    static const uint32 s_threadCount = 4;
+    static const uint32 s_messagesPerThread = 100;
+    uint32 m_repliesReceived = 0;
+};
+
+static void anyThreadSenderRun(Connection *connection, std::string destination,
+                               CountingReplyReceiver *replyReceiver, uint32 threadIndex)
+{
+    for (uint32 i = 0; i < CountingReplyReceiver::s_messagesPerThread; i++) {
+        Message call = Message::createCall(echoPath, echoInterface, echoMethod);
+        call.setDestination(destination);
+        Arguments::Writer writer;
+        writer.writeUint32(threadIndex * CountingReplyReceiver::s_messagesPerThread + i);
+        call.setArguments(writer.finish());
+        TEST(!connection->sendFromAnyThread(std::move(call), replyReceiver).isError());
+
+        Message noReplyCall = Message::createCall(echoPath, echoInterface, echoMethod);
+        noReplyCall.setDestination(destination);
+        noReplyCall.setExpectsReply(false);
+        TEST(!connection->sendNoReplyFromAnyThread(std::move(noReplyCall)).isError());
+    }
+}
+
+static void testSendFromAnyThread()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+    TEST(conn.isConnected());
+
+    EchoReplier echoReplier;
+    conn.setSpontaneousMessageReceiver(&echoReplier);
+    CountingReplyReceiver replyReceiver;
+
+    std::vector<std::thread> senderThreads;
+    for (uint32 i = 0; i < CountingReplyReceiver::s_threadCount; i++) {
+        senderThreads.emplace_back(anyThreadSenderRun, &conn, conn.uniqueName(), &replyReceiver, i);
+    }
+    const uint32 messageCount = CountingReplyReceiver::s_threadCount * CountingReplyReceiver::s_messagesPerThread;
+    while (replyReceiver.m_repliesReceived < messageCount ||
+           echoReplier.m_noReplyCallsReceived < messageCount) {
+        eventDispatcher.poll();
+    }
+    for (std::thread &thread : senderThreads) {
+        thread.join();
+    }
+}
+
+class ThreadCheckingReplyReceiver : public IReplyReceiver
+{
+public:
+    void handleReply(uint32 serial, Message reply, Error error) override
+    {
+        TEST(std::this_thread::get_id() == m_expectedThread);
+        TEST(!error.isError());
+        TEST(reply.replySerial() == serial);
+        m_repliesReceived++;
+    }
+
+    std::thread::id m_expectedThread;
+    uint32 m_repliesReceived = 0;
+};
+
+static void testSendFromAnyThreadWithReplyDispatcher()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+    TEST(conn.isConnected());
+
+    EchoReplier echoReplier;
+    conn.setSpontaneousMessageReceiver(&echoReplier);
+
+    // the sender thread runs an EventDispatcher without Connection to receive the replies
+    std::atomic<bool> done { false };
+    const std::string destination = conn.uniqueName();
+    std::thread senderThread([&conn, &eventDispatcher, &done, destination]() {
+        EventDispatcher replyDispatcher;
+        ThreadCheckingReplyReceiver replyReceiver;
+        replyReceiver.m_expectedThread = std::this_thread::get_id();
+        const uint32 messageCount = 100;
+        for (uint32 i = 0; i < messageCount; i++) {
+            Message call = Message::createCall(echoPath, echoInterface, echoMethod);
+            call.setDestination(destination);
+            Arguments::Writer writer;
+            writer.writeUint32(i);
+            call.setArguments(writer.finish());
+            TEST(!conn.sendFromAnyThread(std::move(call), &replyReceiver, &replyDispatcher).isError());
+        }
+        while (replyReceiver.m_repliesReceived < messageCount) {
+            replyDispatcher.poll();
+        }
+        done = true;
+        eventDispatcher.interrupt();
+    });
+    while (!done) {
+        eventDispatcher.poll();
+    }
+    senderThread.join();
+}
 
 // more things to test:
 // - (do we want to do this, and if so here??) blocking on a reply through other thread's connection
 // - ping-pong with several messages queued - every message should arrive exactly once and messages
 //   should arrive in sending order (can use serials for that as simplificitaion)
 
+static void disconnectingSecondaryRun(Connection::CommRef mainConnectionRef, std::string destination,
+                                      std::atomic<bool> *secondaryReady)
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, std::move(mainConnectionRef));
+    while (!conn.uniqueName().length()) {
+        eventDispatcher.poll();
+    }
+
+    std::atomic<bool> sawDisconnect(false);
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> senderThreads;
+    for (uint32 i = 0; i < 4; i++) {
+        senderThreads.emplace_back([&conn, &destination, &sawDisconnect, &stop] () {
+            while (!stop) {
+                Message noReplyCall = Message::createCall(echoPath, echoInterface, echoMethod);
+                noReplyCall.setDestination(destination);
+                noReplyCall.setExpectsReply(false);
+                const Error error = conn.sendNoReplyFromAnyThread(std::move(noReplyCall));
+                if (error.isError()) {
+                    TEST(error.code() == Error::LocalDisconnect);
+                    sawDisconnect = true;
+                }
+            }
+        });
+    }
+    *secondaryReady = true;
+
+    // the main Connection disconnects meanwhile
+    const uint64 deadline = PlatformTime::monotonicMsecs() + 5000;
+    while (!sawDisconnect) {
+        TEST(PlatformTime::monotonicMsecs() < deadline);
+        eventDispatcher.poll(10);
+    }
+    stop = true;
+    for (std::thread &thread : senderThreads) {
+        thread.join();
+    }
+    // process the sends that were queued last
+    eventDispatcher.poll(10);
+}
+
+static void testSendFromAnyThreadWhileDisconnecting()
+{
+    EventDispatcher eventDispatcher;
+    Connection conn(&eventDispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+    TEST(conn.isConnected());
+
+    std::atomic<bool> secondaryReady(false);
+    std::thread secondaryThread(disconnectingSecondaryRun, conn.createCommRef(), conn.uniqueName(),
+                                &secondaryReady);
+    while (!secondaryReady) {
+        eventDispatcher.poll(10);
+    }
+    // let some messages through before disconnecting
+    for (int i = 0; i < 5; i++) {
+        eventDispatcher.poll(10);
+    }
+    conn.close();
+    secondaryThread.join();
+}
+
 int main(int, char *[])
 {
     testPingPong();
     testThreadedTimeout();
+    testThreadedCall();
+    testSendFromAnyThread();
+    testSendFromAnyThreadWithReplyDispatcher();
+    testSendFromAnyThreadWhileDisconnecting();
     std::cout << "Passed!\n";
 }
@@ -0,0 +1,190 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "eventdispatcher.h"
+#include "eventdispatcher_p.h"
+#include "iioeventlistener.h"
+#include "platformtime.h"
+
+#include "../testutil.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Tests readiness notification and wakeups of the native event pollers, with and without
+// edge-triggered epoll (DFERRY_EPOLL_EDGE_TRIGGERED)
+
+#ifdef __linux__
+class SocketReader : public IIoEventListener
+{
+public:
+    explicit SocketReader(int fd)
+       : m_fd(fd)
+    {
+        setReadInterest(true);
+    }
+
+    ~SocketReader() override
+    {
+        if (ioEventSource()) {
+            ioEventSource()->removeIoListener(this);
+        }
+    }
+
+    IO::Status handleIoReady(IO::RW rw) override
+    {
+        TEST(rw == IO::RW::Read);
+        TEST(!m_isAtEnd);
+        m_notificationCount++;
+        // small reads, so that draining the socket takes several of them
+        byte buffer[64];
+        while (true) {
+            const ssize_t length = ::read(m_fd, buffer, sizeof(buffer));
+            if (length > 0) {
+                m_bytesRead += uint32(length);
+            } else if (length == 0) {
+                // like a transport that has seen the other side close, stay registered without interest
+                m_isAtEnd = true;
+                setReadInterest(false);
+                break;
+            } else {
+                break; // EAGAIN
+            }
+        }
+        return IO::Status::OK;
+    }
+
+    FileDescriptor fileDescriptor() const override { return m_fd; }
+    bool drainsIoOnReady() const override { return true; }
+
+    void setReadInterest(bool isInterested) { setIoInterest(isInterested ? uint32(IO::RW::Read) : 0); }
+
+    int m_fd;
+    uint32 m_bytesRead = 0;
+    int m_notificationCount = 0;
+    bool m_isAtEnd = false;
+};
+
+// Returns how often poll() returned in the given time
+static int pollCountWithin(EventDispatcher *dispatcher, uint64 msecs)
+{
+    const uint64 end = PlatformTime::monotonicMsecs() + msecs;
+    int count = 0;
+    for (uint64 now = PlatformTime::monotonicMsecs(); now < end; now = PlatformTime::monotonicMsecs()) {
+        dispatcher->poll(int(end - now));
+        count++;
+    }
+    return count;
+}
+
+template<typename Predicate>
+static void pollUntil(EventDispatcher *dispatcher, Predicate isDone)
+{
+    const uint64 deadline = PlatformTime::monotonicMsecs() + 5000;
+    while (!isDone()) {
+        TEST(PlatformTime::monotonicMsecs() < deadline);
+        dispatcher->poll(100);
+    }
+}
+
+static void writeBytes(int fd, uint32 count)
+{
+    const std::vector<byte> data(count, 'x');
+    TEST(::write(fd, data.data(), data.size()) == ssize_t(count));
+}
+
+static void testInterrupt(EventDispatcher::Backend backend)
+{
+    EventDispatcher dispatcher(backend);
+
+    // Several interrupts before polling cause only one wakeup
+    dispatcher.interrupt();
+    dispatcher.interrupt();
+    dispatcher.interrupt();
+    TEST(!dispatcher.poll(-1));
+    TEST(pollCountWithin(&dispatcher, 50) <= 2);
+
+    // from another thread, while waiting
+    std::thread interruptThread([&dispatcher] () {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        dispatcher.interrupt();
+    });
+    TEST(!dispatcher.poll(-1));
+    interruptThread.join();
+}
+
+static void testReadReadiness(EventDispatcher::Backend backend)
+{
+    EventDispatcher dispatcher(backend);
+    int fds[2];
+    TEST(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == 0);
+    SocketReader reader(fds[0]);
+    EventDispatcherPrivate::get(&dispatcher)->addIoListener(&reader);
+
+    // More than one read's worth; with edge-triggered notification, the reader must drain it all at once
+    writeBytes(fds[1], 1000);
+    pollUntil(&dispatcher, [&reader] () { return reader.m_bytesRead == 1000; });
+
+    // Data that arrives while there is no interest is reported when interest returns, even though the
+    // (edge-triggered) readiness change happened before
+    reader.setReadInterest(false);
+    writeBytes(fds[1], 500);
+    pollCountWithin(&dispatcher, 20);
+    TEST(reader.m_bytesRead == 1000);
+    reader.setReadInterest(true);
+    pollUntil(&dispatcher, [&reader] () { return reader.m_bytesRead == 1500; });
+
+    // A hangup without interest must neither be reported nor make poll() return right away, over and over
+    reader.setReadInterest(false);
+    const int notificationCount = reader.m_notificationCount;
+    ::close(fds[1]);
+    TEST(pollCountWithin(&dispatcher, 100) < 10);
+    TEST(reader.m_notificationCount == notificationCount);
+    reader.setReadInterest(true);
+    pollUntil(&dispatcher, [&reader] () { return reader.m_isAtEnd; });
+
+    // the reader has removed its interest itself
+    TEST(pollCountWithin(&dispatcher, 100) < 10);
+    EventDispatcherPrivate::get(&dispatcher)->removeIoListener(&reader);
+    ::close(fds[0]);
+}
+#endif
+
+int main(int, char *[])
+{
+#ifdef __linux__
+    for (EventDispatcher::Backend backend : { EventDispatcher::Backend::Default,
+                                              EventDispatcher::Backend::IoUring }) {
+        testInterrupt(backend);
+        testReadReadiness(backend);
+    }
+#endif
+    std::cout << "Passed!\n";
+}
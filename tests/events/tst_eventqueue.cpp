@@ -0,0 +1,119 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "arguments.h"
+#include "connectaddress.h"
+#include "connection.h"
+#include "eventdispatcher.h"
+#include "imessagereceiver.h"
+#include "ireplyreceiver.h"
+#include "message.h"
+#include "platformtime.h"
+
+#include "../testutil.h"
+
+#include <iostream>
+
+// Tests the delivery of events that are queued for the event dispatcher's thread, using
+// Connection::sendFromAnyThread() which is built on it
+
+static const char *echoPath = "/echo";
+static const char *echoInterface = "org.example_3c1b3a8e0e5d4c02.echo";
+static const char *echoMethod = "echo";
+
+class EchoReplier : public IMessageReceiver
+{
+public:
+    void handleSpontaneousMessageReceived(Message call, Connection *connection) override
+    {
+        if (call.interface() != echoInterface) {
+            return;
+        }
+        Message reply = Message::createReplyTo(call);
+        TEST(!connection->sendNoReply(std::move(reply)).isError());
+    }
+};
+
+class CountingReplyReceiver : public IReplyReceiver
+{
+public:
+    void handleReply(uint32 serial, Message reply, Error error) override
+    {
+        TEST(!error.isError());
+        TEST(reply.replySerial() == serial);
+        m_repliesReceived++;
+    }
+
+    uint32 m_repliesReceived = 0;
+};
+
+static void sendPing(Connection *connection, CountingReplyReceiver *replyReceiver)
+{
+    Message call = Message::createCall(echoPath, echoInterface, echoMethod);
+    call.setDestination(connection->uniqueName());
+    TEST(!connection->sendFromAnyThread(std::move(call), replyReceiver).isError());
+}
+
+static void waitForReplies(EventDispatcher *dispatcher, CountingReplyReceiver *replyReceiver,
+                           uint32 count)
+{
+    const uint64 deadline = PlatformTime::monotonicMsecs() + 5000;
+    while (replyReceiver->m_repliesReceived < count) {
+        TEST(PlatformTime::monotonicMsecs() < deadline);
+        dispatcher->poll(100);
+    }
+}
+
+static void testEventsQueuedBeforeInterrupt()
+{
+    EventDispatcher dispatcher;
+    Connection conn(&dispatcher, ConnectAddress::StandardBus::Session);
+    conn.waitForConnectionEstablished();
+    TEST(conn.isConnected());
+
+    EchoReplier echoReplier;
+    conn.setSpontaneousMessageReceiver(&echoReplier);
+    CountingReplyReceiver replyReceiver;
+
+    // The wakeup for the queued event and the interrupt can be merged into one that only says "stop".
+    // The event must still be processed, or the queue stays non-empty and queueing more events
+    // doesn't wake the dispatcher anymore.
+    sendPing(&conn, &replyReceiver);
+    dispatcher.interrupt();
+    TEST(!dispatcher.poll(0));
+    sendPing(&conn, &replyReceiver);
+    waitForReplies(&dispatcher, &replyReceiver, 2);
+
+    // again, with the interrupt first
+    dispatcher.interrupt();
+    sendPing(&conn, &replyReceiver);
+    TEST(!dispatcher.poll(0));
+    sendPing(&conn, &replyReceiver);
+    waitForReplies(&dispatcher, &replyReceiver, 4);
+}
+
+int main(int, char *[])
+{
+    testEventsQueuedBeforeInterrupt();
+    std::cout << "Passed!\n";
+}
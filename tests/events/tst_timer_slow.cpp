@@ -492,8 +492,9 @@ static void testSerialWraparound()
         }
     });
 
-    // Glassbox testing: we know that the maximum timer serials is 1023, so testing 10k * 17 timers
-    // is plenty. This should be adapted if / when the implementation changes.
+    // Timers with the same due time used to be ordered by a serial number with a maximum of 1023, which
+    // needed special treatment when it wrapped around. The timer wheel has no such limit, but adding
+    // and removing 10k * 17 timers is still a good test that order is kept.
     for (int i = 0; i < 10000; i++) {
         for (int j = 0; j < 17; j++) {
             timers[j] = new Timer(&dispatcher);
@@ -514,6 +515,45 @@ static void testSerialWraparound()
     }
 }
 
+static void testOrderAcrossWheelLevels()
+{
+    // The intervals are chosen so that some timers are initially not in the lowest level of the timer
+    // wheel (more than 256 ms ahead), and some have the same due time.
+    EventDispatcher dispatcher;
+
+    constexpr int timersCount = 6;
+    const int intervals[timersCount] = { 300, 20, 300, 700, 260, 20 };
+    const int expectedOrder[timersCount] = { 1, 5, 4, 0, 2, 3 };
+    Timer *timers[timersCount];
+    int triggerCount = 0;
+    const uint64 baseTime = PlatformTime::monotonicMsecs();
+
+    CompletionFunc orderCheck([&] (void *task) {
+        TEST(triggerCount < timersCount);
+        const int timerIndex = expectedOrder[triggerCount++];
+        TEST(task == timers[timerIndex]);
+        TEST(PlatformTime::monotonicMsecs() - baseTime >= uint64(intervals[timerIndex]));
+        if (triggerCount == timersCount) {
+            dispatcher.interrupt();
+        }
+    });
+
+    for (int i = 0; i < timersCount; i++) {
+        timers[i] = new Timer(&dispatcher);
+        timers[i]->setCompletionListener(&orderCheck);
+        timers[i]->setRepeating(false);
+        timers[i]->start(intervals[i]);
+    }
+
+    while (dispatcher.poll()) {
+    }
+    TEST(triggerCount == timersCount);
+
+    for (int i = 0; i < timersCount; i++) {
+        delete timers[i];
+    }
+}
+
 int main(int, char *[])
 {
     testBasic();
@@ -525,5 +565,6 @@ int main(int, char *[])
     testTriggerOnlyOncePerDispatch();
     testReEnableNonRepeatingInTrigger();
     testSerialWraparound();
+    testOrderAcrossWheelLevels();
     std::cout << "Passed!\n";
 }
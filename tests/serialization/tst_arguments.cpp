@@ -22,10 +22,13 @@
 */
 
 #include "arguments.h"
+#include "error.h"
+#include "signatureprogram.h"
 
 #include "../testutil.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
@@ -729,6 +732,240 @@ static void test_stringValidation()
     }
 }
 
+// straightforward reference implementation of UTF-8 validation to compare against
+static bool isValidUtf8Reference(const std::string &s)
+{
+    for (size_t i = 0; i < s.size(); ) {
+        const byte b0 = byte(s[i]);
+        uint32 codePoint;
+        size_t sequenceLength;
+        if (b0 == 0) {
+            return false;
+        } else if (b0 < 0x80) {
+            codePoint = b0;
+            sequenceLength = 1;
+        } else if ((b0 & 0xe0) == 0xc0) {
+            codePoint = b0 & 0x1f;
+            sequenceLength = 2;
+        } else if ((b0 & 0xf0) == 0xe0) {
+            codePoint = b0 & 0x0f;
+            sequenceLength = 3;
+        } else if ((b0 & 0xf8) == 0xf0) {
+            codePoint = b0 & 0x07;
+            sequenceLength = 4;
+        } else {
+            return false;
+        }
+        if (i + sequenceLength > s.size()) {
+            return false;
+        }
+        for (size_t j = 1; j < sequenceLength; j++) {
+            const byte b = byte(s[i + j]);
+            if ((b & 0xc0) != 0x80) {
+                return false;
+            }
+            codePoint = (codePoint << 6) | (b & 0x3f);
+        }
+        static const uint32 minCodePoint[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (codePoint < minCodePoint[sequenceLength] || codePoint > 0x10ffff ||
+            (codePoint >= 0xd800 && codePoint <= 0xdfff)) {
+            return false;
+        }
+        i += sequenceLength;
+    }
+    return true;
+}
+
+static void test_utf8Validation()
+{
+    static const char *pieces[] = {
+        "a", "Z", "\x7f", "\xc3\xa4", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf", "\xef\xbf\xbf",
+        // invalid
+        "\x80", "\xbf", "\xc0\x80", "\xc1\xbf", "\xe0\x80\x80", "\xed\xa0\x80", "\xf0\x80\x80\x80",
+        "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xff", "\xc3", "\xe2\x82", "\xf0\x9f\x98"
+    };
+    const size_t pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+    // put each piece at many positions in strings of many lengths, to exercise the vectorized blocks and
+    // the scalar tails of the validation code
+    for (size_t piece = 0; piece < pieceCount; piece++) {
+        for (size_t length = 0; length < 80; length += 3) {
+            for (size_t position = 0; position <= length; position += 5) {
+                std::string str(length, 'x');
+                str.insert(position, pieces[piece]);
+                const cstring cstr(str.c_str(), uint32(str.length()));
+                TEST(Arguments::isStringValid(cstr) == isValidUtf8Reference(str));
+            }
+        }
+    }
+    {
+        std::string withNull(100, 'x');
+        TEST(Arguments::isStringValid(cstring(withNull.c_str(), uint32(withNull.length()))));
+        for (size_t i = 0; i < withNull.length(); i += 7) {
+            withNull[i] = '\0';
+            TEST(!Arguments::isStringValid(cstring(withNull.c_str(), uint32(withNull.length()))));
+            withNull[i] = 'x';
+        }
+    }
+    {
+        // invalid UTF-8 is rejected when writing...
+        Arguments::Writer writer;
+        writer.writeString(cstring("\xc0\x80"));
+        TEST(writer.state() == Arguments::InvalidData);
+        TEST(writer.error().code() == Error::InvalidString);
+    }
+    {
+        // ...and when reading
+        Arguments::Writer writer;
+        writer.writeString(cstring("ab"));
+        Arguments args = writer.finish();
+        std::vector<byte> data(args.data().ptr, args.data().ptr + args.data().length);
+        data[4] = 0xc0;
+        data[5] = 0x80;
+        Arguments corrupted(nullptr, args.signature(), chunk(&data.front(), data.size()));
+        Arguments::Reader reader(corrupted);
+        TEST(reader.state() == Arguments::InvalidData);
+        TEST(reader.error().code() == Error::MalformedMessageData);
+    }
+}
+
+static void test_objectPathValidation()
+{
+    std::string longElement;
+    for (int i = 0; i < 100; i++) {
+        longElement += char("abcXYZ019_"[i % 10]);
+    }
+    const std::string valid[] = {
+        "/", "/a", "/_", "/a/b", "/abc/def/0123456789_XYZ", "/" + longElement, "/" + longElement + "/x",
+        "/x/" + longElement
+    };
+    for (const std::string &path : valid) {
+        TEST(Arguments::isObjectPathValid(cstring(path.c_str(), uint32(path.length()))));
+    }
+    const std::string invalid[] = {
+        "", "a", "//", "/a/", "/a//b", "/a-b", "/a.b", "/\xc3\xa4", "/" + longElement + "/",
+        "/" + longElement + "-", "/" + longElement + "//x", "/" + longElement + "\x80" + longElement
+    };
+    for (const std::string &path : invalid) {
+        TEST(!Arguments::isObjectPathValid(cstring(path.c_str(), uint32(path.length()))));
+    }
+    // every position of an invalid character
+    for (size_t i = 1; i < longElement.length(); i++) {
+        for (char c : { '-', ' ', '@', '[', '`', '{', '\x7f' }) {
+            std::string path = "/" + longElement;
+            path[i] = c;
+            TEST(!Arguments::isObjectPathValid(cstring(path.c_str(), uint32(path.length()))));
+            TEST(!Arguments::isObjectPathElementValid(cstring(path.c_str() + 1, uint32(path.length() - 1))));
+        }
+    }
+    TEST(Arguments::isObjectPathElementValid(cstring(longElement.c_str(), uint32(longElement.length()))));
+    TEST(!Arguments::isObjectPathElementValid(cstring("")));
+}
+
+static void test_signatureProgram()
+{
+    // the cached validation must agree with the uncached one
+    static const char *signatures[] = {
+        "", "i", "iqb", "aii", "ai", "a(iaia{ia{iv}})", "a{vi}", "()", "(())", "(t)", "((i)", "(i))", "a{",
+        "a{s", "a{sv", "a{sv}", "v", "vv", "z", "((((((((((((((((((((((((((((((((i))))))))))))))))))))))))))))))))",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaai", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaai"
+    };
+    for (const char *signature : signatures) {
+        for (int i = 0; i < 2; i++) { // the second time, the result comes from the cache
+            for (Arguments::SignatureType type : { Arguments::MethodSignature, Arguments::VariantSignature }) {
+                TEST(SignatureProgram::isSignatureValid(cstring(signature), type) ==
+                     Arguments::isSignatureValid(cstring(signature), type));
+            }
+        }
+    }
+    TEST(SignatureProgram::get(cstring("a{sv}")) == SignatureProgram::get(cstring("a{sv}")));
+    // not null-terminated
+    TEST(!SignatureProgram::isSignatureValid(cstring("ii", 1)));
+
+    std::shared_ptr<const SignatureProgram> program = SignatureProgram::get(cstring("ya{s(yt)}(iay)(qx)"));
+    TEST(program->isValid(Arguments::MethodSignature));
+    TEST(!program->isValid(Arguments::VariantSignature));
+    TEST(program->isCompiled());
+    TEST(program->op(0).type.state() == Arguments::Byte);
+    TEST(program->op(0).skip == 1);
+    TEST(program->op(0).fixedSize == 1);
+    TEST(program->op(1).type.state() == Arguments::BeginArray);
+    TEST(program->op(1).skip == 8);
+    TEST(program->op(1).fixedSize == 0);
+    TEST(program->op(2).type.state() == Arguments::BeginDict);
+    TEST(program->op(4).type.state() == Arguments::BeginStruct);
+    TEST(program->op(4).skip == 4);
+    TEST(program->op(4).fixedSize == 16); // y, 7 bytes padding, t
+    TEST(program->op(7).type.state() == Arguments::EndStruct);
+    TEST(program->op(7).skip == 0);
+    TEST(program->op(8).type.state() == Arguments::EndDict);
+    TEST(program->op(9).skip == 5);
+    TEST(program->op(9).fixedSize == 0); // contains an array
+    TEST(program->op(14).skip == 4);
+    TEST(program->op(14).fixedSize == 16); // q, 6 bytes padding, x
+
+    program = SignatureProgram::get(cstring("a{"));
+    TEST(!program->isValid(Arguments::MethodSignature));
+    TEST(!program->isCompiled());
+}
+
+static void test_skipFixedSizeStruct()
+{
+    // fixed-size structs are skipped by length, also nested in other structs and in empty arrays
+    Arguments::Writer writer;
+    writer.beginStruct();
+    writer.writeByte(1);
+    writer.writeUint64(2);
+    writer.endStruct();
+    writer.beginStruct();
+    writer.writeString(cstring("not fixed"));
+    writer.beginStruct();
+    writer.writeBoolean(true);
+    writer.writeInt16(-3);
+    writer.endStruct();
+    writer.writeUint32(4);
+    writer.endStruct();
+    writer.beginArray(Arguments::Writer::WriteTypesOfEmptyArray);
+    writer.beginStruct();
+    writer.writeDouble(5.0);
+    writer.endStruct();
+    writer.endArray();
+    writer.beginVariant();
+    writer.beginStruct();
+    writer.writeInt32(6);
+    writer.endStruct();
+    writer.endVariant();
+    writer.writeUint16(7);
+    Arguments arg = writer.finish();
+    TEST(writer.state() != Arguments::InvalidData);
+
+    Arguments::Reader reader(arg);
+    TEST(reader.state() == Arguments::BeginStruct);
+    reader.skipStruct();
+    reader.beginStruct();
+    const cstring notFixed = reader.readString();
+    TEST(std::string(notFixed.ptr, notFixed.length) == "not fixed");
+    reader.skipStruct();
+    TEST(reader.readUint32() == 4);
+    reader.endStruct();
+    TEST(!reader.beginArray(Arguments::Reader::ReadTypesOnlyIfEmpty));
+    reader.skipStruct();
+    reader.endArray();
+    reader.beginVariant();
+    reader.skipStruct(); // no SignatureProgram inside variants, so this takes the slow path
+    reader.endVariant();
+    TEST(reader.readUint16() == 7);
+    TEST(reader.state() == Arguments::Finished);
+
+    // the same with skipCurrentElement(), which skips nested fixed-size structs by length
+    Arguments::Reader reader2(arg);
+    reader2.skipCurrentElement();
+    reader2.skipCurrentElement();
+    reader2.skipCurrentElement();
+    reader2.skipCurrentElement();
+    TEST(reader2.readUint16() == 7);
+    TEST(reader2.state() == Arguments::Finished);
+}
+
 static void test_nesting()
 {
     {
@@ -1457,6 +1694,285 @@ static void test_primitiveArray()
     }
 }
 
+// same layout in memory and on the wire: memcpy() path
+struct Sample
+{
+    uint32 a;
+    uint32 b;
+    int64 c;
+    double d;
+};
+
+static const uint32 s_sampleOffsets[] = {
+    offsetof(Sample, a), offsetof(Sample, b), offsetof(Sample, c), offsetof(Sample, d)
+};
+static const Arguments::StructLayout s_sampleLayout = { cstring("(uuxd)"), s_sampleOffsets, sizeof(Sample) };
+
+static Sample makeSample(uint32 i)
+{
+    Sample ret;
+    ret.a = i;
+    ret.b = ~i;
+    ret.c = -int64(i) * 1000000007;
+    ret.d = i * 0.5;
+    return ret;
+}
+
+static bool operator==(const Sample &s1, const Sample &s2)
+{
+    return s1.a == s2.a && s1.b == s2.b && s1.c == s2.c && s1.d == s2.d;
+}
+
+// different field order in memory, padding on the wire, a nested struct: field by field path
+struct Shuffled
+{
+    uint32 u;
+    byte y;
+    uint16 q;
+    double d;
+};
+
+static const uint32 s_shuffledOffsets[] = {
+    offsetof(Shuffled, y), offsetof(Shuffled, q), offsetof(Shuffled, d), offsetof(Shuffled, u)
+};
+static const Arguments::StructLayout s_shuffledLayout = { cstring("(y(qd)u)"), s_shuffledOffsets,
+                                                          sizeof(Shuffled) };
+
+static Shuffled makeShuffled(uint32 i)
+{
+    Shuffled ret;
+    memset(&ret, 0xff, sizeof(ret)); // garbage in the padding must not make it to the wire
+    ret.u = i * 3;
+    ret.y = byte(i);
+    ret.q = uint16(i * 7);
+    ret.d = -1.0 * i;
+    return ret;
+}
+
+static bool operator==(const Shuffled &s1, const Shuffled &s2)
+{
+    return s1.u == s2.u && s1.y == s2.y && s1.q == s2.q && s1.d == s2.d;
+}
+
+static void writeElement(Arguments::Writer *writer, const Sample &s)
+{
+    writer->beginStruct();
+    writer->writeUint32(s.a);
+    writer->writeUint32(s.b);
+    writer->writeInt64(s.c);
+    writer->writeDouble(s.d);
+    writer->endStruct();
+}
+
+static void writeElement(Arguments::Writer *writer, const Shuffled &s)
+{
+    writer->beginStruct();
+    writer->writeByte(s.y);
+    writer->beginStruct();
+    writer->writeUint16(s.q);
+    writer->writeDouble(s.d);
+    writer->endStruct();
+    writer->writeUint32(s.u);
+    writer->endStruct();
+}
+
+static Sample readElement(Arguments::Reader *reader, const Sample &)
+{
+    Sample ret;
+    reader->beginStruct();
+    ret.a = reader->readUint32();
+    ret.b = reader->readUint32();
+    ret.c = reader->readInt64();
+    ret.d = reader->readDouble();
+    reader->endStruct();
+    return ret;
+}
+
+static Shuffled readElement(Arguments::Reader *reader, const Shuffled &)
+{
+    Shuffled ret;
+    reader->beginStruct();
+    ret.y = reader->readByte();
+    reader->beginStruct();
+    ret.q = reader->readUint16();
+    ret.d = reader->readDouble();
+    reader->endStruct();
+    ret.u = reader->readUint32();
+    reader->endStruct();
+    return ret;
+}
+
+// Writes the array once with writeStructArray() and once element by element, between two other
+// values and optionally inside a variant, and checks that the results are identical and readable
+// both ways.
+template<typename T>
+static void testStructArray(const Arguments::StructLayout &layout, const std::vector<T> &elements,
+                            bool inVariant)
+{
+    Arguments bulk;
+    Arguments regular;
+    for (int i = 0; i < 2; i++) {
+        Arguments::Writer writer;
+        writer.writeByte(1);
+        if (inVariant) {
+            writer.beginVariant();
+        }
+        if (i == 0) {
+            writer.writeStructArray(layout, elements);
+        } else {
+            writer.beginArray(elements.empty() ? Arguments::Writer::WriteTypesOfEmptyArray
+                                               : Arguments::Writer::NonEmptyArray);
+            for (const T &element : elements) {
+                writeElement(&writer, element);
+            }
+            if (elements.empty()) {
+                writeElement(&writer, T());
+            }
+            writer.endArray();
+        }
+        if (inVariant) {
+            writer.endVariant();
+        }
+        writer.writeByte(2);
+        TEST(writer.state() != Arguments::InvalidData);
+        (i == 0 ? bulk : regular) = writer.finish();
+    }
+    TEST(stringsEqual(bulk.signature(), regular.signature()));
+    TEST(chunksEqual(bulk.data(), regular.data()));
+    if (elements.size() <= 3) { // doRoundtrip() is slow with a lot of data
+        doRoundtrip(bulk);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        Arguments::Reader reader(bulk);
+        TEST(reader.readByte() == 1);
+        if (inVariant) {
+            reader.beginVariant();
+        }
+        std::vector<T> readBack;
+        if (i == 0) {
+            uint32 count = 0;
+            TEST(reader.peekStructArray(layout, &count));
+            TEST(count == elements.size());
+            TEST(reader.readStructArray(layout, &readBack));
+        } else {
+            reader.beginArray();
+            while (reader.state() == Arguments::BeginStruct) {
+                readBack.push_back(readElement(&reader, T()));
+            }
+            reader.endArray();
+        }
+        TEST(readBack == elements);
+        if (inVariant) {
+            reader.endVariant();
+        }
+        TEST(reader.readByte() == 2);
+        TEST(reader.state() == Arguments::Finished);
+    }
+}
+
+static void test_structArray()
+{
+    static const uint32 counts[] = { 0, 1, 2, 3, 1000 };
+    for (uint32 count : counts) {
+        std::vector<Sample> samples;
+        std::vector<Shuffled> shuffled;
+        for (uint32 i = 0; i < count; i++) {
+            samples.push_back(makeSample(i));
+            shuffled.push_back(makeShuffled(i));
+        }
+        for (int inVariant = 0; inVariant < 2; inVariant++) {
+            testStructArray(s_sampleLayout, samples, inVariant);
+            testStructArray(s_shuffledLayout, shuffled, inVariant);
+        }
+    }
+
+    // byte-swapped data; Sample has no padding on the wire, so swapping each field is easy
+    {
+        std::vector<Sample> samples;
+        for (uint32 i = 0; i < 5; i++) {
+            samples.push_back(makeSample(i));
+        }
+        Arguments::Writer writer;
+        writer.writeStructArray(s_sampleLayout, samples);
+        const Arguments arg = writer.finish();
+        std::vector<byte> swapped(arg.data().ptr, arg.data().ptr + arg.data().length);
+        std::reverse(swapped.begin(), swapped.begin() + 4); // array length
+        for (uint32 i = 0; i < samples.size(); i++) {
+            byte *const element = &swapped[8 + i * sizeof(Sample)];
+            std::reverse(element, element + 4);
+            std::reverse(element + 4, element + 8);
+            std::reverse(element + 8, element + 16);
+            std::reverse(element + 16, element + 24);
+        }
+        const Arguments swappedArg(nullptr, arg.signature(), chunk(&swapped[0], swapped.size()), true);
+        Arguments::Reader reader(swappedArg);
+        std::vector<Sample> readBack;
+        TEST(reader.readStructArray(s_sampleLayout, &readBack));
+        TEST(readBack == samples);
+        TEST(reader.state() == Arguments::Finished);
+    }
+
+    // nonzero padding
+    {
+        std::vector<Shuffled> shuffled;
+        shuffled.push_back(makeShuffled(1));
+        shuffled.push_back(makeShuffled(2));
+        Arguments::Writer writer;
+        writer.writeStructArray(s_shuffledLayout, shuffled);
+        const Arguments arg = writer.finish();
+        // array length, padding to 8, y, then the padding byte in question
+        std::vector<byte> corrupted(arg.data().ptr, arg.data().ptr + arg.data().length);
+        corrupted[8 + 1] = 1;
+        const Arguments corruptedArg(nullptr, arg.signature(), chunk(&corrupted[0], corrupted.size()));
+        Arguments::Reader reader(corruptedArg);
+        uint32 count = 0;
+        TEST(reader.peekStructArray(s_shuffledLayout, &count));
+        TEST(count == 2);
+        std::vector<Shuffled> readBack;
+        TEST(!reader.readStructArray(s_shuffledLayout, &readBack));
+        TEST(reader.state() == Arguments::InvalidData);
+        TEST(reader.error().code() == Error::MalformedMessageData);
+    }
+
+    // layouts that don't fit
+    {
+        Arguments::Writer writer;
+        writer.writeStructArray(s_sampleLayout, std::vector<Sample>(3, makeSample(1)));
+        const Arguments arg = writer.finish();
+        Arguments::Reader reader(arg);
+        uint32 count = 0;
+        TEST(!reader.peekStructArray(s_shuffledLayout, &count));
+        const uint32 offsets[] = { 0, 4, 8, 16 };
+        const Arguments::StructLayout otherTypes = { cstring("(uuxt)"), offsets, sizeof(Sample) };
+        TEST(!reader.peekStructArray(otherTypes, &count));
+        Shuffled wrongSize[3];
+        TEST(!reader.readStructArray(otherTypes, wrongSize));
+        TEST(reader.state() == Arguments::BeginArray);
+        TEST(reader.readStructArray(s_sampleLayout, std::vector<Sample>(3).data()));
+        TEST(reader.state() == Arguments::Finished);
+    }
+    static const char *const unsuitable[] = { "(us)", "(ub)", "(uh)", "(uv)", "(uai)", "u", "(u", "()" };
+    for (const char *signature : unsuitable) {
+        const uint32 offsets[] = { 0, 4 };
+        const Arguments::StructLayout layout = { cstring(signature), offsets, 16 };
+        Arguments::Writer writer;
+        const uint32 input[4] = { 0, 0, 0, 0 };
+        writer.writeStructArray(layout, input, 1);
+        TEST(writer.state() == Arguments::InvalidData);
+        TEST(writer.error().code() == Error::NotPrimitiveType);
+    }
+    {
+        // fields outside of the struct in memory
+        const uint32 offsets[] = { 0, 4 };
+        const Arguments::StructLayout layout = { cstring("(ux)"), offsets, 8 };
+        Arguments::Writer writer;
+        const uint64 input[2] = { 0, 0 };
+        writer.writeStructArray(layout, input, 1);
+        TEST(writer.state() == Arguments::InvalidData);
+    }
+}
+
 static void test_signatureLengths()
 {
     for (int i = 0; i <= 256; i++) {
@@ -1941,6 +2457,10 @@ static void test_closeWrongAggregate()
 int main(int, char *[])
 {
     test_stringValidation();
+    test_utf8Validation();
+    test_objectPathValidation();
+    test_signatureProgram();
+    test_skipFixedSizeStruct();
     test_nesting();
     test_roundtrip();
     test_writerMisuse();
@@ -1952,6 +2472,7 @@ int main(int, char *[])
     test_realMessage();
     test_isWritingSignatureBug();
     test_primitiveArray();
+    test_structArray();
     test_signatureLengths();
     test_emptyArrayAndDict();
     test_fileDescriptors();
@@ -28,14 +28,17 @@
 #include "imessagereceiver.h"
 #include "message.h"
 #include "pendingreply.h"
+#include "stringtools.h"
 #include "testutil.h"
 #include "connection.h"
 
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <vector>
 
 static void test_signatureHeader()
 {
@@ -47,6 +50,290 @@ static void test_signatureHeader()
     TEST(msg.signature() == "yt");
 }
 
+static void test_saveLoadedMessage()
+{
+    // After load(), the arguments point into the receive buffer, which serialize() releases
+    Message msg = Message::createCall("/foo", "org.foo.interface", "aMethod");
+    msg.setSerial(1);
+    Arguments::Writer writer;
+    writer.writeString(cstring("payload"));
+    writer.writeUint32(1234);
+    msg.setArguments(writer.finish());
+
+    Message loaded;
+    loaded.load(msg.save());
+    TEST(!loaded.error().isError());
+    loaded.setMethod("anotherMethod");
+    const std::vector<byte> saved = loaded.save();
+
+    Message reloaded;
+    reloaded.load(saved);
+    TEST(!reloaded.error().isError());
+    TEST(reloaded.method() == "anotherMethod");
+    Arguments::Reader reader(reloaded.arguments());
+    TEST(toStdString(reader.readString()) == "payload");
+    TEST(reader.readUint32() == 1234);
+    TEST(reader.state() == Arguments::Finished);
+}
+
+static void test_nameHeaderValidation()
+{
+    Message msg = Message::createCall("/foo", "org.foo.interface", "aMethod");
+    msg.setSerial(1);
+    const std::vector<byte> valid = msg.save();
+    {
+        Message loaded;
+        loaded.load(valid);
+        TEST(!loaded.error().isError());
+        TEST(loaded.interface() == "org.foo.interface");
+    }
+
+    // replace one character of a name in the serialized data, keeping the length the same
+    const auto corrupted = [&valid](const std::string &original, const std::string &replacement) {
+        std::vector<byte> data = valid;
+        auto it = std::search(data.begin(), data.end(), original.begin(), original.end());
+        TEST(it != data.end());
+        std::copy(replacement.begin(), replacement.end(), it);
+        Message loaded;
+        loaded.load(data);
+        return loaded.error().isError();
+    };
+    TEST(!corrupted("org.foo.interface", "org.foo.interfac_"));
+    TEST(corrupted("org.foo.interface", "org.foo.1nterface"));
+    TEST(corrupted("org.foo.interface", "org.foo-interface"));
+    TEST(corrupted("org.foo.interface", "org.foo..nterface"));
+    TEST(corrupted("org.foo.interface", "orgXfooXinterface"));
+    TEST(!corrupted("aMethod", "aMetho2"));
+    TEST(corrupted("aMethod", "1Method"));
+    TEST(corrupted("aMethod", "aMeth.d"));
+}
+
+// Produces marshalled data in the byte order that is *not* the one of this machine, which
+// Arguments::Writer can't do
+class ForeignWriter
+{
+public:
+    void align(uint32 alignment)
+    {
+        while (data.size() % alignment) {
+            data.push_back(0);
+        }
+    }
+    void writeByte(byte b) { data.push_back(b); }
+    template<typename T>
+    void write(T value)
+    {
+        align(sizeof(T));
+        data.resize(data.size() + sizeof(T));
+        put(data.size() - sizeof(T), value);
+    }
+    template<typename T>
+    void put(size_t position, T value)
+    {
+        memcpy(&data[position], &value, sizeof(T));
+        std::reverse(data.begin() + position, data.begin() + position + sizeof(T));
+    }
+    void writeString(const std::string &s)
+    {
+        write(uint32(s.length()));
+        data.insert(data.end(), s.begin(), s.end());
+        data.push_back(0);
+    }
+    void writeSignature(const std::string &s)
+    {
+        writeByte(byte(s.length()));
+        data.insert(data.end(), s.begin(), s.end());
+        data.push_back(0);
+    }
+    // returns where the array length is, and after the call, data.size() is where the elements begin
+    size_t beginArray(uint32 elementAlignment)
+    {
+        write(uint32(0));
+        const size_t lengthPosition = data.size() - sizeof(uint32);
+        align(elementAlignment);
+        return lengthPosition;
+    }
+    void endArray(size_t lengthPosition, size_t elementsBegin)
+    {
+        put(lengthPosition, uint32(data.size() - elementsBegin));
+    }
+
+    std::vector<byte> data;
+};
+
+static const uint32 s_foreignArrayCount = 19; // long enough for the vector code and a scalar tail
+
+// With malformed = true, the length of an array does not match its contents
+static std::vector<byte> createForeignMessage(bool malformed = false)
+{
+    const uint16 one = 1;
+    const bool isLittleEndian = *reinterpret_cast<const byte *>(&one) == 1;
+
+    ForeignWriter w;
+    w.writeByte(isLittleEndian ? 'B' : 'l');
+    w.writeByte(Message::MethodCallMessage);
+    w.writeByte(0); // flags
+    w.writeByte(1); // protocol version
+    w.write(uint32(0)); // body length, filled in later
+    w.write(uint32(1)); // serial
+
+    const size_t headersLength = w.beginArray(8);
+    const size_t headersBegin = w.data.size();
+    w.align(8);
+    w.writeByte(Message::PathHeader);
+    w.writeSignature("o");
+    w.writeString("/foo");
+    w.align(8);
+    w.writeByte(Message::MethodHeader);
+    w.writeSignature("s");
+    w.writeString("aMethod");
+    w.align(8);
+    w.writeByte(Message::SignatureHeader);
+    w.writeSignature("g");
+    w.writeSignature("qa(ud)a{sv}ats");
+    w.endArray(headersLength, headersBegin);
+    w.align(8);
+    const size_t bodyBegin = w.data.size();
+
+    w.write(uint16(0x1234));
+
+    size_t length = w.beginArray(8);
+    size_t begin = w.data.size();
+    w.align(8);
+    w.write(uint32(7));
+    w.write(1.5);
+    w.align(8);
+    w.write(uint32(0xdeadbeef));
+    w.write(-2.25);
+    w.endArray(length, begin);
+
+    length = w.beginArray(8);
+    begin = w.data.size();
+    w.align(8);
+    w.writeString("a");
+    w.writeSignature("i");
+    w.write(int32(-5));
+    w.align(8);
+    w.writeString("b");
+    w.writeSignature("an");
+    const size_t innerLength = w.beginArray(2);
+    const size_t innerBegin = w.data.size();
+    w.write(int16(1));
+    w.write(int16(-2));
+    w.write(int16(3));
+    w.endArray(innerLength, innerBegin);
+    w.endArray(length, begin);
+
+    length = w.beginArray(8);
+    begin = w.data.size();
+    for (uint32 i = 0; i < s_foreignArrayCount; i++) {
+        w.write(uint64(0x0102030405060708) * i);
+    }
+    w.endArray(length, begin);
+    if (malformed) {
+        w.put(length, uint32(s_foreignArrayCount * sizeof(uint64) - 1));
+    }
+
+    w.writeString("end");
+
+    w.put(4, uint32(w.data.size() - bodyBegin));
+    return w.data;
+}
+
+static void checkForeignMessageBody(const Arguments &args)
+{
+    Arguments::Reader reader(args);
+    TEST(reader.readUint16() == 0x1234);
+
+    reader.beginArray();
+    reader.beginStruct();
+    TEST(reader.readUint32() == 7);
+    TEST(reader.readDouble() == 1.5);
+    reader.endStruct();
+    reader.beginStruct();
+    TEST(reader.readUint32() == 0xdeadbeef);
+    TEST(reader.readDouble() == -2.25);
+    reader.endStruct();
+    reader.endArray();
+
+    reader.beginDict();
+    TEST(toStdString(reader.readString()) == "a");
+    reader.beginVariant();
+    TEST(reader.readInt32() == -5);
+    reader.endVariant();
+    TEST(toStdString(reader.readString()) == "b");
+    reader.beginVariant();
+    reader.beginArray();
+    TEST(reader.readInt16() == 1);
+    TEST(reader.readInt16() == -2);
+    TEST(reader.readInt16() == 3);
+    reader.endArray();
+    reader.endVariant();
+    reader.endDict();
+
+    if (args.isByteSwapped()) {
+        TEST(reader.peekPrimitiveArray() == Arguments::BeginArray);
+        reader.beginArray();
+        for (uint32 i = 0; i < s_foreignArrayCount; i++) {
+            TEST(reader.readUint64() == uint64(0x0102030405060708) * i);
+        }
+        reader.endArray();
+    } else {
+        const std::pair<Arguments::IoState, chunk> array = reader.readPrimitiveArray();
+        TEST(array.first == Arguments::Uint64);
+        TEST(array.second.length == s_foreignArrayCount * sizeof(uint64));
+        for (uint32 i = 0; i < s_foreignArrayCount; i++) {
+            uint64 value;
+            memcpy(&value, array.second.ptr + i * sizeof(uint64), sizeof(uint64));
+            TEST(value == uint64(0x0102030405060708) * i);
+        }
+    }
+
+    TEST(toStdString(reader.readString()) == "end");
+    TEST(reader.state() == Arguments::Finished);
+}
+
+static void test_convertToNativeByteOrder()
+{
+    const std::vector<byte> foreign = createForeignMessage();
+    {
+        Message msg;
+        msg.load(foreign);
+        TEST(!msg.error().isError());
+        TEST(msg.arguments().isByteSwapped());
+        checkForeignMessageBody(msg.arguments());
+
+        TEST(msg.convertToNativeByteOrder());
+        TEST(!msg.arguments().isByteSwapped());
+        checkForeignMessageBody(msg.arguments());
+        TEST(msg.convertToNativeByteOrder()); // nothing left to do
+
+        // the header has been converted, too
+        const std::vector<byte> native = msg.save();
+        TEST(native.size() == foreign.size());
+        TEST(native[0] != foreign[0]);
+        Message reloaded;
+        reloaded.load(native);
+        TEST(!reloaded.error().isError());
+        TEST(!reloaded.arguments().isByteSwapped());
+        TEST(reloaded.serial() == 1);
+        TEST(reloaded.path() == "/foo");
+        TEST(reloaded.method() == "aMethod");
+        checkForeignMessageBody(reloaded.arguments());
+    }
+    {
+        // a message that can't be converted must be left unchanged
+        const std::vector<byte> malformed = createForeignMessage(true);
+        Message msg;
+        msg.load(malformed);
+        TEST(!msg.error().isError());
+        TEST(!msg.convertToNativeByteOrder());
+        TEST(msg.arguments().isByteSwapped());
+        Arguments::Reader reader(msg.arguments());
+        TEST(reader.readUint16() == 0x1234);
+    }
+}
+
 class PrintAndTerminateClient : public IMessageReceiver
 {
 public:
@@ -69,9 +356,10 @@ public:
 };
 
 // used during implementation, is supposed to not crash and be valgrind-clean afterwards
-void testBasic(const ConnectAddress &clientAddress)
+void testBasic(const ConnectAddress &clientAddress,
+                EventDispatcher::Backend backend = EventDispatcher::Backend::Default)
 {
-    EventDispatcher dispatcher;
+    EventDispatcher dispatcher(backend);
 
     ConnectAddress serverAddress = clientAddress;
     serverAddress.setRole(ConnectAddress::Role::PeerServer);
@@ -92,12 +380,148 @@ void testBasic(const ConnectAddress &clientAddress)
     writer.writeString("couch");
     msg.setArguments(writer.finish());
 
+    // connecting is asynchronous
+    clientConnection.waitForConnectionEstablished();
     clientConnection.sendNoReply(std::move(msg));
+    // the connection is idle, so the message should have been written without waiting for the event loop
+    TEST(clientConnection.sendQueueLength() == 0);
 
     while (dispatcher.poll()) {
     }
 }
 
+class BurstReceiver : public IMessageReceiver
+{
+public:
+    void handleSpontaneousMessageReceived(Message msg, Connection *connection) override
+    {
+        Arguments::Reader reader(msg.arguments());
+        TEST(reader.readUint32() == m_receivedCount);
+        // payload sizes vary so that message boundaries fall at many different positions in the
+        // receive buffer, and some messages are too large for the receive buffer
+        chunk payload = reader.readPrimitiveArray().second;
+        TEST(payload.length == payloadSize(m_receivedCount));
+        for (uint32 i = 0; i < payload.length; i++) {
+            TEST(payload.ptr[i] == byte(m_receivedCount + i));
+        }
+        TEST(reader.isFinished());
+        if (++m_receivedCount == s_messageCount) {
+            connection->eventDispatcher()->interrupt();
+        }
+    }
+
+    static uint32 payloadSize(uint32 messageIndex)
+    {
+        return messageIndex % 10 == 9 ? 40000 + messageIndex : messageIndex * 37;
+    }
+
+    static const uint32 s_messageCount = 200;
+    uint32 m_receivedCount = 0;
+};
+
+// many messages in quick succession, so that several messages arrive with one read
+void testBurst(const ConnectAddress &clientAddress,
+                EventDispatcher::Backend backend = EventDispatcher::Backend::Default)
+{
+    EventDispatcher dispatcher(backend);
+
+    ConnectAddress serverAddress = clientAddress;
+    serverAddress.setRole(ConnectAddress::Role::PeerServer);
+
+    Connection serverConnection(&dispatcher, serverAddress);
+    Connection clientConnection(&dispatcher, clientAddress);
+
+    BurstReceiver burstReceiver;
+    serverConnection.setSpontaneousMessageReceiver(&burstReceiver);
+
+    std::vector<byte> payload;
+    for (uint32 i = 0; i < BurstReceiver::s_messageCount; i++) {
+        Message msg = Message::createSignal("/foo", "org.foo.interface", "burst");
+        Arguments::Writer writer;
+        writer.writeUint32(i);
+        payload.resize(BurstReceiver::payloadSize(i));
+        for (uint32 j = 0; j < payload.size(); j++) {
+            payload[j] = byte(i + j);
+        }
+        writer.writePrimitiveArray(Arguments::Byte, chunk(payload.data(), payload.size()));
+        msg.setArguments(writer.finish());
+        TEST(!clientConnection.sendNoReply(std::move(msg)).isError());
+    }
+
+    while (dispatcher.poll()) {
+    }
+    TEST(burstReceiver.m_receivedCount == BurstReceiver::s_messageCount);
+}
+
+#ifdef __linux__
+class FdBurstReceiver : public IMessageReceiver
+{
+public:
+    void handleSpontaneousMessageReceived(Message msg, Connection *connection) override
+    {
+        Arguments::Reader reader(msg.arguments());
+        const uint32 index = reader.readUint32();
+        TEST(index == m_receivedCount);
+        TEST(msg.unixFdCount() == (carriesFd(index) ? 1 : 0));
+        if (carriesFd(index)) {
+            // the message owns the file descriptor, so don't close it here
+            const int fd = reader.readUnixFd();
+            uint32 readBuf = 12345;
+            TEST(::read(fd, &readBuf, sizeof(uint32)) == sizeof(uint32));
+            TEST(readBuf == index);
+        }
+        TEST(reader.isFinished());
+        if (++m_receivedCount == s_messageCount) {
+            connection->eventDispatcher()->interrupt();
+        }
+    }
+
+    static bool carriesFd(uint32 messageIndex) { return messageIndex % 3 == 1; }
+
+    static const uint32 s_messageCount = 30;
+    uint32 m_receivedCount = 0;
+};
+
+// messages with and without file descriptors sent in one burst, so that they are queued together
+void testFileDescriptorsInBurst(const ConnectAddress &clientAddress,
+                                 EventDispatcher::Backend backend = EventDispatcher::Backend::Default)
+{
+    EventDispatcher dispatcher(backend);
+
+    ConnectAddress serverAddress = clientAddress;
+    serverAddress.setRole(ConnectAddress::Role::PeerServer);
+
+    Connection serverConnection(&dispatcher, serverAddress);
+    Connection clientConnection(&dispatcher, clientAddress);
+
+    FdBurstReceiver fdBurstReceiver;
+    serverConnection.setSpontaneousMessageReceiver(&fdBurstReceiver);
+
+    std::vector<int> writeSides;
+    for (uint32 i = 0; i < FdBurstReceiver::s_messageCount; i++) {
+        Message msg = Message::createSignal("/foo", "org.foo.interface", "fdBurst");
+        Arguments::Writer writer;
+        writer.writeUint32(i);
+        int pipeFds[2];
+        if (FdBurstReceiver::carriesFd(i)) {
+            TEST(pipe2(pipeFds, O_NONBLOCK) == 0);
+            TEST(::write(pipeFds[1], &i, sizeof(uint32)) == sizeof(uint32));
+            writer.writeUnixFd(pipeFds[0]);
+            writeSides.push_back(pipeFds[1]);
+        }
+        msg.setArguments(writer.finish());
+        TEST(!clientConnection.sendNoReply(std::move(msg)).isError());
+    }
+
+    while (dispatcher.poll()) {
+    }
+    TEST(fdBurstReceiver.m_receivedCount == FdBurstReceiver::s_messageCount);
+    for (int fd : writeSides) {
+        ::close(fd);
+    }
+}
+#endif
+
 void testMessageLength()
 {
     static const uint32 bufferSize = Arguments::MaxArrayLength + 1024;
@@ -287,9 +711,51 @@ void testAssignment()
     TEST(msg2.replySerial() == 0);
 }
 
+void testSaveLoad()
+{
+    // The serialized header and body are stored separately and only put together on demand,
+    // so check that all ways to get at the serialized data agree.
+    std::vector<byte> payload(10000);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = byte(i * 7);
+    }
+    Arguments::Writer writer;
+    writer.writeString(cstring("hello"));
+    writer.writePrimitiveArray(Arguments::Byte, chunk(&payload[0], payload.size()));
+
+    Message msg = Message::createCall("/foo", "org.foo.bar", "someMethod");
+    msg.setSerial(1);
+    msg.setArguments(writer.finish());
+
+    const std::vector<byte> saved = msg.save();
+    TEST(!saved.empty());
+    msg.setSerial(2); // patches the serialized header
+    const chunk view = msg.serializeAndView();
+    TEST(view.length == saved.size());
+    TEST(memcmp(view.ptr + 12, &saved[12], saved.size() - 12) == 0);
+    TEST(msg.save() == std::vector<byte>(view.ptr, view.ptr + view.length));
+
+    Message loaded;
+    loaded.load(saved);
+    TEST(!loaded.error().isError());
+    TEST(loaded.serial() == 1);
+    TEST(loaded.method() == "someMethod");
+    TEST(loaded.save() == saved);
+
+    Arguments::Reader reader(loaded.arguments());
+    TEST(toStdString(reader.readString()) == "hello");
+    const chunk readPayload = reader.readPrimitiveArray().second;
+    TEST(readPayload.length == payload.size());
+    TEST(memcmp(readPayload.ptr, &payload[0], payload.size()) == 0);
+    TEST(reader.isFinished());
+}
+
 int main(int, char *[])
 {
     test_signatureHeader();
+    test_saveLoadedMessage();
+    test_nameHeaderValidation();
+    test_convertToNativeByteOrder();
 #ifdef __linux__
     {
         ConnectAddress clientAddress;
@@ -297,6 +763,12 @@ int main(int, char *[])
         clientAddress.setRole(ConnectAddress::Role::PeerClient);
         clientAddress.setPath("dferry.Test.Message");
         testBasic(clientAddress);
+        testBurst(clientAddress);
+        testFileDescriptorsInBurst(clientAddress);
+        // falls back to the default if io_uring is not available
+        testBasic(clientAddress, EventDispatcher::Backend::IoUring);
+        testBurst(clientAddress, EventDispatcher::Backend::IoUring);
+        testFileDescriptorsInBurst(clientAddress, EventDispatcher::Backend::IoUring);
     }
 #endif
     // TODO: SocketType::Unix works on any Unix-compatible OS, but we'll need to construct a path
@@ -306,6 +778,10 @@ int main(int, char *[])
         clientAddress.setPort(6800);
         clientAddress.setRole(ConnectAddress::Role::PeerClient);
         testBasic(clientAddress);
+#ifdef __linux__
+        // io_uring without file descriptor passing, with messages queued while still connecting
+        testBurst(clientAddress, EventDispatcher::Backend::IoUring);
+#endif
     }
 
     testMessageLength();
@@ -317,8 +793,8 @@ int main(int, char *[])
     testFileDescriptorsForDataTransfer();
 #endif
     testAssignment();
+    testSaveLoad();
 
-    // TODO testSaveLoad();
     // TODO testDeepCopy();
     std::cout << "\nNote that the hammock error is part of the test.\nPassed!\n";
 }
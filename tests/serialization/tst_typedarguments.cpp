@@ -0,0 +1,229 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#include "typedarguments.h"
+
+#include "arguments.h"
+#include "error.h"
+
+#include "../testutil.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static bool stringsEqual(cstring s1, cstring s2)
+{
+    return s1.length == s2.length && memcmp(s1.ptr, s2.ptr, s1.length) == 0;
+}
+
+static bool chunksEqual(chunk a1, chunk a2)
+{
+    return a1.length == a2.length && memcmp(a1.ptr, a2.ptr, a1.length) == 0;
+}
+
+static void test_signature()
+{
+    TEST(stringsEqual(TypedWriter<>::signature(), cstring("")));
+    TEST(stringsEqual(TypedWriter<int32, std::string, std::vector<uint64>>::signature(), cstring("isat")));
+    TEST(stringsEqual(TypedWriter<bool, byte, int16, uint16, uint32, int64, double>::signature(),
+                      cstring("bynquxd")));
+    TEST(stringsEqual(TypedWriter<std::map<std::string, std::vector<std::tuple<byte, double>>>>::signature(),
+                      cstring("a{sa(yd)}")));
+    TEST(stringsEqual(TypedReader<std::tuple<int32, std::tuple<std::string>>, std::vector<bool>>::signature(),
+                      cstring("(i(s))ab")));
+}
+
+// the typed API must produce exactly the same data as the dynamic one
+static void test_sameDataAsWriter()
+{
+    const std::vector<uint64> uint64s = { 1, 2, 0xffffffffffffffffull };
+    const std::vector<std::string> strings = { "", "a", "bcd" };
+    std::map<uint16, std::tuple<byte, double>> dict;
+    dict[7] = std::make_tuple(byte(3), 1.5);
+    dict[9] = std::make_tuple(byte(4), -2.25);
+
+    Arguments::Writer writer;
+    writer.writeByte(1);
+    writer.writeInt32(-5);
+    writer.writeString(cstring("hello"));
+    writer.beginArray();
+    for (uint64 u : uint64s) {
+        writer.writeUint64(u);
+    }
+    writer.endArray();
+    writer.writeBoolean(true);
+    writer.beginArray();
+    for (const std::string &s : strings) {
+        writer.writeString(cstring(s.c_str(), s.length()));
+    }
+    writer.endArray();
+    writer.beginArray(Arguments::Writer::WriteTypesOfEmptyArray);
+    writer.writeDouble(0.0);
+    writer.endArray();
+    writer.beginDict();
+    for (const auto &entry : dict) {
+        writer.writeUint16(entry.first);
+        writer.beginStruct();
+        writer.writeByte(std::get<0>(entry.second));
+        writer.writeDouble(std::get<1>(entry.second));
+        writer.endStruct();
+    }
+    writer.endDict();
+    Arguments dynamicArgs = writer.finish();
+    TEST(!dynamicArgs.error().isError());
+
+    typedef TypedWriter<byte, int32, std::string, std::vector<uint64>, bool, std::vector<std::string>,
+                        std::vector<double>, std::map<uint16, std::tuple<byte, double>>> Writer;
+    Arguments typedArgs = Writer::write(1, -5, "hello", uint64s, true, strings, std::vector<double>(), dict);
+    TEST(!typedArgs.error().isError());
+
+    TEST(stringsEqual(typedArgs.signature(), dynamicArgs.signature()));
+    TEST(chunksEqual(typedArgs.data(), dynamicArgs.data()));
+
+    // and read it back, both from typed and from dynamically written data
+    for (const Arguments *args : { &typedArgs, &dynamicArgs }) {
+        byte b = 0;
+        int32 i = 0;
+        std::string s;
+        std::vector<uint64> us;
+        bool flag = false;
+        std::vector<std::string> ss;
+        std::vector<double> ds = { 1.0 };
+        std::map<uint16, std::tuple<byte, double>> d;
+        TypedReader<byte, int32, std::string, std::vector<uint64>, bool, std::vector<std::string>,
+                    std::vector<double>, std::map<uint16, std::tuple<byte, double>>> reader(*args);
+        TEST(reader.read(&b, &i, &s, &us, &flag, &ss, &ds, &d));
+        TEST(!reader.error().isError());
+        TEST(b == 1);
+        TEST(i == -5);
+        TEST(s == "hello");
+        TEST(us == uint64s);
+        TEST(flag);
+        TEST(ss == strings);
+        TEST(ds.empty());
+        TEST(d == dict);
+    }
+}
+
+static void test_readWithDynamicReader()
+{
+    const std::tuple<int16, std::vector<bool>, std::string> value(-3, { true, false, true }, "x");
+    Arguments args = TypedWriter<std::tuple<int16, std::vector<bool>, std::string>>::write(value);
+    TEST(!args.error().isError());
+
+    Arguments::Reader reader(args);
+    TEST(reader.state() == Arguments::BeginStruct);
+    reader.beginStruct();
+    TEST(reader.readInt16() == -3);
+    reader.beginArray();
+    TEST(reader.readBoolean());
+    TEST(!reader.readBoolean());
+    TEST(reader.readBoolean());
+    reader.endArray();
+    TEST(stringsEqual(reader.readString(), cstring("x")));
+    reader.endStruct();
+    TEST(reader.state() == Arguments::Finished);
+}
+
+static void test_empty()
+{
+    Arguments args = TypedWriter<>::write();
+    TEST(!args.error().isError());
+    TEST(args.signature().length == 0);
+    TEST(args.data().length == 0);
+    TEST(TypedReader<>(args).read());
+}
+
+static void test_errors()
+{
+    // embedded null in a string
+    Arguments args = TypedWriter<std::string>::write(std::string("a\0b", 3));
+    TEST(args.error().code() == Error::InvalidString);
+
+    args = TypedWriter<uint32, std::vector<byte>>::write(5, { 1, 2, 3 });
+    TEST(!args.error().isError());
+
+    // wrong signature
+    {
+        int32 i;
+        std::vector<byte> bytes;
+        TypedReader<int32, std::vector<byte>> reader(args);
+        TEST(!reader.read(&i, &bytes));
+        TEST(reader.error().code() == Error::ReadWrongType);
+    }
+
+    // truncated data
+    for (uint32 length = 0; length < args.data().length; length++) {
+        Arguments truncated(nullptr, args.signature(), chunk(args.data().ptr, length));
+        uint32 u;
+        std::vector<byte> bytes;
+        TypedReader<uint32, std::vector<byte>> reader(truncated);
+        TEST(!reader.read(&u, &bytes));
+        TEST(reader.error().code() == Error::MalformedMessageData);
+    }
+
+    // invalid boolean value
+    Arguments intArgs = TypedWriter<uint32>::write(2);
+    Arguments boolArgs(nullptr, cstring("b"), intArgs.data());
+    bool b;
+    TypedReader<bool> boolReader(boolArgs);
+    TEST(!boolReader.read(&b));
+    TEST(boolReader.error().code() == Error::MalformedMessageData);
+}
+
+static void test_byteSwapped()
+{
+    Arguments args = TypedWriter<uint32, std::vector<uint16>, double>::write(0x01020304, { 0x0506, 0x0708 },
+                                                                              1.0);
+    TEST(!args.error().isError());
+    // swap the data manually: uint32 at 0, array length at 4, uint16s at 8 and 10, double at 16
+    std::vector<byte> data(args.data().ptr, args.data().ptr + args.data().length);
+    TEST(data.size() == 24);
+    std::reverse(data.begin(), data.begin() + 4);
+    std::reverse(data.begin() + 4, data.begin() + 8);
+    std::reverse(data.begin() + 8, data.begin() + 10);
+    std::reverse(data.begin() + 10, data.begin() + 12);
+    std::reverse(data.begin() + 16, data.begin() + 24);
+    Arguments swapped(nullptr, args.signature(), chunk(&data.front(), data.size()), true);
+
+    uint32 u;
+    std::vector<uint16> shorts;
+    double d;
+    TypedReader<uint32, std::vector<uint16>, double> reader(swapped);
+    TEST(reader.read(&u, &shorts, &d));
+    TEST(u == 0x01020304);
+    TEST(shorts == std::vector<uint16>({ 0x0506, 0x0708 }));
+    TEST(d == 1.0);
+}
+
+int main(int, char *[])
+{
+    test_signature();
+    test_sameDataAsWriter();
+    test_readWithDynamicReader();
+    test_empty();
+    test_errors();
+    test_byteSwapped();
+    std::cout << "Passed!\n";
+}
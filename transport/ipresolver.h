@@ -41,6 +41,9 @@
 
 class ConnectAddress;
 
+// Only numeric addresses (and "localhost") are accepted, so resolving never does a network lookup and
+// never blocks. TODO: host names need an asynchronous resolver, e.g. getaddrinfo() in a helper thread
+// that posts the result to the EventDispatcher; until then, IpSocket can stay synchronous here.
 class IpResolver
 {
 public:
@@ -31,6 +31,7 @@
 #include <netinet/in.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #endif
@@ -65,6 +66,18 @@ static bool errorInterrupted()
 #endif
 }
 
+static bool errorConnectInProgress()
+{
+#ifdef _WIN32
+    // Winsock returns WSAEWOULDBLOCK when connecting a non-blocking socket
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    // after EINTR, connecting also continues in the background
+    const int en = errno;
+    return en == EINPROGRESS || en == EINTR;
+#endif
+}
+
 static bool setNonBlocking(int fd)
 {
 #ifdef _WIN32
@@ -96,6 +109,39 @@ static int sendFlags()
 #endif
 }
 
+enum {
+    MaxGatherChunks = 64
+};
+
+// one gather send() call; returns the number of bytes written or -1 on error, like send()
+static ssize_t sendChunks(FileDescriptor fd, const chunk *chunks, uint32 count)
+{
+    assert(count <= MaxGatherChunks);
+#ifdef _WIN32
+    WSABUF bufs[MaxGatherChunks];
+    for (uint32 i = 0; i < count; i++) {
+        bufs[i].buf = reinterpret_cast<char *>(chunks[i].ptr);
+        bufs[i].len = chunks[i].length;
+    }
+    DWORD sent = 0;
+    if (WSASend(fd, bufs, count, &sent, 0, nullptr, nullptr) != 0) {
+        return -1;
+    }
+    return ssize_t(sent);
+#else
+    struct iovec iov[MaxGatherChunks];
+    for (uint32 i = 0; i < count; i++) {
+        iov[i].iov_base = chunks[i].ptr;
+        iov[i].iov_len = chunks[i].length;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(fd, &msg, sendFlags());
+#endif
+}
+
 static void closeSocket(int fd)
 {
 #ifdef _WIN32
@@ -109,6 +155,7 @@ static void closeSocket(int fd)
 IpSocket::IpSocket(const ConnectAddress &ca)
    : m_fd(-1)
 {
+    m_supportsCompletionIo = true;
     assert(ca.type() == ConnectAddress::Type::Tcp || ca.type() == ConnectAddress::Type::Tcp4);
     if (ca.type() != ConnectAddress::Type::Tcp && ca.type() != ConnectAddress::Type::Tcp4) {
         std::cerr << "IpSocket contruction failed 0.\n";
@@ -128,15 +175,21 @@ IpSocket::IpSocket(const ConnectAddress &ca)
         return;
     }
 
+    // This doesn't block, see IpResolver
     IpResolver resolver(ca);
     bool ok = resolver.resultValid();
 
-    ok = ok && connect(fd, resolver.resolved(), resolver.resolvedLength()) == 0;
-
-    // only make it non-blocking after connect() because Winsock returns
-    // WSAEWOULDBLOCK when connecting a non-blocking socket
+    // Connect without blocking; the result is checked when the socket becomes writable
     ok = ok && setNonBlocking(fd);
 
+    if (ok && connect(fd, resolver.resolved(), resolver.resolvedLength()) != 0) {
+        if (errorConnectInProgress()) {
+            setConnecting();
+        } else {
+            ok = false;
+        }
+    }
+
     if (ok) {
         m_fd = fd;
     } else {
@@ -147,6 +200,7 @@ IpSocket::IpSocket(const ConnectAddress &ca)
 IpSocket::IpSocket(FileDescriptor fd)
    : m_fd(fd)
 {
+    m_supportsCompletionIo = true;
     if (!setNonBlocking(m_fd)) {
         closeSocket(fd);
         m_fd = -1;
@@ -169,7 +223,7 @@ void IpSocket::platformClose()
     }
 }
 
-IO::Result IpSocket::write(chunk a)
+IO::Result IpSocket::write(const chunk *data, uint32 chunkCount)
 {
     IO::Result ret;
     if (!isValidFileDescriptor(m_fd)) {
@@ -177,11 +231,23 @@ IO::Result IpSocket::write(chunk a)
         ret.status = IO::Status::InternalError;
         return ret;
     }
+    if (writesCompletedIo()) {
+        static const std::vector<int> noFileDescriptors;
+        return writeCompleted(data, chunkCount, noFileDescriptors);
+    }
 
-    const uint32 initialLength = a.length;
+    // Chunks that don't fit are left for the next call, the caller needs to handle short writes anyway
+    chunk parts[MaxGatherChunks];
+    uint32 partCount = 0;
+    for (uint32 i = 0; i < chunkCount && partCount < MaxGatherChunks; i++) {
+        if (data[i].length) {
+            parts[partCount++] = data[i];
+        }
+    }
 
-    while (a.length > 0) {
-        ssize_t nbytes = send(m_fd, reinterpret_cast<char *>(a.ptr), a.length, sendFlags());
+    uint32 firstPart = 0;
+    while (firstPart < partCount) {
+        ssize_t nbytes = sendChunks(m_fd, parts + firstPart, partCount - firstPart);
         if (nbytes < 0) {
             if (errorInterrupted()) {
                 continue;
@@ -197,11 +263,18 @@ IO::Result IpSocket::write(chunk a)
             break;
         }
 
-        a.ptr += nbytes;
-        a.length -= uint32(nbytes);
+        ret.length += uint32(nbytes);
+        uint32 written = uint32(nbytes);
+        while (firstPart < partCount && written >= parts[firstPart].length) {
+            written -= parts[firstPart].length;
+            firstPart++;
+        }
+        if (written) {
+            parts[firstPart].ptr += written;
+            parts[firstPart].length -= written;
+        }
     }
 
-    ret.length = initialLength - a.length;
     return ret;
 }
 
@@ -213,6 +286,9 @@ IO::Result IpSocket::read(byte *buffer, uint32 maxSize)
         ret.status = IO::Status::InternalError;
         return ret;
     }
+    if (readsCompletedIo()) {
+        return readCompleted(buffer, maxSize, nullptr);
+    }
 
     while (maxSize > 0) {
         ssize_t nbytes = recv(m_fd, reinterpret_cast<char *>(buffer), maxSize, 0);
@@ -236,6 +312,10 @@ IO::Result IpSocket::read(byte *buffer, uint32 maxSize)
         ret.length += uint32(nbytes);
         buffer += nbytes;
         maxSize -= uint32(nbytes);
+        if (maxSize > 0) {
+            // see comment in LocalSocket::read() for rationale of short read behavior
+            break;
+        }
     }
 
     return ret;
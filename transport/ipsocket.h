@@ -41,7 +41,7 @@ public:
     ~IpSocket() override;
 
     // pure virtuals from ITransport
-    IO::Result write(chunk data) override;
+    IO::Result write(const chunk *data, uint32 chunkCount) override;
     IO::Result read(byte *buffer, uint32 maxSize) override;
     void platformClose() override;
     bool isOpen() override;
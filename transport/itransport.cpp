@@ -25,16 +25,39 @@
 
 #include "eventdispatcher.h"
 #include "eventdispatcher_p.h"
+#include "icompletionlistener.h"
 #include "itransportlistener.h"
 #include "ipsocket.h"
 #include "connectaddress.h"
+#include "platformtime.h"
 
 #ifdef __unix__
 #include "localsocket.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <winsock2.h>
 #endif
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+static void closeFileDescriptors(const std::vector<int> &fds)
+{
+#ifdef __unix__
+    for (const int fd : fds) {
+        ::close(fd);
+    }
+#else
+    (void)fds;
+#endif
+}
 
 ITransport::ITransport()
 {
@@ -42,6 +65,9 @@ ITransport::ITransport()
 
 ITransport::~ITransport()
 {
+    if (m_deletedFlag) {
+        *m_deletedFlag = true;
+    }
     setReadListener(nullptr);
     setWriteListener(nullptr);
 }
@@ -55,7 +81,7 @@ IO::Result ITransport::readWithFileDescriptors(byte *buffer, uint32 maxSize, std
     return read(buffer, maxSize);
 }
 
-IO::Result ITransport::writeWithFileDescriptors(chunk, const std::vector<int> &)
+IO::Result ITransport::writeWithFileDescriptors(const chunk *, uint32, const std::vector<int> &)
 {
     // Just don't call this on a transport that doesn't support passing file descriptors
     IO::Result res;
@@ -101,8 +127,250 @@ void ITransport::setWriteListener(ITransportListener *listener)
 
 void ITransport::updateTransportIoInterest()
 {
+    if (m_isConnecting) {
+        // write readiness signals that connecting has finished
+        setIoInterest(m_isConnectRetryPending ? 0 : uint32(IO::RW::Write));
+        return;
+    }
     setIoInterest((m_readListener ? uint32(IO::RW::Read) : 0) |
                   (m_writeListener ? uint32(IO::RW::Write) : 0));
+    maybeStartCompletionIo();
+}
+
+void ITransport::maybeStartCompletionIo()
+{
+    // This is called when the transport has been connected, and when listeners change, which happens
+    // after the transport has been added to its IIoEventSource
+    if (m_completionSource || !m_supportsCompletionIo || !ioEventSource() || !isOpen()) {
+        return;
+    }
+    IIoCompletionSource *const source = ioEventSource()->ioCompletionSource();
+    if (source && source->startCompletionIo(fileDescriptor(), this, m_receivedUnixFdsCount)) {
+        m_completionSource = source;
+        m_isReceiveFinished = false;
+        m_isSendFailed = false;
+    }
+}
+
+bool ITransport::readsCompletedIo() const
+{
+    return m_completionSource &&
+           (hasUnreadCompletions() || !m_completionSource->isReceiveStarved(fileDescriptor()));
+}
+
+IO::Result ITransport::readCompleted(byte *buffer, uint32 maxSize, std::vector<int> *fileDescriptors)
+{
+    IO::Result ret;
+    while (ret.length < maxSize && !m_receivedChunks.empty()) {
+        ReceivedChunk &received = m_receivedChunks.front();
+        if (!received.fileDescriptors.empty()) {
+            // As with recvmsg(), file descriptors arrive with the first byte of a read so that
+            // ReceiveBuffer can assign them to the right message
+            if (ret.length) {
+                break;
+            }
+            if (fileDescriptors) {
+                fileDescriptors->insert(fileDescriptors->end(), received.fileDescriptors.begin(),
+                                        received.fileDescriptors.end());
+            } else {
+                closeFileDescriptors(received.fileDescriptors);
+            }
+            received.fileDescriptors.clear();
+        }
+        const uint32 count = std::min(maxSize - ret.length, received.data.length);
+        memcpy(buffer + ret.length, received.data.ptr, count);
+        ret.length += count;
+        received.data.ptr += count;
+        received.data.length -= count;
+        if (!received.data.length) {
+            m_completionSource->releaseReceiveBuffer(received.bufferId);
+            m_receivedChunks.pop_front();
+        }
+    }
+    if (!ret.length && m_isReceiveFinished) {
+        // orderly shutdown or error, after all data that came before it
+        close();
+        ret.status = IO::Status::RemoteClosed;
+    }
+    return ret;
+}
+
+IO::Result ITransport::writeCompleted(const chunk *data, uint32 chunkCount,
+                                      const std::vector<int> &fileDescriptors)
+{
+    IO::Result ret;
+    if (m_isSendFailed) {
+        close();
+        ret.status = IO::Status::RemoteClosed;
+        return ret;
+    }
+    ret.length = m_completionSource->send(fileDescriptor(), data, chunkCount, fileDescriptors);
+    return ret;
+}
+
+void ITransport::handleReceiveCompleted(chunk data, uint32 bufferId, std::vector<int> fileDescriptors)
+{
+    m_receivedChunks.push_back(ReceivedChunk{ data, bufferId, std::move(fileDescriptors) });
+}
+
+void ITransport::handleReceiveFinished()
+{
+    m_isReceiveFinished = true;
+}
+
+void ITransport::handleSendFailed()
+{
+    m_isSendFailed = true;
+}
+
+void ITransport::handleCompletionIoStopped()
+{
+    for (const ReceivedChunk &received : m_receivedChunks) {
+        m_completionSource->releaseReceiveBuffer(received.bufferId);
+        closeFileDescriptors(received.fileDescriptors);
+    }
+    m_receivedChunks.clear();
+    m_completionSource = nullptr;
+}
+
+void ITransport::setConnecting()
+{
+    m_isConnecting = true;
+    updateTransportIoInterest();
+}
+
+void ITransport::setConnectRetryPending()
+{
+    m_isConnectRetryPending = true;
+    setConnecting();
+}
+
+ITransport::ConnectProgress ITransport::platformRetryConnect()
+{
+    return ConnectProgress::Failed;
+}
+
+void ITransport::retryConnect()
+{
+    assert(m_isConnectRetryPending);
+    const ConnectProgress progress = platformRetryConnect();
+    if (progress == ConnectProgress::RetryLater) {
+        return;
+    }
+    m_isConnectRetryPending = false;
+    if (progress == ConnectProgress::Failed) {
+        close();
+        finishConnecting();
+    } else {
+        updateTransportIoInterest();
+    }
+}
+
+void ITransport::setConnectListener(ICompletionListener *listener)
+{
+    m_connectListener = listener;
+}
+
+bool ITransport::waitForConnected()
+{
+    while (m_isConnectRetryPending) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ConnectRetryIntervalMsecs));
+        retryConnect();
+    }
+    if (m_isConnecting) {
+        if (!waitForIo(uint32(IO::RW::Write), -1)) {
+            close();
+        }
+        finishConnecting();
+    }
+    return isOpen();
+}
+
+uint32 ITransport::waitForIo(uint32 rw, int timeoutMsecs)
+{
+    if (!isOpen()) {
+        return 0;
+    }
+    if (m_completionSource) {
+        return waitForCompletedIo(rw, timeoutMsecs);
+    }
+    short events = 0;
+    if (rw & uint32(IO::RW::Read)) {
+        events |= POLLIN;
+    }
+    if (rw & uint32(IO::RW::Write)) {
+        events |= POLLOUT;
+    }
+#ifdef _WIN32
+    WSAPOLLFD pfd = { fileDescriptor(), events, 0 };
+    const int pollRet = WSAPoll(&pfd, 1, timeoutMsecs);
+#else
+    struct pollfd pfd = { fileDescriptor(), events, 0 };
+    int pollRet;
+    do {
+        // ### the timeout starts again after EINTR
+        pollRet = poll(&pfd, 1, timeoutMsecs);
+    } while (pollRet < 0 && errno == EINTR);
+#endif
+    if (pollRet < 0) {
+        return rw; // let the next I/O operation find out what's wrong
+    }
+    uint32 ret = 0;
+    // errors and hangups are reported by the next I/O operation
+    if (pfd.revents & (POLLIN | POLLERR | POLLHUP)) {
+        ret |= rw & uint32(IO::RW::Read);
+    }
+    if (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) {
+        ret |= rw & uint32(IO::RW::Write);
+    }
+    return ret;
+}
+
+uint32 ITransport::waitForCompletedIo(uint32 rw, int timeoutMsecs)
+{
+    const uint64 deadline = PlatformTime::monotonicMsecs() + uint64(std::max(timeoutMsecs, 0));
+    while (true) {
+        uint32 ready = hasUnreadCompletions() ? uint32(IO::RW::Read) : 0;
+        if (m_isSendFailed || m_completionSource->canSend(fileDescriptor())) {
+            ready |= uint32(IO::RW::Write);
+        }
+        if (ready & rw) {
+            return ready & rw;
+        }
+        int remaining = -1;
+        if (timeoutMsecs >= 0) {
+            const uint64 now = PlatformTime::monotonicMsecs();
+            remaining = now < deadline ? int(deadline - now) : 0;
+        }
+        // This also reports readability while receiving is starved, the read listener reads directly then
+        const uint32 happened = m_completionSource->waitForCompletions(fileDescriptor(), remaining);
+        if (!happened) {
+            return 0; // timeout
+        }
+        if (happened & rw & uint32(IO::RW::Read) && !readsCompletedIo()) {
+            return uint32(IO::RW::Read);
+        }
+    }
+}
+
+void ITransport::finishConnecting()
+{
+    assert(m_isConnecting);
+    int error = 0;
+#ifdef _WIN32
+    int errorLength = sizeof(error);
+#else
+    socklen_t errorLength = sizeof(error);
+#endif
+    if (isOpen() && (getsockopt(fileDescriptor(), SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&error),
+                                &errorLength) != 0 || error != 0)) {
+        close();
+    }
+    m_isConnecting = false;
+    updateTransportIoInterest();
+    if (m_connectListener) {
+        m_connectListener->handleCompletion(this);
+    }
 }
 
 void ITransport::close()
@@ -120,8 +388,41 @@ IO::Status ITransport::handleIoReady(IO::RW rw)
 {
     IO::Status ret = IO::Status::OK;
     assert(uint32(rw) & ioInterest()); // only get notified about events we requested
+    if (m_isConnecting) {
+        // A failure to connect is reported to the connect listener, not through the return value
+        finishConnecting();
+        return ret;
+    }
     if (rw == IO::RW::Read && m_readListener) {
+        bool isDeleted = false;
+        bool *const outerDeletedFlag = m_deletedFlag;
+        m_deletedFlag = &isDeleted;
         ret = m_readListener->handleTransportCanRead();
+        // Completed receives are not reported again, so don't leave any behind when the listener stops
+        // reading early, e.g. before data with file descriptors
+        while (!isDeleted && ret == IO::Status::OK && m_readListener && m_completionSource &&
+               hasUnreadCompletions() && (ioInterest() & uint32(IO::RW::Read))) {
+            const size_t chunkCount = m_receivedChunks.size();
+            const uint32 frontLength = chunkCount ? m_receivedChunks.front().data.length : 0;
+            ret = m_readListener->handleTransportCanRead();
+            if (isDeleted) {
+                break;
+            }
+            if (m_receivedChunks.size() == chunkCount &&
+                (!chunkCount || m_receivedChunks.front().data.length == frontLength)) {
+                break; // no progress
+            }
+        }
+        if (isDeleted) {
+            if (outerDeletedFlag) {
+                *outerDeletedFlag = true;
+            }
+            // Whoever deleted us has dealt with the outcome, possibly by replacing us with a new
+            // transport (see ConnectionPrivate::restartAuthentication()). An error would now be taken
+            // to mean that the replacement failed.
+            return IO::Status::OK;
+        }
+        m_deletedFlag = outerDeletedFlag;
     } else if (rw == IO::RW::Write && m_writeListener) {
         ret = m_writeListener->handleTransportCanWrite();
     } else {
@@ -133,6 +434,11 @@ IO::Status ITransport::handleIoReady(IO::RW rw)
     return ret;
 }
 
+bool ITransport::drainsIoOnReady() const
+{
+    return true;
+}
+
 //static
 ITransport *ITransport::create(const ConnectAddress &ci)
 {
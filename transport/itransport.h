@@ -24,18 +24,25 @@
 #ifndef ITRANSPORT_H
 #define ITRANSPORT_H
 
+#include "iiocompletionsource.h"
 #include "iioeventlistener.h"
 #include "platform.h"
 #include "types.h"
 
+#include <deque>
 #include <vector>
 
 class ConnectAddress;
 class EventDispatcher;
+class ICompletionListener;
 class ITransportListener;
 class SelectEventPoller;
 
-class ITransport : public IIoEventListener
+// With an event poller that supports it (see IIoCompletionSource), a transport that is a stream
+// socket switches to completion-based I/O once it is connected and registered. Its listeners don't
+// notice: read() then returns data that has already been received, write() queues data to be sent
+// together with waiting for events, and waitForIo() waits for completions.
+class ITransport : public IIoEventListener, public IIoCompletionListener
 {
 public:
     // An ITransport subclass must have a file descriptor after construction and it must not change
@@ -52,30 +59,104 @@ public:
     virtual IO::Result read(byte *buffer, uint32 maxSize) = 0;
     virtual IO::Result readWithFileDescriptors(byte *buffer, uint32 maxSize,
                                                std::vector<int> *fileDescriptors);
-    virtual IO::Result write(chunk data) = 0;
-    virtual IO::Result writeWithFileDescriptors(chunk data, const std::vector<int> &fileDescriptors);
+    // Gather writes: the chunks are written in order as if they were one contiguous block of data,
+    // using one system call where possible. As with any write, less than the total may be written.
+    virtual IO::Result write(const chunk *data, uint32 chunkCount) = 0;
+    virtual IO::Result writeWithFileDescriptors(const chunk *data, uint32 chunkCount,
+                                                const std::vector<int> &fileDescriptors);
+    IO::Result write(chunk data) { return write(&data, 1); }
 
     void close();
     virtual bool isOpen() = 0;
 
+    // Connecting is non-blocking: a new transport may be open, but still connecting. In that case, it
+    // waits for write readiness instead of calling its listeners. When connecting has finished, the
+    // connect listener is notified; the transport is then either connected or closed.
+    bool isConnecting() const { return m_isConnecting; }
+    // Sometimes connecting can't even be started, e.g. while the listen backlog of a local server is full.
+    // The transport is then connecting, but waits for retryConnect() instead of for I/O. It must not be
+    // added to an IIoEventSource until retrying has succeeded because an unconnected socket reports a
+    // hangup right away. Calling retryConnect() every ConnectRetryIntervalMsecs is up to the owner.
+    bool isConnectRetryPending() const { return m_isConnectRetryPending; }
+    void retryConnect();
+    enum { ConnectRetryIntervalMsecs = 10 };
+    void setConnectListener(ICompletionListener *listener);
+    // Blocks until connecting has finished, then notifies the connect listener. Returns isOpen().
+    bool waitForConnected();
+    // Blocks in the kernel until the transport is ready for any of the kinds of I/O in rw (IO::RW flags),
+    // or until timeoutMsecs have passed if it is not -1. Returns the kinds of I/O that are ready, which
+    // is 0 after a timeout or if the transport is not open. It doesn't read or write anything.
+    uint32 waitForIo(uint32 rw, int timeoutMsecs);
+
     uint32 supportedPassingUnixFdsCount() const { return m_supportedUnixFdsCount; }
 
     IO::Status handleIoReady(IO::RW rw) override;
+    // The transport listeners read until there is no more data and write until there is nothing left
+    // or the transport would block
+    bool drainsIoOnReady() const override;
+
+    // reimplemented from IIoCompletionListener
+    void handleReceiveCompleted(chunk data, uint32 bufferId, std::vector<int> fileDescriptors) override;
+    void handleReceiveFinished() override;
+    void handleSendFailed() override;
+    void handleCompletionIoStopped() override;
 
     // factory method - creates a suitable subclass to connect to address
     static ITransport *create(const ConnectAddress &connectAddress);
 
 protected:
     virtual void platformClose() = 0;
+    // for subclasses, when connect() is still in progress at the end of construction
+    void setConnecting();
+    // for subclasses, when connect() must be retried later, see isConnectRetryPending()
+    void setConnectRetryPending();
+    enum class ConnectProgress {
+        InProgress, // including already connected - write readiness is then reported right away
+        RetryLater,
+        Failed
+    };
+    // called from retryConnect()
+    virtual ConnectProgress platformRetryConnect();
+    // For subclasses that set m_supportsCompletionIo: their reads and writes must go through
+    // readCompleted() and writeCompleted() while these return true. Receiving may temporarily
+    // fall back to reading from the socket, see IIoCompletionSource::isReceiveStarved().
+    bool readsCompletedIo() const;
+    bool writesCompletedIo() const { return m_completionSource != nullptr; }
+    IO::Result readCompleted(byte *buffer, uint32 maxSize, std::vector<int> *fileDescriptors);
+    IO::Result writeCompleted(const chunk *data, uint32 chunkCount, const std::vector<int> &fileDescriptors);
     uint32 m_supportedUnixFdsCount = 0;
+    bool m_supportsCompletionIo = false;
+    // File descriptors that completed reads can carry. Unlike m_supportedUnixFdsCount, this is also
+    // nonzero on the server side of a LocalSocket, which reads file descriptors without announcing it.
+    uint32 m_receivedUnixFdsCount = 0;
 
 private:
     void updateTransportIoInterest(); // "Transport" in name to avoid confusion with IIoEventSource
+    void finishConnecting();
+    void maybeStartCompletionIo();
+    bool hasUnreadCompletions() const { return !m_receivedChunks.empty() || m_isReceiveFinished; }
+    uint32 waitForCompletedIo(uint32 rw, int timeoutMsecs);
     friend class ITransportListener;
     friend class SelectEventPoller;
 
     ITransportListener *m_readListener = nullptr;
     ITransportListener *m_writeListener = nullptr;
+    ICompletionListener *m_connectListener = nullptr;
+    bool m_isConnecting = false;
+    bool m_isConnectRetryPending = false;
+    // The read listener may delete us (see ReceiveBuffer); the destructor sets *m_deletedFlag
+    bool *m_deletedFlag = nullptr;
+
+    struct ReceivedChunk
+    {
+        chunk data; // the part not read yet
+        uint32 bufferId;
+        std::vector<int> fileDescriptors;
+    };
+    IIoCompletionSource *m_completionSource = nullptr;
+    std::deque<ReceivedChunk> m_receivedChunks;
+    bool m_isReceiveFinished = false;
+    bool m_isSendFailed = false;
 };
 
 #endif // ITRANSPORT_H
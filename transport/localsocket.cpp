@@ -39,13 +39,17 @@
 enum {
     // ### This is configurable in libdbus-1 but nobody ever seems to change it from the default of 16.
     MaxFds = 16,
-    MaxFdPayloadSize = MaxFds * sizeof(int)
+    MaxFdPayloadSize = MaxFds * sizeof(int),
+    MaxIovecs = 64
 };
 
 LocalSocket::LocalSocket(const std::string &socketFilePath)
-   : m_fd(-1)
+   : m_fd(-1),
+     m_socketFilePath(socketFilePath)
 {
     m_supportedUnixFdsCount = MaxFds;
+    m_supportsCompletionIo = true;
+    m_receivedUnixFdsCount = MaxFds;
     const int fd = socket(PF_UNIX, SOCK_STREAM, 0);
     if (fd < 0) {
         return;
@@ -53,25 +57,68 @@ LocalSocket::LocalSocket(const std::string &socketFilePath)
     // don't let forks inherit the file descriptor - that can cause confusion...
     fcntl(fd, F_SETFD, FD_CLOEXEC);
 
-    struct sockaddr_un addr;
-    addr.sun_family = PF_UNIX;
-    bool ok = socketFilePath.length() + 1 <= sizeof(addr.sun_path);
-    if (ok) {
-        memcpy(addr.sun_path, socketFilePath.c_str(), socketFilePath.length() + 1);
-    }
-
-    ok = ok && (connect(fd, (struct sockaddr *)&addr, sizeof(sa_family_t) + socketFilePath.length()) == 0);
+    // Connect without blocking; I/O always uses MSG_DONTWAIT anyway
+    const int oldFlags = fcntl(fd, F_GETFL);
+    bool ok = oldFlags != -1 && fcntl(fd, F_SETFL, oldFlags | O_NONBLOCK) != -1;
 
     if (ok) {
         m_fd = fd;
-    } else {
+        switch (startConnecting()) {
+        case ConnectProgress::InProgress:
+            break;
+        case ConnectProgress::RetryLater:
+            setConnectRetryPending();
+            break;
+        case ConnectProgress::Failed:
+            m_fd = -1;
+            ok = false;
+            break;
+        }
+    }
+
+    if (!ok) {
         ::close(fd);
     }
 }
 
+ITransport::ConnectProgress LocalSocket::startConnecting()
+{
+    struct sockaddr_un addr;
+    addr.sun_family = PF_UNIX;
+    if (m_socketFilePath.length() + 1 > sizeof(addr.sun_path)) {
+        return ConnectProgress::Failed;
+    }
+    memcpy(addr.sun_path, m_socketFilePath.c_str(), m_socketFilePath.length() + 1);
+    const socklen_t addrLength = sizeof(sa_family_t) + m_socketFilePath.length();
+
+    if (connect(m_fd, (struct sockaddr *)&addr, addrLength) == 0) {
+        return ConnectProgress::InProgress; // ...and already finished, which is fine
+    }
+    // after EINTR, connecting also continues in the background
+    if (errno == EINPROGRESS || errno == EINTR) {
+        if (!isConnecting()) {
+            setConnecting();
+        }
+        return ConnectProgress::InProgress;
+    }
+    // The server's listen backlog is full. Unlike EINPROGRESS, this does not start connecting in the
+    // background, so connect() must be called again later.
+    if (errno == EAGAIN) {
+        return ConnectProgress::RetryLater;
+    }
+    return ConnectProgress::Failed;
+}
+
+ITransport::ConnectProgress LocalSocket::platformRetryConnect()
+{
+    return startConnecting();
+}
+
 LocalSocket::LocalSocket(int fd)
    : m_fd(fd)
 {
+    m_supportsCompletionIo = true;
+    m_receivedUnixFdsCount = MaxFds;
 }
 
 LocalSocket::~LocalSocket()
@@ -87,50 +134,31 @@ void LocalSocket::platformClose()
     }
 }
 
-IO::Result LocalSocket::write(chunk data)
+IO::Result LocalSocket::write(const chunk *data, uint32 chunkCount)
 {
-    IO::Result ret;
-    if (data.length == 0) {
-        return ret;
-    }
-    if (m_fd < 0) {
-        ret.status = IO::Status::InternalError;
-        return ret;
-    }
-
-    const uint32 initialLength = data.length;
-
-    while (data.length > 0) {
-        ssize_t nbytes = send(m_fd, data.ptr, data.length, MSG_DONTWAIT | MSG_NOSIGNAL);
-        if (nbytes < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            // see EAGAIN comment in read()
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                break;
-            }
-            close();
-            ret.status = IO::Status::RemoteClosed;
-            return ret;
-        } else if (nbytes == 0) {
-            break;
-        }
-
-        data.ptr += nbytes;
-        data.length -= size_t(nbytes);
-    }
-
-    ret.length = initialLength - data.length;
-    return ret;
+    static const std::vector<int> noFileDescriptors;
+    return writeWithFileDescriptors(data, chunkCount, noFileDescriptors);
 }
 
-// TODO: consider using iovec to avoid "copying together" message parts before sending; iovec tricks
-// are probably not going to help for receiving, though.
-IO::Result LocalSocket::writeWithFileDescriptors(chunk data, const std::vector<int> &fileDescriptors)
+IO::Result LocalSocket::writeWithFileDescriptors(const chunk *data, uint32 chunkCount,
+                                                 const std::vector<int> &fileDescriptors)
 {
     IO::Result ret;
-    if (data.length == 0) {
+
+    // sendmsg  boilerplate
+    struct msghdr send_msg;
+    struct iovec iov[MaxIovecs];
+
+    // Chunks that don't fit are left for the next call, the caller needs to handle short writes anyway
+    uint32 iovCount = 0;
+    for (uint32 i = 0; i < chunkCount && iovCount < MaxIovecs; i++) {
+        if (data[i].length) {
+            iov[iovCount].iov_base = data[i].ptr;
+            iov[iovCount].iov_len = data[i].length;
+            iovCount++;
+        }
+    }
+    if (iovCount == 0) {
         return ret;
     }
     if (m_fd < 0) {
@@ -138,18 +166,11 @@ IO::Result LocalSocket::writeWithFileDescriptors(chunk data, const std::vector<i
         return ret;
     }
 
-    // sendmsg  boilerplate
-    struct msghdr send_msg;
-    struct iovec iov;
-
     send_msg.msg_name = nullptr;
     send_msg.msg_namelen = 0;
     send_msg.msg_flags = 0;
-    send_msg.msg_iov = &iov;
-    send_msg.msg_iovlen = 1;
-
-    iov.iov_base = data.ptr;
-    iov.iov_len = data.length;
+    send_msg.msg_iov = iov;
+    send_msg.msg_iovlen = iovCount;
 
     // we can only send a fixed number of fds anyway due to the non-flexible size of the control message
     // receive buffer, so we set an arbitrary limit.
@@ -160,6 +181,9 @@ IO::Result LocalSocket::writeWithFileDescriptors(chunk data, const std::vector<i
         ret.status = IO::Status::InternalError;
         return ret;
     }
+    if (writesCompletedIo()) {
+        return writeCompleted(data, chunkCount, fileDescriptors);
+    }
 
     char cmsgBuf[CMSG_SPACE(MaxFdPayloadSize)];
     const uint32 fdPayloadSize = numFds * sizeof(int);
@@ -185,8 +209,8 @@ IO::Result LocalSocket::writeWithFileDescriptors(chunk data, const std::vector<i
         send_msg.msg_controllen = 0;
     }
 
-    while (iov.iov_len > 0) {
-        ssize_t nbytes = sendmsg(m_fd, &send_msg, MSG_DONTWAIT);
+    while (send_msg.msg_iovlen > 0) {
+        ssize_t nbytes = sendmsg(m_fd, &send_msg, MSG_DONTWAIT | MSG_NOSIGNAL);
         if (nbytes < 0) {
             if (errno == EINTR) {
                 continue;
@@ -200,17 +224,25 @@ IO::Result LocalSocket::writeWithFileDescriptors(chunk data, const std::vector<i
             break;
         } else if (nbytes == 0) {
             break;
-        } else if (nbytes > 0) {
-            // control message already sent, don't send again
-            send_msg.msg_control = nullptr;
-            send_msg.msg_controllen = 0;
         }
+        // control message already sent, don't send again
+        send_msg.msg_control = nullptr;
+        send_msg.msg_controllen = 0;
 
-        iov.iov_base = static_cast<char *>(iov.iov_base) + nbytes;
-        iov.iov_len -= size_t(nbytes);
+        ret.length += uint32(nbytes);
+        // drop the completely written iovecs and advance into the partially written one, if any
+        size_t written = size_t(nbytes);
+        while (send_msg.msg_iovlen > 0 && written >= send_msg.msg_iov->iov_len) {
+            written -= send_msg.msg_iov->iov_len;
+            send_msg.msg_iov++;
+            send_msg.msg_iovlen--;
+        }
+        if (written) {
+            send_msg.msg_iov->iov_base = static_cast<char *>(send_msg.msg_iov->iov_base) + written;
+            send_msg.msg_iov->iov_len -= written;
+        }
     }
 
-    ret.length = data.length - iov.iov_len;
     return ret;
 }
 
@@ -224,6 +256,9 @@ IO::Result LocalSocket::read(byte *buffer, uint32 maxSize)
         ret.status = IO::Status::InternalError;
         return ret;
     }
+    if (readsCompletedIo()) {
+        return readCompleted(buffer, maxSize, nullptr);
+    }
 
     while (ret.length < maxSize) {
         ssize_t nbytes = recv(m_fd, buffer + ret.length, maxSize - ret.length, MSG_DONTWAIT);
@@ -250,6 +285,10 @@ IO::Result LocalSocket::read(byte *buffer, uint32 maxSize)
             return ret;
         }
         ret.length += size_t(nbytes);
+        if (ret.length < maxSize) {
+            // A short read means that there is currently no more data - don't waste a syscall to find out
+            break;
+        }
     }
 
     return ret;
@@ -266,6 +305,9 @@ IO::Result LocalSocket::readWithFileDescriptors(byte *buffer, uint32 maxSize,
         ret.status = IO::Status::InternalError;
         return ret;
     }
+    if (readsCompletedIo()) {
+        return readCompleted(buffer, maxSize, fileDescriptors);
+    }
 
     // recvmsg-with-control-message boilerplate
     struct msghdr recv_msg;
@@ -327,6 +369,10 @@ IO::Result LocalSocket::readWithFileDescriptors(byte *buffer, uint32 maxSize,
         ret.length += size_t(nbytes);
         iov.iov_base = static_cast<char *>(iov.iov_base) + nbytes;
         iov.iov_len -= size_t(nbytes);
+        // see comment in read()
+        if (iov.iov_len > 0) {
+            break;
+        }
     }
 
     return ret;
@@ -39,8 +39,9 @@ public:
     ~LocalSocket() override;
 
     // virtuals from ITransport
-    IO::Result write(chunk data) override;
-    IO::Result writeWithFileDescriptors(chunk data, const std::vector<int> &fileDescriptors) override;
+    IO::Result write(const chunk *data, uint32 chunkCount) override;
+    IO::Result writeWithFileDescriptors(const chunk *data, uint32 chunkCount,
+                                        const std::vector<int> &fileDescriptors) override;
     IO::Result read(byte *buffer, uint32 maxSize) override;
     IO::Result readWithFileDescriptors(byte *buffer, uint32 maxSize,
                                        std::vector<int> *fileDescriptors) override;
@@ -53,8 +54,14 @@ public:
     LocalSocket(const LocalSocket &) = delete;
     LocalSocket &operator=(const LocalSocket &) = delete;
 
+protected:
+    ConnectProgress platformRetryConnect() override;
+
 private:
+    ConnectProgress startConnecting();
+
     int m_fd;
+    std::string m_socketFilePath; // empty if constructed from a file descriptor
 };
 
 #endif // LOCALSOCKET_H
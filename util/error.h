@@ -126,6 +126,7 @@ public:
         SendingTooManyUnixFds, // The FD capacity varies by transport, so this error is only produced
                                // when trying to send a message with too many FDs. It is fine to pass
                                // around a message with lots of file descriptors locally.
+        SendQueueFull, // The send queue is above its high watermark and the policy is to reject messages
         MaxConnectionError = 3071,
 
         // errors for other occasions go here
@@ -0,0 +1,177 @@
+/*
+   Copyright (C) 2026 Andreas Hartmetz <ahartmetz@gmail.com>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LGPL.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+
+   Alternatively, this file is available under the Mozilla Public License
+   Version 1.1.  You may obtain a copy of the License at
+   http://www.mozilla.org/MPL/
+*/
+
+#ifndef INLINECALLBACK_H
+#define INLINECALLBACK_H
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, size_t inlineSize = 3 * sizeof(void *)>
+class InlineCallback;
+
+// A move-only holder for any callable with the given signature, like std::function. Callables of up
+// to inlineSize bytes (e.g. lambdas that capture a few pointers) are stored inside the InlineCallback,
+// larger ones on the heap. Calling goes through one plain function pointer, not a virtual call.
+template <typename R, typename... Args, size_t inlineSize>
+class InlineCallback<R(Args...), inlineSize>
+{
+public:
+    InlineCallback() = default;
+
+    template <typename F, typename = typename std::enable_if<
+                              !std::is_same<typename std::decay<F>::type, InlineCallback>::value>::type>
+    InlineCallback(F &&f)
+    {
+        typedef typename std::decay<F>::type Callable;
+        construct<Callable>(std::forward<F>(f), std::integral_constant<bool, isStoredInline<Callable>()>());
+    }
+
+    InlineCallback(InlineCallback &&other)
+    {
+        moveFrom(&other);
+    }
+
+    InlineCallback &operator=(InlineCallback &&other)
+    {
+        if (this != &other) {
+            reset();
+            moveFrom(&other);
+        }
+        return *this;
+    }
+
+    ~InlineCallback()
+    {
+        reset();
+    }
+
+    InlineCallback(const InlineCallback &) = delete;
+    InlineCallback &operator=(const InlineCallback &) = delete;
+
+    explicit operator bool() const { return m_invoke != nullptr; }
+
+    R operator()(Args... args)
+    {
+        return m_invoke(&m_storage, std::forward<Args>(args)...);
+    }
+
+    void reset()
+    {
+        if (m_manage) {
+            m_manage(Destroy, &m_storage, nullptr);
+        }
+        m_invoke = nullptr;
+        m_manage = nullptr;
+    }
+
+private:
+    struct Storage {
+        alignas(void *) unsigned char bytes[inlineSize];
+    };
+    enum Operation {
+        Move, // from the first to the second Storage, and destroy the source
+        Destroy
+    };
+
+    template <typename Callable>
+    static constexpr bool isStoredInline()
+    {
+        return sizeof(Callable) <= inlineSize && alignof(Callable) <= alignof(Storage) &&
+               std::is_nothrow_move_constructible<Callable>::value;
+    }
+
+    template <typename Callable, typename F>
+    void construct(F &&f, std::true_type /* inline */)
+    {
+        new(&m_storage) Callable(std::forward<F>(f));
+        m_invoke = &invokeInline<Callable>;
+        // Trivial callables, e.g. lambdas capturing only pointers, are moved with memcpy
+        if (!std::is_trivially_copyable<Callable>::value) {
+            m_manage = &manageInline<Callable>;
+        }
+    }
+
+    template <typename Callable, typename F>
+    void construct(F &&f, std::false_type /* inline */)
+    {
+        *reinterpret_cast<Callable **>(&m_storage) = new Callable(std::forward<F>(f));
+        m_invoke = &invokeHeap<Callable>;
+        m_manage = &manageHeap<Callable>;
+    }
+
+    template <typename Callable>
+    static R invokeInline(Storage *storage, Args... args)
+    {
+        return (*reinterpret_cast<Callable *>(storage))(std::forward<Args>(args)...);
+    }
+
+    template <typename Callable>
+    static R invokeHeap(Storage *storage, Args... args)
+    {
+        return (**reinterpret_cast<Callable **>(storage))(std::forward<Args>(args)...);
+    }
+
+    template <typename Callable>
+    static void manageInline(Operation op, Storage *storage, Storage *target)
+    {
+        Callable *const callable = reinterpret_cast<Callable *>(storage);
+        if (op == Move) {
+            new(target) Callable(std::move(*callable));
+        }
+        callable->~Callable();
+    }
+
+    template <typename Callable>
+    static void manageHeap(Operation op, Storage *storage, Storage *target)
+    {
+        Callable **const callable = reinterpret_cast<Callable **>(storage);
+        if (op == Move) {
+            *reinterpret_cast<Callable **>(target) = *callable;
+        } else {
+            delete *callable;
+        }
+    }
+
+    void moveFrom(InlineCallback *other)
+    {
+        if (other->m_manage) {
+            other->m_manage(Move, &other->m_storage, &m_storage);
+        } else if (other->m_invoke) {
+            memcpy(&m_storage, &other->m_storage, sizeof(Storage));
+        }
+        m_invoke = other->m_invoke;
+        m_manage = other->m_manage;
+        other->m_invoke = nullptr;
+        other->m_manage = nullptr;
+    }
+
+    Storage m_storage;
+    R (*m_invoke)(Storage *, Args...) = nullptr;
+    void (*m_manage)(Operation, Storage *, Storage *) = nullptr;
+};
+
+#endif // INLINECALLBACK_H
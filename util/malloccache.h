@@ -69,4 +69,82 @@ private:
     size_t m_blocksCached;
 };
 
+// Like MallocCache, but the maximum number of cached blocks is set at runtime. The cached blocks form a
+// free list that is stored in the blocks themselves, so a large capacity costs no memory up front.
+template <size_t blockSize>
+class MallocPool
+{
+public:
+    static_assert(blockSize >= sizeof(void *), "blocks must be able to hold the free list pointer");
+
+    explicit MallocPool(size_t capacity)
+       : m_freeList(nullptr),
+         m_blocksCached(0),
+         m_capacity(capacity)
+    {
+    }
+
+    ~MallocPool()
+    {
+        setCapacity(0);
+    }
+
+    MallocPool(const MallocPool &) = delete;
+    MallocPool &operator=(const MallocPool &) = delete;
+
+    // frees cached blocks that exceed the new capacity
+    void setCapacity(size_t capacity)
+    {
+#ifndef MALLOCCACHE_PASSTHROUGH
+        m_capacity = capacity;
+        while (m_blocksCached > m_capacity) {
+            FreeBlock *const block = m_freeList;
+            m_freeList = block->next;
+            m_blocksCached--;
+            ::free(block);
+        }
+#else
+        (void) capacity;
+#endif
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+    void *allocate()
+    {
+#ifndef MALLOCCACHE_PASSTHROUGH
+        if (m_freeList) {
+            FreeBlock *const block = m_freeList;
+            m_freeList = block->next;
+            m_blocksCached--;
+            return block;
+        }
+#endif
+        return ::malloc(blockSize);
+    }
+
+    void free(void *allocation)
+    {
+#ifndef MALLOCCACHE_PASSTHROUGH
+        if (m_blocksCached < m_capacity) {
+            FreeBlock *const block = static_cast<FreeBlock *>(allocation);
+            block->next = m_freeList;
+            m_freeList = block;
+            m_blocksCached++;
+            return;
+        }
+#endif
+        ::free(allocation);
+    }
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+    FreeBlock *m_freeList;
+    size_t m_blocksCached;
+    size_t m_capacity;
+};
+
 #endif // MALLOCCACHE_H